@@ -0,0 +1,43 @@
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "src/control_flow.h"
+
+namespace {
+
+// Builds the graph of a ROM filling memory with routines of eight
+// instructions, each calling the next and skipping once, so that every
+// instruction is reached.
+void BM_BuildControlFlowGraph(benchmark::State& state) {
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  for (unsigned int address = Cpu::kMinAddressableMemory;
+       address < Cpu::kMaxMemory; address += 2) {
+    uint16_t instruction = 0x7001;  // ADD V0, 1
+    switch ((address - Cpu::kMinAddressableMemory) / 2 % 8) {
+      case 0:
+        if (address + 16 < Cpu::kMaxMemory) {
+          instruction = 0x2000 | (address + 16);  // CALL
+        }
+        break;
+      case 3:
+        instruction = 0x3000;  // SE V0, 0
+        break;
+      case 7:
+        instruction = 0x00ee;  // RET
+        break;
+    }
+    memory[address] = instruction >> 8;
+    memory[address + 1] = instruction & 0xff;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(build_control_flow_graph(
+        memory.data(), Cpu::kMinAddressableMemory, Cpu::kMaxMemory));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          (Cpu::kMaxMemory - Cpu::kMinAddressableMemory));
+}
+
+BENCHMARK(BM_BuildControlFlowGraph);
+
+}  // namespace
@@ -0,0 +1,122 @@
+#include <benchmark/benchmark.h>
+
+#include "src/cpu.h"
+
+namespace {
+
+class Machine {
+ public:
+  Machine() : random_(1), cpu_(&random_, &keyboard_) {}
+
+  Cpu* cpu() { return &cpu_; }
+
+  // Copies |program| to the start of program memory.
+  template <size_t N>
+  void load(const uint16_t (&program)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, program[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      program[i] & 0xff);
+    }
+  }
+
+ private:
+  Random random_;
+  Keyboard keyboard_;
+  Cpu cpu_;
+};
+
+// Executes |instruction| repeatedly, between |setup| and |teardown| if not 0,
+// which keep instructions that move I or the stack pointer within bounds.
+void BM_Execute(benchmark::State& state, uint16_t instruction,
+                uint16_t setup, uint16_t teardown = 0) {
+  Machine machine;
+  Cpu* cpu = machine.cpu();
+  // Point V1 and V2 at a sprite that fits on screen.
+  cpu->execute(0x6108);
+  cpu->execute(0x6204);
+  for (auto _ : state) {
+    if (setup) {
+      cpu->execute(setup);
+    }
+    benchmark::DoNotOptimize(cpu->execute(instruction));
+    if (teardown) {
+      cpu->execute(teardown);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Execute, 00E0_CLS, 0x00e0, 0);
+BENCHMARK_CAPTURE(BM_Execute, 00EE_RET, 0x00ee, 0x2300);
+BENCHMARK_CAPTURE(BM_Execute, 0nnn_SYS, 0x0300, 0);
+BENCHMARK_CAPTURE(BM_Execute, 1nnn_JP, 0x1300, 0);
+BENCHMARK_CAPTURE(BM_Execute, 2nnn_CALL, 0x2300, 0, 0x00ee);
+BENCHMARK_CAPTURE(BM_Execute, 3xkk_SE, 0x3108, 0);
+BENCHMARK_CAPTURE(BM_Execute, 4xkk_SNE, 0x4108, 0);
+BENCHMARK_CAPTURE(BM_Execute, 5xy0_SE, 0x5120, 0);
+BENCHMARK_CAPTURE(BM_Execute, 6xkk_LD, 0x6342, 0);
+BENCHMARK_CAPTURE(BM_Execute, 7xkk_ADD, 0x7301, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy0_LD, 0x8310, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy1_OR, 0x8311, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy2_AND, 0x8312, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy3_XOR, 0x8313, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy4_ADD, 0x8314, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy5_SUB, 0x8315, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy6_SHR, 0x8316, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xy7_SUBN, 0x8317, 0);
+BENCHMARK_CAPTURE(BM_Execute, 8xyE_SHL, 0x831e, 0);
+BENCHMARK_CAPTURE(BM_Execute, 9xy0_SNE, 0x9120, 0);
+BENCHMARK_CAPTURE(BM_Execute, Annn_LD, 0xa300, 0);
+BENCHMARK_CAPTURE(BM_Execute, Bnnn_JP, 0xb300, 0);
+BENCHMARK_CAPTURE(BM_Execute, Cxkk_RND, 0xc3ff, 0);
+BENCHMARK_CAPTURE(BM_Execute, Dxyn_DRW, 0xd125, 0);
+BENCHMARK_CAPTURE(BM_Execute, Ex9E_SKP, 0xe19e, 0);
+BENCHMARK_CAPTURE(BM_Execute, ExA1_SKNP, 0xe1a1, 0);
+BENCHMARK_CAPTURE(BM_Execute, Fx07_LD, 0xf307, 0);
+BENCHMARK_CAPTURE(BM_Execute, Fx15_LD, 0xf315, 0);
+BENCHMARK_CAPTURE(BM_Execute, Fx18_LD, 0xf318, 0);
+BENCHMARK_CAPTURE(BM_Execute, Fx1E_ADD, 0xf31e, 0xa300);
+BENCHMARK_CAPTURE(BM_Execute, Fx29_LD, 0xf329, 0xa000);
+BENCHMARK_CAPTURE(BM_Execute, Fx33_LD, 0xf333, 0xa300);
+BENCHMARK_CAPTURE(BM_Execute, Fx55_LD, 0xff55, 0xa300);
+BENCHMARK_CAPTURE(BM_Execute, Fx65_LD, 0xff65, 0xa300);
+
+// Fills memory with ALU instructions, jumping back to the start at the end.
+void BM_StepStraightLine(benchmark::State& state) {
+  Machine machine;
+  Cpu* cpu = machine.cpu();
+  constexpr uint16_t kBody[] = {0x7001, 0x8104, 0x8213, 0x6342};
+  uint16_t address = Cpu::kMinAddressableMemory;
+  for (size_t i = 0; address < Cpu::kMaxMemory - 2; ++i, address += 2) {
+    cpu->set_memory(address, kBody[i % std::size(kBody)] >> 8);
+    cpu->set_memory(address + 1, kBody[i % std::size(kBody)] & 0xff);
+  }
+  cpu->set_memory(address, 0x12);
+  cpu->set_memory(address + 1, 0x00);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cpu->step());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StepStraightLine);
+
+// A tight counting loop, mostly branches.
+void BM_StepLoop(benchmark::State& state) {
+  Machine machine;
+  machine.load({
+      0x7001,  // 0x200: ADD V0, 1
+      0x3000,  // 0x202: SE V0, 0
+      0x1200,  // 0x204: JP 0x200
+      0x7101,  // 0x206: ADD V1, 1
+      0x1200,  // 0x208: JP 0x200
+  });
+  Cpu* cpu = machine.cpu();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cpu->step());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StepLoop);
+
+}  // namespace
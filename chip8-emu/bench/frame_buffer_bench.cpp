@@ -0,0 +1,82 @@
+#include <benchmark/benchmark.h>
+
+#include <SFML/Graphics/RenderTarget.hpp>
+
+#include "src/frame_buffer.h"
+
+namespace {
+
+// A render target without a window. sf::RenderTarget activates its target
+// once per primitive drawn, so refusing activation counts the draw calls
+// without reaching OpenGL.
+class CountingRenderTarget : public sf::RenderTarget {
+ public:
+  CountingRenderTarget() = default;
+  ~CountingRenderTarget() override = default;
+
+  sf::Vector2u getSize() const override {
+    return sf::Vector2u(FrameBuffer::kScreenWidth, FrameBuffer::kScreenHeight);
+  }
+
+  bool setActive(bool active = true) override {
+    if (active) {
+      ++draws_;
+    }
+    return false;
+  }
+
+  size_t draws() const { return draws_; }
+
+ private:
+  size_t draws_ = 0;
+};
+
+// Paints a sprite of state.range(0) rows, wrapping around the bottom right
+// corner if state.range(1) is set.
+void BM_Paint(benchmark::State& state) {
+  FrameBuffer buffer;
+  uint8_t rows = state.range(0);
+  bool wrapped = state.range(1);
+  uint8_t x = wrapped ? FrameBuffer::kScreenWidth - 4 : 8;
+  uint8_t y = wrapped ? FrameBuffer::kScreenHeight - rows / 2 : 4;
+  for (auto _ : state) {
+    bool erased = false;
+    for (uint8_t row = 0; row < rows; ++row) {
+      erased |= buffer.paint(x, y + row, 0xa5);
+    }
+    benchmark::DoNotOptimize(erased);
+  }
+  state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_Paint)
+    ->ArgNames({"rows", "wrapped"})
+    ->ArgsProduct({benchmark::CreateDenseRange(1, 15, 1), {0, 1}});
+
+void BM_ClearScreen(benchmark::State& state) {
+  FrameBuffer buffer;
+  for (auto _ : state) {
+    buffer.clear_screen();
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ClearScreen);
+
+// Draws a frame with every other pixel lit.
+void BM_Draw(benchmark::State& state) {
+  FrameBuffer buffer;
+  for (uint8_t y = 0; y < FrameBuffer::kScreenHeight; ++y) {
+    for (uint8_t x = 0; x < FrameBuffer::kScreenWidth; x += 8) {
+      buffer.paint(x, y, y % 2 ? 0xaa : 0x55);
+    }
+  }
+  CountingRenderTarget target;
+  for (auto _ : state) {
+    buffer.draw(&target);
+  }
+  state.counters["draws_per_frame"] =
+      static_cast<double>(target.draws()) / state.iterations();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Draw);
+
+}  // namespace
@@ -0,0 +1,435 @@
+// rom_bench.cpp : Runs every ROM in a directory without a window and reports
+// its throughput, to catch engine regressions end to end.
+//
+// Usage: chip8-rom-bench [--frames N] [--seed S] [--inputs DIR]
+//            [--engine NAME [--verify GRANULARITY]] [--validate warn|strict]
+//            [--json PATH] [ROM_DIR]
+//
+// Games are played with the input recorded in DIR/<rom name>.c8mv if there
+// is one, as recorded with chip8-emu --record, and with scripted key presses
+// otherwise. Each ROM is run twice with the same input: once at full speed
+// on the engine given, for instructions and frames per second, and once
+// stepping and timing every instruction to split the time between drawing,
+// other instructions and timers.
+//
+// Where Linux hardware performance counters are available, the full speed
+// run also reports host cycles, instructions, branch misses and L1 data
+// cache misses per emulated instruction, i.e. per dispatch.
+//
+// With --verify, each ROM is run a third time with the engine in lockstep
+// with the reference interpreter, and a ROM where they diverge fails with a
+// report of the first instruction that went wrong.
+//
+// With --validate, the code of each ROM is found and translated by the engine
+// before the full speed run starts timing, as chip8-emu --validate does
+// before the first frame, so that translating is not counted.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "src/control_flow.h"
+#include "src/cpu.h"
+#include "src/disassembler.h"
+#include "src/execution_engine.h"
+#include "src/lockstep.h"
+#include "src/logging.h"
+#include "src/movie.h"
+#include "src/options.h"
+#include "src/perf_counters.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+// Presses a random key for a while, then releases it for a while, so that
+// games waiting for a key go on and games polling keys move around.
+std::vector<uint16_t> scripted_input(uint32_t frames, uint32_t seed) {
+  Random random(seed);
+  std::vector<uint16_t> keys;
+  keys.reserve(frames);
+  while (keys.size() < frames) {
+    uint16_t key = 1 << (random.rand() % 16);
+    keys.insert(keys.end(), 3 + random.rand() % 18, key);
+    keys.insert(keys.end(), 1 + random.rand() % 10, 0);
+  }
+  keys.resize(frames);
+  return keys;
+}
+
+struct Result {
+  std::string rom;
+  // "movie" or "scripted".
+  std::string input;
+  uint32_t frames = 0;
+  // Instructions executed, not counting steps spent waiting for a key.
+  uint64_t instructions = 0;
+  double seconds = 0;
+  // Time spent, as measured by the timed run, in seconds.
+  double draw_seconds = 0;
+  double alu_seconds = 0;
+  double timer_seconds = 0;
+  uint64_t peak_rss_kb = 0;
+  // Host events during the full speed run, where available.
+  PerfCounters::Counts counts;
+  // The time taken by the lockstep run, if there was one.
+  std::optional<double> verify_seconds;
+  bool diverged = false;
+  bool ok = true;
+
+  double mips() const { return seconds ? instructions / seconds / 1e6 : 0; }
+  double frames_per_second() const { return seconds ? frames / seconds : 0; }
+
+  // Returns |event| per emulated instruction, if it was counted.
+  std::optional<double> per_instruction(PerfCounters::Event event) const {
+    std::optional<uint64_t> count = PerfCounters::get(counts, event);
+    if (!count || instructions == 0) {
+      return std::nullopt;
+    }
+    return static_cast<double>(*count) / instructions;
+  }
+
+  double share(double part) const {
+    double total = draw_seconds + alu_seconds + timer_seconds;
+    return total > 0 ? part / total : 0;
+  }
+};
+
+// Resets the peak resident set size of the process, where supported, so
+// that it can be measured per ROM.
+void reset_peak_rss() {
+#if defined(__linux__)
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+#endif
+}
+
+uint64_t peak_rss_kb() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                           sizeof(counters))) {
+    return counters.PeakWorkingSetSize / 1024;
+  }
+  return 0;
+#else
+#if defined(__linux__)
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      return std::stoull(line.substr(6));
+    }
+  }
+#endif
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+#endif
+}
+
+// The time one call to SteadyClock::now() adds to a measured interval.
+double clock_overhead() {
+  constexpr int kSamples = 100000;
+  auto start = SteadyClock::now();
+  for (int i = 0; i < kSamples; ++i) {
+    SteadyClock::now();
+  }
+  return std::chrono::duration<double>(SteadyClock::now() - start).count() /
+         kSamples;
+}
+
+bool is_draw(uint16_t instruction) {
+  OpcodeClass opcode_class = ::opcode_class(instruction);
+  return opcode_class == OpcodeClass::DRW || opcode_class == OpcodeClass::CLS;
+}
+
+bool run_fast(const std::string& path, const std::vector<uint16_t>& keys,
+              uint32_t seed, EngineKind engine_kind,
+              const EngineOptions& engine_options,
+              std::optional<Validation> validation, PerfCounters* counters,
+              Result* result) {
+  Random random(seed);
+  ScriptedKeyboard keyboard;
+  std::unique_ptr<ExecutionEngine> engine =
+      make_engine(engine_kind, engine_options);
+  Cpu cpu(&random, &keyboard);
+  cpu.set_engine(engine.get());
+  if (!cpu.load(path) ||
+      (validation && !validate_rom(&cpu, engine.get(), *validation))) {
+    return false;
+  }
+  auto start = SteadyClock::now();
+  counters->start();
+  for (uint16_t frame_keys : keys) {
+    keyboard.set_keys(frame_keys);
+    if (!cpu.run_frame()) {
+      counters->stop();
+      return false;
+    }
+  }
+  result->counts = counters->stop();
+  result->seconds =
+      std::chrono::duration<double>(SteadyClock::now() - start).count();
+  return true;
+}
+
+bool run_timed(const std::string& path, const std::vector<uint16_t>& keys,
+               uint32_t seed, double overhead, Result* result) {
+  Random random(seed);
+  ScriptedKeyboard keyboard;
+  Cpu cpu(&random, &keyboard);
+  if (!cpu.load(path)) {
+    return false;
+  }
+  auto elapsed = [overhead](SteadyClock::time_point start) {
+    return std::max(
+        0.0,
+        std::chrono::duration<double>(SteadyClock::now() - start).count() -
+            overhead);
+  };
+  for (uint16_t frame_keys : keys) {
+    keyboard.set_keys(frame_keys);
+    for (unsigned int i = 0; i < Cpu::kInstructionsPerFrame; ++i) {
+      bool waiting = cpu.waiting_for_key_press();
+      uint16_t instruction = (cpu.peek(cpu.pc()) << 8) |
+                             cpu.peek((cpu.pc() + 1) & Cpu::kMaxMemory);
+      auto start = SteadyClock::now();
+      if (!cpu.step()) {
+        return false;
+      }
+      double seconds = elapsed(start);
+      if (waiting) {
+        result->alu_seconds += seconds;
+        continue;
+      }
+      ++result->instructions;
+      (is_draw(instruction) ? result->draw_seconds : result->alu_seconds) +=
+          seconds;
+    }
+    auto start = SteadyClock::now();
+    cpu.update_timers();
+    result->timer_seconds += elapsed(start);
+  }
+  return true;
+}
+
+bool run_verified(const std::string& path, const std::vector<uint16_t>& keys,
+                  uint32_t seed, EngineKind engine_kind,
+                  const EngineOptions& engine_options,
+                  Lockstep::Granularity granularity, Result* result) {
+  Random reference_random(seed);
+  Random random(seed);
+  ScriptedKeyboard keyboard;
+  std::unique_ptr<ExecutionEngine> engine =
+      make_engine(engine_kind, engine_options);
+  Cpu reference(&reference_random, &keyboard);
+  Cpu cpu(&random, &keyboard);
+  cpu.set_engine(engine.get());
+  if (!reference.load(path) || !cpu.load(path)) {
+    return false;
+  }
+  Lockstep lockstep(&reference, &cpu, granularity);
+  auto start = SteadyClock::now();
+  for (uint16_t frame_keys : keys) {
+    keyboard.set_keys(frame_keys);
+    if (!lockstep.run_frame()) {
+      if (lockstep.divergence()) {
+        result->diverged = true;
+        logging::log(logging::Level::ERROR,
+                     result->rom + ": " + lockstep.report());
+      }
+      return false;
+    }
+  }
+  result->verify_seconds =
+      std::chrono::duration<double>(SteadyClock::now() - start).count();
+  return true;
+}
+
+Result benchmark_rom(const fs::path& rom, const Options& options,
+                     double overhead, PerfCounters* counters) {
+  Result result;
+  result.rom = rom.filename().u8string();
+  result.frames = options.frames;
+  uint32_t seed = options.seed.value_or(1);
+
+  std::vector<uint16_t> keys;
+  fs::path movie_path =
+      fs::path(options.inputs_path) / (rom.stem().u8string() + ".c8mv");
+  Movie movie;
+  if (!options.inputs_path.empty() && fs::exists(movie_path) &&
+      load_movie(movie_path.u8string(), &movie)) {
+    result.input = "movie";
+    seed = movie.seed;
+    for (const Movie::Frame& frame : movie.frames) {
+      keys.push_back(frame.keys);
+    }
+    keys.resize(options.frames, keys.empty() ? 0 : keys.back());
+  } else {
+    result.input = "scripted";
+    keys = scripted_input(options.frames, seed);
+  }
+
+  reset_peak_rss();
+  result.ok = run_fast(rom.u8string(), keys, seed, options.engine,
+                       options.engine_options, options.validation, counters,
+                       &result) &&
+              run_timed(rom.u8string(), keys, seed, overhead, &result) &&
+              (!options.verify ||
+               run_verified(rom.u8string(), keys, seed, options.engine,
+                            options.engine_options, *options.verify,
+                            &result));
+  result.peak_rss_kb = peak_rss_kb();
+  return result;
+}
+
+std::string json_number(std::optional<double> value) {
+  if (!value) {
+    return "null";
+  }
+  std::ostringstream out;
+  out << *value;
+  return out.str();
+}
+
+std::string json_string(const std::string& text) {
+  std::string escaped = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+void write_json(const std::vector<Result>& results, EngineKind engine,
+                std::ostream& out) {
+  out << "{\n  \"engine\": " << json_string(engine_name(engine))
+      << ",\n  \"roms\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    out << (i ? "," : "") << "\n    {\"rom\": " << json_string(r.rom)
+        << ", \"input\": " << json_string(r.input)
+        << ", \"ok\": " << (r.ok ? "true" : "false")
+        << ", \"frames\": " << r.frames
+        << ", \"instructions\": " << r.instructions
+        << ", \"seconds\": " << r.seconds << ", \"mips\": " << r.mips()
+        << ", \"frames_per_second\": " << r.frames_per_second()
+        << ", \"time_share\": {\"draw\": " << r.share(r.draw_seconds)
+        << ", \"alu\": " << r.share(r.alu_seconds)
+        << ", \"timers\": " << r.share(r.timer_seconds) << "}"
+        << ", \"peak_rss_kb\": " << r.peak_rss_kb
+        << ", \"verify_seconds\": " << json_number(r.verify_seconds)
+        << ", \"diverged\": " << (r.diverged ? "true" : "false")
+        << ", \"per_instruction\": {";
+    for (size_t event = 0; event < PerfCounters::kEvents; ++event) {
+      out << (event ? ", " : "") << "\""
+          << PerfCounters::name(static_cast<PerfCounters::Event>(event))
+          << "\": "
+          << json_number(
+                 r.per_instruction(static_cast<PerfCounters::Event>(event)));
+    }
+    out << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// Formats a per instruction count for the table.
+std::string counter(std::optional<double> value, int precision) {
+  std::ostringstream out;
+  out << std::setw(10);
+  if (value) {
+    out << std::fixed << std::setprecision(precision) << *value;
+  } else {
+    out << "n/a";
+  }
+  return out.str();
+}
+
+void write_table(const std::vector<Result>& results, std::ostream& out) {
+  out << std::left << std::setw(24) << "ROM" << std::right << std::setw(10)
+      << "MIPS" << std::setw(12) << "frames/s" << std::setw(8) << "draw"
+      << std::setw(8) << "ALU" << std::setw(8) << "timers" << std::setw(12)
+      << "peak RSS" << std::setw(10) << "cyc/ins" << std::setw(10)
+      << "bmiss/ins" << "  input\n";
+  for (const Result& r : results) {
+    out << std::left << std::setw(24) << r.rom << std::right << std::fixed
+        << std::setprecision(1) << std::setw(10) << r.mips() << std::setw(12)
+        << std::setprecision(0) << r.frames_per_second()
+        << std::setprecision(1) << std::setw(7)
+        << 100 * r.share(r.draw_seconds) << "%" << std::setw(7)
+        << 100 * r.share(r.alu_seconds) << "%" << std::setw(7)
+        << 100 * r.share(r.timer_seconds) << "%" << std::setw(9)
+        << r.peak_rss_kb << " kB"
+        << counter(r.per_instruction(PerfCounters::Event::CYCLES), 1)
+        << counter(r.per_instruction(PerfCounters::Event::BRANCH_MISSES), 3)
+        << "  " << r.input
+        << (r.diverged ? ", DIVERGED" : r.ok ? "" : ", FAILED") << "\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    return -1;
+  }
+  fs::path directory = options.rom.empty() ? "roms" : options.rom;
+
+  std::vector<fs::path> roms;
+  try {
+    for (const auto& file : fs::directory_iterator(directory)) {
+      if (file.is_regular_file()) {
+        roms.push_back(file.path());
+      }
+    }
+  } catch (const std::exception&) {
+    logging::log(logging::Level::ERROR,
+                 "Could not open ROM folder " + directory.u8string());
+    return -1;
+  }
+  std::sort(roms.begin(), roms.end());
+
+  double overhead = clock_overhead();
+  PerfCounters counters;
+  std::vector<Result> results;
+  bool ok = true;
+  for (const fs::path& rom : roms) {
+    results.push_back(benchmark_rom(rom, options, overhead, &counters));
+    ok &= results.back().ok;
+  }
+
+  std::cout << "Engine: " << engine_name(options.engine) << "\n";
+  write_table(results, std::cout);
+  if (!options.json_path.empty()) {
+    std::ofstream json(options.json_path);
+    if (!json) {
+      logging::log(logging::Level::ERROR,
+                   "Could not write " + options.json_path);
+      return -1;
+    }
+    write_json(results, options.engine, json);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+// aot.cpp : Compiles a ROM ahead of time into a shared object for the aot
+// engine.
+//
+// Usage: chip8-aot --aot DIR ROM
+//
+// The code reachable from 0x200 is found by following jumps, calls and
+// skips, translated block by block as the optimizing engine does, and
+// written to DIR/<ROM hash>.cpp with one function per block. That is then
+// compiled with $CXX, or c++, into DIR/<ROM hash>.so, which chip8-emu,
+// chip8-headless and chip8-rom-bench load when given --engine aot --aot DIR
+// and that ROM.
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "src/aot_compiler.h"
+#include "src/cpu.h"
+#include "src/logging.h"
+#include "src/options.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    return -1;
+  }
+  const std::string& directory = options.engine_options.aot_path;
+  if (options.rom.empty() || directory.empty()) {
+    logging::log(logging::Level::ERROR, "Usage: chip8-aot --aot DIR ROM");
+    return -1;
+  }
+
+  Random random(0);
+  ScriptedKeyboard keyboard;
+  Cpu cpu(&random, &keyboard);
+  if (!cpu.load(options.rom)) {
+    return -1;
+  }
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  for (unsigned int address = 0; address <= Cpu::kMaxMemory; ++address) {
+    memory[address] = cpu.peek(address);
+  }
+  std::vector<Block> blocks =
+      find_blocks(memory.data(), Cpu::kMinAddressableMemory);
+
+  std::string output_path = aot_module_path(directory, cpu.rom_hash());
+  std::string source_path =
+      std::filesystem::path(output_path).replace_extension(".cpp").u8string();
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  {
+    std::ofstream source(source_path);
+    source << emit_module(memory.data(), cpu.rom_hash(), blocks);
+    if (!source) {
+      logging::log(logging::Level::ERROR, "Could not write " + source_path);
+      return -1;
+    }
+  }
+  if (!compile_module(source_path, output_path)) {
+    return -1;
+  }
+  std::cout << "Compiled " << blocks.size() << " blocks of " << options.rom
+            << " to " << output_path << std::endl;
+  return 0;
+}
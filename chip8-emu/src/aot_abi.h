@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+// The interface between AotEngine and the modules chip8-aot compiles. The
+// generated source declares it from CHIP8_AOT_ABI too, so that it does not
+// depend on any header of the emulator, and the version is bumped whenever
+// it changes.
+constexpr uint32_t kAotAbiVersion = 1;
+
+#define CHIP8_AOT_ABI                                                        \
+  /* Cpu::Registers, as the compiled blocks see them. */                     \
+  struct Chip8AotRegisters {                                                 \
+    uint8_t v[16];                                                           \
+    uint16_t index;                                                          \
+    uint16_t stack[32];                                                      \
+    uint8_t sp;                                                              \
+    uint8_t delay;                                                           \
+    uint8_t sound;                                                           \
+    uint16_t pc;                                                             \
+    bool waiting_for_key_press;                                              \
+    uint8_t key_store_register;                                              \
+  };                                                                         \
+  struct Chip8AotMachine {                                                   \
+    Chip8AotRegisters registers;                                             \
+    void* context;                                                           \
+    /* Runs |word| as the instruction at |address| through the emulator, */  \
+    /* leaving the program counter past it as Cpu::step() does. Returns */   \
+    /* false if it fails. */                                                 \
+    bool (*execute)(Chip8AotMachine* machine, uint16_t address,              \
+                    uint16_t word);                                          \
+    /* Draws |rows| rows of the sprite at I at |x|, |y|, and sets VF to */   \
+    /* whether a pixel was erased if |flag|. */                              \
+    void (*draw)(Chip8AotMachine* machine, uint8_t x, uint8_t y,             \
+                 uint8_t rows, bool flag);                                   \
+  };                                                                         \
+  /* Runs a block, or its first |budget| instructions. Returns the number */ \
+  /* of instructions executed, or 0 if one fails. */                         \
+  typedef uint32_t (*Chip8AotFunction)(Chip8AotMachine* machine,             \
+                                       uint32_t budget);                     \
+  struct Chip8AotBlock {                                                     \
+    uint16_t start;                                                          \
+    /* The bytes the block was compiled from, starting at its start. */      \
+    uint16_t size;                                                           \
+    const uint8_t* source;                                                   \
+    /* The most instructions a run executes. */                              \
+    uint32_t instructions;                                                   \
+    /* Whether running it again once it jumped back to its start would */    \
+    /* change nothing, see Block::idempotent. */                             \
+    bool idempotent;                                                         \
+    Chip8AotFunction function;                                               \
+  };                                                                         \
+  struct Chip8AotModule {                                                    \
+    uint32_t abi_version;                                                    \
+    uint64_t rom_hash;                                                       \
+    uint32_t block_count;                                                    \
+    const Chip8AotBlock* blocks;                                             \
+  };
+
+CHIP8_AOT_ABI
+
+#define CHIP8_AOT_STRINGIFY(...) #__VA_ARGS__
+#define CHIP8_AOT_SOURCE(...) CHIP8_AOT_STRINGIFY(__VA_ARGS__)
+
+// CHIP8_AOT_ABI as source, for the generated code to declare it.
+constexpr const char* kAotAbiSource = CHIP8_AOT_SOURCE(CHIP8_AOT_ABI);
+
+// The function every module exports, returning its Chip8AotModule.
+constexpr const char* kAotModuleSymbol = "chip8_aot_module";
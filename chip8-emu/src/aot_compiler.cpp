@@ -0,0 +1,314 @@
+#include "src/aot_compiler.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+#include <filesystem>
+#include <sstream>
+
+#include "src/aot_abi.h"
+#include "src/disassembler.h"
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+#if defined(_WIN32)
+constexpr const char* kSharedObjectExtension = ".dll";
+#elif defined(__APPLE__)
+constexpr const char* kSharedObjectExtension = ".dylib";
+#else
+constexpr const char* kSharedObjectExtension = ".so";
+#endif
+
+// Returns where execution may go after |block|.
+std::vector<uint16_t> successors(const Block& block) {
+  const IrOp& last = block.instructions.back();
+  uint16_t end = block.end();
+  if (!block.branches) {
+    return {end};
+  }
+  switch (last.opcode) {
+    case IrOpcode::JP:
+      // Past a skip over the jump, execution goes on at the end.
+      if (block.skips_jump) {
+        return {last.nnn, end};
+      }
+      return {last.nnn};
+    case IrOpcode::CALL:
+      return {last.nnn, end};
+    case IrOpcode::SE:
+    case IrOpcode::SNE:
+      return {end, static_cast<uint16_t>(end + 2)};
+    case IrOpcode::EXECUTE:
+      // SKP and SKNP, as unknown instructions go nowhere.
+      if (opcode_class(last.nnn) == OpcodeClass::SKP ||
+          opcode_class(last.nnn) == OpcodeClass::SKNP) {
+        return {end, static_cast<uint16_t>(end + 2)};
+      }
+      return {};
+    default:
+      return {};
+  }
+}
+
+std::string function_name(uint16_t start) {
+  return "block_" + tohex(start, 4).substr(2);
+}
+
+std::string v(uint8_t x) {
+  return "r.v[" + tohex(x, 1) + "]";
+}
+
+std::string source(const IrOp& op) {
+  return op.immediate ? tohex(op.kk, 2) : v(op.y);
+}
+
+// Emits |op| of |block|, which runs |block.size()| instructions.
+void emit_op(const Block& block, const IrOp& op, std::ostream& out) {
+  std::string x = v(op.x);
+  std::string executed = std::to_string(block.size());
+  // Runs the instruction |word| through the emulator.
+  auto execute = [&](uint16_t word) {
+    out << "  if (!m->execute(m, " << tohex(op.address, 3) << ", "
+        << tohex(word, 4) << ")) return 0;\n";
+  };
+  // Runs an ALU operation computing |result| from a and b, and |flag| if
+  // the flag is kept.
+  auto alu = [&](const std::string& right, const std::string& result,
+                 const std::string& flag) {
+    out << "  {\n    uint8_t a = " << x << ";\n";
+    if (!right.empty()) {
+      out << "    uint8_t b = " << right << ";\n";
+    }
+    out << "    " << x << " = " << result << ";\n";
+    if (op.writes_flag) {
+      out << "    r.v[0xf] = " << flag << ";\n";
+    }
+    out << "  }\n";
+  };
+  switch (op.opcode) {
+    case IrOpcode::NOP:
+      break;
+    case IrOpcode::LD:
+      out << "  " << x << " = " << source(op) << ";\n";
+      break;
+    case IrOpcode::ADD:
+      alu(source(op), "a + b", "a + b > 0xff");
+      break;
+    case IrOpcode::SUB:
+      alu(source(op), "a - b", "a > b");
+      break;
+    case IrOpcode::SUBN:
+      alu(source(op), "b - a", "b > a");
+      break;
+    case IrOpcode::SHR:
+      alu("", "a >> 1", "a & 1");
+      break;
+    case IrOpcode::SHL:
+      alu("", "a << 1", "(a >> 7) & 1");
+      break;
+    case IrOpcode::OR:
+      out << "  " << x << " |= " << source(op) << ";\n";
+      break;
+    case IrOpcode::AND:
+      out << "  " << x << " &= " << source(op) << ";\n";
+      break;
+    case IrOpcode::XOR:
+      out << "  " << x << " ^= " << source(op) << ";\n";
+      break;
+    case IrOpcode::LD_I:
+      out << "  r.index = " << tohex(op.nnn, 3) << ";\n";
+      break;
+    case IrOpcode::ADD_I:
+      out << "  r.index += " << source(op) << ";\n";
+      break;
+    case IrOpcode::LD_F:
+      out << "  r.index += " << source(op) << " * 5;\n";
+      break;
+    case IrOpcode::LD_VX_DT:
+      out << "  " << x << " = r.delay;\n";
+      break;
+    case IrOpcode::LD_DT:
+      out << "  r.delay = " << source(op) << ";\n";
+      break;
+    case IrOpcode::LD_ST:
+      out << "  r.sound = " << source(op) << ";\n";
+      break;
+    case IrOpcode::DRW:
+      out << "  m->draw(m, " << x << ", " << v(op.y) << ", " << int{op.kk}
+          << ", " << (op.writes_flag ? "true" : "false") << ");\n";
+      break;
+    case IrOpcode::EXECUTE:
+      execute(op.nnn);
+      break;
+    case IrOpcode::JP:
+      out << "  r.pc = " << tohex(op.nnn, 3) << ";\n";
+      break;
+    case IrOpcode::CALL:
+      // Overflows fail through the emulator, which logs why.
+      out << "  if (r.sp >= 32) return m->execute(m, " << tohex(op.address, 3)
+          << ", " << tohex(0x2000 | op.nnn, 4) << ") ? " << executed
+          << " : 0;\n"
+          << "  r.stack[r.sp++] = " << tohex(op.address, 3) << ";\n"
+          << "  r.pc = " << tohex(op.nnn, 3) << ";\n";
+      break;
+    case IrOpcode::RET:
+      out << "  if (r.sp == 0) return m->execute(m, " << tohex(op.address, 3)
+          << ", 0x00ee) ? " << executed << " : 0;\n"
+          << "  r.pc = r.stack[--r.sp] + 2;\n";
+      break;
+    case IrOpcode::SE:
+      out << "  r.pc = " << x << " == " << source(op) << " ? "
+          << tohex(op.address + 4, 3) << " : " << tohex(op.address + 2, 3)
+          << ";\n";
+      break;
+    case IrOpcode::SNE:
+      out << "  r.pc = " << x << " == " << source(op) << " ? "
+          << tohex(op.address + 2, 3) << " : " << tohex(op.address + 4, 3)
+          << ";\n";
+      break;
+    case IrOpcode::JP_V0:
+      out << "  r.pc = " << tohex(op.nnn, 3) << " + r.v[0x0];\n";
+      break;
+    case IrOpcode::JP_EQ:
+      out << "  r.pc = " << x << " == " << source(op) << " ? "
+          << tohex(op.nnn, 3) << " : " << tohex(op.address + 4, 3) << ";\n";
+      break;
+    case IrOpcode::JP_NE:
+      out << "  r.pc = " << x << " == " << source(op) << " ? "
+          << tohex(op.address + 4, 3) << " : " << tohex(op.nnn, 3) << ";\n";
+      break;
+  }
+}
+
+void emit_block(const uint8_t* memory, const Block& block, std::ostream& out) {
+  for (const IrOp& instruction : block.instructions) {
+    uint16_t word = static_cast<uint16_t>(memory[instruction.address] << 8 |
+                                          memory[instruction.address + 1]);
+    out << "// " << tohex(instruction.address, 3) << ": " << disassemble(word)
+        << "\n";
+  }
+  out << "uint32_t " << function_name(block.start)
+      << "(Chip8AotMachine* m, uint32_t budget) {\n"
+      << "  Chip8AotRegisters& r = m->registers;\n";
+  if (block.size() > 1) {
+    // Runs the instructions one by one, as translated, until the budget
+    // runs out. Only a skip over the final jump may branch.
+    out << "  if (budget < " << block.size() << ") {\n";
+    for (unsigned int i = 0; i + 1 < block.size(); ++i) {
+      const IrOp& instruction = block.instructions[i];
+      emit_op(block, instruction, out);
+      bool last = i + 2 == block.size();
+      if (!last) {
+        out << "  if (budget == " << i + 1 << ") {\n  ";
+      }
+      if (!is_branch(instruction)) {
+        out << "  r.pc = " << tohex(instruction.address + 2, 3) << ";\n";
+      }
+      out << (last ? "" : "  ") << "  return " << i + 1 << ";\n";
+      if (!last) {
+        out << "  }\n";
+      }
+    }
+    out << "  }\n";
+  }
+  for (const IrOp& op : block.ops) {
+    emit_op(block, op, out);
+  }
+  if (!block.branches) {
+    out << "  r.pc = " << tohex(block.end(), 3) << ";\n";
+  }
+  if (block.skips_jump) {
+    // Skipping the jump runs one instruction fewer.
+    out << "  return r.pc == " << tohex(block.end(), 3) << " ? "
+        << block.size() - 1 << " : " << block.size() << ";\n";
+  } else {
+    out << "  return " << block.size() << ";\n";
+  }
+  out << "}\n\n";
+}
+
+}  // namespace
+
+std::vector<Block> find_blocks(const uint8_t* memory, uint16_t entry) {
+  std::vector<Block> blocks;
+  std::bitset<Cpu::kMaxMemory + 1> seen;
+  std::vector<uint16_t> pending = {entry};
+  while (!pending.empty()) {
+    uint16_t start = pending.back();
+    pending.pop_back();
+    // The last byte of memory holds no complete instruction.
+    if (start >= Cpu::kMaxMemory || seen[start]) {
+      continue;
+    }
+    seen[start] = true;
+    blocks.push_back(translate_block(memory, start));
+    for (uint16_t next : successors(blocks.back())) {
+      pending.push_back(next);
+    }
+  }
+  std::sort(blocks.begin(), blocks.end(),
+            [](const Block& a, const Block& b) { return a.start < b.start; });
+  return blocks;
+}
+
+std::string emit_module(const uint8_t* memory, uint64_t rom_hash,
+                        const std::vector<Block>& blocks) {
+  std::ostringstream out;
+  out << "// Generated by chip8-aot for the ROM " << tohex(rom_hash, 16)
+      << ".\n\n"
+      << "#include <cstdint>\n\n"
+      << "namespace {\n\n"
+      << kAotAbiSource << "\n\n";
+  for (const Block& block : blocks) {
+    emit_block(memory, block, out);
+  }
+  for (const Block& block : blocks) {
+    out << "const uint8_t " << function_name(block.start) << "_source[] = {";
+    for (uint16_t address = block.start; address < block.end(); ++address) {
+      out << (address == block.start ? "" : ", ") << tohex(memory[address], 2);
+    }
+    out << "};\n";
+  }
+  out << "\nconst Chip8AotBlock kBlocks[] = {\n";
+  for (const Block& block : blocks) {
+    std::string name = function_name(block.start);
+    out << "    {" << tohex(block.start, 3) << ", "
+        << block.end() - block.start << ", " << name << "_source, "
+        << block.size() << ", " << (block.idempotent ? "true" : "false")
+        << ", " << name << "},\n";
+  }
+  out << "};\n\n"
+      << "}  // namespace\n\n"
+      << "extern \"C\"\n"
+#if defined(_WIN32)
+      << "__declspec(dllexport)\n"
+#endif
+      << "const void* " << kAotModuleSymbol << "() {\n"
+      << "  static const Chip8AotModule module = {" << kAotAbiVersion << ", "
+      << tohex(rom_hash, 16) << "ull, " << blocks.size() << ", kBlocks};\n"
+      << "  return &module;\n"
+      << "}\n";
+  return out.str();
+}
+
+bool compile_module(const std::string& source_path,
+                    const std::string& output_path) {
+  const char* compiler = std::getenv("CXX");
+  std::string command = std::string(compiler ? compiler : "c++") +
+                        " -std=c++17 -O2 -shared -fPIC -o \"" + output_path +
+                        "\" \"" + source_path + "\"";
+  logging::log(logging::Level::INFO, "Running " + command);
+  if (std::system(command.c_str()) != 0) {
+    logging::log(logging::Level::ERROR, "Could not compile " + source_path);
+    return false;
+  }
+  return true;
+}
+
+std::string aot_module_path(const std::string& directory, uint64_t rom_hash) {
+  return (std::filesystem::path(directory) /
+          (tohex(rom_hash, 16).substr(2) + kSharedObjectExtension))
+      .u8string();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/block_ir.h"
+
+// Compiles the code of a ROM ahead of time into a shared object that
+// AotEngine loads, with one C++ function per block.
+
+// Returns the blocks reachable from |entry| in |memory|, following jumps,
+// calls, returns to the instruction after each call and both outcomes of
+// skips, in order of their start. Computed jumps (Bnnn) are not followed, so
+// the code they reach is only found if something else reaches it.
+std::vector<Block> find_blocks(const uint8_t* memory, uint16_t entry);
+
+// Returns the C++ source of a module running |blocks|, translated from
+// |memory| for the ROM hashing to |rom_hash|.
+std::string emit_module(const uint8_t* memory, uint64_t rom_hash,
+                        const std::vector<Block>& blocks);
+
+// Compiles |source_path| into the shared object |output_path| with the
+// compiler named by the CXX environment variable, or c++. Returns true if
+// successful.
+bool compile_module(const std::string& source_path,
+                    const std::string& output_path);
+
+// Returns where the module of the ROM hashing to |rom_hash| is kept in
+// |directory|, e.g. "DIR/0123456789abcdef.so".
+std::string aot_module_path(const std::string& directory, uint64_t rom_hash);
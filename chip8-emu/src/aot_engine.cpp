@@ -0,0 +1,255 @@
+#include "src/aot_engine.h"
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#endif
+
+#include "src/aot_compiler.h"
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+// Cpu::Registers and Chip8AotRegisters have the same members, so they are
+// copied as bytes.
+#define CHECK_OFFSET(member)                               \
+  static_assert(offsetof(Cpu::Registers, member) ==        \
+                    offsetof(Chip8AotRegisters, member),   \
+                "Chip8AotRegisters must match Cpu::Registers")
+CHECK_OFFSET(v);
+CHECK_OFFSET(index);
+CHECK_OFFSET(stack);
+CHECK_OFFSET(sp);
+CHECK_OFFSET(delay);
+CHECK_OFFSET(sound);
+CHECK_OFFSET(pc);
+CHECK_OFFSET(waiting_for_key_press);
+CHECK_OFFSET(key_store_register);
+#undef CHECK_OFFSET
+static_assert(sizeof(Cpu::Registers) == sizeof(Chip8AotRegisters),
+              "Chip8AotRegisters must match Cpu::Registers");
+
+template <typename From, typename To>
+void copy_registers(const From& from, To* to) {
+  static_assert(std::is_trivially_copyable_v<From> &&
+                std::is_trivially_copyable_v<To>);
+  std::memcpy(to, &from, sizeof(*to));
+}
+
+}  // namespace
+
+AotEngine::AotEngine(const EngineOptions& options)
+    : directory_(options.aot_path) {
+  machine_.execute = execute;
+  machine_.draw = draw;
+}
+
+AotEngine::~AotEngine() {
+  unload();
+}
+
+bool AotEngine::run(Cpu* cpu, unsigned int instructions) {
+  Cpu::Registers& r = registers(cpu);
+  const uint8_t* memory = this->memory(cpu);
+  if (!looked_up_ || rom_hash_ != cpu->rom_hash()) {
+    unload();
+    looked_up_ = true;
+    rom_hash_ = cpu->rom_hash();
+    std::string path = aot_module_path(directory_, rom_hash_);
+    std::error_code error;
+    if (directory_.empty() || !std::filesystem::exists(path, error)) {
+      logging::log(logging::Level::INFO,
+                   "No module compiled for the ROM " + tohex(rom_hash_, 16) +
+                       ", interpreting it");
+    } else {
+      load(path, rom_hash_);
+    }
+  }
+  uint64_t written_lines = take_written_lines(cpu);
+  if (stale_) {
+    written_lines = ~0ull;
+    stale_ = false;
+  }
+  validate(memory, written_lines);
+
+  machine_.context = cpu;
+  Chip8AotRegisters& state = machine_.registers;
+  // Whether |state| rather than |r| holds the registers.
+  bool compiled_state = false;
+  bool result = true;
+  unsigned int i = 0;
+  while (i < instructions) {
+    const uint16_t pc = compiled_state ? state.pc : r.pc;
+    // Nothing runs until the key arrives, which cannot happen meanwhile.
+    if (compiled_state ? state.waiting_for_key_press
+                       : r.waiting_for_key_press) {
+      break;
+    }
+    const Chip8AotBlock* block = pc <= Cpu::kMaxMemory && valid_[pc]
+                                     ? blocks_[pc]
+                                     : nullptr;
+    if (block) {
+      if (!compiled_state) {
+        copy_registers(r, &state);
+        compiled_state = true;
+      }
+      unsigned int budget = instructions - i;
+      unsigned int executed = block->function(&machine_, budget);
+      if (executed == 0) {
+        result = false;
+        break;
+      }
+      if (block->idempotent && executed == block->instructions &&
+          state.pc == pc) {
+        // Going round again would change nothing.
+        executed = budget / executed * executed;
+      }
+      count_instructions(cpu, pc, block->instructions, executed);
+      i += executed;
+    } else {
+      if (compiled_state) {
+        copy_registers(state, &r);
+        compiled_state = false;
+      }
+      if (!cpu->step()) {
+        result = false;
+        break;
+      }
+      ++i;
+    }
+    validate(memory, take_written_lines(cpu));
+  }
+  if (compiled_state) {
+    copy_registers(state, &r);
+  }
+  return result;
+}
+
+bool AotEngine::load(const std::string& path, uint64_t rom_hash) {
+#if defined(__unix__) || defined(__APPLE__)
+  void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    logging::log(logging::Level::ERROR,
+                 "Could not load " + path + ": " + dlerror());
+    return false;
+  }
+  auto function = reinterpret_cast<const void* (*)()>(
+      dlsym(handle, kAotModuleSymbol));
+  const Chip8AotModule* module =
+      function ? static_cast<const Chip8AotModule*>(function()) : nullptr;
+  if (!module || module->abi_version != kAotAbiVersion ||
+      module->rom_hash != rom_hash) {
+    logging::log(logging::Level::ERROR,
+                 path + " was not compiled for this ROM by this version");
+    dlclose(handle);
+    return false;
+  }
+
+  unload();
+  handle_ = handle;
+  module_ = module;
+  looked_up_ = true;
+  rom_hash_ = rom_hash;
+  stale_ = true;
+  for (uint32_t i = 0; i < module->block_count; ++i) {
+    const Chip8AotBlock& block = module->blocks[i];
+    if (block.start + block.size > Cpu::kMaxMemory + 1 ||
+        block.instructions == 0) {
+      continue;
+    }
+    blocks_[block.start] = &block;
+    for (unsigned int address = block.start;
+         address < block.start + block.size; ++address) {
+      std::vector<uint16_t>& starts =
+          blocks_by_line_[address / Cpu::kCacheLineSize];
+      if (starts.empty() || starts.back() != block.start) {
+        starts.push_back(block.start);
+      }
+    }
+  }
+  logging::log(logging::Level::INFO,
+               "Loaded " + std::to_string(module->block_count) +
+                   " compiled blocks from " + path);
+  return true;
+#else
+  logging::log(logging::Level::ERROR,
+               "Compiled modules are not supported on this platform");
+  return false;
+#endif
+}
+
+void AotEngine::unload() {
+#if defined(__unix__) || defined(__APPLE__)
+  if (handle_) {
+    dlclose(handle_);
+  }
+#endif
+  handle_ = nullptr;
+  module_ = nullptr;
+  blocks_.fill(nullptr);
+  valid_.fill(false);
+  for (std::vector<uint16_t>& starts : blocks_by_line_) {
+    starts.clear();
+  }
+}
+
+void AotEngine::validate(const uint8_t* memory, uint64_t written_lines) {
+  if (!module_) {
+    return;
+  }
+  for (unsigned int line = 0; written_lines; ++line, written_lines >>= 1) {
+    if (!(written_lines & 1)) {
+      continue;
+    }
+    for (uint16_t start : blocks_by_line_[line]) {
+      const Chip8AotBlock& block = *blocks_[start];
+      valid_[start] =
+          std::memcmp(memory + start, block.source, block.size) == 0;
+    }
+  }
+}
+
+bool AotEngine::execute(Chip8AotMachine* machine, uint16_t address,
+                        uint16_t word) {
+  Cpu* cpu = static_cast<Cpu*>(machine->context);
+  Cpu::Registers& r = registers(cpu);
+  copy_registers(machine->registers, &r);
+  r.pc = address;
+  bool result = cpu->execute(word);
+  if (result) {
+    r.pc += 2;
+  }
+  copy_registers(r, &machine->registers);
+  return result;
+}
+
+void AotEngine::draw(Chip8AotMachine* machine, uint8_t x, uint8_t y,
+                     uint8_t rows, bool flag) {
+  Cpu* cpu = static_cast<Cpu*>(machine->context);
+  FrameBuffer* frame_buffer = AotEngine::frame_buffer(cpu);
+  const uint8_t* memory = AotEngine::memory(cpu);
+  uint16_t index = machine->registers.index;
+  for (unsigned int i = 0; i < rows; ++i) {
+    frame_buffer->flip(x, y + i, memory[(index + i) & Cpu::kMaxMemory]);
+  }
+  if (!flag) {
+    return;
+  }
+  // A sprite never overlaps itself, so a pixel it erased is one it sets
+  // that is now off.
+  bool erased = false;
+  for (unsigned int i = 0; i < rows; ++i) {
+    uint8_t row = memory[(index + i) & Cpu::kMaxMemory];
+    for (unsigned int bit = 0; bit < 8; ++bit) {
+      if (((row << bit) & 0x80) && !frame_buffer->get_pixel(x + bit, y + i)) {
+        erased = true;
+      }
+    }
+  }
+  machine->registers.v[0xf] = erased;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/aot_abi.h"
+#include "src/execution_engine.h"
+
+// Runs the blocks chip8-aot compiled ahead of time for the ROM loaded, from
+// the shared object named after its hash in EngineOptions::aot_path, loaded
+// when the ROM first runs. Anything else runs in the reference interpreter:
+// code reached only through computed jumps, blocks whose memory no longer
+// holds what they were compiled from and any ROM without a module.
+//
+// Compiled blocks work on a copy of the registers, only written back when
+// the interpreter or Cpu::execute() needs them.
+class AotEngine : public ExecutionEngine {
+ public:
+  explicit AotEngine(const EngineOptions& options = {});
+  ~AotEngine() override;
+
+  AotEngine(const AotEngine&) = delete;
+  AotEngine& operator=(const AotEngine&) = delete;
+
+  EngineKind kind() const override { return EngineKind::AOT; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+
+  // Loads the module at |path|, which must have been compiled for the ROM
+  // hashing to |rom_hash|. Returns true if successful.
+  bool load(const std::string& path, uint64_t rom_hash);
+
+  // Whether the block starting at |address| runs compiled.
+  bool compiled(uint16_t address) const {
+    return blocks_[address] && valid_[address];
+  }
+
+ private:
+  void unload();
+
+  // Checks again whether the blocks in the cache lines set in
+  // |written_lines| of |memory| are what they were compiled from.
+  void validate(const uint8_t* memory, uint64_t written_lines);
+
+  // The callbacks of compiled blocks.
+  static bool execute(Chip8AotMachine* machine, uint16_t address,
+                      uint16_t word);
+  static void draw(Chip8AotMachine* machine, uint8_t x, uint8_t y,
+                   uint8_t rows, bool flag);
+
+  const std::string directory_;
+  // The ROM the module was looked up for, once looked up.
+  uint64_t rom_hash_ = 0;
+  bool looked_up_ = false;
+  // Whether no block was validated since the module was loaded.
+  bool stale_ = false;
+
+  void* handle_ = nullptr;
+  const Chip8AotModule* module_ = nullptr;
+  std::array<const Chip8AotBlock*, Cpu::kMaxMemory + 1> blocks_ = {};
+  std::array<bool, Cpu::kMaxMemory + 1> valid_ = {};
+  // The start of the blocks compiled from each cache line.
+  std::array<std::vector<uint16_t>, Cpu::kCacheLines> blocks_by_line_;
+
+  Chip8AotMachine machine_ = {};
+};
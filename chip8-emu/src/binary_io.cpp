@@ -0,0 +1,109 @@
+#include "src/binary_io.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "src/logging.h"
+
+void BinaryWriter::u8(uint8_t value) {
+  buffer_.push_back(value);
+}
+
+void BinaryWriter::u16(uint16_t value) {
+  u8(value & 0xff);
+  u8(value >> 8);
+}
+
+void BinaryWriter::u32(uint32_t value) {
+  u16(value & 0xffff);
+  u16(value >> 16);
+}
+
+void BinaryWriter::u64(uint64_t value) {
+  u32(value & 0xffffffff);
+  u32(value >> 32);
+}
+
+void BinaryWriter::bytes(const void* data, size_t size) {
+  const uint8_t* begin = static_cast<const uint8_t*>(data);
+  buffer_.insert(buffer_.end(), begin, begin + size);
+}
+
+bool BinaryWriter::save(const std::string& path) const {
+  std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+  if (!file) {
+    logging::log(logging::Level::ERROR, "Could not open file " + path);
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+  if (!file) {
+    logging::log(logging::Level::ERROR, "Could not write file " + path);
+    return false;
+  }
+  return true;
+}
+
+BinaryReader::BinaryReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size) {}
+
+uint8_t BinaryReader::u8() {
+  return read(1);
+}
+
+uint16_t BinaryReader::u16() {
+  return read(2);
+}
+
+uint32_t BinaryReader::u32() {
+  return read(4);
+}
+
+uint64_t BinaryReader::u64() {
+  return read(8);
+}
+
+void BinaryReader::bytes(void* data, size_t size) {
+  if (size > size_ - position_) {
+    ok_ = false;
+    position_ = size_;
+    std::memset(data, 0, size);
+    return;
+  }
+  std::memcpy(data, data_ + position_, size);
+  position_ += size;
+}
+
+void BinaryReader::skip(size_t size) {
+  if (size > size_ - position_) {
+    ok_ = false;
+    position_ = size_;
+    return;
+  }
+  position_ += size;
+}
+
+uint64_t BinaryReader::read(size_t size) {
+  if (size > size_ - position_) {
+    ok_ = false;
+    position_ = size_;
+    return 0;
+  }
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(data_[position_ + i]) << (8 * i);
+  }
+  position_ += size;
+  return value;
+}
+
+bool read_file(const std::string& path, std::vector<uint8_t>* contents) {
+  std::ifstream file(path, std::ifstream::binary);
+  if (!file) {
+    logging::log(logging::Level::ERROR, "Could not open file " + path);
+    return false;
+  }
+  contents->assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+  return true;
+}
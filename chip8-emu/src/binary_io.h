@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Serializes integers in little endian order into a byte buffer.
+class BinaryWriter {
+ public:
+  BinaryWriter() = default;
+
+  void u8(uint8_t value);
+  void u16(uint16_t value);
+  void u32(uint32_t value);
+  void u64(uint64_t value);
+  void bytes(const void* data, size_t size);
+
+  const std::vector<uint8_t>& buffer() const { return buffer_; }
+
+  // Writes the buffer to |path|. Returns true if successful.
+  bool save(const std::string& path) const;
+
+ private:
+  std::vector<uint8_t> buffer_;
+};
+
+// Reads integers written by BinaryWriter. Reading past the end of the buffer
+// returns zeroes and makes ok() return false.
+class BinaryReader {
+ public:
+  // |data| must outlive this instance.
+  BinaryReader(const uint8_t* data, size_t size);
+
+  uint8_t u8();
+  uint16_t u16();
+  uint32_t u32();
+  uint64_t u64();
+  void bytes(void* data, size_t size);
+  void skip(size_t size);
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return position_ == size_; }
+  size_t position() const { return position_; }
+
+ private:
+  uint64_t read(size_t size);
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t position_ = 0;
+  bool ok_ = true;
+};
+
+// Reads the whole file at |path| into |contents|. Returns true if successful.
+bool read_file(const std::string& path, std::vector<uint8_t>* contents);
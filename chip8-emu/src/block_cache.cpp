@@ -0,0 +1,304 @@
+#include "src/block_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "src/binary_io.h"
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+constexpr uint32_t kMagic = 0x43423843;  // "C8BC".
+constexpr uint32_t kVersion = 1;
+
+// The magic number, versions, quirks, ROM hash, number of entries and
+// checksum of the entries, which follow.
+constexpr size_t kHeaderSize = 36;
+
+// The size of a serialized IrOp.
+constexpr size_t kOpSize = 10;
+
+void write_ops(const std::vector<IrOp>& ops, BinaryWriter* writer) {
+  writer->u8(ops.size());
+  for (const IrOp& op : ops) {
+    writer->u8(static_cast<uint8_t>(op.opcode));
+    writer->u8(op.x);
+    writer->u8(op.y);
+    writer->u8(op.immediate);
+    writer->u8(op.kk);
+    writer->u8(op.writes_flag);
+    writer->u16(op.nnn);
+    writer->u16(op.address);
+  }
+}
+
+void read_ops(BinaryReader* reader, std::vector<IrOp>* ops) {
+  uint8_t size = reader->u8();
+  ops->resize(size);
+  for (IrOp& op : *ops) {
+    op.opcode = static_cast<IrOpcode>(reader->u8());
+    op.x = reader->u8() & 0xf;
+    op.y = reader->u8() & 0xf;
+    op.immediate = reader->u8();
+    op.kk = reader->u8();
+    op.writes_flag = reader->u8();
+    op.nnn = reader->u16();
+    op.address = reader->u16();
+  }
+}
+
+void write_entry(const std::vector<uint8_t>& source, const Block& block,
+                 BinaryWriter* writer) {
+  writer->u16(block.start);
+  writer->u16(source.size());
+  writer->bytes(source.data(), source.size());
+  writer->u64(block.lines);
+  writer->u8(block.branches | block.writes_memory << 1 |
+             block.skips_jump << 2 | block.idempotent << 3);
+  write_ops(block.instructions, writer);
+  write_ops(block.ops, writer);
+}
+
+// Reads the block of the entry at the position of |reader|, after its
+// source.
+void read_block(BinaryReader* reader, uint16_t start, Block* block) {
+  block->start = start;
+  block->lines = reader->u64();
+  uint8_t flags = reader->u8();
+  block->branches = flags & 1;
+  block->writes_memory = flags & 2;
+  block->skips_jump = flags & 4;
+  block->idempotent = flags & 8;
+  read_ops(reader, &block->instructions);
+  read_ops(reader, &block->ops);
+}
+
+// Skips the operations at the position of |reader|. Returns false if one
+// has no opcode.
+bool skip_ops(BinaryReader* reader) {
+  uint8_t size = reader->u8();
+  for (uint8_t i = 0; i < size; ++i) {
+    if (reader->u8() > static_cast<uint8_t>(IrOpcode::JP_NE)) {
+      return false;
+    }
+    reader->skip(kOpSize - 1);
+  }
+  return true;
+}
+
+bool matches(const uint8_t* memory, uint16_t address, const uint8_t* source,
+             size_t size) {
+  return address + size <= Cpu::kMaxMemory + 1 &&
+         std::memcmp(memory + address, source, size) == 0;
+}
+
+}  // namespace
+
+BlockCache::~BlockCache() {
+  close();
+}
+
+bool BlockCache::open(const std::string& directory, uint64_t rom_hash,
+                      uint32_t quirks) {
+  close();
+  added_.clear();
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << rom_hash
+       << ".c8bc";
+  path_ = (std::filesystem::path(directory) / name.str()).u8string();
+  rom_hash_ = rom_hash;
+  quirks_ = quirks;
+
+  std::error_code error;
+  if (!std::filesystem::exists(path_, error)) {
+    return false;
+  }
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = ::open(path_.c_str(), O_RDONLY);
+  struct stat status;
+  if (fd >= 0 && fstat(fd, &status) == 0 && status.st_size > 0) {
+    void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd,
+                         0);
+    if (mapping != MAP_FAILED) {
+      data_ = static_cast<const uint8_t*>(mapping);
+      size_ = status.st_size;
+      mapped_ = true;
+    }
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+#endif
+  if (!mapped_) {
+    if (!read_file(path_, &contents_)) {
+      return false;
+    }
+    data_ = contents_.data();
+    size_ = contents_.size();
+  }
+
+  BinaryReader reader(data_, size_);
+  uint32_t magic = reader.u32();
+  uint32_t version = reader.u32();
+  uint32_t ir_version = reader.u32();
+  uint32_t file_quirks = reader.u32();
+  uint64_t file_rom_hash = reader.u64();
+  uint32_t entries = reader.u32();
+  uint64_t checksum = reader.u64();
+  if (!reader.ok() || magic != kMagic || version != kVersion ||
+      ir_version != kIrVersion || file_quirks != quirks ||
+      file_rom_hash != rom_hash) {
+    logging::log(logging::Level::WARN,
+                 "Ignoring stale block cache " + path_);
+    close();
+    return false;
+  }
+  bool valid = checksum == fnv1a(data_ + kHeaderSize, size_ - kHeaderSize);
+  for (uint32_t i = 0; i < entries && valid; ++i) {
+    uint32_t offset = reader.position();
+    uint16_t start = reader.u16();
+    reader.skip(reader.u16());
+    reader.skip(9);
+    valid = skip_ops(&reader) && skip_ops(&reader) && reader.ok() &&
+            start < Cpu::kMaxMemory;
+    if (valid) {
+      offsets_[start] = offset;
+    }
+  }
+  if (!valid || !reader.at_end()) {
+    logging::log(logging::Level::WARN,
+                 "Ignoring corrupt block cache " + path_);
+    close();
+    return false;
+  }
+  return true;
+}
+
+std::optional<Block> BlockCache::find(const uint8_t* memory,
+                                      uint16_t address) const {
+  auto added = added_.find(address);
+  if (added != added_.end()) {
+    const Entry& entry = added->second;
+    if (!matches(memory, address, entry.source.data(), entry.source.size())) {
+      return std::nullopt;
+    }
+    return entry.block;
+  }
+  if (!offsets_[address]) {
+    return std::nullopt;
+  }
+  uint16_t size;
+  const uint8_t* source = this->source(offsets_[address], &size);
+  if (!matches(memory, address, source, size)) {
+    return std::nullopt;
+  }
+  BinaryReader reader(source + size, data_ + size_ - (source + size));
+  Block block;
+  read_block(&reader, address, &block);
+  return block;
+}
+
+bool BlockCache::contains(const uint8_t* memory, uint16_t address) const {
+  auto added = added_.find(address);
+  if (added != added_.end()) {
+    const Entry& entry = added->second;
+    return matches(memory, address, entry.source.data(), entry.source.size());
+  }
+  if (!offsets_[address]) {
+    return false;
+  }
+  uint16_t size;
+  const uint8_t* source = this->source(offsets_[address], &size);
+  return matches(memory, address, source, size);
+}
+
+void BlockCache::add(const uint8_t* memory, const Block& block) {
+  Entry& entry = added_[block.start];
+  entry.source.assign(memory + block.start, memory + block.end());
+  entry.block = block;
+}
+
+bool BlockCache::save() const {
+  if (path_.empty()) {
+    return false;
+  }
+  BinaryWriter entries;
+  uint32_t count = 0;
+  for (const auto& [start, entry] : added_) {
+    write_entry(entry.source, entry.block, &entries);
+    ++count;
+  }
+  // Keeps the blocks of the file that were not translated again.
+  for (uint32_t address = 0; address < offsets_.size(); ++address) {
+    if (!offsets_[address] || added_.count(address)) {
+      continue;
+    }
+    uint16_t size;
+    const uint8_t* source = this->source(offsets_[address], &size);
+    BinaryReader reader(source + size, data_ + size_ - (source + size));
+    Block block;
+    read_block(&reader, address, &block);
+    write_entry(std::vector<uint8_t>(source, source + size), block, &entries);
+    ++count;
+  }
+
+  BinaryWriter writer;
+  writer.u32(kMagic);
+  writer.u32(kVersion);
+  writer.u32(kIrVersion);
+  writer.u32(quirks_);
+  writer.u64(rom_hash_);
+  writer.u32(count);
+  writer.u64(fnv1a(entries.buffer().data(), entries.buffer().size()));
+  writer.bytes(entries.buffer().data(), entries.buffer().size());
+
+  std::error_code error;
+  std::filesystem::create_directories(
+      std::filesystem::path(path_).parent_path(), error);
+  std::string temporary = path_ + ".tmp";
+#if defined(__unix__) || defined(__APPLE__)
+  // Processes saving at once must not write the same file.
+  temporary = path_ + "." + std::to_string(getpid()) + ".tmp";
+#endif
+  if (!writer.save(temporary)) {
+    return false;
+  }
+  std::filesystem::rename(temporary, path_, error);
+  if (error) {
+    logging::log(logging::Level::ERROR,
+                 "Could not write " + path_ + ": " + error.message());
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+  return true;
+}
+
+void BlockCache::close() {
+#if defined(__unix__) || defined(__APPLE__)
+  if (mapped_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+#endif
+  mapped_ = false;
+  contents_.clear();
+  data_ = nullptr;
+  size_ = 0;
+  offsets_.fill(0);
+}
+
+const uint8_t* BlockCache::source(uint32_t offset, uint16_t* size) const {
+  BinaryReader reader(data_ + offset, size_ - offset);
+  reader.u16();
+  *size = reader.u16();
+  return data_ + offset + 4;
+}
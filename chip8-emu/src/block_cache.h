@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "src/block_ir.h"
+#include "src/cpu.h"
+
+// Translated blocks of a ROM, saved to a file so that other processes
+// running it can reuse them rather than translate them again.
+//
+// The file of a ROM is named after its hash, and holds the version of the IR
+// and the quirks it was translated for. Files of another version or quirks,
+// or whose contents do not match their checksum, are ignored and replaced on
+// save(). Each block keeps the bytes it was translated from, and is only
+// reused while memory still holds them, as self-modifying code may have
+// changed them since.
+//
+// The file is memory-mapped where possible, and blocks are only read from it
+// when first looked up.
+class BlockCache {
+ public:
+  BlockCache() = default;
+  ~BlockCache();
+
+  BlockCache(const BlockCache&) = delete;
+  BlockCache& operator=(const BlockCache&) = delete;
+
+  // Opens the cache of the ROM hashing to |rom_hash| run with |quirks|, in
+  // |directory|. Returns true if it was found and valid. Either way, blocks
+  // can be added and saved afterwards.
+  bool open(const std::string& directory, uint64_t rom_hash, uint32_t quirks);
+
+  // Returns the block starting at |address|, if cached and |memory| still
+  // holds what it was translated from.
+  std::optional<Block> find(const uint8_t* memory, uint16_t address) const;
+
+  // Whether find() would return a block.
+  bool contains(const uint8_t* memory, uint16_t address) const;
+
+  // Adds |block|, translated from |memory|, replacing any cached at its
+  // start.
+  void add(const uint8_t* memory, const Block& block);
+
+  // Writes the blocks opened and added to the file, replacing it at once so
+  // that concurrent processes see either version. Returns true if
+  // successful.
+  bool save() const;
+
+  // The path of the file, once opened.
+  const std::string& path() const { return path_; }
+
+ private:
+  struct Entry {
+    // What the block was translated from, starting at its start.
+    std::vector<uint8_t> source;
+    Block block;
+  };
+
+  void close();
+
+  // Returns the bytes the entry at |offset| of the file was translated from.
+  const uint8_t* source(uint32_t offset, uint16_t* size) const;
+
+  std::string path_;
+  uint64_t rom_hash_ = 0;
+  uint32_t quirks_ = 0;
+
+  // The file, mapped or read.
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<uint8_t> contents_;
+  // The offset in the file of the block starting at each address, or 0.
+  std::array<uint32_t, Cpu::kMaxMemory + 1> offsets_ = {};
+
+  std::map<uint16_t, Entry> added_;
+};
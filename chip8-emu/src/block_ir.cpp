@@ -0,0 +1,674 @@
+#include "src/block_ir.h"
+
+#include <optional>
+
+#include "src/disassembler.h"
+#include "src/util.h"
+
+namespace {
+
+bool has_source(IrOpcode opcode) {
+  switch (opcode) {
+    case IrOpcode::LD:
+    case IrOpcode::ADD:
+    case IrOpcode::SUB:
+    case IrOpcode::SUBN:
+    case IrOpcode::OR:
+    case IrOpcode::AND:
+    case IrOpcode::XOR:
+    case IrOpcode::ADD_I:
+    case IrOpcode::LD_F:
+    case IrOpcode::LD_DT:
+    case IrOpcode::LD_ST:
+    case IrOpcode::SE:
+    case IrOpcode::SNE:
+    case IrOpcode::JP_EQ:
+    case IrOpcode::JP_NE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t source_register(const IrOp& op) {
+  return has_source(op.opcode) && !op.immediate ? 1u << op.y : 0;
+}
+
+// Registers V0 to Vx.
+uint32_t registers_up_to(uint8_t x) {
+  return (2u << x) - 1;
+}
+
+// Translates the instruction |word| at |address|.
+IrOp translate(uint16_t word, uint16_t address) {
+  IrOp op;
+  op.x = (word >> 8) & 0xf;
+  op.y = (word >> 4) & 0xf;
+  op.kk = word & 0xff;
+  op.nnn = word & 0xfff;
+  op.address = address;
+  // Instructions of the form Fx.. read their source from Vx.
+  auto from_x = [&op](IrOpcode opcode) {
+    op.opcode = opcode;
+    op.y = op.x;
+  };
+
+  switch (opcode_class(word)) {
+    case OpcodeClass::SYS:
+      op.opcode = IrOpcode::NOP;
+      break;
+    case OpcodeClass::JP:
+      op.opcode = IrOpcode::JP;
+      break;
+    case OpcodeClass::CALL:
+      op.opcode = IrOpcode::CALL;
+      break;
+    case OpcodeClass::RET:
+      op.opcode = IrOpcode::RET;
+      break;
+    case OpcodeClass::SE_BYTE:
+      op.opcode = IrOpcode::SE;
+      op.immediate = true;
+      break;
+    case OpcodeClass::SNE_BYTE:
+      op.opcode = IrOpcode::SNE;
+      op.immediate = true;
+      break;
+    case OpcodeClass::SE_REG:
+      op.opcode = IrOpcode::SE;
+      break;
+    case OpcodeClass::SNE_REG:
+      op.opcode = IrOpcode::SNE;
+      break;
+    case OpcodeClass::LD_BYTE:
+      op.opcode = IrOpcode::LD;
+      op.immediate = true;
+      break;
+    case OpcodeClass::ADD_BYTE:
+      op.opcode = IrOpcode::ADD;
+      op.immediate = true;
+      break;
+    case OpcodeClass::LD_REG:
+      op.opcode = IrOpcode::LD;
+      break;
+    case OpcodeClass::OR:
+      op.opcode = IrOpcode::OR;
+      break;
+    case OpcodeClass::AND:
+      op.opcode = IrOpcode::AND;
+      break;
+    case OpcodeClass::XOR:
+      op.opcode = IrOpcode::XOR;
+      break;
+    case OpcodeClass::ADD_REG:
+      op.opcode = IrOpcode::ADD;
+      op.writes_flag = true;
+      break;
+    case OpcodeClass::SUB:
+      op.opcode = IrOpcode::SUB;
+      op.writes_flag = true;
+      break;
+    case OpcodeClass::SHR:
+      op.opcode = IrOpcode::SHR;
+      op.writes_flag = true;
+      break;
+    case OpcodeClass::SUBN:
+      op.opcode = IrOpcode::SUBN;
+      op.writes_flag = true;
+      break;
+    case OpcodeClass::SHL:
+      op.opcode = IrOpcode::SHL;
+      op.writes_flag = true;
+      break;
+    case OpcodeClass::LD_I:
+      op.opcode = IrOpcode::LD_I;
+      break;
+    case OpcodeClass::JP_V0:
+      op.opcode = IrOpcode::JP_V0;
+      break;
+    case OpcodeClass::LD_VX_DT:
+      op.opcode = IrOpcode::LD_VX_DT;
+      break;
+    case OpcodeClass::LD_DT_VX:
+      from_x(IrOpcode::LD_DT);
+      break;
+    case OpcodeClass::LD_ST_VX:
+      from_x(IrOpcode::LD_ST);
+      break;
+    case OpcodeClass::ADD_I_VX:
+      from_x(IrOpcode::ADD_I);
+      break;
+    case OpcodeClass::LD_F_VX:
+      from_x(IrOpcode::LD_F);
+      break;
+    case OpcodeClass::DRW:
+      op.opcode = IrOpcode::DRW;
+      op.kk = word & 0xf;
+      op.writes_flag = true;
+      break;
+    default:
+      op.opcode = IrOpcode::EXECUTE;
+      op.nnn = word;
+      break;
+  }
+  return op;
+}
+
+// Whether |op| only affects the registers it writes.
+bool is_pure(const IrOp& op) {
+  return op.opcode != IrOpcode::EXECUTE && op.opcode != IrOpcode::LD_DT &&
+         op.opcode != IrOpcode::LD_ST && op.opcode != IrOpcode::DRW &&
+         !is_branch(op);
+}
+
+// Whether |ops| read no register they write before writing it, and only
+// affect registers, besides a final jump.
+bool is_idempotent(const std::vector<IrOp>& ops) {
+  uint32_t written = 0;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const IrOp& op = ops[i];
+    bool last = i + 1 == ops.size();
+    if (!is_pure(op) &&
+        !(last && (op.opcode == IrOpcode::JP || op.opcode == IrOpcode::JP_EQ ||
+                   op.opcode == IrOpcode::JP_NE))) {
+      return false;
+    }
+    written |= registers_written(op);
+  }
+  // Registers read before being written hold what they held before the
+  // block, unless the block writes them.
+  uint32_t read_before_written = 0;
+  uint32_t written_so_far = 0;
+  for (const IrOp& op : ops) {
+    read_before_written |= registers_read(op) & ~written_so_far;
+    written_so_far |= registers_written(op);
+  }
+  return !(read_before_written & written);
+}
+
+// Returns |op| turned into a load of |value| into |x|.
+IrOp load(const IrOp& op, uint8_t x, uint8_t value) {
+  IrOp load;
+  load.opcode = IrOpcode::LD;
+  load.x = x;
+  load.immediate = true;
+  load.kk = value;
+  load.address = op.address;
+  return load;
+}
+
+// Returns |op| turned into a jump to |target|.
+IrOp jump(const IrOp& op, uint16_t target) {
+  IrOp jump;
+  jump.opcode = IrOpcode::JP;
+  jump.nnn = target;
+  jump.address = op.address;
+  return jump;
+}
+
+// Computes the result and flag of the flag setting operation |op| from
+// |left|, the value of Vx, and |right|, that of its source.
+void fold(const IrOp& op, uint8_t left, uint8_t right, uint8_t* result,
+          bool* flag) {
+  switch (op.opcode) {
+    case IrOpcode::ADD:
+      *result = left + right;
+      *flag = left + right > 0xff;
+      break;
+    case IrOpcode::SUB:
+      *result = left - right;
+      *flag = left > right;
+      break;
+    case IrOpcode::SUBN:
+      *result = right - left;
+      *flag = right > left;
+      break;
+    case IrOpcode::SHR:
+      *result = left >> 1;
+      *flag = left & 1;
+      break;
+    case IrOpcode::SHL:
+      *result = left << 1;
+      *flag = (left >> 7) & 1;
+      break;
+    case IrOpcode::OR:
+      *result = left | right;
+      break;
+    case IrOpcode::AND:
+      *result = left & right;
+      break;
+    case IrOpcode::XOR:
+      *result = left ^ right;
+      break;
+    default:
+      break;
+  }
+}
+
+const char* mnemonic(IrOpcode opcode) {
+  switch (opcode) {
+    case IrOpcode::NOP:
+      return "NOP";
+    case IrOpcode::LD:
+    case IrOpcode::LD_I:
+    case IrOpcode::LD_F:
+    case IrOpcode::LD_VX_DT:
+    case IrOpcode::LD_DT:
+    case IrOpcode::LD_ST:
+      return "LD";
+    case IrOpcode::ADD:
+    case IrOpcode::ADD_I:
+      return "ADD";
+    case IrOpcode::SUB:
+      return "SUB";
+    case IrOpcode::SUBN:
+      return "SUBN";
+    case IrOpcode::SHR:
+      return "SHR";
+    case IrOpcode::SHL:
+      return "SHL";
+    case IrOpcode::OR:
+      return "OR";
+    case IrOpcode::AND:
+      return "AND";
+    case IrOpcode::XOR:
+      return "XOR";
+    case IrOpcode::JP:
+    case IrOpcode::JP_V0:
+    case IrOpcode::JP_EQ:
+    case IrOpcode::JP_NE:
+      return "JP";
+    case IrOpcode::CALL:
+      return "CALL";
+    case IrOpcode::RET:
+      return "RET";
+    case IrOpcode::SE:
+      return "SE";
+    case IrOpcode::SNE:
+      return "SNE";
+    case IrOpcode::DRW:
+      return "DRW";
+    case IrOpcode::EXECUTE:
+      break;
+  }
+  return "";
+}
+
+std::string register_name(uint8_t x) {
+  return std::string("V") + "0123456789ABCDEF"[x & 0xf];
+}
+
+}  // namespace
+
+uint32_t registers_read(const IrOp& op) {
+  uint32_t x = 1u << op.x;
+  switch (op.opcode) {
+    case IrOpcode::LD:
+    case IrOpcode::LD_DT:
+    case IrOpcode::LD_ST:
+      return source_register(op);
+    case IrOpcode::ADD:
+    case IrOpcode::SUB:
+    case IrOpcode::SUBN:
+    case IrOpcode::OR:
+    case IrOpcode::AND:
+    case IrOpcode::XOR:
+    case IrOpcode::SE:
+    case IrOpcode::SNE:
+    case IrOpcode::JP_EQ:
+    case IrOpcode::JP_NE:
+      return x | source_register(op);
+    case IrOpcode::SHR:
+    case IrOpcode::SHL:
+      return x;
+    case IrOpcode::ADD_I:
+    case IrOpcode::LD_F:
+      return kIndexRegister | source_register(op);
+    case IrOpcode::JP_V0:
+      return 1;
+    case IrOpcode::DRW:
+      return x | 1u << op.y | kIndexRegister;
+    case IrOpcode::EXECUTE:
+      switch (opcode_class(op.nnn)) {
+        case OpcodeClass::CLS:
+        case OpcodeClass::RND:
+        case OpcodeClass::LD_VX_K:
+          return 0;
+        case OpcodeClass::SKP:
+        case OpcodeClass::SKNP:
+          return x;
+        case OpcodeClass::LD_B_VX:
+          return x | kIndexRegister;
+        case OpcodeClass::LD_MEM_VX:
+          return registers_up_to(op.x) | kIndexRegister;
+        case OpcodeClass::LD_VX_MEM:
+          return kIndexRegister;
+        default:
+          return kAllRegisters;
+      }
+    default:
+      return 0;
+  }
+}
+
+uint32_t registers_written(const IrOp& op) {
+  uint32_t x = 1u << op.x;
+  switch (op.opcode) {
+    case IrOpcode::LD:
+    case IrOpcode::OR:
+    case IrOpcode::AND:
+    case IrOpcode::XOR:
+    case IrOpcode::LD_VX_DT:
+      return x;
+    case IrOpcode::ADD:
+    case IrOpcode::SUB:
+    case IrOpcode::SUBN:
+    case IrOpcode::SHR:
+    case IrOpcode::SHL:
+      return x | (op.writes_flag ? kFlagRegister : 0);
+    case IrOpcode::DRW:
+      return op.writes_flag ? kFlagRegister : 0;
+    case IrOpcode::LD_I:
+    case IrOpcode::ADD_I:
+    case IrOpcode::LD_F:
+      return kIndexRegister;
+    case IrOpcode::EXECUTE:
+      // Fx0A writes Vx once the key arrives, after its block.
+      switch (opcode_class(op.nnn)) {
+        case OpcodeClass::RND:
+          return x;
+        case OpcodeClass::LD_MEM_VX:
+          return kIndexRegister;
+        case OpcodeClass::LD_VX_MEM:
+          return registers_up_to(op.x) | kIndexRegister;
+        default:
+          return 0;
+      }
+    default:
+      return 0;
+  }
+}
+
+bool ends_block(uint16_t word) {
+  switch (opcode_class(word)) {
+    case OpcodeClass::LD_VX_K:
+    case OpcodeClass::LD_B_VX:
+    case OpcodeClass::LD_MEM_VX:
+    case OpcodeClass::UNKNOWN:
+      return true;
+    default:
+      return is_branch(word);
+  }
+}
+
+bool is_branch(const IrOp& op) {
+  switch (op.opcode) {
+    case IrOpcode::JP:
+    case IrOpcode::CALL:
+    case IrOpcode::RET:
+    case IrOpcode::SE:
+    case IrOpcode::SNE:
+    case IrOpcode::JP_V0:
+    case IrOpcode::JP_EQ:
+    case IrOpcode::JP_NE:
+      return true;
+    case IrOpcode::EXECUTE:
+      return is_branch(op.nnn) || opcode_class(op.nnn) == OpcodeClass::UNKNOWN;
+    default:
+      return false;
+  }
+}
+
+Block translate_block(const uint8_t* memory, uint16_t address) {
+  Block block;
+  block.start = address;
+  while (address < Cpu::kMaxMemory &&
+         block.size() < Block::kMaxBlockSize) {
+    uint16_t word =
+        static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]);
+    IrOp op = translate(word, address);
+    block.instructions.push_back(op);
+    block.lines |= 1ull << (address / Cpu::kCacheLineSize);
+    block.lines |= 1ull << ((address + 1) / Cpu::kCacheLineSize);
+    address += 2;
+    if (ends_block(word)) {
+      block.branches = is_branch(op);
+      block.writes_memory = opcode_class(word) == OpcodeClass::LD_B_VX ||
+                            opcode_class(word) == OpcodeClass::LD_MEM_VX;
+      break;
+    }
+  }
+
+  block.ops = block.instructions;
+  // A skip over a jump goes on to the jump, unless the jump is to where the
+  // skip would go, which would make it impossible to tell which happened.
+  const IrOp& last = block.instructions.back();
+  if ((last.opcode == IrOpcode::SE || last.opcode == IrOpcode::SNE) &&
+      address < Cpu::kMaxMemory && block.size() < Block::kMaxBlockSize) {
+    uint16_t word =
+        static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]);
+    if (opcode_class(word) == OpcodeClass::JP &&
+        (word & 0xfff) != address + 2) {
+      IrOp jump = translate(word, address);
+      block.instructions.push_back(jump);
+      block.lines |= 1ull << ((address + 1) / Cpu::kCacheLineSize);
+      block.skips_jump = true;
+      IrOp& skip = block.ops.back();
+      skip.opcode = skip.opcode == IrOpcode::SE ? IrOpcode::JP_NE
+                                                : IrOpcode::JP_EQ;
+      skip.nnn = jump.nnn;
+    }
+  }
+
+  propagate_constants(&block.ops);
+  eliminate_dead_writes(&block.ops);
+  block.idempotent = !block.ops.empty() && is_idempotent(block.ops) &&
+                     is_branch(block.ops.back()) &&
+                     block.ops.back().nnn == block.start;
+  return block;
+}
+
+void propagate_constants(std::vector<IrOp>* ops) {
+  std::optional<uint8_t> v[16];
+  std::optional<uint16_t> index;
+  std::optional<uint8_t> delay;
+
+  std::vector<IrOp> propagated;
+  propagated.reserve(ops->size());
+  // Appends a load of |value| into |x|, unless it is already there.
+  auto emit_load = [&](const IrOp& op, uint8_t x, uint8_t value) {
+    if (v[x] != value) {
+      propagated.push_back(load(op, x, value));
+      v[x] = value;
+    }
+  };
+
+  for (IrOp op : *ops) {
+    if (source_register(op) && v[op.y]) {
+      op.immediate = true;
+      op.kk = *v[op.y];
+    }
+
+    switch (op.opcode) {
+      case IrOpcode::LD:
+        if (op.immediate) {
+          emit_load(op, op.x, op.kk);
+          continue;
+        }
+        v[op.x].reset();
+        break;
+      case IrOpcode::ADD:
+      case IrOpcode::SUB:
+      case IrOpcode::SUBN:
+      case IrOpcode::SHR:
+      case IrOpcode::SHL:
+      case IrOpcode::OR:
+      case IrOpcode::AND:
+      case IrOpcode::XOR: {
+        bool unary =
+            op.opcode == IrOpcode::SHR || op.opcode == IrOpcode::SHL;
+        if (v[op.x] && (unary || op.immediate)) {
+          uint8_t result = 0;
+          bool flag = false;
+          fold(op, *v[op.x], op.kk, &result, &flag);
+          emit_load(op, op.x, result);
+          if (op.writes_flag) {
+            emit_load(op, 0xf, flag);
+          }
+          continue;
+        }
+        v[op.x].reset();
+        if (op.writes_flag) {
+          v[0xf].reset();
+        }
+        break;
+      }
+      case IrOpcode::LD_I:
+        if (index == op.nnn) {
+          continue;
+        }
+        index = op.nnn;
+        break;
+      case IrOpcode::ADD_I:
+      case IrOpcode::LD_F:
+        if (index && op.immediate) {
+          uint16_t value =
+              *index + op.kk * (op.opcode == IrOpcode::LD_F ? 5 : 1);
+          IrOp load_index;
+          load_index.opcode = IrOpcode::LD_I;
+          load_index.nnn = value;
+          load_index.address = op.address;
+          propagated.push_back(load_index);
+          index = value;
+          continue;
+        }
+        index.reset();
+        break;
+      case IrOpcode::LD_VX_DT:
+        // The delay timer only changes between runs.
+        if (delay) {
+          emit_load(op, op.x, *delay);
+          continue;
+        }
+        v[op.x].reset();
+        break;
+      case IrOpcode::LD_DT:
+        if (op.immediate) {
+          delay = op.kk;
+        } else {
+          delay.reset();
+        }
+        break;
+      case IrOpcode::SE:
+      case IrOpcode::SNE:
+        if (v[op.x] && op.immediate) {
+          bool skips = (*v[op.x] == op.kk) == (op.opcode == IrOpcode::SE);
+          op = jump(op, op.address + (skips ? 4 : 2));
+        }
+        break;
+      case IrOpcode::JP_EQ:
+      case IrOpcode::JP_NE:
+        if (v[op.x] && op.immediate) {
+          bool jumps = (*v[op.x] == op.kk) == (op.opcode == IrOpcode::JP_EQ);
+          op = jump(op, jumps ? op.nnn : op.address + 4);
+        }
+        break;
+      case IrOpcode::JP_V0:
+        if (v[0]) {
+          op = jump(op, op.nnn + *v[0]);
+        }
+        break;
+      case IrOpcode::NOP:
+        continue;
+      default: {
+        uint32_t written = registers_written(op);
+        for (unsigned int x = 0; x < 16; ++x) {
+          if (written & (1u << x)) {
+            v[x].reset();
+          }
+        }
+        if (written & kIndexRegister) {
+          index.reset();
+        }
+        break;
+      }
+    }
+    propagated.push_back(op);
+  }
+  *ops = std::move(propagated);
+}
+
+void eliminate_dead_writes(std::vector<IrOp>* ops) {
+  uint32_t live = kAllRegisters;
+  std::vector<IrOp> kept;
+  kept.reserve(ops->size());
+  for (auto it = ops->rbegin(); it != ops->rend(); ++it) {
+    IrOp op = *it;
+    if (op.opcode == IrOpcode::NOP ||
+        (is_pure(op) && !(registers_written(op) & live))) {
+      continue;
+    }
+    // The result of an ALU operation on VF is its flag.
+    if (op.writes_flag && (op.opcode == IrOpcode::DRW || op.x != 0xf) &&
+        !(live & kFlagRegister)) {
+      op.writes_flag = false;
+    }
+    live = (live & ~registers_written(op)) | registers_read(op);
+    kept.push_back(op);
+  }
+  ops->assign(kept.rbegin(), kept.rend());
+}
+
+std::string to_string(const IrOp& op) {
+  if (op.opcode == IrOpcode::EXECUTE) {
+    return disassemble(op.nnn);
+  }
+  std::string x = register_name(op.x);
+  std::string source =
+      op.immediate ? tohex(op.kk, 2) : register_name(op.y);
+  std::string text = mnemonic(op.opcode);
+  switch (op.opcode) {
+    case IrOpcode::NOP:
+    case IrOpcode::RET:
+      break;
+    case IrOpcode::JP:
+    case IrOpcode::CALL:
+    case IrOpcode::LD_I:
+      text += (op.opcode == IrOpcode::LD_I ? " I, " : " ") + tohex(op.nnn, 3);
+      break;
+    case IrOpcode::JP_V0:
+      text += " V0, " + tohex(op.nnn, 3);
+      break;
+    case IrOpcode::JP_EQ:
+    case IrOpcode::JP_NE:
+      text += " " + tohex(op.nnn, 3) + " IF " + x +
+              (op.opcode == IrOpcode::JP_EQ ? " == " : " != ") + source;
+      break;
+    case IrOpcode::SHR:
+    case IrOpcode::SHL:
+      text += " " + x;
+      break;
+    case IrOpcode::ADD_I:
+      text += " I, " + source;
+      break;
+    case IrOpcode::LD_F:
+      text += " F, " + source;
+      break;
+    case IrOpcode::LD_VX_DT:
+      text += " " + x + ", DT";
+      break;
+    case IrOpcode::LD_DT:
+      text += " DT, " + source;
+      break;
+    case IrOpcode::LD_ST:
+      text += " ST, " + source;
+      break;
+    case IrOpcode::DRW:
+      text += " " + x + ", " + register_name(op.y) + ", " + tohex(op.kk, 1);
+      break;
+    default:
+      text += " " + x + ", " + source;
+      break;
+  }
+  return op.writes_flag ? text + " [VF]" : text;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/cpu.h"
+
+// The version of the IR and of translate_block(), to be bumped whenever
+// either changes, so that blocks saved by another version are not reused.
+constexpr uint32_t kIrVersion = 1;
+
+// The operations of the block intermediate representation. Each instruction
+// translates to a single operation, which the optimization passes may then
+// rewrite, e.g. into a load of the constant it computes, or remove.
+enum class IrOpcode : uint8_t {
+  NOP,
+  // Vx = source.
+  LD,
+  // Vx op= source, then VF = the carry or borrow if |writes_flag|. SHR and
+  // SHL have no source.
+  ADD,
+  SUB,
+  SUBN,
+  SHR,
+  SHL,
+  // Vx op= source.
+  OR,
+  AND,
+  XOR,
+  // I = nnn.
+  LD_I,
+  // I += source, or source * 5 for LD_F.
+  ADD_I,
+  LD_F,
+  // Vx = DT.
+  LD_VX_DT,
+  // DT = source, ST = source.
+  LD_DT,
+  LD_ST,
+  // Draws kk rows of the sprite at I at Vx, Vy, then VF = whether a pixel
+  // was erased if |writes_flag|.
+  DRW,
+  // Anything else, through Cpu::execute(word), with the program counter at
+  // the instruction.
+  EXECUTE,
+
+  // The following set the program counter, and end their block.
+
+  // PC = nnn.
+  JP,
+  CALL,
+  RET,
+  // Skips the next instruction if Vx == source, or Vx != source.
+  SE,
+  SNE,
+  // PC = nnn + V0.
+  JP_V0,
+  // PC = nnn if Vx == source, or Vx != source, and past the jump otherwise.
+  // A skip over a jump, SNE or SE followed by JP, as one operation.
+  JP_EQ,
+  JP_NE,
+};
+
+struct IrOp {
+  IrOpcode opcode = IrOpcode::NOP;
+  uint8_t x = 0;
+  // The source register, unless |immediate|.
+  uint8_t y = 0;
+  bool immediate = false;
+  uint8_t kk = 0;
+  bool writes_flag = false;
+  // The address operand, or the instruction word for EXECUTE.
+  uint16_t nnn = 0;
+  // The address of the instruction the operation comes from.
+  uint16_t address = 0;
+};
+
+// Register sets, as bitmaps: bit n for Vn, and kIndexRegister for I.
+constexpr uint32_t kFlagRegister = 1u << 0xf;
+constexpr uint32_t kIndexRegister = 1u << 16;
+constexpr uint32_t kAllRegisters = 0x1ffff;
+
+// The registers |op| reads and writes, as run within its block. Memory, the
+// screen, the timers and the stack are not modelled.
+uint32_t registers_read(const IrOp& op);
+uint32_t registers_written(const IrOp& op);
+
+// Whether |op| sets the program counter itself.
+bool is_branch(const IrOp& op);
+
+// A straight run of instructions, translated from memory and optimized as a
+// whole. Blocks end with the first instruction that branches, waits for a
+// key, writes memory or is not an instruction, or after kMaxBlockSize
+// instructions. A skip over a jump ends its block after the jump.
+struct Block {
+  static constexpr unsigned int kMaxBlockSize = 32;
+
+  uint16_t start = 0;
+  // One operation per instruction, as translated, to run part of the block.
+  std::vector<IrOp> instructions;
+  // The operations to run the whole block, once optimized.
+  std::vector<IrOp> ops;
+  // The cache lines the block was translated from, as a bitmap.
+  uint64_t lines = 0;
+  // Whether the last instruction sets the program counter. Otherwise the
+  // block continues at end().
+  bool branches = false;
+  // Whether the last instruction may write memory.
+  bool writes_memory = false;
+  // Whether the block ends with a skip over a jump, in which case it runs
+  // one instruction fewer when it continues at end().
+  bool skips_jump = false;
+  // Whether running the block again once it jumped back to its start leaves
+  // the machine as it was, e.g. in a loop polling the delay timer, as it
+  // only reads registers after writing them.
+  bool idempotent = false;
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(instructions.size());
+  }
+  uint16_t end() const { return start + size() * 2; }
+};
+
+// Whether a block ends after the instruction |word|.
+bool ends_block(uint16_t word);
+
+// Translates the block starting at |address| of |memory|, which must be
+// below Cpu::kMaxMemory, and optimizes it.
+Block translate_block(const uint8_t* memory, uint16_t address);
+
+// Replaces sources holding known values with immediates, folds operations
+// on them into loads, removes loads of values already there and resolves
+// skips on them. Values are only known from within |ops|.
+void propagate_constants(std::vector<IrOp>* ops);
+
+// Removes operations whose results are overwritten within |ops| before being
+// read, and the flag of those whose VF is. Everything is read after |ops|.
+void eliminate_dead_writes(std::vector<IrOp>* ops);
+
+// Returns |op| in assembly, e.g. "ADD V1, V2 [VF]" for an addition that sets
+// VF.
+std::string to_string(const IrOp& op);
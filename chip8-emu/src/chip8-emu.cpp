@@ -7,17 +7,56 @@
 #include <SFML/Window.hpp>
 #include <SFML/Window/Keyboard.hpp>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
+#include "src/clock.h"
 #include "src/constants.h"
+#include "src/control_flow.h"
 #include "src/cpu.h"
+#include "src/execution_engine.h"
+#include "src/fast_forward.h"
 #include "src/frame_buffer.h"
+#include "src/frame_stats.h"
+#include "src/input_latency.h"
 #include "src/logging.h"
+#include "src/metrics.h"
+#include "src/metrics_server.h"
+#include "src/movie.h"
+#include "src/netplay.h"
+#include "src/live_stats.h"
+#include "src/options.h"
+#include "src/perf_overlay.h"
+#include "src/profiler.h"
+#include "src/rewind_buffer.h"
+#include "src/run_ahead.h"
+#include "src/scripted_keyboard.h"
 #include "src/sf_keyboard_adapter.h"
+#include "src/tiered_engine.h"
+#include "src/trace.h"
 
 namespace fs = std::filesystem;
 
-int main() {
+static const std::string kTitle = "chip8 emu";
+
+// How often frame time statistics are logged, in seconds.
+static constexpr double kStatsInterval = 5;
+
+// Shows or hides the performance overlay.
+static constexpr sf::Keyboard::Key kOverlayKey = sf::Keyboard::F1;
+
+// Logs the input latency measured so far, and saves it if asked to.
+static constexpr sf::Keyboard::Key kLatencyKey = sf::Keyboard::F2;
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    return -1;
+  }
+
+  Clock* clock = SystemClock::get();
+
   std::vector<std::filesystem::path> roms;
   try {
     for (const auto& file : fs::directory_iterator(kRomLocation)) {
@@ -33,7 +72,7 @@ int main() {
   sf::RenderWindow window(
       sf::VideoMode(FrameBuffer::kScreenWidth * kRenderMultiplier,
                     FrameBuffer::kScreenHeight * kRenderMultiplier),
-      "chip8 emu", sf::Style::Close);
+      kTitle, sf::Style::Close);
   window.setFramerateLimit(60);
 
   sf::Font font;
@@ -56,19 +95,105 @@ int main() {
   sf::Text title("chip8 emulator", font);
   title.setFillColor(kForegroundColor);
 
-  std::unique_ptr<Random> random = std::make_unique<Random>();
+  PerfOverlay overlay(font);
+  bool show_overlay = false;
+  LiveStats live_stats;
+  // The speed timer drift is being measured against, or -1 to restart.
+  double drift_speed = -1;
+
+  std::unique_ptr<Random> random = options.seed
+                                      ? std::make_unique<Random>(*options.seed)
+                                      : std::make_unique<Random>(*clock);
   std::unique_ptr<SfKeyboardAdapter> keyboard =
       std::make_unique<SfKeyboardAdapter>();
+  // The machine sees the host keyboard latched once per frame, which keeps
+  // it deterministic for a given sequence of frame inputs.
+  ScriptedKeyboard input;
+  std::unique_ptr<ExecutionEngine> engine =
+      make_engine(options.engine, options.engine_options);
   std::unique_ptr<Cpu> cpu;
+  // Declared after the Cpu it counts, so as to be destroyed before it.
+  Metrics metrics;
+  MetricsServer metrics_server(&metrics);
+  if (options.metrics_port != 0 &&
+      !metrics_server.start(options.metrics_port)) {
+    return -1;
+  }
+  RewindBuffer rewind_buffer;
+  Movie movie;
+  // Where the movie of the game being recorded is saved.
+  std::string movie_path;
+  std::unique_ptr<MovieRecorder> recorder;
+  auto finish_recording = [&] {
+    if (recorder) {
+      save_movie(movie, movie_path);
+      recorder.reset();
+    }
+  };
+
+  if (!options.trace_path.empty()) {
+    trace::start();
+  }
+  InputLatency latency;
+  auto save_latency = [&] {
+    std::ostringstream summary;
+    latency.write_summary(summary);
+    logging::log(logging::Level::INFO, "Input latency:\n" + summary.str());
+    if (!options.latency_path.empty()) {
+      latency.save(options.latency_path);
+    }
+  };
+  auto finish_measuring = [&] {
+    if (!options.trace_path.empty()) {
+      trace::stop(options.trace_path);
+    }
+    if (!options.latency_path.empty()) {
+      latency.save(options.latency_path);
+    }
+  };
+
+  std::unique_ptr<Profiler> profiler;
+  auto finish_profiling = [&] {
+    if (profiler) {
+      profiler->save(*cpu, options.profile_path);
+      profiler.reset();
+    }
+  };
+
+  // Set while running at any speed other than 1x.
+  std::unique_ptr<FastForward> fast_forward;
+  double shown_speed = 0;
+  auto stop_fast_forward = [&] {
+    if (fast_forward) {
+      fast_forward.reset();
+      window.setFramerateLimit(60);
+      window.setTitle(kTitle);
+      shown_speed = 0;
+    }
+  };
+  double present_start = 0;
+
+  std::unique_ptr<RunAhead> run_ahead;
+  FrameBuffer future;
+  FrameStats run_ahead_stats;
+  FrameStats run_ahead_state_stats;
+  double stats_start = clock->now();
+
+  std::unique_ptr<UdpTransport> transport;
+  std::unique_ptr<NetplaySession> netplay;
+  FrameStats rollback_stats;
 
   bool in_menu = true;
   while (window.isOpen()) {
+    trace::Span frame_span("frame");
     window.clear(kBackgroundColor);
 
     if (in_menu) {
+      trace::Span menu_span("menu");
       sf::Event event;
       while (window.pollEvent(event)) {
         if (event.type == sf::Event::Closed) {
+          finish_measuring();
           window.close();
           return 0;
         }
@@ -76,9 +201,56 @@ int main() {
         if (event.type == sf::Event::KeyPressed) {
           if (event.key.code == sf::Keyboard::Enter) {
             in_menu = false;
-            cpu = std::make_unique<Cpu>(random.get(), keyboard.get());
-            if (!cpu->load(roms[selected_index].u8string())) {
-              return -1;
+            cpu = std::make_unique<Cpu>(random.get(), &input);
+            cpu->set_engine(engine.get());
+            rewind_buffer.clear();
+            live_stats = LiveStats(clock->now(), cpu->frames_run());
+            drift_speed = -1;
+            trace::Span load_span("load_rom");
+            if (!cpu->load(roms[selected_index].u8string()) ||
+                (options.validation &&
+                 !validate_rom(cpu.get(), engine.get(),
+                               *options.validation))) {
+              // Back to the menu, so that a kiosk keeps running.
+              metrics.add(Metrics::Counter::LOAD_ERRORS);
+              cpu.reset();
+              in_menu = true;
+              goto loop;
+            }
+            if (options.metrics_port != 0) {
+              metrics.attach(cpu.get(),
+                             dynamic_cast<TieredEngine*>(engine.get()));
+            }
+            if (options.netplay_port != 0) {
+              // Both players must start from the same state.
+              random->set_state(random->seed());
+              transport = std::make_unique<UdpTransport>();
+              if (!transport->open(options.netplay_port,
+                                   options.netplay_host,
+                                   options.netplay_peer_port)) {
+                finish_measuring();
+                return -1;
+              }
+              netplay = std::make_unique<NetplaySession>(
+                  cpu.get(), &input, transport.get(), random->seed(), clock);
+            } else if (!options.record_path.empty()) {
+              // One movie per ROM, named as the ROM benchmark looks for it.
+              std::error_code error;
+              fs::create_directories(options.record_path, error);
+              movie_path =
+                  (fs::path(options.record_path) /
+                   (roms[selected_index].stem().u8string() + ".c8mv"))
+                      .u8string();
+              recorder = std::make_unique<MovieRecorder>(
+                  &movie, cpu.get(), &input, random->seed());
+            }
+            if (!options.profile_path.empty()) {
+              profiler = std::make_unique<Profiler>(options.profile_interval);
+              cpu->set_profiler(profiler.get());
+            }
+            if (options.run_ahead > 0) {
+              run_ahead = std::make_unique<RunAhead>(cpu.get(),
+                                                     options.run_ahead, clock);
             }
             goto loop;
           }
@@ -118,31 +290,208 @@ int main() {
       window.draw(chevron);
 
     } else {
-      sf::Event event;
-      while (window.pollEvent(event)) {
-        if (event.type == sf::Event::Closed) {
-          window.close();
-          return 0;
+      // Keys pressed and released within the frame still count as held.
+      uint16_t keys = 0;
+      {
+        trace::Span span("poll_events");
+        sf::Event event;
+        while (window.pollEvent(event)) {
+          if (event.type == sf::Event::Closed) {
+            finish_recording();
+            finish_profiling();
+            finish_measuring();
+            window.close();
+            return 0;
+          }
+          if (event.type == sf::Event::KeyPressed) {
+            if (event.key.code == sf::Keyboard::Escape) {
+              finish_recording();
+              finish_profiling();
+              stop_fast_forward();
+              run_ahead.reset();
+              netplay.reset();
+              transport.reset();
+              metrics.detach();
+              cpu.reset();
+              in_menu = true;
+              goto loop;
+            }
+            if (event.key.code == kOverlayKey) {
+              show_overlay = !show_overlay;
+              live_stats = LiveStats(clock->now(), cpu->frames_run());
+              drift_speed = -1;
+            }
+            if (event.key.code == kLatencyKey) {
+              save_latency();
+            }
+            latency.on_key_event(SfKeyboardAdapter::key_mask(event.key.code),
+                                 clock->now());
+            if (SfKeyboardAdapter::key_mask(event.key.code)) {
+              metrics.add(Metrics::Counter::KEY_EVENTS);
+            }
+            keys |= SfKeyboardAdapter::key_mask(event.key.code);
+          }
         }
-        if (event.type == sf::Event::KeyPressed) {
-          if (event.key.code == sf::Keyboard::Escape) {
-            cpu.reset();
-            in_menu = true;
+        keys |= keyboard->pressed_keys();
+      }
+
+      // Holding backspace runs the game backwards, one frame per frame.
+      // Holding tab runs it as fast as possible. Neither is available in
+      // netplay, which needs both players to run in lockstep.
+      bool rewinding = !netplay &&
+                       sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace);
+      double speed = netplay ? 1 : options.speed;
+      if (!netplay && sf::Keyboard::isKeyPressed(sf::Keyboard::Tab)) {
+        speed = FastForward::kUnbounded;
+      }
+      if (rewinding || speed == 1) {
+        stop_fast_forward();
+      } else if (!fast_forward || fast_forward->speed() != speed) {
+        fast_forward = std::make_unique<FastForward>(speed);
+        fast_forward->start(clock->now());
+        // Pacing is up to FastForward, display() must not wait for vsync.
+        window.setFramerateLimit(0);
+      }
+      // Rewinding runs timers backwards, there is no drift to speak of.
+      double timeline_speed = rewinding ? FastForward::kUnbounded : speed;
+      if (show_overlay && timeline_speed != drift_speed) {
+        live_stats.restart_drift(clock->now(), timeline_speed);
+        drift_speed = timeline_speed;
+      }
+
+      if (netplay) {
+        trace::Span span("netplay");
+        double emulation_start = clock->now();
+        uint32_t frame = netplay->frame();
+        NetplaySession::Status status = netplay->advance(keys);
+        double emulation_end = clock->now();
+        live_stats.add_emulation(emulation_end - emulation_start,
+                                 netplay->frame() - frame);
+        latency.on_emulated(cpu.get(), emulation_end);
+        if (status == NetplaySession::Status::ERROR) {
+          finish_measuring();
+          return -1;
+        }
+        if (status == NetplaySession::Status::DESYNC) {
+          logging::log(logging::Level::ERROR,
+                       "Netplay desync detected around frame " +
+                           std::to_string(netplay->frame()));
+          finish_measuring();
+          return -1;
+        }
+        if (netplay->last_rollback() > 0) {
+          rollback_stats.add(netplay->last_rollback_cost());
+        }
+      } else if (rewinding) {
+        if (rewind_buffer.pop(cpu.get()) && recorder) {
+          recorder->drop_frame();
+        }
+      } else {
+        unsigned int frames =
+            fast_forward ? fast_forward->frames_to_run(clock->now()) : 1;
+        double emulation_start = clock->now();
+        trace::Span span("emulation");
+        for (unsigned int i = 0; i < frames; ++i) {
+          bool result;
+          if (recorder) {
+            result = recorder->run_frame(keys);
+          } else {
+            input.set_keys(keys);
+            result = cpu->run_frame();
+          }
+          if (!result) {
+            finish_recording();
+            finish_profiling();
+            finish_measuring();
+            return -1;
+          }
+          rewind_buffer.push(cpu.get());
+        }
+        double emulation_end = clock->now();
+        live_stats.add_emulation(emulation_end - emulation_start, frames);
+        latency.on_emulated(cpu.get(), emulation_end);
+        if (fast_forward) {
+          fast_forward->on_frames_run(frames, clock->now() - emulation_start);
+          if (!fast_forward->should_present(clock->now())) {
+            if (frames == 0) {
+              clock->sleep(0.001);
+            }
             goto loop;
           }
-          keyboard->on_key_pressed(event.key.code);
         }
       }
-      for (int i = 0; i < 10; ++i) {
-        if (!cpu->step()) {
-          return -1;
+      present_start = clock->now();
+      const FrameBuffer* shown = cpu->frame_buffer();
+      if (run_ahead && !rewinding) {
+        trace::Span span("run_ahead");
+        if (run_ahead->run(&future)) {
+          shown = &future;
+          run_ahead_stats.add(run_ahead->last_cost());
+          run_ahead_state_stats.add(run_ahead->last_state_cost());
+        }
+        double run_ahead_end = clock->now();
+        live_stats.add_emulation(run_ahead_end - present_start, 0);
+        latency.on_emulated(cpu.get(), run_ahead_end);
+      }
+      {
+        trace::Span span("draw");
+        double render_start = clock->now();
+        latency.on_draw(*shown, render_start);
+        shown->draw(&window);
+        if (show_overlay) {
+          overlay.update_graph(live_stats);
+          overlay.draw(&window);
+        }
+        live_stats.add_render(clock->now() - render_start);
+      }
+
+      if (present_start - stats_start >= kStatsInterval) {
+        if (run_ahead_stats.count() > 0) {
+          logging::log(logging::Level::INFO,
+                       "Run-ahead of " + std::to_string(run_ahead->frames()) +
+                           " frames: " + run_ahead_stats.summary() +
+                           "; saving and restoring: " +
+                           run_ahead_state_stats.summary());
+        }
+        if (rollback_stats.count() > 0) {
+          logging::log(logging::Level::INFO,
+                       "Netplay rollbacks: " + rollback_stats.summary());
+        }
+        run_ahead_stats.reset();
+        run_ahead_state_stats.reset();
+        rollback_stats.reset();
+        stats_start = present_start;
+      }
+    }
+
+    {
+      trace::Span span("display");
+      double display_start = clock->now();
+      window.display();
+      if (!in_menu) {
+        double presented = clock->now();
+        latency.on_display(presented);
+        metrics.on_presented(presented);
+        if (show_overlay) {
+          live_stats.add_display(presented - display_start);
+          if (live_stats.end_frame(presented, cpu->frames_run())) {
+            overlay.update_text(live_stats, fast_forward ? shown_speed : 1);
+          }
         }
       }
-      cpu->update_timers();
-      cpu->frame_buffer()->draw(&window);
     }
 
-    window.display();
+    if (fast_forward) {
+      double presented = clock->now();
+      fast_forward->on_presented(presented, presented - present_start);
+      if (fast_forward->effective_speed() != shown_speed) {
+        shown_speed = fast_forward->effective_speed();
+        std::ostringstream title;
+        title << kTitle << " - " << std::fixed << std::setprecision(1)
+              << shown_speed << "x";
+        window.setTitle(title.str());
+      }
+    }
   loop:;
   }
 
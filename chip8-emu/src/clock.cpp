@@ -0,0 +1,26 @@
+#include "src/clock.h"
+
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+SystemClock* SystemClock::get() {
+  static SystemClock clock;
+  return &clock;
+}
+
+double SystemClock::now() const {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void SystemClock::sleep(double seconds) {
+  if (seconds > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  }
+}
+
+uint32_t SystemClock::wall_time() const {
+  return static_cast<uint32_t>(std::time(nullptr));
+}
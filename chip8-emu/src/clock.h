@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// The source of time of everything that measures or waits for it. Provided
+// to allow injecting tests and batch jobs, which run on a VirtualClock so
+// that timing-dependent behavior is fast and reproducible.
+//
+// Times are in seconds, from an arbitrary origin.
+class Clock {
+ public:
+  virtual ~Clock() = default;
+
+  virtual double now() const = 0;
+
+  // Waits for |seconds|.
+  virtual void sleep(double seconds) = 0;
+
+  // The seconds since the Unix epoch, e.g. to seed a Random.
+  virtual uint32_t wall_time() const = 0;
+};
+
+// The time of the machine, from a monotonic clock.
+class SystemClock : public Clock {
+ public:
+  // A clock shared by everything not given one.
+  static SystemClock* get();
+
+  double now() const override;
+  void sleep(double seconds) override;
+  uint32_t wall_time() const override;
+};
+
+// Time that only passes when told to. sleep() returns at once, having
+// advanced the time by the amount slept.
+class VirtualClock : public Clock {
+ public:
+  explicit VirtualClock(double start = 0, uint32_t wall_time = 0)
+      : now_(start), wall_time_(wall_time) {}
+
+  double now() const override { return now_; }
+  void sleep(double seconds) override { advance(seconds); }
+  uint32_t wall_time() const override {
+    return wall_time_ + static_cast<uint32_t>(now_);
+  }
+
+  void advance(double seconds) {
+    if (seconds > 0) {
+      now_ += seconds;
+    }
+  }
+
+ private:
+  double now_;
+  const uint32_t wall_time_;
+};
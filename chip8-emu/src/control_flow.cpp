@@ -0,0 +1,387 @@
+#include "src/control_flow.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "src/disassembler.h"
+#include "src/execution_engine.h"
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+// The most entries of a jump table, as V0 adds at most 0xFF to its base.
+constexpr unsigned int kMaxJumpTableEntries = 0x80;
+
+// Whether an instruction fits at |address|, as the last byte of memory holds
+// no complete one.
+bool fits(uint32_t address) {
+  return address < Cpu::kMaxMemory;
+}
+
+uint16_t instruction_at(const uint8_t* memory, uint16_t address) {
+  return memory[address] << 8 | memory[address + 1];
+}
+
+// Returns the entries of the jump table at |base|, or |base| alone if there
+// is none.
+std::vector<uint16_t> jump_table(const uint8_t* memory, uint16_t base) {
+  std::vector<uint16_t> entries;
+  for (uint32_t address = base;
+       fits(address) && entries.size() < kMaxJumpTableEntries &&
+       opcode_class(instruction_at(memory, address)) == OpcodeClass::JP;
+       address += 2) {
+    entries.push_back(address);
+  }
+  if (entries.empty()) {
+    entries.push_back(base);
+  }
+  return entries;
+}
+
+// Returns where execution may go after the branch at |address| within its
+// routine, i.e. not into the routine a call calls.
+std::vector<uint16_t> branch_targets(const uint8_t* memory,
+                                     uint16_t address) {
+  uint16_t instruction = instruction_at(memory, address);
+  uint16_t nnn = instruction & 0xfff;
+  std::vector<uint16_t> targets;
+  switch (opcode_class(instruction)) {
+    case OpcodeClass::JP:
+      targets = {nnn};
+      break;
+    case OpcodeClass::CALL:
+      targets = {static_cast<uint16_t>(address + 2)};
+      break;
+    case OpcodeClass::JP_V0:
+      targets = jump_table(memory, nnn);
+      break;
+    case OpcodeClass::RET:
+      break;
+    default:
+      targets = {static_cast<uint16_t>(address + 2),
+                 static_cast<uint16_t>(address + 4)};
+      break;
+  }
+  targets.erase(std::remove_if(targets.begin(), targets.end(),
+                               [](uint16_t target) { return !fits(target); }),
+                targets.end());
+  return targets;
+}
+
+// Copies the memory of |cpu|, for the graph to be built from.
+std::vector<uint8_t> memory_of(const Cpu& cpu) {
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  for (unsigned int address = 0; address <= Cpu::kMaxMemory; ++address) {
+    memory[address] = cpu.peek(address);
+  }
+  return memory;
+}
+
+ControlFlowGraph rom_graph(const Cpu& cpu, const uint8_t* memory) {
+  return build_control_flow_graph(memory, Cpu::kMinAddressableMemory,
+                                  Cpu::kMinAddressableMemory + cpu.rom_size());
+}
+
+std::string block_name(uint16_t address) {
+  return "block_" + tohex(address, 3).substr(2);
+}
+
+}  // namespace
+
+const ControlFlowGraph::BasicBlock* ControlFlowGraph::block_at(
+    uint16_t address) const {
+  auto it = std::lower_bound(
+      blocks.begin(), blocks.end(), address,
+      [](const BasicBlock& block, uint16_t start) {
+        return block.start < start;
+      });
+  return it != blocks.end() && it->start == address ? &*it : nullptr;
+}
+
+std::vector<std::pair<uint16_t, uint16_t>> ControlFlowGraph::data_ranges()
+    const {
+  std::vector<std::pair<uint16_t, uint16_t>> ranges;
+  for (uint32_t address = begin; address < end; ++address) {
+    if (code[address]) {
+      continue;
+    }
+    if (!ranges.empty() && ranges.back().second == address) {
+      ++ranges.back().second;
+    } else {
+      ranges.push_back({address, address + 1});
+    }
+  }
+  return ranges;
+}
+
+ControlFlowGraph build_control_flow_graph(const uint8_t* memory,
+                                          uint16_t begin, uint16_t end) {
+  ControlFlowGraph graph;
+  graph.begin = begin;
+  graph.end = std::min<uint32_t>(end, Cpu::kMaxMemory + 1);
+  if (!fits(begin)) {
+    return graph;
+  }
+
+  // Marks the instructions reached, and those that start a block, going on
+  // from each until a branch.
+  std::bitset<Cpu::kMaxMemory + 1> instructions;
+  std::bitset<Cpu::kMaxMemory + 1> leaders;
+  std::bitset<Cpu::kMaxMemory + 1> entries;
+  std::vector<uint16_t> pending = {begin};
+  leaders[begin] = true;
+  entries[begin] = true;
+  while (!pending.empty()) {
+    uint32_t address = pending.back();
+    pending.pop_back();
+    for (; fits(address) && !instructions[address]; address += 2) {
+      instructions[address] = true;
+      graph.code[address] = true;
+      graph.code[address + 1] = true;
+      uint16_t instruction = instruction_at(memory, address);
+      if (opcode_class(instruction) == OpcodeClass::UNKNOWN) {
+        break;
+      }
+      if (!is_branch(instruction)) {
+        continue;
+      }
+      std::vector<uint16_t> targets = branch_targets(memory, address);
+      if (opcode_class(instruction) == OpcodeClass::CALL &&
+          fits(instruction & 0xfff)) {
+        targets.push_back(instruction & 0xfff);
+        entries[instruction & 0xfff] = true;
+      }
+      for (uint16_t target : targets) {
+        leaders[target] = true;
+        pending.push_back(target);
+      }
+      break;
+    }
+  }
+
+  // Splits the instructions into blocks at the leaders.
+  for (uint32_t start = 0; start <= Cpu::kMaxMemory; ++start) {
+    if (!leaders[start] || !instructions[start]) {
+      continue;
+    }
+    ControlFlowGraph::BasicBlock block;
+    block.start = start;
+    uint32_t address = start;
+    for (;; address += 2) {
+      uint16_t instruction = instruction_at(memory, address);
+      OpcodeClass opcode_class = ::opcode_class(instruction);
+      if (opcode_class == OpcodeClass::UNKNOWN) {
+        block.invalid = true;
+        graph.invalid_instructions.push_back(address);
+        break;
+      }
+      if (is_branch(instruction)) {
+        block.successors = branch_targets(memory, address);
+        if (opcode_class == OpcodeClass::CALL && fits(instruction & 0xfff)) {
+          block.callee = instruction & 0xfff;
+        }
+        block.computed_jump = opcode_class == OpcodeClass::JP_V0;
+        block.returns = opcode_class == OpcodeClass::RET;
+        break;
+      }
+      if (!fits(address + 2) || !instructions[address + 2]) {
+        break;
+      }
+      if (leaders[address + 2]) {
+        block.successors = {static_cast<uint16_t>(address + 2)};
+        break;
+      }
+    }
+    block.end = address + 2;
+    graph.blocks.push_back(std::move(block));
+  }
+
+  // Collects the routines each routine calls, going through its blocks up to
+  // the entries of other routines.
+  std::vector<int> block_index(Cpu::kMaxMemory + 1, -1);
+  for (size_t i = 0; i < graph.blocks.size(); ++i) {
+    block_index[graph.blocks[i].start] = static_cast<int>(i);
+  }
+  std::vector<uint16_t> starts;
+  for (uint32_t entry = 0; entry <= Cpu::kMaxMemory; ++entry) {
+    if (!entries[entry]) {
+      continue;
+    }
+    ControlFlowGraph::Routine routine;
+    routine.entry = entry;
+    std::bitset<Cpu::kMaxMemory + 1> visited;
+    starts = {routine.entry};
+    visited[entry] = true;
+    while (!starts.empty()) {
+      int index = block_index[starts.back()];
+      starts.pop_back();
+      if (index < 0) {
+        continue;
+      }
+      const ControlFlowGraph::BasicBlock& block = graph.blocks[index];
+      if (block.callee) {
+        routine.callees.push_back(*block.callee);
+      }
+      for (uint16_t successor : block.successors) {
+        if (entries[successor] && successor != entry) {
+          routine.callees.push_back(successor);
+        } else if (!visited[successor]) {
+          visited[successor] = true;
+          starts.push_back(successor);
+        }
+      }
+    }
+    std::vector<uint16_t>& callees = routine.callees;
+    std::sort(callees.begin(), callees.end());
+    callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+    graph.routines.push_back(std::move(routine));
+  }
+  // The entry point comes first.
+  std::stable_partition(graph.routines.begin(), graph.routines.end(),
+                        [begin](const ControlFlowGraph::Routine& routine) {
+                          return routine.entry == begin;
+                        });
+  return graph;
+}
+
+std::string to_text(const ControlFlowGraph& graph, const uint8_t* memory) {
+  std::ostringstream out;
+  out << "Blocks:\n";
+  for (const ControlFlowGraph::BasicBlock& block : graph.blocks) {
+    out << "\n" << tohex(block.start, 3) << "-" << tohex(block.end, 3);
+    if (!block.successors.empty()) {
+      out << " ->";
+      for (size_t i = 0; i < block.successors.size(); ++i) {
+        out << (i ? ", " : " ") << tohex(block.successors[i], 3);
+      }
+    }
+    if (block.callee) {
+      out << " (calls " << tohex(*block.callee, 3) << ")";
+    }
+    if (block.computed_jump) {
+      out << " (computed)";
+    }
+    out << "\n";
+    for (uint32_t address = block.start; address < block.end; address += 2) {
+      uint16_t instruction = instruction_at(memory, address);
+      out << "  " << tohex(address, 3) << "  " << tohex(instruction).substr(2)
+          << "  " << disassemble(instruction) << "\n";
+    }
+  }
+
+  out << "\nData:\n";
+  for (const auto& [first, last] : graph.data_ranges()) {
+    out << "  " << tohex(first, 3) << "-" << tohex(last, 3) << "\n";
+  }
+
+  out << "\nRoutines:\n";
+  for (const ControlFlowGraph::Routine& routine : graph.routines) {
+    out << "  " << tohex(routine.entry, 3);
+    for (size_t i = 0; i < routine.callees.size(); ++i) {
+      out << (i ? ", " : " calls ") << tohex(routine.callees[i], 3);
+    }
+    out << "\n";
+  }
+
+  if (!graph.invalid_instructions.empty()) {
+    out << "\nInvalid instructions:\n";
+    for (uint16_t address : graph.invalid_instructions) {
+      out << "  " << tohex(address, 3) << "  "
+          << disassemble(instruction_at(memory, address)) << "\n";
+    }
+  }
+  return out.str();
+}
+
+std::string to_dot(const ControlFlowGraph& graph, const uint8_t* memory) {
+  std::ostringstream out;
+  out << "digraph chip8 {\n"
+      << "  node [shape=box, fontname=\"monospace\"];\n";
+  for (const ControlFlowGraph::BasicBlock& block : graph.blocks) {
+    out << "  " << block_name(block.start) << " [label=\"";
+    for (uint32_t address = block.start; address < block.end; address += 2) {
+      out << tohex(address, 3) << ": "
+          << disassemble(instruction_at(memory, address)) << "\\l";
+    }
+    out << "\"" << (block.invalid ? ", color=red" : "") << "];\n";
+  }
+  for (const ControlFlowGraph::BasicBlock& block : graph.blocks) {
+    for (uint16_t successor : block.successors) {
+      out << "  " << block_name(block.start) << " -> "
+          << block_name(successor) << ";\n";
+    }
+    if (block.callee) {
+      out << "  " << block_name(block.start) << " -> "
+          << block_name(*block.callee) << " [style=dashed];\n";
+    }
+  }
+  out << "}\n";
+  return out.str();
+}
+
+bool save_control_flow_graph(const Cpu& cpu, const std::string& path) {
+  std::vector<uint8_t> memory = memory_of(cpu);
+  ControlFlowGraph graph = rom_graph(cpu, memory.data());
+  bool dot = path.size() >= 4 && path.compare(path.size() - 4, 4, ".dot") == 0;
+  std::ofstream file(path);
+  file << (dot ? to_dot(graph, memory.data()) : to_text(graph, memory.data()));
+  if (!file) {
+    logging::log(logging::Level::ERROR,
+                 "Could not write the control flow graph to " + path);
+    return false;
+  }
+  logging::log(logging::Level::INFO,
+               "Control flow graph written to " + path);
+  return true;
+}
+
+bool parse_validation(const std::string& name, Validation* validation) {
+  if (name == "warn") {
+    *validation = Validation::WARN;
+  } else if (name == "strict") {
+    *validation = Validation::STRICT;
+  } else {
+    logging::log(logging::Level::ERROR,
+                 "Unknown validation " + name + ", expected warn or strict");
+    return false;
+  }
+  return true;
+}
+
+bool validate_rom(Cpu* cpu, ExecutionEngine* engine, Validation validation) {
+  if (validation == Validation::STRICT && cpu->rom_truncated()) {
+    logging::log(logging::Level::ERROR,
+                 "Refusing the ROM, as it does not fit in memory");
+    return false;
+  }
+  std::vector<uint8_t> memory = memory_of(*cpu);
+  ControlFlowGraph graph = rom_graph(*cpu, memory.data());
+  for (uint16_t address : graph.invalid_instructions) {
+    uint16_t instruction = instruction_at(memory.data(), address);
+    logging::log(logging::Level::WARN,
+                 "Instruction " + tohex(instruction) + " at " +
+                     tohex(address, 3) + " may be reached but does not decode");
+  }
+  size_t data = 0;
+  for (const auto& [first, last] : graph.data_ranges()) {
+    data += last - first;
+  }
+  logging::log(logging::Level::INFO,
+               "Found " + std::to_string(graph.blocks.size()) +
+                   " blocks in " + std::to_string(graph.routines.size()) +
+                   " routines, and " + std::to_string(data) + " of " +
+                   std::to_string(cpu->rom_size()) +
+                   " bytes of the ROM that never run");
+  if (validation == Validation::STRICT && !graph.invalid_instructions.empty()) {
+    logging::log(logging::Level::ERROR,
+                 "Refusing the ROM, as it may run instructions that do not "
+                 "decode");
+    return false;
+  }
+  if (engine) {
+    engine->prepare(cpu, graph);
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/cpu.h"
+
+class ExecutionEngine;
+
+// The code of a ROM, found by recursive descent: following jumps, calls,
+// returns to the instruction after each call and both outcomes of skips from
+// the entry point, rather than decoding every word of the ROM, so that the
+// data between routines is not taken for code.
+struct ControlFlowGraph {
+  // A straight run of instructions, entered only at its start. Every branch
+  // ends one, as in the execution engines, so that each starts where one of
+  // their blocks does.
+  struct BasicBlock {
+    uint16_t start = 0;
+    // Past its last instruction.
+    uint16_t end = 0;
+    // Where execution may go on to within the routine: the targets of its
+    // last instruction, the instruction after a call, or the next block.
+    std::vector<uint16_t> successors;
+    // The routine it calls, if it ends with a call.
+    std::optional<uint16_t> callee;
+    // Whether it ends with a computed jump (Bnnn), whose successors are
+    // guessed, see build_control_flow_graph().
+    bool computed_jump = false;
+    // Whether it ends with a return.
+    bool returns = false;
+    // Whether it ends with an instruction that does not decode, where
+    // execution would fail.
+    bool invalid = false;
+  };
+
+  // The entry point, or a routine called, and the routines it calls. Jumping
+  // or running into the entry of another counts as calling it, as the code
+  // from there is that routine's.
+  struct Routine {
+    uint16_t entry = 0;
+    std::vector<uint16_t> callees;
+  };
+
+  // The ROM, which the code map covers, from |begin| to |end|.
+  uint16_t begin = 0;
+  uint16_t end = 0;
+  // In order of their start.
+  std::vector<BasicBlock> blocks;
+  // In order of their entry, the entry point first.
+  std::vector<Routine> routines;
+  // The bytes of memory holding instructions reached.
+  std::bitset<Cpu::kMaxMemory + 1> code;
+  // The instructions that do not decode, in order of their address.
+  std::vector<uint16_t> invalid_instructions;
+
+  // Returns the block starting at |address|, or nullptr if none does.
+  const BasicBlock* block_at(uint16_t address) const;
+
+  // Returns the ranges of bytes of the ROM that are not code, as the first
+  // byte and the byte past the last of each.
+  std::vector<std::pair<uint16_t, uint16_t>> data_ranges() const;
+};
+
+// Builds the control flow graph of the ROM loaded from |begin| to |end| in
+// |memory|, entered at |begin|. Computed jumps are taken to index jump
+// tables: the run of jumps (1nnn) from their base address, each of which is
+// a successor, or the base address alone if there is none.
+ControlFlowGraph build_control_flow_graph(const uint8_t* memory,
+                                          uint16_t begin, uint16_t end);
+
+// Returns |graph| as text, with each block disassembled from |memory|, the
+// data ranges, the routines and the instructions that do not decode.
+std::string to_text(const ControlFlowGraph& graph, const uint8_t* memory);
+
+// Returns |graph| in the DOT language of Graphviz, with a node per block
+// disassembled from |memory|, solid edges to successors and dashed ones to
+// the routines called.
+std::string to_dot(const ControlFlowGraph& graph, const uint8_t* memory);
+
+// Writes the graph of the ROM loaded in |cpu| to |path|, in DOT if it ends
+// with ".dot" and as text otherwise. Returns false, after logging why, if it
+// could not.
+bool save_control_flow_graph(const Cpu& cpu, const std::string& path);
+
+// How ROMs are checked once loaded, with --validate.
+enum class Validation {
+  // Warns about the instructions reached that do not decode.
+  WARN,
+  // Also refuses ROMs with any, and those too large for memory.
+  STRICT,
+};
+
+// Parses "warn" or "strict" into |validation|. Returns false, after logging
+// why, if it is neither.
+bool parse_validation(const std::string& name, Validation* validation);
+
+// Builds the graph of the ROM loaded in |cpu|, warns about the instructions
+// reached that do not decode, and logs how much of the ROM is code, so that
+// a broken ROM is found before it runs into one. Then has |engine|, if any,
+// decode or translate the code found ahead of time, see
+// ExecutionEngine::prepare(). Returns false, after logging why, if
+// |validation| is STRICT and the ROM did not fit in memory or there are
+// instructions that do not decode.
+bool validate_rom(Cpu* cpu, ExecutionEngine* engine, Validation validation);
@@ -1,15 +1,41 @@
 #include "src/cpu.h"
 
+#include <cstring>
 #include <fstream>
 
+#include "src/execution_engine.h"
 #include "src/font_set.h"
 #include "src/logging.h"
+#include "src/profiler.h"
+#include "src/trace.h"
 #include "src/util.h"
 
+static_assert(Cpu::kCacheLines <= 64,
+              "The dirty line bitmap must fit in a uint64_t");
+
+uint64_t Cpu::State::hash() const {
+  uint64_t hash = fnv1a(registers.v, sizeof(registers.v));
+  hash = fnv1a(&registers.index, sizeof(registers.index), hash);
+  hash = fnv1a(registers.stack, sizeof(registers.stack), hash);
+  hash = fnv1a(&registers.sp, sizeof(registers.sp), hash);
+  hash = fnv1a(&registers.delay, sizeof(registers.delay), hash);
+  hash = fnv1a(&registers.sound, sizeof(registers.sound), hash);
+  hash = fnv1a(&registers.pc, sizeof(registers.pc), hash);
+  hash = fnv1a(&registers.waiting_for_key_press,
+               sizeof(registers.waiting_for_key_press), hash);
+  hash = fnv1a(&registers.key_store_register,
+               sizeof(registers.key_store_register), hash);
+  hash = fnv1a(memory, sizeof(memory), hash);
+  uint64_t frame_buffer_hash = frame_buffer.hash();
+  hash = fnv1a(&frame_buffer_hash, sizeof(frame_buffer_hash), hash);
+  return fnv1a(&random_state, sizeof(random_state), hash);
+}
+
 Cpu::Cpu(Random* random, Keyboard* keyboard)
     : random_(random),
       keyboard_(keyboard),
       buffer_(std::make_unique<FrameBuffer>()) {
+  registers_.pc = kMinAddressableMemory;
   keyboard_->add_observer(this);
   for (int i = 0; i < kFontSet.size(); ++i) {
     memory_[i] = kFontSet[i];
@@ -30,16 +56,43 @@ void Cpu::set_memory(uint16_t address, uint8_t byte) {
                  "Attempted to set memory exceeding " + kMaxMemory);
     return;
   }
-  memory_[address] = byte;
+  write_memory(address, byte);
+}
+
+void Cpu::save_state(State* state) const {
+  state->registers = registers_;
+  std::memcpy(state->memory, memory_, sizeof(memory_));
+  state->frame_buffer = *buffer_;
+  state->dirty_lines = dirty_lines_;
+  state->random_state = random_->state();
+}
+
+void Cpu::load_state(const State& state) {
+  registers_ = state.registers;
+  // Only the lines that differ are written, so that the engine keeps what it
+  // translated from the others, as states are loaded every frame when
+  // running ahead or rolling back.
+  for (unsigned int line = 0; line < kCacheLines; ++line) {
+    size_t offset = line * kCacheLineSize;
+    if (std::memcmp(memory_ + offset, state.memory + offset,
+                    kCacheLineSize) != 0) {
+      written_lines_ |= 1ull << line;
+    }
+  }
+  std::memcpy(memory_, state.memory, sizeof(memory_));
+  *buffer_ = state.frame_buffer;
+  dirty_lines_ = state.dirty_lines;
+  random_->set_state(state.random_state);
 }
 
 bool Cpu::execute(uint16_t instruction) {
-  if (waiting_for_key_press_) {
+  if (registers_.waiting_for_key_press) {
     logging::log(
         logging::Level::ERROR,
         "Attempted to execute an instruction while waiting for a key press");
     return false;
   }
+  uint8_t* v = registers_.v;
 
   // 00e0 - CLS.
   if (instruction == 0x00e0) {
@@ -48,12 +101,12 @@ bool Cpu::execute(uint16_t instruction) {
   }
   // 00ee - RET.
   if (instruction == 0x00ee) {
-    if (sp_ <= 0) {
+    if (registers_.sp <= 0) {
       logging::log(logging::Level::ERROR, "Stack underflow");
       return false;
     }
-    --sp_;
-    pc_ = stack_[sp_];
+    --registers_.sp;
+    registers_.pc = registers_.stack[registers_.sp];
     return true;
   }
   // 0nnn - SYS addr.
@@ -63,202 +116,208 @@ bool Cpu::execute(uint16_t instruction) {
   }
   // 1nnn - JP addr.
   if (instruction >> 12 == 0x1) {
-    pc_ = (instruction & 0xfff) - 2;
+    registers_.pc = (instruction & 0xfff) - 2;
     return true;
   }
   // 2nnn - CALL addr.
   if (instruction >> 12 == 0x2) {
-    if (sp_ >= kStackSize) {
+    if (registers_.sp >= kStackSize) {
       logging::log(logging::Level::ERROR, "Stack overflow");
       return false;
     }
-    stack_[sp_] = pc_;
-    ++sp_;
-    pc_ = (instruction & 0xfff) - 2;
+    registers_.stack[registers_.sp] = registers_.pc;
+    ++registers_.sp;
+    registers_.pc = (instruction & 0xfff) - 2;
     return true;
   }
   // 3xkk - SE Vx, byte.
   if (instruction >> 12 == 0x3) {
-    if (v_[(instruction & 0xf00) >> 8] == (instruction & 0x0ff)) {
-      pc_ += 2;
+    if (v[(instruction & 0xf00) >> 8] == (instruction & 0x0ff)) {
+      registers_.pc += 2;
     }
     return true;
   }
   // 4xkk - SNE Vx, byte.
   if (instruction >> 12 == 0x4) {
-    if (v_[(instruction & 0xf00) >> 8] != (instruction & 0x0ff)) {
-      pc_ += 2;
+    if (v[(instruction & 0xf00) >> 8] != (instruction & 0x0ff)) {
+      registers_.pc += 2;
     }
     return true;
   }
   // 5xy0 - SE Vx, Vy.
   if (instruction >> 12 == 0x5 && (instruction & 0xf) == 0) {
-    if (v_[(instruction & 0xf00) >> 8] == v_[(instruction & 0x0f0) >> 4]) {
-      pc_ += 2;
+    if (v[(instruction & 0xf00) >> 8] == v[(instruction & 0x0f0) >> 4]) {
+      registers_.pc += 2;
     }
     return true;
   }
   // 6xkk - LD Vx, byte.
   if (instruction >> 12 == 0x6) {
-    v_[(instruction & 0xf00) >> 8] = instruction & 0x0ff;
+    v[(instruction & 0xf00) >> 8] = instruction & 0x0ff;
     return true;
   }
   // 7xkk - ADD Vx, byte.
   if (instruction >> 12 == 0x7) {
-    v_[(instruction & 0xf00) >> 8] += instruction & 0x0ff;
+    v[(instruction & 0xf00) >> 8] += instruction & 0x0ff;
     return true;
   }
   // 8xy0 - LD Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0) {
-    v_[(instruction & 0xf00) >> 8] = v_[(instruction & 0x0f0) >> 4];
+    v[(instruction & 0xf00) >> 8] = v[(instruction & 0x0f0) >> 4];
     return true;
   }
   // 8xy1 - OR Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x1) {
-    v_[(instruction & 0xf00) >> 8] |= v_[(instruction & 0x0f0) >> 4];
+    v[(instruction & 0xf00) >> 8] |= v[(instruction & 0x0f0) >> 4];
     return true;
   }
   // 8xy2 - AND Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x2) {
-    v_[(instruction & 0xf00) >> 8] &= v_[(instruction & 0x0f0) >> 4];
+    v[(instruction & 0xf00) >> 8] &= v[(instruction & 0x0f0) >> 4];
     return true;
   }
   // 8xy3 - XOR Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x3) {
-    v_[(instruction & 0xf00) >> 8] ^= v_[(instruction & 0x0f0) >> 4];
+    v[(instruction & 0xf00) >> 8] ^= v[(instruction & 0x0f0) >> 4];
     return true;
   }
   // 8xy4 - ADD Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x4) {
-    uint16_t right = v_[(instruction & 0x0f0) >> 4];
-    uint16_t left = v_[(instruction & 0xf00) >> 8];
-    v_[(instruction & 0xf00) >> 8] += right;
-    v_[0xf] = left + right > 0x00ff;
+    uint16_t right = v[(instruction & 0x0f0) >> 4];
+    uint16_t left = v[(instruction & 0xf00) >> 8];
+    v[(instruction & 0xf00) >> 8] += right;
+    v[0xf] = left + right > 0x00ff;
     return true;
   }
   // 8xy5 - SUB Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x5) {
-    uint16_t right = v_[(instruction & 0x0f0) >> 4];
-    bool no_borrow = v_[(instruction & 0xf00) >> 8] > right;
-    v_[(instruction & 0xf00) >> 8] -= right;
-    v_[0xf] = no_borrow;
+    uint16_t right = v[(instruction & 0x0f0) >> 4];
+    bool no_borrow = v[(instruction & 0xf00) >> 8] > right;
+    v[(instruction & 0xf00) >> 8] -= right;
+    v[0xf] = no_borrow;
     return true;
   }
   // 8xy6 - SHR Vx {, Vy}.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x6) {
-    bool last_bit = v_[(instruction & 0xf00) >> 8] & 1;
-    v_[(instruction & 0xf00) >> 8] >>= 1;
-    v_[0xf] = last_bit;
+    bool last_bit = v[(instruction & 0xf00) >> 8] & 1;
+    v[(instruction & 0xf00) >> 8] >>= 1;
+    v[0xf] = last_bit;
     return true;
   }
   // 8xy7 - SUBN Vx, Vy.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0x7) {
-    uint16_t right = v_[(instruction & 0x0f0) >> 4];
-    bool no_borrow = right > v_[(instruction & 0xf00) >> 8];
-    v_[(instruction & 0xf00) >> 8] = right - v_[(instruction & 0xf00) >> 8];
-    v_[0xf] = no_borrow;
+    uint16_t right = v[(instruction & 0x0f0) >> 4];
+    bool no_borrow = right > v[(instruction & 0xf00) >> 8];
+    v[(instruction & 0xf00) >> 8] = right - v[(instruction & 0xf00) >> 8];
+    v[0xf] = no_borrow;
     return true;
   }
   // 8xyE - SHL Vx {, Vy}.
   if (instruction >> 12 == 0x8 && (instruction & 0xf) == 0xe) {
-    bool first_bit = (v_[(instruction & 0xf00) >> 8] >> 7) & 1;
-    v_[(instruction & 0xf00) >> 8] <<= 1;
-    v_[0xf] = first_bit;
+    bool first_bit = (v[(instruction & 0xf00) >> 8] >> 7) & 1;
+    v[(instruction & 0xf00) >> 8] <<= 1;
+    v[0xf] = first_bit;
     return true;
   }
   // 9xy0 - SNE Vx, Vy.
   if (instruction >> 12 == 0x9 && (instruction & 0xf) == 0) {
-    if (v_[(instruction & 0xf00) >> 8] != v_[(instruction & 0x0f0) >> 4]) {
-      pc_ += 2;
+    if (v[(instruction & 0xf00) >> 8] != v[(instruction & 0x0f0) >> 4]) {
+      registers_.pc += 2;
     }
     return true;
   }
   // annn - LD I, addr.
   if (instruction >> 12 == 0xa) {
-    index_ = instruction & 0xfff;
+    registers_.index = instruction & 0xfff;
     return true;
   }
   // bnnn - JP V0, addr.
   if (instruction >> 12 == 0xb) {
-    pc_ = (instruction & 0xfff) + v_[0] - 2;
+    registers_.pc = (instruction & 0xfff) + v[0] - 2;
     return true;
   }
   // Cxkk - RND Vx, byte.
   if (instruction >> 12 == 0xc) {
-    v_[(instruction & 0xf00) >> 8] = random_->rand() & (instruction & 0xff);
+    v[(instruction & 0xf00) >> 8] = random_->rand() & (instruction & 0xff);
     return true;
   }
   // Dxyn - DRW Vx, Vy, nibble.
   if (instruction >> 12 == 0xd) {
-    uint8_t x = v_[(instruction & 0xf00) >> 8];
-    uint8_t y = v_[(instruction & 0x0f0) >> 4];
+    uint8_t x = v[(instruction & 0xf00) >> 8];
+    uint8_t y = v[(instruction & 0x0f0) >> 4];
     bool erased = false;
     for (size_t i = 0; i < (instruction & 0xf); ++i) {
-      if (buffer_->paint(x, y + i, memory_[index_ + i])) {
+      uint8_t row = memory_[(registers_.index + i) & kMaxMemory];
+      if (buffer_->paint(x, y + i, row)) {
         erased = true;
       }
     }
-    v_[0xf] = erased;
+    v[0xf] = erased;
     return true;
   }
   // Ex9E - SKP Vx.
   if (instruction >> 12 == 0xe && (instruction & 0xff) == 0x9e) {
-    if (keyboard_->is_key_pressed(v_[(instruction & 0xf00) >> 8])) {
-      pc_ += 2;
+    uint8_t key = v[(instruction & 0xf00) >> 8];
+    if (keyboard_->is_key_pressed(key)) {
+      observed_keys_ |= 1 << (key & 0xf);
+      registers_.pc += 2;
     }
     return true;
   }
   // ExA1 - SKNP Vx.
   if (instruction >> 12 == 0xe && (instruction & 0xff) == 0xa1) {
-    if (!keyboard_->is_key_pressed(v_[(instruction & 0xf00) >> 8])) {
-      pc_ += 2;
+    uint8_t key = v[(instruction & 0xf00) >> 8];
+    if (keyboard_->is_key_pressed(key)) {
+      observed_keys_ |= 1 << (key & 0xf);
+    } else {
+      registers_.pc += 2;
     }
     return true;
   }
   // Fx07 - LD Vx, DT.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x07) {
-    v_[(instruction & 0xf00) >> 8] = delay_;
+    v[(instruction & 0xf00) >> 8] = registers_.delay;
     return true;
   }
   // Fx0A - LD Vx, K.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x0a) {
-    key_store_register_ = (instruction & 0xf00) >> 8;
-    waiting_for_key_press_ = true;
+    registers_.key_store_register = (instruction & 0xf00) >> 8;
+    registers_.waiting_for_key_press = true;
     return true;
   }
   // Fx15 - LD DT, Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x15) {
-    delay_ = v_[(instruction & 0xf00) >> 8];
+    registers_.delay = v[(instruction & 0xf00) >> 8];
     return true;
   }
   // Fx18 - LD ST, Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x18) {
-    sound_ = v_[(instruction & 0xf00) >> 8];
+    registers_.sound = v[(instruction & 0xf00) >> 8];
     return true;
   }
   // Fx1E - ADD I, Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x1e) {
-    index_ += v_[(instruction & 0xf00) >> 8];
+    registers_.index += v[(instruction & 0xf00) >> 8];
     return true;
   }
   // Fx29 - LD F, Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x29) {
-    index_ += v_[(instruction & 0xf00) >> 8] * 5;
+    registers_.index += v[(instruction & 0xf00) >> 8] * 5;
     return true;
   }
   // Fx33 - LD B, Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x33) {
-    uint8_t value = v_[(instruction & 0xf00) >> 8];
-    memory_[index_] = value / 100;
-    memory_[index_ + 1] = (value / 10) % 10;
-    memory_[index_ + 2] = value % 10;
+    uint8_t value = v[(instruction & 0xf00) >> 8];
+    write_memory(registers_.index, value / 100);
+    write_memory(registers_.index + 1, (value / 10) % 10);
+    write_memory(registers_.index + 2, value % 10);
     return true;
   }
   // Fx55 - LD [I], Vx.
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x55) {
     uint8_t registers = (instruction & 0xf00) >> 8;
     for (uint8_t reg = 0; reg <= registers; ++reg) {
-      memory_[index_++] = v_[reg];
+      write_memory(registers_.index++, v[reg]);
     }
     return true;
   }
@@ -266,7 +325,7 @@ bool Cpu::execute(uint16_t instruction) {
   if (instruction >> 12 == 0xf && (instruction & 0xff) == 0x65) {
     uint8_t registers = (instruction & 0xf00) >> 8;
     for (uint8_t reg = 0; reg <= registers; ++reg) {
-      v_[reg] = memory_[index_++];
+      v[reg] = memory_[registers_.index++ & kMaxMemory];
     }
     return true;
   }
@@ -277,25 +336,63 @@ bool Cpu::execute(uint16_t instruction) {
 }
 
 bool Cpu::step() {
-  if (waiting_for_key_press_) {
+  if (registers_.waiting_for_key_press) {
     return true;
   }
-  bool result = execute((static_cast<uint16_t>(memory_[pc_] << 8) | memory_[pc_ + 1]));
+  uint16_t instruction =
+      static_cast<uint16_t>(memory_[registers_.pc & kMaxMemory] << 8) |
+      memory_[(registers_.pc + 1) & kMaxMemory];
+  if (profiler_ && profiler_->tick()) {
+    profiler_->sample(*this, instruction);
+  }
+  if (instruction_counts_) {
+    ++(*instruction_counts_)[instruction];
+  }
+  bool result = execute(instruction);
   if (result) {
-    pc_ += 2;
+    registers_.pc += 2;
   }
   return result;
 }
 
 void Cpu::update_timers() {
-  if (sound_ > 0) {
-    --sound_;
+  if (registers_.sound > 0) {
+    --registers_.sound;
   }
-  if (delay_ > 0) {
-    --delay_;
+  if (registers_.delay > 0) {
+    --registers_.delay;
   }
 }
 
+bool Cpu::run(unsigned int instructions) {
+  if (engine_ && !profiler_) {
+    return engine_->run(this, instructions);
+  }
+  for (unsigned int i = 0; i < instructions; ++i) {
+    if (!step()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Cpu::run_frame() {
+  {
+    trace::Span span("instructions");
+    if (!run(kInstructionsPerFrame)) {
+      return false;
+    }
+  }
+  end_frame();
+  return true;
+}
+
+void Cpu::end_frame() {
+  trace::Span span("update_timers");
+  update_timers();
+  ++frames_run_;
+}
+
 bool Cpu::load(const std::string& path) {
   std::ifstream file(path, std::ifstream::binary);
   if (!file) {
@@ -306,21 +403,42 @@ bool Cpu::load(const std::string& path) {
   int length = file.tellg();
   file.seekg(0, file.beg);
 
-  const int kMaxRead = kMaxMemory - kMinAddressableMemory;
-  if (length > kMaxRead) {
+  const int kMaxRead = kMaxMemory + 1 - kMinAddressableMemory;
+  rom_truncated_ = length > kMaxRead;
+  if (rom_truncated_) {
     logging::log(logging::Level::WARN,
                  "File " + path + " exceeds maximum size, ignoring last bytes");
   }
-  file.read((char*)(memory_) + kMinAddressableMemory, kMaxMemory);
+  file.read((char*)(memory_) + kMinAddressableMemory, kMaxRead);
+  dirty_lines_ = ~0ull;
+  written_lines_ = ~0ull;
+  rom_size_ = static_cast<uint16_t>(file.gcount());
+  rom_hash_ = fnv1a(memory_ + kMinAddressableMemory, rom_size_);
   logging::log(logging::Level::INFO, "File " + path + " loaded successfully");
-  pc_ = kMinAddressableMemory;
+  registers_.pc = kMinAddressableMemory;
   return true;
 }
 
+void Cpu::set_engine(ExecutionEngine* engine) {
+  if (engine != engine_) {
+    engine_ = engine;
+    written_lines_ = ~0ull;
+  }
+}
+
+void Cpu::write_memory(uint16_t address, uint8_t byte) {
+  address &= kMaxMemory;
+  memory_[address] = byte;
+  uint64_t line = 1ull << ((address / kCacheLineSize) % kCacheLines);
+  dirty_lines_ |= line;
+  written_lines_ |= line;
+}
+
 void Cpu::on_key_pressed(uint8_t key) {
-  if (!waiting_for_key_press_) {
+  if (!registers_.waiting_for_key_press) {
     return;
   }
-  v_[key_store_register_] = key;
-  waiting_for_key_press_ = false;
+  registers_.v[registers_.key_store_register] = key;
+  registers_.waiting_for_key_press = false;
+  observed_keys_ |= 1 << (key & 0xf);
 }
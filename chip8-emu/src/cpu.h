@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
 
@@ -7,6 +8,9 @@
 #include "src/keyboard.h"
 #include "src/random.h"
 
+class ExecutionEngine;
+class Profiler;
+
 // A CHIP-8 complete CPU.
 class Cpu : Keyboard::KeyboardObserver {
  public:
@@ -19,6 +23,46 @@ class Cpu : Keyboard::KeyboardObserver {
   // The size of the program stack.
   static constexpr unsigned int kStackSize = 32;
 
+  // The number of instructions executed per 60 Hz frame.
+  static constexpr unsigned int kInstructionsPerFrame = 10;
+
+  // The granularity, in bytes, at which memory writes are tracked.
+  static constexpr unsigned int kCacheLineSize = 64;
+
+  // The number of tracked cache lines. Fits in a single uint64_t bitmap.
+  static constexpr unsigned int kCacheLines =
+      (kMaxMemory + 1) / kCacheLineSize;
+
+  // The registers and flags of the machine, i.e. everything but memory and
+  // the framebuffer. Execution engines work on the Cpu's own copy.
+  struct Registers {
+    uint8_t v[16];
+    uint16_t index;
+    uint16_t stack[kStackSize];
+    uint8_t sp;
+    uint8_t delay;
+    uint8_t sound;
+    uint16_t pc;
+    bool waiting_for_key_press;
+    uint8_t key_store_register;
+  };
+
+  // The number of times each instruction word was stepped.
+  using InstructionCounts = std::array<uint32_t, 0x10000>;
+
+  // A complete copy of the machine, used for save states and rewinding.
+  struct State {
+    Registers registers;
+    uint8_t memory[kMaxMemory + 1];
+    FrameBuffer frame_buffer;
+    uint64_t dirty_lines;
+    uint32_t random_state;
+
+    // Returns a hash of everything that affects emulation, to detect when
+    // two machines diverge.
+    uint64_t hash() const;
+  };
+
   // |random| and |keyboard| must outlive this instance.
   Cpu(Random* random, Keyboard* keyboard);
 
@@ -42,38 +86,123 @@ class Cpu : Keyboard::KeyboardObserver {
   // Updates the delay and sound timers, decrementing them if necessary.
   void update_timers();
 
+  // Executes the next |instructions| instructions with the execution engine,
+  // as many calls to step() would. Stops at the first that fails and
+  // returns false.
+  bool run(unsigned int instructions);
+
+  // Executes a frame worth of instructions and then ends the frame.
+  bool run_frame();
+
+  // Updates the timers and counts the frame, after a frame worth of
+  // instructions were executed some other way than run_frame().
+  void end_frame();
+
+  // Returns the number of frames run. It is not part of the machine state,
+  // so frames run again after load_state() count again.
+  uint64_t frames_run() const { return frames_run_; }
+
   // Attempts to load the chip 8 file |path|. Returns true if successful, false
   // otherwise.
   bool load(const std::string& path);
 
-  uint16_t pc() const { return pc_; }
+  // Returns the FNV-1a hash of the last loaded file.
+  uint64_t rom_hash() const { return rom_hash_; }
 
-  uint16_t v(uint8_t index) const { return v_[index]; }
+  // Returns the number of bytes of the last loaded file, loaded from
+  // kMinAddressableMemory.
+  uint16_t rom_size() const { return rom_size_; }
 
-  uint16_t index() const { return index_; }
+  // Whether the last loaded file did not fit in memory, so that only its
+  // first rom_size() bytes were loaded.
+  bool rom_truncated() const { return rom_truncated_; }
 
-  uint16_t sound() const { return sound_; }
+  uint16_t pc() const { return registers_.pc; }
+
+  uint16_t v(uint8_t index) const { return registers_.v[index]; }
+
+  uint16_t index() const { return registers_.index; }
+
+  uint16_t sound() const { return registers_.sound; }
+
+  // Whether Fx0A is waiting for a key, in which case step() does nothing.
+  bool waiting_for_key_press() const {
+    return registers_.waiting_for_key_press;
+  }
 
   FrameBuffer const * frame_buffer() const { return buffer_.get(); }
 
+  // Returns the keys, bit n being key n, found pressed by Ex9E or ExA1 or
+  // ending an Fx0A wait since the last call to clear_observed_keys(). Not
+  // part of the machine state.
+  uint16_t observed_keys() const { return observed_keys_; }
+
+  void clear_observed_keys() { observed_keys_ = 0; }
+
+  // Returns a bitmap of the cache lines written since the last call to
+  // clear_dirty_lines(). Bit n covers bytes [n * kCacheLineSize,
+  // (n + 1) * kCacheLineSize).
+  uint64_t dirty_lines() const { return dirty_lines_; }
+
+  void clear_dirty_lines() { dirty_lines_ = 0; }
+
+  const Registers& registers() const { return registers_; }
+
+  // The state of the random number generator, as saved by save_state().
+  uint32_t random_state() const { return random_->state(); }
+
+  // Copies the complete machine state, including the state of the random
+  // number generator, into |state|.
+  void save_state(State* state) const;
+
+  // Replaces the complete machine state with |state|.
+  void load_state(const State& state);
+
+  // Lets |profiler| sample the instructions stepped, or stops profiling if
+  // null. |profiler| must outlive this instance or be unset.
+  void set_profiler(Profiler* profiler) { profiler_ = profiler; }
+
+  // Counts the instructions stepped into |counts|, or stops counting if
+  // null. |counts| must outlive this instance or be unset.
+  void set_instruction_counts(InstructionCounts* counts) {
+    instruction_counts_ = counts;
+  }
+
+  // Runs instructions with |engine|, or steps them one at a time with
+  // execute() if null. |engine| must outlive this instance or be unset, and
+  // must not be used by another Cpu meanwhile. Setting the engine already
+  // set keeps what it translated. While profiling, which must see each
+  // instruction, instructions are stepped. Engines count the instructions
+  // they run themselves.
+  void set_engine(ExecutionEngine* engine);
+
  protected:
   // Keyboard::KeyboardObserver:
   void on_key_pressed(uint8_t key) override;
 
  private:
-  uint8_t v_[16] = {{0}};
-  uint16_t index_ = 0;
+  friend class ExecutionEngine;
+
+  // Writes |byte| to |address|, wrapping around past the end of memory like
+  // every access through I, and marks its cache line as dirty.
+  void write_memory(uint16_t address, uint8_t byte);
+
+  Registers registers_ = {};
   const std::unique_ptr<FrameBuffer> buffer_;
-  uint16_t stack_[kStackSize];
-  uint8_t sp_ = 0;
-  uint8_t delay_ = 0;
-  uint8_t sound_ = 0;
-  uint16_t pc_ = kMinAddressableMemory;
   uint8_t memory_[kMaxMemory + 1] = {{0}};
-
-  bool waiting_for_key_press_ = false;
-  uint8_t key_store_register_;
+  uint64_t dirty_lines_ = ~0ull;
+  // The cache lines written since the engine last took them, so that it can
+  // drop what it translated from them.
+  uint64_t written_lines_ = ~0ull;
+  uint64_t rom_hash_ = 0;
+  uint16_t rom_size_ = 0;
+  bool rom_truncated_ = false;
+  uint64_t frames_run_ = 0;
+  uint16_t observed_keys_ = 0;
 
   Random* random_;
   Keyboard* keyboard_;
+  Profiler* profiler_ = nullptr;
+  InstructionCounts* instruction_counts_ = nullptr;
+  ExecutionEngine* engine_ = nullptr;
 };
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "src/control_flow.h"
+#include "src/cpu.h"
+#include "src/disassembler.h"
+#include "src/superinstruction.h"
+
+// The fields of an instruction word, split once, and the superinstruction
+// starting with it, if any.
+struct DecodedInstruction {
+  OpcodeClass opcode_class;
+  uint8_t x;
+  uint8_t y;
+  uint8_t n;
+  uint8_t kk;
+  uint16_t nnn;
+  uint16_t word;
+  Superinstruction superinstruction;
+  // The words of the other instructions of the superinstruction.
+  uint16_t next_words[2];
+
+  static DecodedInstruction decode(uint16_t word) {
+    return {::opcode_class(word),
+            static_cast<uint8_t>((word >> 8) & 0xf),
+            static_cast<uint8_t>((word >> 4) & 0xf),
+            static_cast<uint8_t>(word & 0xf),
+            static_cast<uint8_t>(word & 0xff),
+            static_cast<uint16_t>(word & 0xfff),
+            word,
+            Superinstruction::NONE,
+            {0, 0}};
+  }
+
+  // Decodes the instruction at |address| of |memory|, which must be below
+  // Cpu::kMaxMemory, along with the superinstruction starting there.
+  static DecodedInstruction decode(const uint8_t* memory, uint16_t address) {
+    DecodedInstruction decoded = decode(
+        static_cast<uint16_t>(memory[address] << 8 | memory[address + 1]));
+    decoded.superinstruction = match_superinstruction(memory, address);
+    for (unsigned int i = 1;
+         i < superinstruction_length(decoded.superinstruction); ++i) {
+      unsigned int next = address + i * 2;
+      decoded.next_words[i - 1] =
+          static_cast<uint16_t>(memory[next] << 8 | memory[next + 1]);
+    }
+    return decoded;
+  }
+
+  // Whether executing the instruction may write memory.
+  bool writes_memory() const {
+    return opcode_class == OpcodeClass::LD_B_VX ||
+           opcode_class == OpcodeClass::LD_MEM_VX;
+  }
+};
+
+// Entries decoded from the instruction at every address, a cache line at a
+// time when first needed, and dropped when their memory is written. |Entry|
+// must have a static Entry decode(uint16_t word) for the last address, which
+// holds no complete instruction, and a static
+// Entry decode(const uint8_t* memory, uint16_t address) for the others,
+// which may look at up to 6 bytes from |address|.
+template <typename Entry>
+class DecodeCache {
+ public:
+  // Returns the entry of the instruction at |address| of |memory|, which must
+  // be below Cpu::kMaxMemory.
+  const Entry& get(const uint8_t* memory, uint16_t address) {
+    unsigned int line = address / Cpu::kCacheLineSize;
+    if (!((decoded_lines_ >> line) & 1)) {
+      decode_line(memory, line);
+    }
+    return entries_[address];
+  }
+
+  // Decodes the cache lines holding the blocks of |graph| from |memory|,
+  // unless they already are.
+  void prepare(const uint8_t* memory, const ControlFlowGraph& graph) {
+    for (const ControlFlowGraph::BasicBlock& block : graph.blocks) {
+      for (unsigned int line = block.start / Cpu::kCacheLineSize;
+           line <= (block.end - 1u) / Cpu::kCacheLineSize; ++line) {
+        if (!((decoded_lines_ >> line) & 1)) {
+          decode_line(memory, line);
+        }
+      }
+    }
+  }
+
+  // Drops the entries of the cache lines set in |written_lines|.
+  void invalidate(uint64_t written_lines) {
+    // Instructions and superinstructions at the end of a line end in the
+    // next one.
+    decoded_lines_ &= ~(written_lines | (written_lines >> 1));
+  }
+
+ private:
+  void decode_line(const uint8_t* memory, unsigned int line) {
+    unsigned int end = (line + 1) * Cpu::kCacheLineSize;
+    for (unsigned int address = line * Cpu::kCacheLineSize; address < end;
+         ++address) {
+      entries_[address] =
+          address < Cpu::kMaxMemory
+              ? Entry::decode(memory, static_cast<uint16_t>(address))
+              : Entry::decode(static_cast<uint16_t>(memory[address] << 8));
+    }
+    decoded_lines_ |= 1ull << line;
+  }
+
+  std::array<Entry, Cpu::kMaxMemory + 1> entries_;
+  uint64_t decoded_lines_ = 0;
+};
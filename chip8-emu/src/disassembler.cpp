@@ -0,0 +1,175 @@
+#include "src/disassembler.h"
+
+#include "src/util.h"
+
+namespace {
+
+struct Pattern {
+  uint16_t mask;
+  uint16_t value;
+  OpcodeClass opcode_class;
+  const char* name;
+};
+
+// In the order they are matched, 00E0 and 00EE before 0nnn.
+constexpr Pattern kPatterns[] = {
+    {0xffff, 0x00e0, OpcodeClass::CLS, "00E0"},
+    {0xffff, 0x00ee, OpcodeClass::RET, "00EE"},
+    {0xf000, 0x0000, OpcodeClass::SYS, "0nnn"},
+    {0xf000, 0x1000, OpcodeClass::JP, "1nnn"},
+    {0xf000, 0x2000, OpcodeClass::CALL, "2nnn"},
+    {0xf000, 0x3000, OpcodeClass::SE_BYTE, "3xkk"},
+    {0xf000, 0x4000, OpcodeClass::SNE_BYTE, "4xkk"},
+    {0xf00f, 0x5000, OpcodeClass::SE_REG, "5xy0"},
+    {0xf000, 0x6000, OpcodeClass::LD_BYTE, "6xkk"},
+    {0xf000, 0x7000, OpcodeClass::ADD_BYTE, "7xkk"},
+    {0xf00f, 0x8000, OpcodeClass::LD_REG, "8xy0"},
+    {0xf00f, 0x8001, OpcodeClass::OR, "8xy1"},
+    {0xf00f, 0x8002, OpcodeClass::AND, "8xy2"},
+    {0xf00f, 0x8003, OpcodeClass::XOR, "8xy3"},
+    {0xf00f, 0x8004, OpcodeClass::ADD_REG, "8xy4"},
+    {0xf00f, 0x8005, OpcodeClass::SUB, "8xy5"},
+    {0xf00f, 0x8006, OpcodeClass::SHR, "8xy6"},
+    {0xf00f, 0x8007, OpcodeClass::SUBN, "8xy7"},
+    {0xf00f, 0x800e, OpcodeClass::SHL, "8xyE"},
+    {0xf00f, 0x9000, OpcodeClass::SNE_REG, "9xy0"},
+    {0xf000, 0xa000, OpcodeClass::LD_I, "Annn"},
+    {0xf000, 0xb000, OpcodeClass::JP_V0, "Bnnn"},
+    {0xf000, 0xc000, OpcodeClass::RND, "Cxkk"},
+    {0xf000, 0xd000, OpcodeClass::DRW, "Dxyn"},
+    {0xf0ff, 0xe09e, OpcodeClass::SKP, "Ex9E"},
+    {0xf0ff, 0xe0a1, OpcodeClass::SKNP, "ExA1"},
+    {0xf0ff, 0xf007, OpcodeClass::LD_VX_DT, "Fx07"},
+    {0xf0ff, 0xf00a, OpcodeClass::LD_VX_K, "Fx0A"},
+    {0xf0ff, 0xf015, OpcodeClass::LD_DT_VX, "Fx15"},
+    {0xf0ff, 0xf018, OpcodeClass::LD_ST_VX, "Fx18"},
+    {0xf0ff, 0xf01e, OpcodeClass::ADD_I_VX, "Fx1E"},
+    {0xf0ff, 0xf029, OpcodeClass::LD_F_VX, "Fx29"},
+    {0xf0ff, 0xf033, OpcodeClass::LD_B_VX, "Fx33"},
+    {0xf0ff, 0xf055, OpcodeClass::LD_MEM_VX, "Fx55"},
+    {0xf0ff, 0xf065, OpcodeClass::LD_VX_MEM, "Fx65"},
+};
+
+std::string reg(uint16_t instruction, int shift) {
+  return std::string("V") + "0123456789ABCDEF"[(instruction >> shift) & 0xf];
+}
+
+}  // namespace
+
+OpcodeClass opcode_class(uint16_t instruction) {
+  for (const Pattern& pattern : kPatterns) {
+    if ((instruction & pattern.mask) == pattern.value) {
+      return pattern.opcode_class;
+    }
+  }
+  return OpcodeClass::UNKNOWN;
+}
+
+const char* opcode_pattern(OpcodeClass opcode_class) {
+  for (const Pattern& pattern : kPatterns) {
+    if (pattern.opcode_class == opcode_class) {
+      return pattern.name;
+    }
+  }
+  return "????";
+}
+
+std::string disassemble(uint16_t instruction) {
+  std::string x = reg(instruction, 8);
+  std::string y = reg(instruction, 4);
+  std::string kk = tohex(instruction & 0xff, 2);
+  std::string nnn = tohex(instruction & 0xfff, 3);
+  switch (opcode_class(instruction)) {
+    case OpcodeClass::CLS:
+      return "CLS";
+    case OpcodeClass::RET:
+      return "RET";
+    case OpcodeClass::SYS:
+      return "SYS " + nnn;
+    case OpcodeClass::JP:
+      return "JP " + nnn;
+    case OpcodeClass::CALL:
+      return "CALL " + nnn;
+    case OpcodeClass::SE_BYTE:
+      return "SE " + x + ", " + kk;
+    case OpcodeClass::SNE_BYTE:
+      return "SNE " + x + ", " + kk;
+    case OpcodeClass::SE_REG:
+      return "SE " + x + ", " + y;
+    case OpcodeClass::LD_BYTE:
+      return "LD " + x + ", " + kk;
+    case OpcodeClass::ADD_BYTE:
+      return "ADD " + x + ", " + kk;
+    case OpcodeClass::LD_REG:
+      return "LD " + x + ", " + y;
+    case OpcodeClass::OR:
+      return "OR " + x + ", " + y;
+    case OpcodeClass::AND:
+      return "AND " + x + ", " + y;
+    case OpcodeClass::XOR:
+      return "XOR " + x + ", " + y;
+    case OpcodeClass::ADD_REG:
+      return "ADD " + x + ", " + y;
+    case OpcodeClass::SUB:
+      return "SUB " + x + ", " + y;
+    case OpcodeClass::SHR:
+      return "SHR " + x;
+    case OpcodeClass::SUBN:
+      return "SUBN " + x + ", " + y;
+    case OpcodeClass::SHL:
+      return "SHL " + x;
+    case OpcodeClass::SNE_REG:
+      return "SNE " + x + ", " + y;
+    case OpcodeClass::LD_I:
+      return "LD I, " + nnn;
+    case OpcodeClass::JP_V0:
+      return "JP V0, " + nnn;
+    case OpcodeClass::RND:
+      return "RND " + x + ", " + kk;
+    case OpcodeClass::DRW:
+      return "DRW " + x + ", " + y + ", " + tohex(instruction & 0xf, 1);
+    case OpcodeClass::SKP:
+      return "SKP " + x;
+    case OpcodeClass::SKNP:
+      return "SKNP " + x;
+    case OpcodeClass::LD_VX_DT:
+      return "LD " + x + ", DT";
+    case OpcodeClass::LD_VX_K:
+      return "LD " + x + ", K";
+    case OpcodeClass::LD_DT_VX:
+      return "LD DT, " + x;
+    case OpcodeClass::LD_ST_VX:
+      return "LD ST, " + x;
+    case OpcodeClass::ADD_I_VX:
+      return "ADD I, " + x;
+    case OpcodeClass::LD_F_VX:
+      return "LD F, " + x;
+    case OpcodeClass::LD_B_VX:
+      return "LD B, " + x;
+    case OpcodeClass::LD_MEM_VX:
+      return "LD [I], " + x;
+    case OpcodeClass::LD_VX_MEM:
+      return "LD " + x + ", [I]";
+    case OpcodeClass::UNKNOWN:
+      break;
+  }
+  return "DW " + tohex(instruction);
+}
+
+bool is_branch(uint16_t instruction) {
+  switch (opcode_class(instruction)) {
+    case OpcodeClass::RET:
+    case OpcodeClass::JP:
+    case OpcodeClass::CALL:
+    case OpcodeClass::SE_BYTE:
+    case OpcodeClass::SNE_BYTE:
+    case OpcodeClass::SE_REG:
+    case OpcodeClass::SNE_REG:
+    case OpcodeClass::JP_V0:
+    case OpcodeClass::SKP:
+    case OpcodeClass::SKNP:
+      return true;
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The CHIP-8 instruction families, one per opcode pattern.
+enum class OpcodeClass {
+  CLS,        // 00E0
+  RET,        // 00EE
+  SYS,        // 0nnn
+  JP,         // 1nnn
+  CALL,       // 2nnn
+  SE_BYTE,    // 3xkk
+  SNE_BYTE,   // 4xkk
+  SE_REG,     // 5xy0
+  LD_BYTE,    // 6xkk
+  ADD_BYTE,   // 7xkk
+  LD_REG,     // 8xy0
+  OR,         // 8xy1
+  AND,        // 8xy2
+  XOR,        // 8xy3
+  ADD_REG,    // 8xy4
+  SUB,        // 8xy5
+  SHR,        // 8xy6
+  SUBN,       // 8xy7
+  SHL,        // 8xyE
+  SNE_REG,    // 9xy0
+  LD_I,       // Annn
+  JP_V0,      // Bnnn
+  RND,        // Cxkk
+  DRW,        // Dxyn
+  SKP,        // Ex9E
+  SKNP,       // ExA1
+  LD_VX_DT,   // Fx07
+  LD_VX_K,    // Fx0A
+  LD_DT_VX,   // Fx15
+  LD_ST_VX,   // Fx18
+  ADD_I_VX,   // Fx1E
+  LD_F_VX,    // Fx29
+  LD_B_VX,    // Fx33
+  LD_MEM_VX,  // Fx55
+  LD_VX_MEM,  // Fx65
+  UNKNOWN,
+};
+
+// The number of values of OpcodeClass, including UNKNOWN.
+constexpr size_t kOpcodeClasses = static_cast<size_t>(OpcodeClass::UNKNOWN) + 1;
+
+OpcodeClass opcode_class(uint16_t instruction);
+
+// Returns the opcode pattern of |opcode_class|, e.g. "8xy4".
+const char* opcode_pattern(OpcodeClass opcode_class);
+
+// Returns |instruction| in assembly, e.g. "ADD V1, V2".
+std::string disassemble(uint16_t instruction);
+
+// Returns true if |instruction| may continue anywhere but at the next
+// instruction, i.e. jumps, calls, returns and skips.
+bool is_branch(uint16_t instruction);
@@ -0,0 +1,93 @@
+#include "src/execution_engine.h"
+
+#include "src/aot_engine.h"
+#include "src/logging.h"
+#include "src/optimizing_engine.h"
+#include "src/predecoded_engine.h"
+#include "src/threaded_engine.h"
+#include "src/tiered_engine.h"
+
+namespace {
+
+constexpr struct {
+  EngineKind kind;
+  const char* name;
+} kEngines[] = {
+    {EngineKind::INTERPRETER, "interpreter"},
+    {EngineKind::PREDECODED, "predecoded"},
+    {EngineKind::THREADED, "threaded"},
+    {EngineKind::OPTIMIZING, "optimizing"},
+    {EngineKind::TIERED, "tiered"},
+    {EngineKind::AOT, "aot"},
+};
+
+}  // namespace
+
+const char* engine_name(EngineKind kind) {
+  for (const auto& engine : kEngines) {
+    if (engine.kind == kind) {
+      return engine.name;
+    }
+  }
+  return "unknown";
+}
+
+bool parse_engine_kind(const std::string& name, EngineKind* kind) {
+  for (const auto& engine : kEngines) {
+    if (name == engine.name) {
+      *kind = engine.kind;
+      return true;
+    }
+  }
+  std::string names;
+  for (const auto& engine : kEngines) {
+    names += names.empty() ? "" : ", ";
+    names += engine.name;
+  }
+  logging::log(logging::Level::ERROR,
+               "Unknown engine " + name + ", expected one of " + names);
+  return false;
+}
+
+std::unique_ptr<ExecutionEngine> make_engine(EngineKind kind,
+                                             const EngineOptions& options) {
+  switch (kind) {
+    case EngineKind::PREDECODED:
+      return std::make_unique<PredecodedEngine>();
+    case EngineKind::THREADED:
+      return std::make_unique<ThreadedEngine>();
+    case EngineKind::OPTIMIZING:
+      return std::make_unique<OptimizingEngine>();
+    case EngineKind::TIERED:
+      return std::make_unique<TieredEngine>(options);
+    case EngineKind::AOT:
+      return std::make_unique<AotEngine>(options);
+    case EngineKind::INTERPRETER:
+      break;
+  }
+  return std::make_unique<InterpreterEngine>();
+}
+
+void ExecutionEngine::add_instruction_counts(Cpu* cpu, uint16_t start,
+                                             unsigned int size,
+                                             unsigned int executed) {
+  Cpu::InstructionCounts* counts = cpu->instruction_counts_;
+  unsigned int rounds = executed / size;
+  unsigned int rest = executed % size;
+  for (unsigned int j = 0; j < size && (rounds || j < rest); ++j) {
+    uint16_t address = (start + j * 2) & Cpu::kMaxMemory;
+    uint16_t word =
+        static_cast<uint16_t>(cpu->memory_[address] << 8 |
+                              cpu->memory_[(address + 1) & Cpu::kMaxMemory]);
+    (*counts)[word] += rounds + (j < rest);
+  }
+}
+
+bool InterpreterEngine::run(Cpu* cpu, unsigned int instructions) {
+  for (unsigned int i = 0; i < instructions; ++i) {
+    if (!cpu->step()) {
+      return false;
+    }
+  }
+  return true;
+}
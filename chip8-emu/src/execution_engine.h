@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "src/cpu.h"
+
+class BlockCache;
+struct ControlFlowGraph;
+
+// The ways of executing CHIP-8 code, selected with --engine.
+enum class EngineKind {
+  // Steps every instruction through Cpu::execute(), the reference.
+  INTERPRETER,
+  // Decodes every instruction once and dispatches on the decoded opcode.
+  PREDECODED,
+  // Decodes every instruction once into a pointer to its handler.
+  THREADED,
+  // Translates and optimizes blocks of instructions, and runs them through
+  // pointers to handlers.
+  OPTIMIZING,
+  // Interprets blocks at first, then moves those that run often to the
+  // threaded and then the optimizing engine's way of running them.
+  TIERED,
+  // Runs blocks compiled ahead of time by chip8-aot, interpreting the rest.
+  AOT,
+};
+
+// How engines are tuned, from the command line.
+struct EngineOptions {
+  // The number of times a block runs before TieredEngine decodes it, and
+  // before it optimizes it.
+  uint32_t threaded_threshold = 16;
+  uint32_t optimized_threshold = 256;
+
+  // The directory of the modules chip8-aot compiled, for AotEngine.
+  std::string aot_path;
+};
+
+// Returns the name of |kind| as given to --engine, e.g. "threaded".
+const char* engine_name(EngineKind kind);
+
+// Parses an engine name into |kind|. Returns false, after logging why, if
+// there is no such engine.
+bool parse_engine_kind(const std::string& name, EngineKind* kind);
+
+// Executes the instructions of a Cpu, working on its own registers and
+// memory, so that engines can be swapped between frames. Every engine must
+// leave the machine exactly as Cpu::step() would.
+class ExecutionEngine {
+ public:
+  virtual ~ExecutionEngine() = default;
+
+  virtual EngineKind kind() const = 0;
+
+  // Executes the next |instructions| instructions of |cpu|. Stops at the
+  // first that fails and returns false.
+  virtual bool run(Cpu* cpu, unsigned int instructions) = 0;
+
+  // Makes engines that translate blocks look them up in the cache given,
+  // which must outlive them, before translating them, and add those they
+  // translate. Others ignore it.
+  virtual void set_block_cache(BlockCache*) {}
+
+  // Makes engines that decode or translate code when it first runs do so
+  // ahead of time for the code the graph given found in the ROM just loaded
+  // into the Cpu. Others ignore it, as TieredEngine does, only translating
+  // what runs often.
+  virtual void prepare(Cpu*, const ControlFlowGraph&) {}
+
+ protected:
+  static Cpu::Registers& registers(Cpu* cpu) { return cpu->registers_; }
+
+  static const uint8_t* memory(const Cpu* cpu) { return cpu->memory_; }
+
+  static FrameBuffer* frame_buffer(Cpu* cpu) { return cpu->buffer_.get(); }
+
+  // Whether |cpu| counts the instructions it runs, see
+  // Cpu::set_instruction_counts(). Engines count those they run without
+  // Cpu::step(), which counts its own.
+  static bool counts_instructions(const Cpu* cpu) {
+    return cpu->instruction_counts_ != nullptr;
+  }
+
+  // Counts the first |executed| instructions of the |size| at |start| of
+  // |cpu| as run, going round them again past |size|, as idempotent blocks
+  // do, if |cpu| counts instructions.
+  static void count_instructions(Cpu* cpu, uint16_t start, unsigned int size,
+                                 unsigned int executed) {
+    if (cpu->instruction_counts_) {
+      add_instruction_counts(cpu, start, size, executed);
+    }
+  }
+
+  // Returns the bitmap of cache lines written since the last call, so that
+  // anything translated from them can be dropped.
+  static uint64_t take_written_lines(Cpu* cpu) {
+    uint64_t lines = cpu->written_lines_;
+    cpu->written_lines_ = 0;
+    return lines;
+  }
+
+ private:
+  static void add_instruction_counts(Cpu* cpu, uint16_t start,
+                                     unsigned int size, unsigned int executed);
+};
+
+// Returns a new engine of |kind|.
+std::unique_ptr<ExecutionEngine> make_engine(
+    EngineKind kind, const EngineOptions& options = {});
+
+// The reference engine, which steps every instruction.
+class InterpreterEngine : public ExecutionEngine {
+ public:
+  EngineKind kind() const override { return EngineKind::INTERPRETER; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+};
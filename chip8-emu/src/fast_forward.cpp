@@ -0,0 +1,98 @@
+#include "src/fast_forward.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// The weight of a new sample in the moving averages.
+constexpr double kSmoothing = 0.1;
+
+// How often the effective speed is measured, in seconds.
+constexpr double kSampleInterval = 0.5;
+
+// Tolerates presents arriving a little early due to timer jitter.
+constexpr double kPresentSlack = 0.9;
+
+double smooth(double average, double sample) {
+  if (average == 0) {
+    return sample;
+  }
+  return average + (sample - average) * kSmoothing;
+}
+
+}  // namespace
+
+FastForward::FastForward(double speed) : speed_(speed) {}
+
+void FastForward::start(double now) {
+  start_ = now;
+  frames_since_start_ = 0;
+  last_present_ = now;
+  frames_since_present_ = 0;
+  sample_start_ = now;
+  sample_frames_ = 0;
+  effective_speed_ = 0;
+}
+
+unsigned int FastForward::frames_to_run(double now) {
+  // Emulate in batches of about one present interval, so that events keep
+  // being polled while running unbounded.
+  unsigned int batch = 1;
+  if (frame_cost_ > 0) {
+    batch = std::max(
+        1.0, std::floor(1 / kMaxPresentRate / frame_cost_));
+  }
+  if (speed_ == kUnbounded) {
+    return batch;
+  }
+
+  double frames_per_second = speed_ * kFrameRate;
+  double due = (now - start_) * frames_per_second - frames_since_start_;
+  if (due > kMaxBacklog * frames_per_second) {
+    start_ = now - 1 / frames_per_second;
+    frames_since_start_ = 0;
+    due = 1;
+  }
+  if (due < 1) {
+    return 0;
+  }
+  return std::min(batch, static_cast<unsigned int>(due));
+}
+
+void FastForward::on_frames_run(unsigned int frames, double seconds) {
+  if (frames == 0) {
+    return;
+  }
+  frames_since_start_ += frames;
+  frames_since_present_ += frames;
+  sample_frames_ += frames;
+  frame_cost_ = smooth(frame_cost_, seconds / frames);
+}
+
+bool FastForward::should_present(double now) const {
+  return frames_since_present_ >= skip() &&
+         now - last_present_ >= kPresentSlack / kMaxPresentRate;
+}
+
+void FastForward::on_presented(double now, double seconds) {
+  present_cost_ = smooth(present_cost_, seconds);
+  last_present_ = now;
+  frames_since_present_ = 0;
+
+  if (now - sample_start_ >= kSampleInterval) {
+    effective_speed_ = sample_frames_ / ((now - sample_start_) * kFrameRate);
+    sample_start_ = now;
+    sample_frames_ = 0;
+  }
+}
+
+unsigned int FastForward::skip() const {
+  if (frame_cost_ == 0 || present_cost_ == 0) {
+    return 1;
+  }
+  // Solves present / (skip * frame + present) <= kMaxPresentShare.
+  double skip = present_cost_ * (1 - kMaxPresentShare) /
+                (kMaxPresentShare * frame_cost_);
+  return std::max(1.0, std::ceil(skip));
+}
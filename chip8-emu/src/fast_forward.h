@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+// Paces emulation when running faster (or slower) than real time.
+//
+// Decides how many frames to emulate on each pass of the main loop and which
+// of them to present. Only every skip()-th frame is presented, with skip()
+// derived from the measured cost of presenting versus emulating a frame so
+// that presenting never takes more than kMaxPresentShare of the time. Since
+// timers tick once per emulated frame, they speed up along with the CPU.
+//
+// Times are in seconds, from an arbitrary origin.
+class FastForward {
+ public:
+  // Runs as fast as the host allows.
+  static constexpr double kUnbounded = 0;
+
+  // Emulated frames per second at 1x.
+  static constexpr double kFrameRate = 60;
+
+  // Frames are never presented more often than this, per second.
+  static constexpr double kMaxPresentRate = 60;
+
+  // The largest share of time that presenting frames may take.
+  static constexpr double kMaxPresentShare = 0.2;
+
+  // If emulation falls behind a bounded speed by more than this, e.g. because
+  // the window was being dragged, the backlog is dropped instead of being
+  // caught up with.
+  static constexpr double kMaxBacklog = 0.25;
+
+  // |speed| is a multiple of kFrameRate, or kUnbounded.
+  explicit FastForward(double speed);
+
+  // Starts pacing at |now|.
+  void start(double now);
+
+  // Returns the number of frames to emulate at |now|. Returns 0 when ahead of
+  // a bounded speed, in which case the caller should wait a little.
+  unsigned int frames_to_run(double now);
+
+  // Records that |frames| frames were emulated in |seconds|.
+  void on_frames_run(unsigned int frames, double seconds);
+
+  // Returns true if the last emulated frame should be presented at |now|.
+  bool should_present(double now) const;
+
+  // Records that a frame was presented at |now|, which took |seconds|.
+  void on_presented(double now, double seconds);
+
+  // Returns the number of emulated frames per presented frame.
+  unsigned int skip() const;
+
+  // Returns the emulation speed measured over the last half second or so, as
+  // a multiple of kFrameRate.
+  double effective_speed() const { return effective_speed_; }
+
+  double speed() const { return speed_; }
+
+ private:
+  const double speed_;
+
+  double start_ = 0;
+  uint64_t frames_since_start_ = 0;
+
+  // Exponential moving averages, in seconds.
+  double frame_cost_ = 0;
+  double present_cost_ = 0;
+
+  double last_present_ = 0;
+  unsigned int frames_since_present_ = 0;
+
+  double sample_start_ = 0;
+  uint64_t sample_frames_ = 0;
+  double effective_speed_ = 0;
+};
@@ -2,6 +2,7 @@
 
 #include "src/constants.h"
 #include "src/logging.h"
+#include "src/util.h"
 
 #include <bitset>
 #include <iostream>
@@ -20,6 +21,14 @@ bool FrameBuffer::paint(uint8_t x, uint8_t y, uint8_t line) {
   return erased;
 }
 
+void FrameBuffer::flip(uint8_t x, uint8_t y, uint8_t line) {
+  for (size_t i = 0; line; ++i, line <<= 1) {
+    if (line & 0x80) {
+      buffer_[(x + i) % kScreenWidth].flip(y % kScreenHeight);
+    }
+  }
+}
+
 bool FrameBuffer::get_pixel(uint8_t x, uint8_t y) const {
   return buffer_[x % kScreenWidth].test(y % kScreenHeight);
 }
@@ -34,7 +43,23 @@ void FrameBuffer::clear_screen() {
   }
 }
 
-void FrameBuffer::draw(sf::RenderWindow* window) const {
+uint32_t FrameBuffer::column(uint8_t x) const {
+  return buffer_[x % kScreenWidth].to_ulong();
+}
+
+void FrameBuffer::xor_column(uint8_t x, uint32_t bits) {
+  buffer_[x % kScreenWidth] ^= std::bitset<kScreenHeight>(bits);
+}
+
+uint64_t FrameBuffer::hash() const {
+  uint32_t columns[kScreenWidth];
+  for (size_t x = 0; x < kScreenWidth; ++x) {
+    columns[x] = column(x);
+  }
+  return fnv1a(columns, sizeof(columns));
+}
+
+void FrameBuffer::draw(sf::RenderTarget* target) const {
   sf::RectangleShape pixel;
   pixel.setFillColor(kForegroundColor);
   pixel.setSize(sf::Vector2f(kRenderMultiplier, kRenderMultiplier));
@@ -43,7 +68,7 @@ void FrameBuffer::draw(sf::RenderWindow* window) const {
     for (int y = 0; y < kScreenHeight; ++y) {
       if (get_pixel(x, y)) {
         pixel.setPosition(x * kRenderMultiplier, y * kRenderMultiplier);
-        window->draw(pixel);
+        target->draw(pixel);
       }
     }
   }
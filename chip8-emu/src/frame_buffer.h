@@ -18,6 +18,9 @@ class FrameBuffer {
   // paiting caused a screen bit to be flipped off.
   bool paint(uint8_t x, uint8_t y, uint8_t line);
 
+  // Paints like paint(), without finding out whether anything was erased.
+  void flip(uint8_t x, uint8_t y, uint8_t line);
+
   // Returns the pixel at coordinates |x|, |y|, wrapping the screen if
   // necessary.
   bool get_pixel(uint8_t x, uint8_t y) const;
@@ -28,8 +31,17 @@ class FrameBuffer {
   // Clears the framebuffer.
   void clear_screen();
 
-  // Draws the framebuffer onto the |window|.
-  void draw(sf::RenderWindow* window) const;
+  // Returns the pixels of column |x| as a bitmask, bit n being row n.
+  uint32_t column(uint8_t x) const;
+
+  // Flips the pixels of column |x| set in |bits|, bit n being row n.
+  void xor_column(uint8_t x, uint32_t bits);
+
+  // Returns a hash of the screen contents, to cheaply compare frames.
+  uint64_t hash() const;
+
+  // Draws the framebuffer onto |target|, usually the window.
+  void draw(sf::RenderTarget* target) const;
 
   void print();
 
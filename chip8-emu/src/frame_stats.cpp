@@ -0,0 +1,27 @@
+#include "src/frame_stats.h"
+
+#include <iomanip>
+#include <sstream>
+
+void FrameStats::add(double seconds) {
+  if (count_ == 0 || seconds < min_) {
+    min_ = seconds;
+  }
+  if (count_ == 0 || seconds > max_) {
+    max_ = seconds;
+  }
+  total_ += seconds;
+  ++count_;
+}
+
+void FrameStats::reset() {
+  *this = FrameStats();
+}
+
+std::string FrameStats::summary() const {
+  std::ostringstream summary;
+  summary << std::fixed << std::setprecision(3) << "avg " << average() * 1000
+          << " ms, min " << min_ * 1000 << " ms, max " << max_ * 1000
+          << " ms over " << count_ << " frames";
+  return summary.str();
+}
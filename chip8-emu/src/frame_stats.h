@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Accumulates per-frame durations, in seconds, to be summarized periodically.
+class FrameStats {
+ public:
+  FrameStats() = default;
+
+  void add(double seconds);
+
+  void reset();
+
+  size_t count() const { return count_; }
+  double min() const { return min_; }
+  double max() const { return max_; }
+  double average() const { return count_ ? total_ / count_ : 0; }
+
+  // Returns e.g. "avg 0.120 ms, min 0.100 ms, max 0.300 ms over 60 frames".
+  std::string summary() const;
+
+ private:
+  size_t count_ = 0;
+  double total_ = 0;
+  double min_ = 0;
+  double max_ = 0;
+};
@@ -0,0 +1,374 @@
+// headless.cpp : Runs a ROM without a window, as fast as possible. Used to
+// replay movies and to record scripted runs.
+//
+// Usage: chip8-headless [--seed S] [--frames N] [--record PATH] ROM
+//        chip8-headless --replay PATH [--from FRAME] ROM
+//        chip8-headless --seed S --netplay-port PORT --netplay-peer HOST:PORT
+//            [--frames N] ROM
+//        chip8-headless --engine NAME --verify GRANULARITY [--seed S]
+//            [--frames N | --replay PATH] ROM
+//
+// Any mode can run on another execution engine with --engine NAME, be
+// profiled with --profile PATH [--profile-interval N], traced with --trace
+// PATH and serve metrics with --metrics-port PORT. --block-cache DIR keeps
+// the blocks the engine translates for the next run of the ROM, and
+// --validate warn|strict checks the ROM and has the engine translate its code
+// before it runs. --cfg PATH writes the control flow graph of the ROM before
+// it runs, in DOT if PATH ends with .dot. Outside netplay, --clock virtual
+// runs on simulated time, a frame passing with each frame run, so that the
+// timings and the seed are the same on every run.
+//
+// In netplay mode each player holds scripted keys, and the hash of the final
+// state is printed so that both players can be compared.
+//
+// In verify mode the engine runs in lockstep with the reference interpreter,
+// with no keys held or with the keys of a movie, and the first instruction
+// where they differ is reported.
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include "src/block_cache.h"
+#include "src/clock.h"
+#include "src/control_flow.h"
+#include "src/cpu.h"
+#include "src/execution_engine.h"
+#include "src/fast_forward.h"
+#include "src/frame_stats.h"
+#include "src/lockstep.h"
+#include "src/logging.h"
+#include "src/metrics.h"
+#include "src/metrics_server.h"
+#include "src/movie.h"
+#include "src/netplay.h"
+#include "src/options.h"
+#include "src/profiler.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+#include "src/tiered_engine.h"
+#include "src/trace.h"
+#include "src/util.h"
+
+namespace {
+
+// Reads the movie at |path| into |movie|, refusing one recorded with another
+// ROM than |cpu|'s, whose frames would not match, or with unsupported
+// quirks. Returns true if successful.
+bool load_movie_for(const Cpu& cpu, const std::string& path, Movie* movie) {
+  if (!load_movie(path, movie)) {
+    return false;
+  }
+  if (movie->rom_hash != cpu.rom_hash()) {
+    logging::log(logging::Level::ERROR,
+                 "Movie was recorded with a different ROM (" +
+                     tohex(movie->rom_hash, 16) + ")");
+    return false;
+  }
+  if (movie->quirks != Movie::kDefaultQuirks) {
+    logging::log(logging::Level::ERROR,
+                 "Movie uses unsupported quirks " + tohex(movie->quirks, 8));
+    return false;
+  }
+  return true;
+}
+
+// Lets a frame pass on |clock| if it is virtual. The system clock moves by
+// itself.
+void pass_frame(Clock* clock) {
+  if (auto* virtual_clock = dynamic_cast<VirtualClock*>(clock)) {
+    virtual_clock->advance(1 / FastForward::kFrameRate);
+  }
+}
+
+int replay(const Options& options, Cpu* cpu, ScriptedKeyboard* keyboard,
+           Metrics* metrics, Clock* clock) {
+  Movie movie;
+  if (!load_movie_for(*cpu, options.replay_path, &movie)) {
+    return -1;
+  }
+
+  MoviePlayer player(&movie, cpu, keyboard);
+  if (!player.seek(options.from_frame)) {
+    logging::log(logging::Level::ERROR,
+                 "Could not seek to frame " +
+                     std::to_string(options.from_frame));
+    return -1;
+  }
+
+  double start = clock->now();
+  uint32_t frames = 0;
+  while (true) {
+    MoviePlayer::Status status = player.run_frame();
+    if (status == MoviePlayer::Status::END) {
+      break;
+    }
+    if (status != MoviePlayer::Status::OK) {
+      logging::log(logging::Level::ERROR,
+                   (status == MoviePlayer::Status::DESYNC
+                        ? "Framebuffer differs from the recording at frame "
+                        : "Execution failed at frame ") +
+                       std::to_string(player.frame() - 1));
+      return 1;
+    }
+    ++frames;
+    pass_frame(clock);
+    metrics->update(clock->now() - start);
+  }
+  double elapsed = clock->now() - start;
+  std::cout << "Replayed " << frames << " frames in " << elapsed * 1000
+            << " ms (" << frames / elapsed << " frames/s), all matching"
+            << std::endl;
+  return 0;
+}
+
+int verify(const Options& options, Cpu* cpu, ScriptedKeyboard* keyboard,
+           uint32_t seed, Clock* clock) {
+  // The reference draws the same random numbers from a generator of its own.
+  Random random(seed);
+  Cpu reference(&random, keyboard);
+  if (!reference.load(options.rom)) {
+    return -1;
+  }
+
+  Movie movie;
+  uint32_t frames = options.frames;
+  if (!options.replay_path.empty()) {
+    if (!load_movie_for(*cpu, options.replay_path, &movie)) {
+      return -1;
+    }
+    if (!movie.keyframes.empty()) {
+      cpu->load_state(*movie.keyframes.front().state);
+      reference.load_state(*movie.keyframes.front().state);
+      keyboard->reset(movie.keyframes.front().keys);
+    }
+    frames = movie.frames.size();
+  }
+
+  Lockstep lockstep(&reference, cpu, *options.verify);
+  double start = clock->now();
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    if (!movie.frames.empty()) {
+      keyboard->set_keys(movie.frames[frame].keys);
+    }
+    if (!lockstep.run_frame()) {
+      if (lockstep.divergence()) {
+        std::cout << lockstep.report();
+      } else {
+        logging::log(logging::Level::ERROR,
+                     "Execution failed at frame " + std::to_string(frame));
+      }
+      return 1;
+    }
+    pass_frame(clock);
+  }
+  double elapsed = clock->now() - start;
+  std::cout << "Verified " << frames << " frames of the "
+            << engine_name(options.engine) << " engine against the reference "
+            << "at " << granularity_name(*options.verify) << " granularity in "
+            << elapsed * 1000 << " ms" << std::endl;
+  return 0;
+}
+
+int record(const Options& options, Cpu* cpu, ScriptedKeyboard* keyboard,
+           uint32_t seed, Metrics* metrics, Clock* clock) {
+  Movie movie;
+  MovieRecorder recorder(&movie, cpu, keyboard, seed);
+  double start = clock->now();
+  for (uint32_t frame = 0; frame < options.frames; ++frame) {
+    if (!recorder.run_frame(0)) {
+      logging::log(logging::Level::ERROR,
+                   "Execution failed at frame " + std::to_string(frame));
+      return 1;
+    }
+    pass_frame(clock);
+    metrics->update(clock->now() - start);
+  }
+  double elapsed = clock->now() - start;
+  std::cout << "Ran " << options.frames << " frames in " << elapsed * 1000
+            << " ms (" << options.frames / elapsed << " frames/s)"
+            << std::endl;
+  if (!options.record_path.empty() &&
+      !save_movie(movie, options.record_path)) {
+    return -1;
+  }
+  return 0;
+}
+
+// Presses a key of the player's own in bursts, so that predictions of the
+// remote input often fail and rollbacks get exercised.
+uint16_t scripted_keys(uint32_t frame, unsigned short player) {
+  return (frame / 5 + player) % 3 == 0 ? 1 << (player % 16) : 0;
+}
+
+int netplay(const Options& options, Cpu* cpu, ScriptedKeyboard* keyboard,
+            uint32_t seed, Metrics* metrics, Clock* clock) {
+  // Gives up if the peer does not show up or stops responding.
+  constexpr double kTimeout = 30;
+  // Keeps sending the last input for a while, as the peer may still need it.
+  constexpr double kLinger = 0.5;
+
+  UdpTransport transport;
+  if (!transport.open(options.netplay_port, options.netplay_host,
+                      options.netplay_peer_port)) {
+    return -1;
+  }
+  NetplaySession session(cpu, keyboard, &transport, seed, clock);
+  FrameStats rollbacks;
+  uint32_t rollback_frames = 0;
+  uint32_t max_rollback = 0;
+
+  double start = clock->now();
+  double last_progress = start;
+  uint32_t last_confirmed = 0;
+  while (session.frame() < options.frames ||
+         session.confirmed() < options.frames) {
+    NetplaySession::Status status =
+        session.frame() < options.frames
+            ? session.advance(scripted_keys(session.frame(),
+                                            options.netplay_port))
+            : session.update();
+    if (status == NetplaySession::Status::ERROR) {
+      return -1;
+    }
+    if (status == NetplaySession::Status::DESYNC) {
+      logging::log(logging::Level::ERROR,
+                   "Desync detected around frame " +
+                       std::to_string(session.frame()));
+      return 1;
+    }
+    if (session.last_rollback() > 0) {
+      rollbacks.add(session.last_rollback_cost());
+      rollback_frames += session.last_rollback();
+      max_rollback = std::max(max_rollback, session.last_rollback());
+    }
+
+    metrics->update(clock->now() - start);
+
+    if (session.confirmed() != last_confirmed) {
+      last_confirmed = session.confirmed();
+      last_progress = clock->now();
+    } else if (clock->now() - last_progress > kTimeout) {
+      logging::log(logging::Level::ERROR, "Timed out waiting for the peer");
+      return -1;
+    }
+    if (status == NetplaySession::Status::WAITING ||
+        session.frame() >= options.frames) {
+      clock->sleep(0.001);
+    }
+  }
+  double elapsed = clock->now() - start;
+
+  double linger = clock->now();
+  while (clock->now() - linger < kLinger) {
+    if (session.update() == NetplaySession::Status::DESYNC) {
+      logging::log(logging::Level::ERROR, "Desync detected at the end");
+      return 1;
+    }
+    clock->sleep(0.01);
+  }
+
+  Cpu::State state;
+  cpu->save_state(&state);
+  std::cout << "Ran " << options.frames << " frames in " << elapsed * 1000
+            << " ms with " << rollbacks.count() << " rollbacks of "
+            << rollback_frames << " frames in total, at most " << max_rollback
+            << " at once (" << rollbacks.summary() << ")" << std::endl;
+  std::cout << "Final state hash " << tohex(state.hash(), 16) << std::endl;
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    return -1;
+  }
+  if (options.rom.empty()) {
+    logging::log(logging::Level::ERROR, "No ROM given");
+    return -1;
+  }
+
+  VirtualClock virtual_clock;
+  Clock* clock = options.virtual_clock
+                     ? static_cast<Clock*>(&virtual_clock)
+                     : SystemClock::get();
+  auto random = options.seed ? std::make_unique<Random>(*options.seed)
+                             : std::make_unique<Random>(*clock);
+  ScriptedKeyboard keyboard;
+  std::unique_ptr<ExecutionEngine> engine =
+      make_engine(options.engine, options.engine_options);
+  Cpu cpu(random.get(), &keyboard);
+  cpu.set_engine(engine.get());
+  if (!options.trace_path.empty()) {
+    trace::start(clock);
+  }
+  bool loaded;
+  {
+    trace::Span span("load_rom");
+    loaded = cpu.load(options.rom);
+  }
+  if (!loaded) {
+    return -1;
+  }
+
+  // Opened before validating, so that the blocks translated ahead of time
+  // are looked up in it and added to it.
+  BlockCache block_cache;
+  if (!options.block_cache_path.empty()) {
+    block_cache.open(options.block_cache_path, cpu.rom_hash(),
+                     Movie::kDefaultQuirks);
+    engine->set_block_cache(&block_cache);
+  }
+  if (options.validation) {
+    trace::Span span("validate_rom");
+    if (!validate_rom(&cpu, engine.get(), *options.validation)) {
+      return -1;
+    }
+  }
+  if (!options.cfg_path.empty() &&
+      !save_control_flow_graph(cpu, options.cfg_path)) {
+    return -1;
+  }
+
+  Metrics metrics;
+  MetricsServer metrics_server(&metrics);
+  if (options.metrics_port != 0) {
+    if (!metrics_server.start(options.metrics_port)) {
+      return -1;
+    }
+    metrics.attach(&cpu, dynamic_cast<TieredEngine*>(engine.get()));
+  }
+
+  Profiler profiler(options.profile_interval);
+  if (!options.profile_path.empty()) {
+    cpu.set_profiler(&profiler);
+  }
+
+  int result;
+  if (options.verify) {
+    result = verify(options, &cpu, &keyboard, random->seed(), clock);
+  } else if (!options.replay_path.empty()) {
+    result = replay(options, &cpu, &keyboard, &metrics, clock);
+  } else if (options.netplay_port != 0) {
+    result =
+        netplay(options, &cpu, &keyboard, random->seed(), &metrics, clock);
+  } else {
+    result =
+        record(options, &cpu, &keyboard, random->seed(), &metrics, clock);
+  }
+  if (!options.trace_path.empty() && !trace::stop(options.trace_path)) {
+    return -1;
+  }
+  if (!options.profile_path.empty() &&
+      !profiler.save(cpu, options.profile_path)) {
+    return -1;
+  }
+  // The cache only saves translating again, so the run stands without it.
+  if (!options.block_cache_path.empty() && !block_cache.save()) {
+    logging::log(logging::Level::WARN,
+                 "Block cache not saved, the next run translates again");
+  }
+  return result;
+}
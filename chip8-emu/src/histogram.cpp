@@ -0,0 +1,152 @@
+#include "src/histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+// The number of bits needed to represent |value|.
+unsigned int bit_width(uint64_t value) {
+#if defined(__GNUC__)
+  return value ? 64 - __builtin_clzll(value) : 0;
+#else
+  unsigned int width = 0;
+  while (value) {
+    value >>= 1;
+    ++width;
+  }
+  return width;
+#endif
+}
+
+// Percentiles are reported 5 times per halving of the distance to 100%, as
+// HdrHistogram does by default.
+constexpr int kTicksPerHalfDistance = 5;
+
+}  // namespace
+
+Histogram::Histogram() : counts_(bucket(kMaxValue) + 1) {}
+
+size_t Histogram::bucket(uint64_t value) {
+  unsigned int width = bit_width(value);
+  unsigned int shift =
+      width > kSubBucketBits + 1 ? width - (kSubBucketBits + 1) : 0;
+  return shift * kSubBuckets + (value >> shift);
+}
+
+uint64_t Histogram::lowest_value(size_t bucket) {
+  if (bucket < 2 * kSubBuckets) {
+    return bucket;
+  }
+  unsigned int shift = bucket / kSubBuckets - 1;
+  return (bucket - shift * kSubBuckets) << shift;
+}
+
+uint64_t Histogram::highest_value(size_t bucket) {
+  if (bucket < 2 * kSubBuckets) {
+    return bucket;
+  }
+  unsigned int shift = bucket / kSubBuckets - 1;
+  return lowest_value(bucket) + (1ull << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+  value = std::min(value, kMaxValue);
+  ++counts_[bucket(value)];
+  if (count_ == 0 || value < min_) {
+    min_ = value;
+  }
+  if (count_ == 0 || value > max_) {
+    max_ = value;
+  }
+  ++count_;
+  total_ += value;
+  total_squares_ += static_cast<double>(value) * value;
+}
+
+void Histogram::reset() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  count_ = 0;
+  min_ = 0;
+  max_ = 0;
+  total_ = 0;
+  total_squares_ = 0;
+}
+
+double Histogram::mean() const {
+  return count_ ? total_ / count_ : 0;
+}
+
+double Histogram::standard_deviation() const {
+  if (count_ == 0) {
+    return 0;
+  }
+  double mean = this->mean();
+  return std::sqrt(std::max(0.0, total_squares_ / count_ - mean * mean));
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100 * count_)));
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    cumulative += counts_[i];
+    if (cumulative >= rank) {
+      return std::min(highest_value(i), max_);
+    }
+  }
+  return max_;
+}
+
+void Histogram::write_percentiles(std::ostream& out, double scale) const {
+  char line[128];
+  std::snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n", "Value",
+                "Percentile", "TotalCount", "1/(1-Percentile)");
+  out << line;
+
+  double percentile_to = 0;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < counts_.size() && count_ > 0; ++i) {
+    if (counts_[i] == 0) {
+      continue;
+    }
+    cumulative += counts_[i];
+    double value = std::min(highest_value(i), max_) / scale;
+    if (cumulative == count_) {
+      std::snprintf(line, sizeof(line), "%12.3f %2.12f %10llu\n", value, 1.0,
+                    static_cast<unsigned long long>(cumulative));
+      out << line;
+      break;
+    }
+    double current = 100.0 * cumulative / count_;
+    while (current >= percentile_to) {
+      std::snprintf(line, sizeof(line), "%12.3f %2.12f %10llu %14.2f\n",
+                    value, percentile_to / 100,
+                    static_cast<unsigned long long>(cumulative),
+                    1 / (1 - percentile_to / 100));
+      out << line;
+      double ticks =
+          kTicksPerHalfDistance *
+          std::pow(2, std::floor(std::log2(100 / (100 - percentile_to))) + 1);
+      percentile_to += 100 / ticks;
+    }
+  }
+
+  std::snprintf(line, sizeof(line),
+                "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+                mean() / scale, standard_deviation() / scale);
+  out << line;
+  std::snprintf(line, sizeof(line),
+                "#[Max     = %12.3f, Total count    = %12llu]\n", max_ / scale,
+                static_cast<unsigned long long>(count_));
+  out << line;
+  std::snprintf(line, sizeof(line),
+                "#[Buckets = %12zu, SubBuckets     = %12llu]\n",
+                counts_.size() / kSubBuckets - 1,
+                static_cast<unsigned long long>(2 * kSubBuckets));
+  out << line;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counts values with a fixed relative precision over a wide range, in the
+// manner of HdrHistogram, e.g. latencies in microseconds from 1 us to over
+// an hour.
+//
+// Values below 2 * kSubBuckets are counted exactly. Above, each power of two
+// is split into kSubBuckets buckets, so that a value is known to within
+// 1 / kSubBuckets of itself. Recording is a few shifts and an increment.
+class Histogram {
+ public:
+  static constexpr unsigned int kSubBucketBits = 7;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+  // Values are clamped to this.
+  static constexpr uint64_t kMaxValue = (1ull << 32) - 1;
+
+  Histogram();
+
+  void record(uint64_t value);
+
+  void reset();
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return min_; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+  double standard_deviation() const;
+
+  // Returns the value below which |percentile| percent of the values fall,
+  // as the highest value of its bucket.
+  uint64_t percentile(double percentile) const;
+
+  // Writes the distribution in the percentile format of HdrHistogram, which
+  // its plotter and tools read, dividing values by |scale|, e.g. 1000 to
+  // write microseconds as milliseconds.
+  void write_percentiles(std::ostream& out, double scale) const;
+
+ private:
+  static size_t bucket(uint64_t value);
+
+  // The lowest and highest values counted in |bucket|.
+  static uint64_t lowest_value(size_t bucket);
+  static uint64_t highest_value(size_t bucket);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t min_ = 0;
+  uint64_t max_ = 0;
+  double total_ = 0;
+  double total_squares_ = 0;
+};
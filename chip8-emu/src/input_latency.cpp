@@ -0,0 +1,133 @@
+#include "src/input_latency.h"
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+#include "src/logging.h"
+
+void InputLatency::on_key_event(uint16_t keys, double now) {
+  keys &= ~pending_;
+  for (size_t key = 0; key < presses_.size(); ++key) {
+    if (keys & (1 << key)) {
+      presses_[key] = Press();
+      presses_[key].event = now;
+    }
+  }
+  pending_ |= keys;
+}
+
+void InputLatency::on_emulated(Cpu* cpu, double now) {
+  uint16_t observed = cpu->observed_keys() & pending_;
+  cpu->clear_observed_keys();
+  for (size_t key = 0; observed; ++key) {
+    if (observed & (1 << key)) {
+      if (presses_[key].observed < 0) {
+        presses_[key].observed = now;
+      }
+      observed &= ~(1 << key);
+    }
+  }
+}
+
+void InputLatency::on_draw(const FrameBuffer& shown, double now) {
+  uint64_t hash = shown.hash();
+  if (hash != last_hash_) {
+    for (size_t key = 0; key < presses_.size(); ++key) {
+      Press& press = presses_[key];
+      if ((pending_ & (1 << key)) && press.observed >= 0 &&
+          press.changed < 0) {
+        press.changed = now;
+      }
+    }
+  }
+  last_hash_ = hash;
+}
+
+void InputLatency::on_display(double now) {
+  if (last_display_ >= 0) {
+    record(Stage::FRAME_TIME, now - last_display_);
+  }
+  last_display_ = now;
+
+  for (size_t key = 0; pending_ >> key; ++key) {
+    if (!(pending_ & (1 << key))) {
+      continue;
+    }
+    const Press& press = presses_[key];
+    if (press.changed >= 0) {
+      record(Stage::EVENT_TO_OBSERVED, press.observed - press.event);
+      record(Stage::OBSERVED_TO_CHANGE, press.changed - press.observed);
+      record(Stage::CHANGE_TO_DISPLAY, now - press.changed);
+      record(Stage::EVENT_TO_DISPLAY, now - press.event);
+    } else if (now - press.event > kTimeout) {
+      ++timeouts_;
+    } else {
+      continue;
+    }
+    pending_ &= ~(1 << key);
+  }
+}
+
+void InputLatency::reset() {
+  *this = InputLatency();
+}
+
+void InputLatency::record(Stage stage, double seconds) {
+  histograms_[static_cast<size_t>(stage)].record(
+      seconds > 0 ? std::llround(seconds * 1e6) : 0);
+}
+
+const char* InputLatency::name(Stage stage) {
+  switch (stage) {
+    case Stage::EVENT_TO_OBSERVED:
+      return "event_to_observed";
+    case Stage::OBSERVED_TO_CHANGE:
+      return "observed_to_change";
+    case Stage::CHANGE_TO_DISPLAY:
+      return "change_to_display";
+    case Stage::EVENT_TO_DISPLAY:
+      return "event_to_display";
+    case Stage::FRAME_TIME:
+      return "frame_time";
+  }
+  return "unknown";
+}
+
+void InputLatency::write_summary(std::ostream& out) const {
+  out << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < kStages; ++i) {
+    const Histogram& histogram = histograms_[i];
+    out << std::left << std::setw(20) << name(static_cast<Stage>(i))
+        << std::right << " p50 " << std::setw(9)
+        << histogram.percentile(50) / 1000.0 << " ms, p99 " << std::setw(9)
+        << histogram.percentile(99) / 1000.0 << " ms, max " << std::setw(9)
+        << histogram.max() / 1000.0 << " ms over " << histogram.count()
+        << "\n";
+  }
+  out << timeouts_ << " presses not displayed within " << kTimeout
+      << " s\n";
+}
+
+bool InputLatency::save(const std::string& path) const {
+  std::ofstream summary(path);
+  if (!summary) {
+    logging::log(logging::Level::ERROR,
+                 "Could not write input latency to " + path);
+    return false;
+  }
+  write_summary(summary);
+  for (size_t i = 0; i < kStages; ++i) {
+    std::string stage_path =
+        path + "." + name(static_cast<Stage>(i)) + ".hgrm";
+    std::ofstream distribution(stage_path);
+    if (!distribution) {
+      logging::log(logging::Level::ERROR,
+                   "Could not write input latency to " + stage_path);
+      return false;
+    }
+    histograms_[i].write_percentiles(distribution, 1000);
+  }
+  logging::log(logging::Level::INFO, "Input latency written to " + path);
+  return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "src/cpu.h"
+#include "src/frame_buffer.h"
+#include "src/histogram.h"
+
+// Measures how long key presses take to show on screen, stage by stage:
+//
+// - from the host key event to the first instruction that sees the key
+//   pressed (Ex9E, ExA1) or that was waiting for it (Fx0A),
+// - from there to the first change of the frame about to be drawn,
+// - from there to the end of window.display(),
+//
+// along with the total and the time between displayed frames. Each stage is
+// kept in a Histogram of microseconds. Instructions are timed at the end of
+// the batch of frames they ran in, which is as close as the emulator gets
+// to the machine reading its keypad.
+//
+// Presses whose effect is not displayed within kTimeout, e.g. because the
+// game ignores the key, are dropped and counted.
+//
+// Times are in seconds, from an arbitrary origin.
+class InputLatency {
+ public:
+  enum class Stage {
+    EVENT_TO_OBSERVED,
+    OBSERVED_TO_CHANGE,
+    CHANGE_TO_DISPLAY,
+    EVENT_TO_DISPLAY,
+    FRAME_TIME,
+  };
+
+  static constexpr size_t kStages = 5;
+
+  static constexpr double kTimeout = 1;
+
+  InputLatency() = default;
+
+  // Records that |keys|, bit n being key n, were pressed on the host at
+  // |now|. Keys already being measured are ignored.
+  void on_key_event(uint16_t keys, double now);
+
+  // Takes the keys |cpu| observed since the last call, which ran until
+  // |now|. Called after every batch of emulated frames, including those run
+  // ahead.
+  void on_emulated(Cpu* cpu, double now);
+
+  // Records that |shown| is about to be drawn at |now|.
+  void on_draw(const FrameBuffer& shown, double now);
+
+  // Records that the frame drawn was displayed at |now|.
+  void on_display(double now);
+
+  void reset();
+
+  const Histogram& histogram(Stage stage) const {
+    return histograms_[static_cast<size_t>(stage)];
+  }
+
+  // The number of presses dropped after kTimeout.
+  uint64_t timeouts() const { return timeouts_; }
+
+  static const char* name(Stage stage);
+
+  // Writes the median, 99th percentile and maximum of each stage.
+  void write_summary(std::ostream& out) const;
+
+  // Writes the summary to |path|, and the distribution of each stage to
+  // |path|.<stage>.hgrm in milliseconds, in HdrHistogram's percentile
+  // format. Returns true if successful.
+  bool save(const std::string& path) const;
+
+ private:
+  struct Press {
+    double event = 0;
+    // Negative until reached.
+    double observed = -1;
+    double changed = -1;
+  };
+
+  void record(Stage stage, double seconds);
+
+  // The keys being measured.
+  uint16_t pending_ = 0;
+  std::array<Press, 16> presses_;
+
+  uint64_t last_hash_ = 0;
+  double last_display_ = -1;
+
+  std::array<Histogram, kStages> histograms_;
+  uint64_t timeouts_ = 0;
+};
@@ -0,0 +1,88 @@
+#include "src/live_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/cpu.h"
+#include "src/fast_forward.h"
+
+LiveStats::LiveStats(double now, uint64_t frames_run)
+    : last_frame_(now), window_start_(now), window_frames_run_(frames_run) {}
+
+void LiveStats::restart_drift(double now, double speed) {
+  drift_start_ = now;
+  drift_speed_ = speed;
+  drift_ticks_ = 0;
+  timer_drift_.reset();
+}
+
+void LiveStats::add_emulation(double seconds, uint64_t ticks) {
+  window_emulation_ += seconds;
+  drift_ticks_ += ticks;
+}
+
+void LiveStats::add_render(double seconds) {
+  window_render_ += seconds;
+}
+
+void LiveStats::add_display(double seconds) {
+  window_display_ += seconds;
+}
+
+bool LiveStats::end_frame(double now, uint64_t frames_run) {
+  history_[(history_start_ + history_size_) % kHistory] = now - last_frame_;
+  if (history_size_ < kHistory) {
+    ++history_size_;
+  } else {
+    history_start_ = (history_start_ + 1) % kHistory;
+  }
+  last_frame_ = now;
+  ++window_frames_;
+
+  if (now - window_start_ < kRefreshInterval) {
+    return false;
+  }
+  refresh(now, frames_run);
+  return true;
+}
+
+double LiveStats::frame_time(size_t i) const {
+  return history_[(history_start_ + i) % kHistory];
+}
+
+void LiveStats::refresh(double now, uint64_t frames_run) {
+  double elapsed = now - window_start_;
+  frames_per_second_ = window_frames_ / elapsed;
+  instructions_per_second_ = (frames_run - window_frames_run_) *
+                             Cpu::kInstructionsPerFrame / elapsed;
+  emulation_time_ = window_emulation_ / window_frames_;
+  render_time_ = window_render_ / window_frames_;
+  display_time_ = window_display_ / window_frames_;
+
+  std::array<double, kHistory> sorted;
+  for (size_t i = 0; i < history_size_; ++i) {
+    sorted[i] = frame_time(i);
+  }
+  std::sort(sorted.begin(), sorted.begin() + history_size_);
+  min_frame_time_ = sorted[0];
+  double total = 0;
+  for (size_t i = 0; i < history_size_; ++i) {
+    total += sorted[i];
+  }
+  average_frame_time_ = total / history_size_;
+  size_t p99 = static_cast<size_t>(std::ceil(0.99 * history_size_)) - 1;
+  p99_frame_time_ = sorted[p99];
+
+  if (drift_speed_ != FastForward::kUnbounded) {
+    timer_drift_ =
+        drift_ticks_ / (FastForward::kFrameRate * drift_speed_) -
+        (now - drift_start_);
+  }
+
+  window_start_ = now;
+  window_frames_run_ = frames_run;
+  window_frames_ = 0;
+  window_emulation_ = 0;
+  window_render_ = 0;
+  window_display_ = 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Measures the emulator while it runs, for the performance overlay.
+//
+// The caller reports where the time of each presented frame went. Frame
+// times are kept for the last kHistory frames, while the other figures are
+// averaged and refreshed every kRefreshInterval, so that they can be read.
+//
+// Times are in seconds, from an arbitrary origin.
+class LiveStats {
+ public:
+  // The number of frame times kept.
+  static constexpr size_t kHistory = 120;
+
+  // How often the figures are refreshed.
+  static constexpr double kRefreshInterval = 0.5;
+
+  // Starts measuring at |now|, when Cpu::frames_run() is |frames_run|.
+  explicit LiveStats(double now = 0, uint64_t frames_run = 0);
+
+  // Measures timer drift from |now| on, against timers ticking at |speed|
+  // times 60 Hz, or not at all if |speed| is FastForward::kUnbounded.
+  void restart_drift(double now, double speed);
+
+  // Records |seconds| spent emulating, which moved the shown game |ticks|
+  // frames, i.e. timer ticks, forward.
+  void add_emulation(double seconds, uint64_t ticks);
+
+  // Records |seconds| spent drawing.
+  void add_render(double seconds);
+
+  // Records |seconds| spent displaying, including waiting for vsync or the
+  // frame rate limit.
+  void add_display(double seconds);
+
+  // Ends the frame presented at |now|. |frames_run| is Cpu::frames_run(),
+  // which also counts the frames emulated by run-ahead and rollbacks.
+  // Returns true if the figures below were refreshed.
+  bool end_frame(double now, uint64_t frames_run);
+
+  // The times between the last presented frames, oldest first.
+  size_t frame_times() const { return history_size_; }
+  double frame_time(size_t i) const;
+
+  double frames_per_second() const { return frames_per_second_; }
+  double instructions_per_second() const { return instructions_per_second_; }
+  double min_frame_time() const { return min_frame_time_; }
+  double average_frame_time() const { return average_frame_time_; }
+  double p99_frame_time() const { return p99_frame_time_; }
+
+  // How far the timers are ahead of the wall clock, or empty if drift is not
+  // being measured.
+  std::optional<double> timer_drift() const { return timer_drift_; }
+
+  // The average time per presented frame spent on each part.
+  double emulation_time() const { return emulation_time_; }
+  double render_time() const { return render_time_; }
+  double display_time() const { return display_time_; }
+
+ private:
+  void refresh(double now, uint64_t frames_run);
+
+  double last_frame_;
+  std::array<double, kHistory> history_ = {};
+  size_t history_start_ = 0;
+  size_t history_size_ = 0;
+
+  // Since the figures were last refreshed.
+  double window_start_;
+  uint64_t window_frames_run_;
+  uint64_t window_frames_ = 0;
+  double window_emulation_ = 0;
+  double window_render_ = 0;
+  double window_display_ = 0;
+
+  double drift_start_ = 0;
+  double drift_speed_ = 0;
+  uint64_t drift_ticks_ = 0;
+
+  double frames_per_second_ = 0;
+  double instructions_per_second_ = 0;
+  double min_frame_time_ = 0;
+  double average_frame_time_ = 0;
+  double p99_frame_time_ = 0;
+  std::optional<double> timer_drift_;
+  double emulation_time_ = 0;
+  double render_time_ = 0;
+  double display_time_ = 0;
+};
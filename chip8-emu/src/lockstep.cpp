@@ -0,0 +1,285 @@
+#include "src/lockstep.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "src/disassembler.h"
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+constexpr struct {
+  Lockstep::Granularity granularity;
+  const char* name;
+} kGranularities[] = {
+    {Lockstep::Granularity::INSTRUCTION, "instruction"},
+    {Lockstep::Granularity::BLOCK, "block"},
+    {Lockstep::Granularity::FRAME, "frame"},
+};
+
+// The most differing memory bytes listed one by one.
+constexpr int kMaxMemoryDifferences = 4;
+
+uint16_t fetch(const Cpu& cpu) {
+  return static_cast<uint16_t>(cpu.peek(cpu.pc() & Cpu::kMaxMemory) << 8) |
+         cpu.peek((cpu.pc() + 1) & Cpu::kMaxMemory);
+}
+
+// Compares the registers of |reference| and |engine|, and their random number
+// generators, which an engine drawing numbers too often or too rarely only
+// shows in the registers later on.
+bool same_registers(const Cpu& reference, const Cpu& engine) {
+  const Cpu::Registers& a = reference.registers();
+  const Cpu::Registers& b = engine.registers();
+  return reference.random_state() == engine.random_state() &&
+         std::equal(std::begin(a.v), std::end(a.v), std::begin(b.v)) &&
+         a.index == b.index && a.sp == b.sp &&
+         std::equal(std::begin(a.stack), std::end(a.stack),
+                    std::begin(b.stack)) &&
+         a.delay == b.delay && a.sound == b.sound && a.pc == b.pc &&
+         a.waiting_for_key_press == b.waiting_for_key_press &&
+         a.key_store_register == b.key_store_register;
+}
+
+void add_difference(const std::string& name, uint32_t reference,
+                    uint32_t engine, size_t digits,
+                    std::vector<std::string>* differences) {
+  if (reference != engine) {
+    differences->push_back(name + ": " + tohex(reference, digits) +
+                           " (reference) != " + tohex(engine, digits) +
+                           " (engine)");
+  }
+}
+
+}  // namespace
+
+const char* granularity_name(Lockstep::Granularity granularity) {
+  for (const auto& entry : kGranularities) {
+    if (entry.granularity == granularity) {
+      return entry.name;
+    }
+  }
+  return "unknown";
+}
+
+bool parse_granularity(const std::string& name,
+                       Lockstep::Granularity* granularity) {
+  for (const auto& entry : kGranularities) {
+    if (name == entry.name) {
+      *granularity = entry.granularity;
+      return true;
+    }
+  }
+  logging::log(logging::Level::ERROR,
+               "Unknown verification granularity " + name +
+                   ", expected instruction, block or frame");
+  return false;
+}
+
+std::vector<std::string> state_differences(const Cpu::State& reference,
+                                           const Cpu::State& engine) {
+  const Cpu::Registers& a = reference.registers;
+  const Cpu::Registers& b = engine.registers;
+  std::vector<std::string> differences;
+  add_difference("PC", a.pc, b.pc, 3, &differences);
+  for (int i = 0; i < 16; ++i) {
+    add_difference(std::string("V") + "0123456789ABCDEF"[i], a.v[i], b.v[i],
+                   2, &differences);
+  }
+  add_difference("I", a.index, b.index, 3, &differences);
+  add_difference("SP", a.sp, b.sp, 2, &differences);
+  for (unsigned int i = 0; i < std::max(a.sp, b.sp) && i < Cpu::kStackSize;
+       ++i) {
+    add_difference("stack[" + std::to_string(i) + "]", a.stack[i],
+                   b.stack[i], 3, &differences);
+  }
+  add_difference("DT", a.delay, b.delay, 2, &differences);
+  add_difference("ST", a.sound, b.sound, 2, &differences);
+  add_difference("waiting for key", a.waiting_for_key_press,
+                 b.waiting_for_key_press, 1, &differences);
+  add_difference("key register", a.key_store_register, b.key_store_register,
+                 1, &differences);
+
+  int memory_differences = 0;
+  for (unsigned int address = 0; address <= Cpu::kMaxMemory; ++address) {
+    if (reference.memory[address] == engine.memory[address]) {
+      continue;
+    }
+    if (++memory_differences <= kMaxMemoryDifferences) {
+      add_difference("memory[" + tohex(address, 3) + "]",
+                     reference.memory[address], engine.memory[address], 2,
+                     &differences);
+    }
+  }
+  if (memory_differences > kMaxMemoryDifferences) {
+    differences.push_back(
+        "and " +
+        std::to_string(memory_differences - kMaxMemoryDifferences) +
+        " more memory bytes");
+  }
+  if (reference.frame_buffer.hash() != engine.frame_buffer.hash()) {
+    differences.push_back("screen");
+  }
+  add_difference("random state", reference.random_state, engine.random_state,
+                 8, &differences);
+  return differences;
+}
+
+Lockstep::Lockstep(Cpu* reference, Cpu* engine, Granularity granularity)
+    : reference_(reference),
+      engine_(engine),
+      granularity_(granularity),
+      frame_start_(std::make_unique<Cpu::State>()) {
+  reference_->set_engine(nullptr);
+}
+
+Lockstep::~Lockstep() = default;
+
+bool Lockstep::run_frame() {
+  if (divergence_) {
+    return false;
+  }
+  reference_->save_state(frame_start_.get());
+  for (unsigned int instruction = 0;
+       instruction < Cpu::kInstructionsPerFrame;) {
+    unsigned int count = run_chunk(instruction);
+    if (count == 0) {
+      return false;
+    }
+    instruction += count;
+  }
+  reference_->end_frame();
+  engine_->end_frame();
+  if (!same_registers(*reference_, *engine_) || !same_memory_and_screen()) {
+    find_divergence(Cpu::kInstructionsPerFrame, true, true);
+    return false;
+  }
+  ++frame_;
+  return true;
+}
+
+unsigned int Lockstep::run_chunk(unsigned int instruction) {
+  unsigned int remaining = Cpu::kInstructionsPerFrame - instruction;
+  unsigned int count = 0;
+  bool reference_result;
+  if (granularity_ == Granularity::FRAME) {
+    count = remaining;
+    reference_result = reference_->run(count);
+  } else {
+    do {
+      uint16_t opcode = fetch(*reference_);
+      bool waiting = reference_->waiting_for_key_press();
+      reference_result = reference_->step();
+      ++count;
+      if (granularity_ == Granularity::INSTRUCTION ||
+          (!waiting && is_branch(opcode))) {
+        break;
+      }
+    } while (reference_result && count < remaining);
+  }
+  bool engine_result = engine_->run(count);
+
+  if (reference_result != engine_result ||
+      !same_registers(*reference_, *engine_)) {
+    find_divergence(instruction + count, reference_result, engine_result);
+    return 0;
+  }
+  // Both failed alike.
+  if (!reference_result) {
+    return 0;
+  }
+  return count;
+}
+
+bool Lockstep::same_memory_and_screen() {
+  uint64_t lines = reference_->dirty_lines() | engine_->dirty_lines();
+  reference_->clear_dirty_lines();
+  engine_->clear_dirty_lines();
+  for (unsigned int line = 0; line < Cpu::kCacheLines; ++line) {
+    if (!((lines >> line) & 1)) {
+      continue;
+    }
+    for (unsigned int address = line * Cpu::kCacheLineSize;
+         address < (line + 1) * Cpu::kCacheLineSize; ++address) {
+      if (reference_->peek(address) != engine_->peek(address)) {
+        return false;
+      }
+    }
+  }
+  return reference_->frame_buffer()->hash() ==
+         engine_->frame_buffer()->hash();
+}
+
+void Lockstep::find_divergence(unsigned int noticed_at, bool reference_result,
+                               bool engine_result) {
+  // What was noticed, in case it cannot be narrowed down.
+  auto reference_state = std::make_unique<Cpu::State>();
+  auto engine_state = std::make_unique<Cpu::State>();
+  reference_->save_state(reference_state.get());
+  engine_->save_state(engine_state.get());
+  divergence_ = Divergence();
+  divergence_->frame = frame_;
+  divergence_->instruction = noticed_at - 1;
+  divergence_->pc = frame_start_->registers.pc;
+  divergence_->reference_result = reference_result;
+  divergence_->engine_result = engine_result;
+  divergence_->differences =
+      state_differences(*reference_state, *engine_state);
+  divergence_->reproduced = false;
+
+  reference_->load_state(*frame_start_);
+  engine_->load_state(*frame_start_);
+  for (unsigned int instruction = 0; instruction < noticed_at;
+       ++instruction) {
+    uint16_t pc = reference_->pc();
+    uint16_t opcode = fetch(*reference_);
+    reference_result = reference_->step();
+    engine_result = engine_->run(1);
+    reference_->save_state(reference_state.get());
+    engine_->save_state(engine_state.get());
+    std::vector<std::string> differences =
+        state_differences(*reference_state, *engine_state);
+    if (reference_result != engine_result || !differences.empty()) {
+      divergence_->instruction = instruction;
+      divergence_->pc = pc;
+      divergence_->opcode = opcode;
+      divergence_->reference_result = reference_result;
+      divergence_->engine_result = engine_result;
+      divergence_->differences = differences;
+      divergence_->reproduced = true;
+      return;
+    }
+    if (!reference_result) {
+      break;
+    }
+  }
+}
+
+std::string Lockstep::report() const {
+  if (!divergence_) {
+    return "";
+  }
+  std::ostringstream out;
+  out << "The engine diverged from the reference at frame "
+      << divergence_->frame << ", instruction " << divergence_->instruction;
+  if (divergence_->reproduced) {
+    out << ", " << tohex(divergence_->pc, 3) << ": "
+        << tohex(divergence_->opcode) << " "
+        << disassemble(divergence_->opcode);
+  } else {
+    out << ", not reproduced one instruction at a time from "
+        << tohex(divergence_->pc, 3);
+  }
+  out << "\n";
+  if (divergence_->reference_result != divergence_->engine_result) {
+    out << "  the instruction "
+        << (divergence_->reference_result ? "failed only on the engine"
+                                          : "failed only on the reference")
+        << "\n";
+  }
+  for (const std::string& difference : divergence_->differences) {
+    out << "  " << difference << "\n";
+  }
+  return out.str();
+}
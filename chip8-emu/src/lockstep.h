@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "src/cpu.h"
+
+// Runs a Cpu on an execution engine in lockstep with a Cpu stepping every
+// instruction through the reference interpreter, and stops where they first
+// differ.
+//
+// Registers are compared every instruction, every block or every frame, and
+// memory and the screen at the end of every frame, only where either
+// machine wrote. On a difference the frame is run again from its start, one
+// instruction at a time comparing everything, to find the first instruction
+// that went wrong.
+class Lockstep {
+ public:
+  enum class Granularity {
+    INSTRUCTION,
+    // Up to and including the next jump, call, return or skip.
+    BLOCK,
+    FRAME,
+  };
+
+  // Where the machines first differ, and how.
+  struct Divergence {
+    // The frame, counted from the first run_frame(), and the instruction
+    // within it.
+    uint64_t frame = 0;
+    unsigned int instruction = 0;
+    // The instruction that went wrong and its address.
+    uint16_t pc = 0;
+    uint16_t opcode = 0;
+    // Whether the instruction succeeded on each machine.
+    bool reference_result = true;
+    bool engine_result = true;
+    // Every difference, e.g. "VF: 0x01 (reference) != 0x00 (engine)".
+    std::vector<std::string> differences;
+    // False if running the frame again one instruction at a time did not
+    // reproduce it, in which case it is where it was first noticed.
+    bool reproduced = true;
+  };
+
+  // |reference| and |engine| must be in the same state, read the same
+  // keyboard and outlive this instance. |reference| is set to step every
+  // instruction, |engine| runs on its own engine. Uses and clears the dirty
+  // lines of both.
+  Lockstep(Cpu* reference, Cpu* engine, Granularity granularity);
+  ~Lockstep();
+
+  // Runs the next frame on both machines. Returns false if they diverge, in
+  // which case divergence() tells how, or if they both fail.
+  bool run_frame();
+
+  const std::optional<Divergence>& divergence() const { return divergence_; }
+
+  // Describes the divergence, if any, over a few lines.
+  std::string report() const;
+
+ private:
+  // Runs the next instructions of the frame, starting with the
+  // |instruction|th, on both machines. Returns the number run, or 0 if the
+  // machines diverge or fail.
+  unsigned int run_chunk(unsigned int instruction);
+
+  // Finds the first instruction of the frame where the machines differ,
+  // from the state saved at its start.
+  void find_divergence(unsigned int noticed_at, bool reference_result,
+                       bool engine_result);
+
+  bool same_memory_and_screen();
+
+  Cpu* reference_;
+  Cpu* engine_;
+  const Granularity granularity_;
+  std::unique_ptr<Cpu::State> frame_start_;
+  uint64_t frame_ = 0;
+  std::optional<Divergence> divergence_;
+};
+
+// Returns the name of |granularity| as given to --verify, e.g. "block".
+const char* granularity_name(Lockstep::Granularity granularity);
+
+// Parses a granularity name into |granularity|. Returns false, after logging
+// why, if there is no such granularity.
+bool parse_granularity(const std::string& name,
+                       Lockstep::Granularity* granularity);
+
+// Returns the differences between |reference| and |engine|, e.g.
+// "VF: 0x01 (reference) != 0x00 (engine)", or nothing if they are equal.
+std::vector<std::string> state_differences(const Cpu::State& reference,
+                                           const Cpu::State& engine);
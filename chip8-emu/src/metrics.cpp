@@ -0,0 +1,189 @@
+#include "src/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/fast_forward.h"
+
+namespace {
+
+void write_header(std::ostream& out, const char* name, const char* type,
+                  const char* help) {
+  out << "# HELP " << name << " " << help << "\n# TYPE " << name << " "
+      << type << "\n";
+}
+
+}  // namespace
+
+Metrics::Metrics()
+    : instruction_counts_(std::make_unique<Cpu::InstructionCounts>()) {
+  for (auto& counter : counters_) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  for (auto& count : opcode_counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  for (size_t tier = 0; tier < kTiers; ++tier) {
+    tier_instructions_[tier].store(0, std::memory_order_relaxed);
+    tier_promotions_[tier].store(0, std::memory_order_relaxed);
+  }
+  instruction_counts_->fill(0);
+}
+
+Metrics::~Metrics() {
+  detach();
+}
+
+void Metrics::attach(Cpu* cpu, const TieredEngine* tiers) {
+  detach();
+  cpu_ = cpu;
+  frames_run_ = cpu->frames_run();
+  tiers_ = tiers;
+  if (tiers) {
+    tier_counters_ = tiers->counters();
+  } else {
+    cpu->set_instruction_counts(instruction_counts_.get());
+  }
+}
+
+void Metrics::detach() {
+  if (!cpu_) {
+    return;
+  }
+  publish();
+  cpu_->set_instruction_counts(nullptr);
+  cpu_ = nullptr;
+  tiers_ = nullptr;
+}
+
+void Metrics::on_presented(double now) {
+  if (last_presented_ >= 0) {
+    double frame_time = now - last_presented_;
+    double refreshes = frame_time * FastForward::kFrameRate;
+    if (refreshes > kDroppedFrameThreshold) {
+      add(Counter::DROPPED_FRAMES, std::lround(refreshes) - 1);
+    }
+    frame_times_.record(std::llround(frame_time * 1e6));
+  }
+  last_presented_ = now;
+
+  if (window_start_ < 0) {
+    window_start_ = now;
+  } else if (now - window_start_ >= kFrameTimeWindow) {
+    p99_frame_time_.store(frame_times_.percentile(99) / 1e6,
+                          std::memory_order_relaxed);
+    frame_times_.reset();
+    window_start_ = now;
+  }
+  update(now);
+}
+
+void Metrics::update(double now) {
+  if (now - last_publish_ < kPublishInterval) {
+    return;
+  }
+  last_publish_ = now;
+  publish();
+}
+
+void Metrics::publish() {
+  if (!cpu_) {
+    return;
+  }
+  add(Counter::FRAMES, cpu_->frames_run() - frames_run_);
+  frames_run_ = cpu_->frames_run();
+
+  if (tiers_) {
+    const TieredEngine::Counters& counters = tiers_->counters();
+    uint64_t instructions = 0;
+    for (size_t tier = 0; tier < kTiers; ++tier) {
+      uint64_t added =
+          counters.instructions[tier] - tier_counters_.instructions[tier];
+      tier_instructions_[tier].fetch_add(added, std::memory_order_relaxed);
+      tier_promotions_[tier].fetch_add(
+          counters.promotions[tier] - tier_counters_.promotions[tier],
+          std::memory_order_relaxed);
+      instructions += added;
+    }
+    add(Counter::INSTRUCTIONS, instructions);
+    add(Counter::TIER_DEMOTIONS,
+        counters.demotions - tier_counters_.demotions);
+    tier_counters_ = counters;
+    return;
+  }
+
+  // Most ROMs only ever run a few hundred different words.
+  uint64_t instructions = 0;
+  for (size_t word = 0; word < instruction_counts_->size(); ++word) {
+    uint32_t count = (*instruction_counts_)[word];
+    if (count == 0) {
+      continue;
+    }
+    opcode_counts_[static_cast<size_t>(opcode_class(word))].fetch_add(
+        count, std::memory_order_relaxed);
+    instructions += count;
+  }
+  instruction_counts_->fill(0);
+  add(Counter::INSTRUCTIONS, instructions);
+}
+
+void Metrics::write(std::ostream& out) const {
+  write_header(out, "chip8_frames_total", "counter", "Frames emulated.");
+  out << "chip8_frames_total " << get(Counter::FRAMES) << "\n";
+  write_header(out, "chip8_instructions_total", "counter",
+               "Instructions executed.");
+  out << "chip8_instructions_total " << get(Counter::INSTRUCTIONS) << "\n";
+  write_header(out, "chip8_dropped_frames_total", "counter",
+               "Display refreshes missed between presented frames.");
+  out << "chip8_dropped_frames_total " << get(Counter::DROPPED_FRAMES)
+      << "\n";
+  write_header(out, "chip8_key_events_total", "counter",
+               "Key presses of the CHIP-8 keypad.");
+  out << "chip8_key_events_total " << get(Counter::KEY_EVENTS) << "\n";
+  write_header(out, "chip8_load_errors_total", "counter",
+               "ROMs that could not be loaded.");
+  out << "chip8_load_errors_total " << get(Counter::LOAD_ERRORS) << "\n";
+
+  write_header(out, "chip8_opcode_instructions_total", "counter",
+               "Instructions executed by opcode.");
+  for (size_t i = 0; i < kOpcodeClasses; ++i) {
+    OpcodeClass opcode_class = static_cast<OpcodeClass>(i);
+    out << "chip8_opcode_instructions_total{opcode=\""
+        << (opcode_class == OpcodeClass::UNKNOWN
+                ? "unknown"
+                : opcode_pattern(opcode_class))
+        << "\"} " << opcode_count(opcode_class) << "\n";
+  }
+
+  write_header(out, "chip8_tier_instructions_total", "counter",
+               "Instructions executed by the tiered engine, by tier.");
+  for (size_t i = 0; i < kTiers; ++i) {
+    Tier tier = static_cast<Tier>(i);
+    out << "chip8_tier_instructions_total{tier=\"" << tier_name(tier)
+        << "\"} " << tier_instructions(tier) << "\n";
+  }
+  write_header(out, "chip8_tier_promotions_total", "counter",
+               "Blocks the tiered engine promoted, by the tier promoted to.");
+  for (size_t i = 1; i < kTiers; ++i) {
+    Tier tier = static_cast<Tier>(i);
+    out << "chip8_tier_promotions_total{tier=\"" << tier_name(tier)
+        << "\"} " << tier_promotions(tier) << "\n";
+  }
+  write_header(out, "chip8_tier_demotions_total", "counter",
+               "Blocks the tiered engine demoted as their memory was "
+               "written.");
+  out << "chip8_tier_demotions_total " << get(Counter::TIER_DEMOTIONS)
+      << "\n";
+
+  write_header(out, "chip8_frame_time_p99_seconds", "gauge",
+               "99th percentile time between presented frames over the "
+               "last 10 seconds.");
+  double p99 = p99_frame_time();
+  out << "chip8_frame_time_p99_seconds ";
+  if (p99 < 0) {
+    out << "NaN";
+  } else {
+    out << p99;
+  }
+  out << "\n";
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "src/cpu.h"
+#include "src/disassembler.h"
+#include "src/histogram.h"
+#include "src/tiered_engine.h"
+
+// Counters of a long running emulator, written in the Prometheus text
+// format for MetricsServer to serve.
+//
+// Only the emulation thread counts, so the published values are relaxed
+// atomics that it alone writes and any thread may read. Instructions are
+// counted per instruction word by the Cpu and its engine, without atomics,
+// and gathered into opcode counts every kPublishInterval. When the Cpu runs
+// a TieredEngine, its tier counters are published instead.
+//
+// Times are in seconds, from an arbitrary origin.
+class Metrics {
+ public:
+  enum class Counter {
+    FRAMES,
+    INSTRUCTIONS,
+    DROPPED_FRAMES,
+    KEY_EVENTS,
+    LOAD_ERRORS,
+    TIER_DEMOTIONS,
+  };
+
+  static constexpr size_t kCounters = 6;
+
+  // How often the instructions counted by the Cpu are published.
+  static constexpr double kPublishInterval = 1;
+
+  // The 99th percentile frame time is over this long.
+  static constexpr double kFrameTimeWindow = 10;
+
+  // A frame presented more than this many refreshes after the previous one
+  // counts the refreshes in between as dropped.
+  static constexpr double kDroppedFrameThreshold = 1.5;
+
+  Metrics();
+  ~Metrics();
+
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  // Counts the frames and instructions |cpu| runs, until detach(). |cpu|
+  // must outlive this instance or be detached. If |tiers| is the engine of
+  // |cpu|, instructions are counted by tier rather than by opcode, and it
+  // must outlive this instance or be detached too.
+  void attach(Cpu* cpu, const TieredEngine* tiers = nullptr);
+
+  // Publishes what the attached Cpu ran and stops counting it.
+  void detach();
+
+  void add(Counter counter, uint64_t value = 1) {
+    counters_[static_cast<size_t>(counter)].fetch_add(
+        value, std::memory_order_relaxed);
+  }
+
+  // Records a frame presented at |now|, then calls update().
+  void on_presented(double now);
+
+  // Publishes what the attached Cpu ran, if kPublishInterval has passed
+  // since the last time. Called once per frame.
+  void update(double now);
+
+  // The following may be called from any thread.
+
+  uint64_t get(Counter counter) const {
+    return counters_[static_cast<size_t>(counter)].load(
+        std::memory_order_relaxed);
+  }
+
+  uint64_t opcode_count(OpcodeClass opcode_class) const {
+    return opcode_counts_[static_cast<size_t>(opcode_class)].load(
+        std::memory_order_relaxed);
+  }
+
+  uint64_t tier_instructions(Tier tier) const {
+    return tier_instructions_[static_cast<size_t>(tier)].load(
+        std::memory_order_relaxed);
+  }
+
+  uint64_t tier_promotions(Tier tier) const {
+    return tier_promotions_[static_cast<size_t>(tier)].load(
+        std::memory_order_relaxed);
+  }
+
+  // The 99th percentile time between presented frames over the last full
+  // kFrameTimeWindow, or a negative value until there is one.
+  double p99_frame_time() const {
+    return p99_frame_time_.load(std::memory_order_relaxed);
+  }
+
+  // Writes every metric in the Prometheus text exposition format.
+  void write(std::ostream& out) const;
+
+ private:
+  void publish();
+
+  std::array<std::atomic<uint64_t>, kCounters> counters_;
+  std::array<std::atomic<uint64_t>, kOpcodeClasses> opcode_counts_;
+  std::array<std::atomic<uint64_t>, kTiers> tier_instructions_;
+  std::array<std::atomic<uint64_t>, kTiers> tier_promotions_;
+  std::atomic<double> p99_frame_time_{-1};
+
+  // Owned by the emulation thread.
+  Cpu* cpu_ = nullptr;
+  std::unique_ptr<Cpu::InstructionCounts> instruction_counts_;
+  const TieredEngine* tiers_ = nullptr;
+  // The counters of |tiers_| when last published.
+  TieredEngine::Counters tier_counters_;
+  uint64_t frames_run_ = 0;
+  double last_publish_ = 0;
+  double last_presented_ = -1;
+  // Frame times in microseconds since |window_start_|.
+  Histogram frame_times_;
+  double window_start_ = -1;
+};
@@ -0,0 +1,98 @@
+#include "src/metrics_server.h"
+
+#include <sstream>
+#include <string>
+
+#include "src/logging.h"
+
+namespace {
+
+// How often the server checks whether it should stop.
+constexpr int kPollIntervalMs = 100;
+
+// Requests are never larger than this.
+constexpr size_t kMaxRequestSize = 4096;
+
+bool send_response(sf::TcpSocket* client, const std::string& status,
+                   const std::string& content_type, const std::string& body) {
+  std::string response = "HTTP/1.0 " + status +
+                         "\r\nContent-Type: " + content_type +
+                         "\r\nContent-Length: " +
+                         std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  return client->send(response.data(), response.size()) == sf::Socket::Done;
+}
+
+}  // namespace
+
+MetricsServer::MetricsServer(const Metrics* metrics) : metrics_(metrics) {}
+
+MetricsServer::~MetricsServer() {
+  stop();
+}
+
+bool MetricsServer::start(unsigned short port) {
+  stop();
+  if (listener_.listen(port, sf::IpAddress::LocalHost) != sf::Socket::Done) {
+    logging::log(logging::Level::ERROR,
+                 "Could not serve metrics on port " + std::to_string(port));
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread(&MetricsServer::run, this);
+  logging::log(logging::Level::INFO,
+               "Serving metrics on http://127.0.0.1:" +
+                   std::to_string(this->port()) + "/metrics");
+  return true;
+}
+
+void MetricsServer::stop() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  listener_.close();
+}
+
+void MetricsServer::run() {
+  sf::SocketSelector selector;
+  selector.add(listener_);
+  while (running_) {
+    if (!selector.wait(sf::milliseconds(kPollIntervalMs))) {
+      continue;
+    }
+    sf::TcpSocket client;
+    if (listener_.accept(client) == sf::Socket::Done) {
+      serve(&client);
+    }
+  }
+}
+
+void MetricsServer::serve(sf::TcpSocket* client) {
+  // Reads up to the end of the headers, giving up on slow clients so that
+  // stop() is never held up for long.
+  sf::SocketSelector selector;
+  selector.add(*client);
+  std::string request;
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < kMaxRequestSize) {
+    if (!selector.wait(sf::milliseconds(kRequestTimeoutMs))) {
+      return;
+    }
+    char buffer[512];
+    size_t received;
+    if (client->receive(buffer, sizeof(buffer), received) !=
+        sf::Socket::Done) {
+      return;
+    }
+    request.append(buffer, received);
+  }
+
+  if (request.rfind("GET /metrics ", 0) != 0) {
+    send_response(client, "404 Not Found", "text/plain", "Not found\n");
+    return;
+  }
+  std::ostringstream body;
+  metrics_->write(body);
+  send_response(client, "200 OK", "text/plain; version=0.0.4", body.str());
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include <SFML/Network.hpp>
+
+#include "src/metrics.h"
+
+// Serves Metrics over HTTP on localhost, for Prometheus to scrape, from a
+// thread of its own. GET /metrics answers with every metric, anything else
+// with 404.
+//
+// Clients are served one at a time. The thread only reads the metrics, so
+// it never holds up the emulation thread.
+class MetricsServer {
+ public:
+  // How long a client has to send its request.
+  static constexpr int kRequestTimeoutMs = 1000;
+
+  // |metrics| must outlive this instance.
+  explicit MetricsServer(const Metrics* metrics);
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  // Starts serving on 127.0.0.1:|port|, or on a free port if 0. Returns
+  // false, after logging why, if the port cannot be listened on.
+  bool start(unsigned short port);
+
+  // Stops serving, waiting for the current client if any.
+  void stop();
+
+  // The port being listened on.
+  unsigned short port() const { return listener_.getLocalPort(); }
+
+ private:
+  void run();
+
+  void serve(sf::TcpSocket* client);
+
+  const Metrics* metrics_;
+  sf::TcpListener listener_;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+};
@@ -0,0 +1,207 @@
+#include "src/movie.h"
+
+#include <algorithm>
+
+#include "src/binary_io.h"
+#include "src/logging.h"
+
+namespace {
+
+constexpr uint32_t kMagic = 0x564d3843;  // "C8MV".
+constexpr uint32_t kVersion = 1;
+
+void write_state(const Cpu::State& state, BinaryWriter* writer) {
+  const Cpu::Registers& registers = state.registers;
+  writer->bytes(registers.v, sizeof(registers.v));
+  writer->u16(registers.index);
+  for (uint16_t address : registers.stack) {
+    writer->u16(address);
+  }
+  writer->u8(registers.sp);
+  writer->u8(registers.delay);
+  writer->u8(registers.sound);
+  writer->u16(registers.pc);
+  writer->u8(registers.waiting_for_key_press);
+  writer->u8(registers.key_store_register);
+  writer->bytes(state.memory, sizeof(state.memory));
+  for (uint8_t x = 0; x < FrameBuffer::kScreenWidth; ++x) {
+    writer->u32(state.frame_buffer.column(x));
+  }
+  writer->u32(state.random_state);
+}
+
+void read_state(BinaryReader* reader, Cpu::State* state) {
+  Cpu::Registers& registers = state->registers;
+  reader->bytes(registers.v, sizeof(registers.v));
+  registers.index = reader->u16();
+  for (uint16_t& address : registers.stack) {
+    address = reader->u16();
+  }
+  registers.sp = reader->u8();
+  registers.delay = reader->u8();
+  registers.sound = reader->u8();
+  registers.pc = reader->u16();
+  registers.waiting_for_key_press = reader->u8();
+  registers.key_store_register = reader->u8();
+  reader->bytes(state->memory, sizeof(state->memory));
+  state->frame_buffer.clear_screen();
+  for (uint8_t x = 0; x < FrameBuffer::kScreenWidth; ++x) {
+    state->frame_buffer.xor_column(x, reader->u32());
+  }
+  state->dirty_lines = ~0ull;
+  state->random_state = reader->u32();
+}
+
+}  // namespace
+
+bool save_movie(const Movie& movie, const std::string& path) {
+  BinaryWriter writer;
+  writer.u32(kMagic);
+  writer.u32(kVersion);
+  writer.u64(movie.rom_hash);
+  writer.u32(movie.seed);
+  writer.u32(movie.quirks);
+  writer.u32(movie.keyframe_interval);
+
+  writer.u32(movie.frames.size());
+  for (const Movie::Frame& frame : movie.frames) {
+    writer.u16(frame.keys);
+    writer.u64(frame.frame_buffer_hash);
+  }
+
+  writer.u32(movie.keyframes.size());
+  for (const Movie::Keyframe& keyframe : movie.keyframes) {
+    writer.u32(keyframe.frame);
+    writer.u16(keyframe.keys);
+    write_state(*keyframe.state, &writer);
+  }
+  return writer.save(path);
+}
+
+bool load_movie(const std::string& path, Movie* movie) {
+  std::vector<uint8_t> contents;
+  if (!read_file(path, &contents)) {
+    return false;
+  }
+  BinaryReader reader(contents.data(), contents.size());
+  if (reader.u32() != kMagic || reader.u32() != kVersion) {
+    logging::log(logging::Level::ERROR, path + " is not a supported movie");
+    return false;
+  }
+  movie->rom_hash = reader.u64();
+  movie->seed = reader.u32();
+  movie->quirks = reader.u32();
+  movie->keyframe_interval = reader.u32();
+
+  uint32_t frames = reader.u32();
+  movie->frames.clear();
+  for (uint32_t i = 0; i < frames && reader.ok(); ++i) {
+    Movie::Frame frame;
+    frame.keys = reader.u16();
+    frame.frame_buffer_hash = reader.u64();
+    movie->frames.push_back(frame);
+  }
+
+  uint32_t keyframes = reader.u32();
+  movie->keyframes.clear();
+  for (uint32_t i = 0; i < keyframes && reader.ok(); ++i) {
+    Movie::Keyframe keyframe;
+    keyframe.frame = reader.u32();
+    keyframe.keys = reader.u16();
+    keyframe.state = std::make_unique<Cpu::State>();
+    read_state(&reader, keyframe.state.get());
+    movie->keyframes.push_back(std::move(keyframe));
+  }
+
+  if (!reader.ok() || !reader.at_end()) {
+    logging::log(logging::Level::ERROR, "Movie " + path + " is corrupt");
+    return false;
+  }
+  return true;
+}
+
+MovieRecorder::MovieRecorder(Movie* movie, Cpu* cpu,
+                             ScriptedKeyboard* keyboard, uint32_t seed)
+    : movie_(movie), cpu_(cpu), keyboard_(keyboard) {
+  movie_->rom_hash = cpu_->rom_hash();
+  movie_->seed = seed;
+  movie_->quirks = Movie::kDefaultQuirks;
+  movie_->frames.clear();
+  movie_->keyframes.clear();
+}
+
+bool MovieRecorder::run_frame(uint16_t keys) {
+  uint32_t frame = movie_->frames.size();
+  if (frame % movie_->keyframe_interval == 0 &&
+      (movie_->keyframes.empty() || movie_->keyframes.back().frame < frame)) {
+    Movie::Keyframe keyframe;
+    keyframe.frame = frame;
+    keyframe.keys = keyboard_->keys();
+    keyframe.state = std::make_unique<Cpu::State>();
+    cpu_->save_state(keyframe.state.get());
+    movie_->keyframes.push_back(std::move(keyframe));
+  }
+
+  keyboard_->set_keys(keys);
+  bool result = cpu_->run_frame();
+  movie_->frames.push_back({keys, cpu_->frame_buffer()->hash()});
+  return result;
+}
+
+void MovieRecorder::drop_frame() {
+  if (movie_->frames.empty()) {
+    return;
+  }
+  movie_->frames.pop_back();
+  uint32_t frame = movie_->frames.size();
+  while (!movie_->keyframes.empty() && movie_->keyframes.back().frame > frame) {
+    movie_->keyframes.pop_back();
+  }
+  // Make the next frame's key presses relative to the recorded ones.
+  if (!movie_->frames.empty()) {
+    keyboard_->reset(movie_->frames.back().keys);
+  } else if (!movie_->keyframes.empty()) {
+    keyboard_->reset(movie_->keyframes.front().keys);
+  }
+}
+
+MoviePlayer::MoviePlayer(const Movie* movie, Cpu* cpu,
+                         ScriptedKeyboard* keyboard)
+    : movie_(movie), cpu_(cpu), keyboard_(keyboard) {}
+
+bool MoviePlayer::seek(uint32_t frame) {
+  auto keyframe = std::upper_bound(
+      movie_->keyframes.begin(), movie_->keyframes.end(), frame,
+      [](uint32_t frame, const Movie::Keyframe& keyframe) {
+        return frame < keyframe.frame;
+      });
+  if (keyframe == movie_->keyframes.begin() ||
+      frame > movie_->frames.size()) {
+    return false;
+  }
+  --keyframe;
+  cpu_->load_state(*keyframe->state);
+  keyboard_->reset(keyframe->keys);
+  for (frame_ = keyframe->frame; frame_ < frame; ++frame_) {
+    keyboard_->set_keys(movie_->frames[frame_].keys);
+    if (!cpu_->run_frame()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MoviePlayer::Status MoviePlayer::run_frame() {
+  if (frame_ >= movie_->frames.size()) {
+    return Status::END;
+  }
+  const Movie::Frame& frame = movie_->frames[frame_++];
+  keyboard_->set_keys(frame.keys);
+  if (!cpu_->run_frame()) {
+    return Status::ERROR;
+  }
+  if (cpu_->frame_buffer()->hash() != frame.frame_buffer_hash) {
+    return Status::DESYNC;
+  }
+  return Status::OK;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/cpu.h"
+#include "src/scripted_keyboard.h"
+
+// A recording of a play session: the keys held on every frame, plus what is
+// needed to reproduce it and to check that the reproduction is faithful.
+//
+// Complete save states are embedded every |keyframe_interval| frames, so a
+// replay can start at any frame after running at most |keyframe_interval|
+// frames.
+struct Movie {
+  // The core implements a single set of CHIP-8 quirks. Recorded so movies
+  // made with a different set can be told apart once they are configurable.
+  static constexpr uint32_t kDefaultQuirks = 0;
+
+  static constexpr uint32_t kDefaultKeyframeInterval = 600;
+
+  struct Frame {
+    // The keys held during the frame, bit n being key n.
+    uint16_t keys;
+    // FrameBuffer::hash() at the end of the frame.
+    uint64_t frame_buffer_hash;
+  };
+
+  struct Keyframe {
+    // The frame this is the starting state of.
+    uint32_t frame;
+    // The keys held before the frame.
+    uint16_t keys;
+    std::unique_ptr<Cpu::State> state;
+  };
+
+  uint64_t rom_hash = 0;
+  uint32_t seed = 0;
+  uint32_t quirks = kDefaultQuirks;
+  uint32_t keyframe_interval = kDefaultKeyframeInterval;
+
+  std::vector<Frame> frames;
+  // Sorted by frame.
+  std::vector<Keyframe> keyframes;
+};
+
+// Writes |movie| to |path|. Returns true if successful.
+bool save_movie(const Movie& movie, const std::string& path);
+
+// Reads the movie at |path| into |movie|. Returns true if successful.
+bool load_movie(const std::string& path, Movie* movie);
+
+// Drives a machine frame by frame while recording its input into a movie.
+class MovieRecorder {
+ public:
+  // |movie|, |cpu| and |keyboard| must outlive this instance. |keyboard| must
+  // be the keyboard |cpu| reads from, and |seed| the seed of its Random.
+  MovieRecorder(Movie* movie, Cpu* cpu, ScriptedKeyboard* keyboard,
+                uint32_t seed);
+
+  // Presses |keys| and runs one frame, recording both.
+  bool run_frame(uint16_t keys);
+
+  // Forgets the last recorded frame. To be called after rewinding the
+  // machine by one frame.
+  void drop_frame();
+
+ private:
+  Movie* movie_;
+  Cpu* cpu_;
+  ScriptedKeyboard* keyboard_;
+};
+
+// Replays a movie, checking that every frame matches the recording.
+class MoviePlayer {
+ public:
+  enum class Status {
+    // The frame ran and matched the recording.
+    OK,
+    // The frame ran but its framebuffer differs from the recording.
+    DESYNC,
+    // The machine failed to execute an instruction.
+    ERROR,
+    // There are no more frames to replay.
+    END,
+  };
+
+  // |movie|, |cpu| and |keyboard| must outlive this instance. |keyboard| must
+  // be the keyboard |cpu| reads from. seek() must be called before the first
+  // frame is run.
+  MoviePlayer(const Movie* movie, Cpu* cpu, ScriptedKeyboard* keyboard);
+
+  // Restores the last keyframe at or before |frame| and runs forward up to
+  // |frame|. Returns false if there is no such keyframe or the machine fails.
+  bool seek(uint32_t frame);
+
+  // Runs the next frame.
+  Status run_frame();
+
+  // The next frame to be run.
+  uint32_t frame() const { return frame_; }
+
+ private:
+  const Movie* movie_;
+  Cpu* cpu_;
+  ScriptedKeyboard* keyboard_;
+  uint32_t frame_ = 0;
+};
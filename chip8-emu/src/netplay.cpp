@@ -0,0 +1,242 @@
+#include "src/netplay.h"
+
+#include <algorithm>
+
+#include "src/binary_io.h"
+#include "src/logging.h"
+
+namespace {
+
+constexpr uint32_t kMagic = 0x504e3843;  // "C8NP".
+
+constexpr uint32_t kNoFrame = UINT32_MAX;
+
+}  // namespace
+
+bool UdpTransport::open(unsigned short local_port, const sf::IpAddress& peer,
+                        unsigned short peer_port) {
+  if (socket_.bind(local_port) != sf::Socket::Done) {
+    logging::log(logging::Level::ERROR,
+                 "Could not bind to UDP port " + std::to_string(local_port));
+    return false;
+  }
+  socket_.setBlocking(false);
+  peer_ = peer;
+  peer_port_ = peer_port;
+  return true;
+}
+
+void UdpTransport::send(const std::vector<uint8_t>& packet) {
+  // Lost packets are fine, the next one carries the same input.
+  socket_.send(packet.data(), packet.size(), peer_, peer_port_);
+}
+
+bool UdpTransport::receive(std::vector<uint8_t>* packet) {
+  uint8_t buffer[1024];
+  std::size_t received;
+  sf::IpAddress sender;
+  unsigned short port;
+  while (socket_.receive(buffer, sizeof(buffer), received, sender, port) ==
+         sf::Socket::Done) {
+    if (sender == peer_ && port == peer_port_) {
+      packet->assign(buffer, buffer + received);
+      return true;
+    }
+  }
+  return false;
+}
+
+NetplaySession::NetplaySession(Cpu* cpu, ScriptedKeyboard* keyboard,
+                               NetplayTransport* transport, uint32_t seed,
+                               Clock* clock)
+    : cpu_(cpu),
+      keyboard_(keyboard),
+      transport_(transport),
+      seed_(seed),
+      clock_(clock) {
+  for (Snapshot& snapshot : snapshots_) {
+    snapshot.frame = kNoFrame;
+    snapshot.state = std::make_unique<Cpu::State>();
+  }
+  for (Hash& hash : hashes_) {
+    hash.frame = kNoFrame;
+  }
+  remote_hashes_ = hashes_;
+}
+
+NetplaySession::~NetplaySession() = default;
+
+NetplaySession::Status NetplaySession::advance(uint16_t local_keys) {
+  Status status = sync();
+  if (status == Status::ADVANCED) {
+    if (frame_ >= remote_confirmed_ + kMaxRollback) {
+      status = Status::WAITING;
+    } else {
+      local_keys_[frame_ % kHistory] = local_keys;
+      if (!run_frame()) {
+        return Status::ERROR;
+      }
+    }
+  }
+  send();
+  return status;
+}
+
+NetplaySession::Status NetplaySession::update() {
+  Status status = sync();
+  send();
+  return status;
+}
+
+NetplaySession::Status NetplaySession::sync() {
+  last_rollback_ = 0;
+  last_rollback_cost_ = 0;
+  if (!receive() || !rollback()) {
+    return Status::ERROR;
+  }
+  hash_confirmed_states();
+  return desync_ ? Status::DESYNC : Status::ADVANCED;
+}
+
+bool NetplaySession::receive() {
+  std::vector<uint8_t> packet;
+  while (transport_->receive(&packet)) {
+    BinaryReader reader(packet.data(), packet.size());
+    if (reader.u32() != kMagic) {
+      continue;
+    }
+    uint32_t seed = reader.u32();
+    uint64_t rom_hash = reader.u64();
+    if (seed != seed_ || rom_hash != cpu_->rom_hash()) {
+      logging::log(logging::Level::ERROR,
+                   "Netplay peer runs a different ROM or seed");
+      return false;
+    }
+
+    uint32_t first = reader.u32();
+    uint8_t count = reader.u8();
+    for (uint32_t frame = first; frame < first + count; ++frame) {
+      uint16_t keys = reader.u16();
+      if (!reader.ok()) {
+        break;
+      }
+      // Keys already received, after a gap or too far ahead are dropped, but
+      // still read through to get to the hash.
+      if (frame != remote_confirmed_ || frame >= frame_ + kHistory / 2) {
+        continue;
+      }
+      remote_keys_[frame % kHistory] = keys;
+      if (frame < frame_ && predicted_keys_[frame % kHistory] != keys) {
+        mispredicted_ = std::min(mispredicted_, frame);
+      }
+      ++remote_confirmed_;
+    }
+
+    Hash hash;
+    hash.frame = reader.u32();
+    hash.hash = reader.u64();
+    if (reader.ok() && hash.frame != kNoFrame) {
+      remote_hashes_[hash.frame % kHistory] = hash;
+      const Hash& local = hashes_[hash.frame % kHistory];
+      if (local.frame == hash.frame && local.hash != hash.hash) {
+        desync_ = true;
+      }
+    }
+  }
+  return true;
+}
+
+void NetplaySession::send() {
+  BinaryWriter writer;
+  writer.u32(kMagic);
+  writer.u32(seed_);
+  writer.u64(cpu_->rom_hash());
+
+  uint32_t first = frame_ > kInputWindow ? frame_ - kInputWindow : 0;
+  writer.u32(first);
+  writer.u8(frame_ - first);
+  for (uint32_t frame = first; frame < frame_; ++frame) {
+    writer.u16(local_keys_[frame % kHistory]);
+  }
+
+  if (hashed_ > 0) {
+    const Hash& hash = hashes_[(hashed_ - 1) % kHistory];
+    writer.u32(hash.frame);
+    writer.u64(hash.hash);
+  } else {
+    writer.u32(kNoFrame);
+    writer.u64(0);
+  }
+  transport_->send(writer.buffer());
+}
+
+bool NetplaySession::rollback() {
+  if (mispredicted_ == kNoFrame) {
+    return true;
+  }
+  double start = clock_->now();
+  const Snapshot& snapshot = snapshots_[mispredicted_ % snapshots_.size()];
+  if (snapshot.frame != mispredicted_) {
+    logging::log(logging::Level::ERROR,
+                 "Rollback to frame " + std::to_string(mispredicted_) +
+                     " is too far back");
+    return false;
+  }
+  cpu_->load_state(*snapshot.state);
+  keyboard_->reset(snapshot.keys);
+
+  uint32_t target = frame_;
+  frame_ = mispredicted_;
+  mispredicted_ = kNoFrame;
+  last_rollback_ = target - frame_;
+  while (frame_ < target) {
+    if (!run_frame()) {
+      return false;
+    }
+  }
+  last_rollback_cost_ = clock_->now() - start;
+  return true;
+}
+
+bool NetplaySession::run_frame() {
+  Snapshot& snapshot = snapshots_[frame_ % snapshots_.size()];
+  snapshot.frame = frame_;
+  snapshot.keys = keyboard_->keys();
+  cpu_->save_state(snapshot.state.get());
+
+  uint16_t remote = remote_keys(frame_);
+  predicted_keys_[frame_ % kHistory] = remote;
+  keyboard_->set_keys(local_keys_[frame_ % kHistory] | remote);
+  if (!cpu_->run_frame()) {
+    return false;
+  }
+  ++frame_;
+  return true;
+}
+
+void NetplaySession::hash_confirmed_states() {
+  // The state before a frame is final once the input of every frame before
+  // it is known and has been run with.
+  while (hashed_ < frame_ && hashed_ <= remote_confirmed_) {
+    const Snapshot& snapshot = snapshots_[hashed_ % snapshots_.size()];
+    if (snapshot.frame == hashed_) {
+      Hash hash = {hashed_, snapshot.state->hash()};
+      hashes_[hashed_ % kHistory] = hash;
+      const Hash& remote = remote_hashes_[hashed_ % kHistory];
+      if (remote.frame == hash.frame && remote.hash != hash.hash) {
+        desync_ = true;
+      }
+    }
+    ++hashed_;
+  }
+}
+
+uint16_t NetplaySession::remote_keys(uint32_t frame) const {
+  if (frame < remote_confirmed_) {
+    return remote_keys_[frame % kHistory];
+  }
+  if (remote_confirmed_ == 0) {
+    return 0;
+  }
+  return remote_keys_[(remote_confirmed_ - 1) % kHistory];
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <SFML/Network/IpAddress.hpp>
+#include <SFML/Network/UdpSocket.hpp>
+
+#include "src/clock.h"
+#include "src/cpu.h"
+#include "src/scripted_keyboard.h"
+
+// Carries netplay packets to the other player. Provided to allow injecting
+// tests.
+class NetplayTransport {
+ public:
+  NetplayTransport() = default;
+  virtual ~NetplayTransport() = default;
+
+  virtual void send(const std::vector<uint8_t>& packet) = 0;
+
+  // Returns the next packet received into |packet|, or false if there is none
+  // yet. Must not block.
+  virtual bool receive(std::vector<uint8_t>* packet) = 0;
+};
+
+// A transport over a non-blocking UDP socket.
+class UdpTransport : public NetplayTransport {
+ public:
+  UdpTransport() = default;
+  ~UdpTransport() override = default;
+
+  // Binds to |local_port|, or to any port if sf::Socket::AnyPort, and talks
+  // to |peer|:|peer_port|. Returns true if successful.
+  bool open(unsigned short local_port, const sf::IpAddress& peer,
+            unsigned short peer_port);
+
+  unsigned short local_port() const { return socket_.getLocalPort(); }
+
+  // NetplayTransport:
+  void send(const std::vector<uint8_t>& packet) override;
+  bool receive(std::vector<uint8_t>* packet) override;
+
+ private:
+  sf::UdpSocket socket_;
+  sf::IpAddress peer_;
+  unsigned short peer_port_ = 0;
+};
+
+// A two player session kept in sync by rollback.
+//
+// Both players run the same ROM with the same seed on a shared keypad, each
+// machine seeing the keys of both players combined. Every frame runs right
+// away with the local keys and a prediction of the remote ones (the last
+// remote keys received). When the actual remote keys for a frame turn out to
+// differ from the prediction, the machine is rolled back to that frame and
+// the frames since are run again. A player never gets more than
+// kMaxRollback frames ahead of the input it has received.
+//
+// Players exchange hashes of states whose input is final on both sides, so a
+// desync is detected within a few frames.
+class NetplaySession {
+ public:
+  // The most frames that may have to be run again on a rollback.
+  static constexpr uint32_t kMaxRollback = 8;
+
+  enum class Status {
+    // The next frame was run.
+    ADVANCED,
+    // Too far ahead of the remote player, the frame was not run.
+    WAITING,
+    // The players' machines diverged.
+    DESYNC,
+    // The machine failed, or the peer runs a different ROM or seed.
+    ERROR,
+  };
+
+  // |cpu|, |keyboard|, |transport| and |clock|, which times rollbacks, must
+  // outlive this instance. |keyboard| must be the keyboard |cpu| reads from
+  // and |seed| the seed of its Random.
+  NetplaySession(Cpu* cpu, ScriptedKeyboard* keyboard,
+                 NetplayTransport* transport, uint32_t seed,
+                 Clock* clock = SystemClock::get());
+  ~NetplaySession();
+
+  // Runs the next frame with |local_keys| held by the local player, after
+  // taking in the remote input received so far.
+  Status advance(uint16_t local_keys);
+
+  // Takes in the remote input received so far and sends the local one,
+  // without running a new frame.
+  Status update();
+
+  // The next frame to be run.
+  uint32_t frame() const { return frame_; }
+
+  // The number of frames for which the remote input is known.
+  uint32_t confirmed() const { return remote_confirmed_; }
+
+  // The number of frames run again by the last advance() or update(), and
+  // the time it took in seconds.
+  uint32_t last_rollback() const { return last_rollback_; }
+  double last_rollback_cost() const { return last_rollback_cost_; }
+
+ private:
+  // Inputs kept for the redundancy window and rollbacks. Must be larger than
+  // twice kMaxRollback plus kInputWindow.
+  static constexpr uint32_t kHistory = 64;
+
+  // The number of past local inputs resent in every packet, so that lost
+  // packets do not need to be retransmitted.
+  static constexpr uint32_t kInputWindow = 32;
+
+  struct Snapshot {
+    uint32_t frame;
+    // The keys held before the frame.
+    uint16_t keys;
+    std::unique_ptr<Cpu::State> state;
+  };
+
+  struct Hash {
+    uint32_t frame;
+    uint64_t hash;
+  };
+
+  // Takes in the remote input received so far, rolling back if needed.
+  Status sync();
+  // Returns false if a packet came from an incompatible peer.
+  bool receive();
+  void send();
+  bool rollback();
+  bool run_frame();
+  void hash_confirmed_states();
+  uint16_t remote_keys(uint32_t frame) const;
+
+  Cpu* cpu_;
+  ScriptedKeyboard* keyboard_;
+  NetplayTransport* transport_;
+  const uint32_t seed_;
+  Clock* clock_;
+
+  uint32_t frame_ = 0;
+  std::array<uint16_t, kHistory> local_keys_ = {};
+  std::array<uint16_t, kHistory> remote_keys_ = {};
+  // The remote keys each frame was last run with.
+  std::array<uint16_t, kHistory> predicted_keys_ = {};
+  uint32_t remote_confirmed_ = 0;
+  // The first frame run with a wrong prediction, if any.
+  uint32_t mispredicted_ = UINT32_MAX;
+
+  std::array<Snapshot, kMaxRollback + 1> snapshots_;
+
+  // Hashes of the state before each frame whose previous frames' inputs are
+  // all final.
+  std::array<Hash, kHistory> hashes_;
+  // The hashes received from the remote player.
+  std::array<Hash, kHistory> remote_hashes_;
+  // The next frame whose starting state is to be hashed.
+  uint32_t hashed_ = 0;
+  bool desync_ = false;
+
+  uint32_t last_rollback_ = 0;
+  double last_rollback_cost_ = 0;
+};
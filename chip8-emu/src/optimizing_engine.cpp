@@ -0,0 +1,500 @@
+#include "src/optimizing_engine.h"
+
+#include <algorithm>
+#include <optional>
+
+#include "src/block_cache.h"
+#include "src/control_flow.h"
+
+namespace {
+
+using Context = OptimizingEngine::Context;
+using LazyFlag = OptimizingEngine::LazyFlag;
+
+template <bool kImmediate>
+uint8_t source(const Context& c, const IrOp& op) {
+  return kImmediate ? op.kk : c.registers.v[op.y];
+}
+
+// Keeps what the flag of |op| is computed from, rather than the flag.
+void defer_flag(Context& c, const IrOp& op, uint8_t left, uint8_t right) {
+  c.flag.opcode = op.opcode;
+  c.flag.left = left;
+  c.flag.right = right;
+}
+
+bool nop(Context&, const IrOp&) {
+  return true;
+}
+
+template <bool kImmediate>
+bool ld(Context& c, const IrOp& op) {
+  c.registers.v[op.x] = source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kImmediate, bool kFlag>
+bool add(Context& c, const IrOp& op) {
+  uint8_t right = source<kImmediate>(c, op);
+  if (kFlag) {
+    defer_flag(c, op, c.registers.v[op.x], right);
+  }
+  c.registers.v[op.x] += right;
+  return true;
+}
+
+template <bool kImmediate, bool kFlag>
+bool sub(Context& c, const IrOp& op) {
+  uint8_t right = source<kImmediate>(c, op);
+  if (kFlag) {
+    defer_flag(c, op, c.registers.v[op.x], right);
+  }
+  c.registers.v[op.x] -= right;
+  return true;
+}
+
+template <bool kImmediate, bool kFlag>
+bool subn(Context& c, const IrOp& op) {
+  uint8_t right = source<kImmediate>(c, op);
+  if (kFlag) {
+    defer_flag(c, op, c.registers.v[op.x], right);
+  }
+  c.registers.v[op.x] = right - c.registers.v[op.x];
+  return true;
+}
+
+template <bool kFlag>
+bool shr(Context& c, const IrOp& op) {
+  if (kFlag) {
+    defer_flag(c, op, c.registers.v[op.x], 0);
+  }
+  c.registers.v[op.x] >>= 1;
+  return true;
+}
+
+template <bool kFlag>
+bool shl(Context& c, const IrOp& op) {
+  if (kFlag) {
+    defer_flag(c, op, c.registers.v[op.x], 0);
+  }
+  c.registers.v[op.x] <<= 1;
+  return true;
+}
+
+template <bool kImmediate>
+bool or_reg(Context& c, const IrOp& op) {
+  c.registers.v[op.x] |= source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kImmediate>
+bool and_reg(Context& c, const IrOp& op) {
+  c.registers.v[op.x] &= source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kImmediate>
+bool xor_reg(Context& c, const IrOp& op) {
+  c.registers.v[op.x] ^= source<kImmediate>(c, op);
+  return true;
+}
+
+bool ld_i(Context& c, const IrOp& op) {
+  c.registers.index = op.nnn;
+  return true;
+}
+
+template <bool kImmediate>
+bool add_i(Context& c, const IrOp& op) {
+  c.registers.index += source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kImmediate>
+bool ld_f(Context& c, const IrOp& op) {
+  c.registers.index += source<kImmediate>(c, op) * 5;
+  return true;
+}
+
+bool ld_vx_dt(Context& c, const IrOp& op) {
+  c.registers.v[op.x] = c.registers.delay;
+  return true;
+}
+
+template <bool kImmediate>
+bool ld_dt(Context& c, const IrOp& op) {
+  c.registers.delay = source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kImmediate>
+bool ld_st(Context& c, const IrOp& op) {
+  c.registers.sound = source<kImmediate>(c, op);
+  return true;
+}
+
+template <bool kFlag>
+bool drw(Context& c, const IrOp& op) {
+  Cpu::Registers& r = c.registers;
+  uint8_t x = r.v[op.x];
+  uint8_t y = r.v[op.y];
+  for (unsigned int i = 0; i < op.kk; ++i) {
+    c.frame_buffer->flip(x, y + i, c.memory[(r.index + i) & Cpu::kMaxMemory]);
+  }
+  if (kFlag) {
+    defer_flag(c, op, x, y);
+    c.flag.rows = op.kk;
+    c.flag.index = r.index;
+  }
+  return true;
+}
+
+bool materialize_flag(Context& c, const IrOp&) {
+  OptimizingEngine::materialize(c);
+  return true;
+}
+
+bool execute(Context& c, const IrOp& op) {
+  c.registers.pc = op.address;
+  if (!c.cpu->execute(op.nnn)) {
+    return false;
+  }
+  c.registers.pc += 2;
+  return true;
+}
+
+bool jp(Context& c, const IrOp& op) {
+  c.registers.pc = op.nnn;
+  return true;
+}
+
+bool call(Context& c, const IrOp& op) {
+  Cpu::Registers& r = c.registers;
+  // Overflows fail through the reference, which logs why.
+  if (r.sp >= Cpu::kStackSize) {
+    r.pc = op.address;
+    return c.cpu->execute(0x2000 | op.nnn);
+  }
+  r.stack[r.sp++] = op.address;
+  r.pc = op.nnn;
+  return true;
+}
+
+bool ret(Context& c, const IrOp& op) {
+  Cpu::Registers& r = c.registers;
+  if (r.sp == 0) {
+    r.pc = op.address;
+    return c.cpu->execute(0x00ee);
+  }
+  r.pc = r.stack[--r.sp] + 2;
+  return true;
+}
+
+template <bool kImmediate>
+bool se(Context& c, const IrOp& op) {
+  bool equal = c.registers.v[op.x] == source<kImmediate>(c, op);
+  c.registers.pc = op.address + (equal ? 4 : 2);
+  return true;
+}
+
+template <bool kImmediate>
+bool sne(Context& c, const IrOp& op) {
+  bool equal = c.registers.v[op.x] == source<kImmediate>(c, op);
+  c.registers.pc = op.address + (equal ? 2 : 4);
+  return true;
+}
+
+bool jp_v0(Context& c, const IrOp& op) {
+  c.registers.pc = op.nnn + c.registers.v[0];
+  return true;
+}
+
+template <bool kImmediate>
+bool jp_eq(Context& c, const IrOp& op) {
+  bool equal = c.registers.v[op.x] == source<kImmediate>(c, op);
+  c.registers.pc = equal ? op.nnn : op.address + 4;
+  return true;
+}
+
+template <bool kImmediate>
+bool jp_ne(Context& c, const IrOp& op) {
+  bool equal = c.registers.v[op.x] == source<kImmediate>(c, op);
+  c.registers.pc = equal ? op.address + 4 : op.nnn;
+  return true;
+}
+
+// Picks the instantiation of |handler| for the source of |op|.
+#define BY_SOURCE(handler) \
+  (op.immediate ? handler<true> : handler<false>)
+#define BY_SOURCE_AND_FLAG(handler)                                  \
+  (op.immediate ? (op.writes_flag ? handler<true, true>              \
+                                  : handler<true, false>)            \
+                : (op.writes_flag ? handler<false, true>             \
+                                  : handler<false, false>))
+
+OptimizingEngine::Handler handler_of(const IrOp& op) {
+  switch (op.opcode) {
+    case IrOpcode::NOP:
+      return nop;
+    case IrOpcode::LD:
+      return BY_SOURCE(ld);
+    case IrOpcode::ADD:
+      return BY_SOURCE_AND_FLAG(add);
+    case IrOpcode::SUB:
+      return BY_SOURCE_AND_FLAG(sub);
+    case IrOpcode::SUBN:
+      return BY_SOURCE_AND_FLAG(subn);
+    case IrOpcode::SHR:
+      return op.writes_flag ? shr<true> : shr<false>;
+    case IrOpcode::SHL:
+      return op.writes_flag ? shl<true> : shl<false>;
+    case IrOpcode::OR:
+      return BY_SOURCE(or_reg);
+    case IrOpcode::AND:
+      return BY_SOURCE(and_reg);
+    case IrOpcode::XOR:
+      return BY_SOURCE(xor_reg);
+    case IrOpcode::LD_I:
+      return ld_i;
+    case IrOpcode::ADD_I:
+      return BY_SOURCE(add_i);
+    case IrOpcode::LD_F:
+      return BY_SOURCE(ld_f);
+    case IrOpcode::LD_VX_DT:
+      return ld_vx_dt;
+    case IrOpcode::LD_DT:
+      return BY_SOURCE(ld_dt);
+    case IrOpcode::LD_ST:
+      return BY_SOURCE(ld_st);
+    case IrOpcode::DRW:
+      return op.writes_flag ? drw<true> : drw<false>;
+    case IrOpcode::EXECUTE:
+      return execute;
+    case IrOpcode::JP:
+      return jp;
+    case IrOpcode::CALL:
+      return call;
+    case IrOpcode::RET:
+      return ret;
+    case IrOpcode::SE:
+      return BY_SOURCE(se);
+    case IrOpcode::SNE:
+      return BY_SOURCE(sne);
+    case IrOpcode::JP_V0:
+      return jp_v0;
+    case IrOpcode::JP_EQ:
+      return BY_SOURCE(jp_eq);
+    case IrOpcode::JP_NE:
+      return BY_SOURCE(jp_ne);
+  }
+  return execute;
+}
+
+#undef BY_SOURCE
+#undef BY_SOURCE_AND_FLAG
+
+// Whether VF must hold the flag before |op| runs: it reads VF, writes it
+// other than with a flag, or runs through Cpu::execute(), which may read
+// anything. The flag of a DRW is also only valid until the screen or the
+// sprite change, which only happens through Cpu::execute() or a DRW that
+// sets the flag anew.
+bool needs_flag(const IrOp& op) {
+  return op.opcode == IrOpcode::EXECUTE ||
+         (registers_read(op) & kFlagRegister) ||
+         (!op.writes_flag && (registers_written(op) & kFlagRegister));
+}
+
+// Compiles |ops|, materializing the flag where it is needed if |lazy_flag|.
+std::vector<OptimizingEngine::Op> compile(const std::vector<IrOp>& ops,
+                                          bool lazy_flag) {
+  std::vector<OptimizingEngine::Op> compiled;
+  compiled.reserve(ops.size());
+  for (const IrOp& op : ops) {
+    if (lazy_flag && needs_flag(op)) {
+      compiled.push_back({materialize_flag, op});
+    }
+    compiled.push_back({handler_of(op), op});
+  }
+  return compiled;
+}
+
+}  // namespace
+
+OptimizingEngine::CompiledBlock::CompiledBlock(const Block& block)
+    : ops(compile(block.ops, true)),
+      instructions(compile(block.instructions, false)),
+      end(block.end()),
+      branches(block.branches),
+      writes_memory(block.writes_memory),
+      skips_jump(block.skips_jump),
+      idempotent(block.idempotent) {}
+
+void OptimizingEngine::materialize(Context& c) {
+  const LazyFlag& flag = c.flag;
+  uint8_t& vf = c.registers.v[0xf];
+  switch (flag.opcode) {
+    case IrOpcode::ADD:
+      vf = flag.left + flag.right > 0xff;
+      break;
+    case IrOpcode::SUB:
+      vf = flag.left > flag.right;
+      break;
+    case IrOpcode::SUBN:
+      vf = flag.right > flag.left;
+      break;
+    case IrOpcode::SHR:
+      vf = flag.left & 1;
+      break;
+    case IrOpcode::SHL:
+      vf = (flag.left >> 7) & 1;
+      break;
+    case IrOpcode::DRW: {
+      // A sprite never overlaps itself, so a pixel it erased is one it sets
+      // that is now off.
+      bool erased = false;
+      for (unsigned int i = 0; i < flag.rows; ++i) {
+        uint8_t row = c.memory[(flag.index + i) & Cpu::kMaxMemory];
+        for (unsigned int bit = 0; bit < 8; ++bit) {
+          if (((row << bit) & 0x80) &&
+              !c.frame_buffer->get_pixel(flag.left + bit, flag.right + i)) {
+            erased = true;
+          }
+        }
+      }
+      vf = erased;
+      break;
+    }
+    default:
+      return;
+  }
+  c.flag.opcode = IrOpcode::NOP;
+}
+
+bool OptimizingEngine::run(Cpu* cpu, unsigned int instructions) {
+  Context c = {cpu, registers(cpu), memory(cpu), frame_buffer(cpu), {}};
+  Cpu::Registers& r = c.registers;
+  invalidate(take_written_lines(cpu));
+
+  bool result = true;
+  unsigned int i = 0;
+  // Nothing runs until the key arrives, which cannot happen meanwhile.
+  while (i < instructions && !r.waiting_for_key_press) {
+    // The last byte of memory holds no complete instruction.
+    if (r.pc >= Cpu::kMaxMemory) {
+      materialize(c);
+      if (!cpu->step()) {
+        result = false;
+        break;
+      }
+      ++i;
+      continue;
+    }
+    unsigned int executed = run_block(c, instructions - i);
+    if (executed == 0) {
+      result = false;
+      break;
+    }
+    i += executed;
+    invalidate(take_written_lines(cpu));
+  }
+  materialize(c);
+  return result;
+}
+
+unsigned int OptimizingEngine::run_block(Context& c, unsigned int budget) {
+  Cpu::Registers& r = c.registers;
+  uint16_t start = r.pc;
+  const CompiledBlock& block = get(c.memory, start);
+  unsigned int size = static_cast<unsigned int>(block.instructions.size());
+  if (size > budget) {
+    // Only a skip over the final jump may branch.
+    for (unsigned int j = 0; j < budget; ++j) {
+      const Op& op = block.instructions[j];
+      materialize(c);
+      if (!op.handler(c, op.ir)) {
+        return 0;
+      }
+    }
+    if (!is_branch(block.instructions[budget - 1].ir)) {
+      r.pc = start + budget * 2;
+    }
+    count_instructions(c.cpu, start, size, budget);
+    return budget;
+  }
+
+  for (const Op& op : block.ops) {
+    if (!op.handler(c, op.ir)) {
+      return 0;
+    }
+  }
+  if (!block.branches) {
+    r.pc = block.end;
+  }
+  unsigned int executed = size;
+  if (block.skips_jump && r.pc == block.end) {
+    executed = size - 1;
+  } else if (block.idempotent && r.pc == start) {
+    // Going round again would change nothing.
+    executed = budget / size * size;
+  }
+  count_instructions(c.cpu, start, size, executed);
+  return executed;
+}
+
+const OptimizingEngine::CompiledBlock& OptimizingEngine::get(
+    const uint8_t* memory, uint16_t address) {
+  std::unique_ptr<CompiledBlock>& compiled = blocks_[address];
+  if (!compiled) {
+    std::optional<Block> cached;
+    if (cache_) {
+      cached = cache_->find(memory, address);
+    }
+    Block block = cached ? *cached : translate_block(memory, address);
+    if (cache_ && !cached) {
+      cache_->add(memory, block);
+    }
+    compiled = std::make_unique<CompiledBlock>(block);
+    for (unsigned int line = 0; line < Cpu::kCacheLines; ++line) {
+      std::vector<uint16_t>& starts = blocks_by_line_[line];
+      // A block dropped for another line may still be listed.
+      if (((block.lines >> line) & 1) &&
+          std::find(starts.begin(), starts.end(), address) == starts.end()) {
+        starts.push_back(address);
+      }
+    }
+  }
+  return *compiled;
+}
+
+bool OptimizingEngine::cached(const uint8_t* memory, uint16_t address) const {
+  return blocks_[address] || (cache_ && cache_->contains(memory, address));
+}
+
+void OptimizingEngine::prepare(Cpu* cpu, const ControlFlowGraph& graph) {
+  invalidate(take_written_lines(cpu));
+  const uint8_t* memory = this->memory(cpu);
+  for (const ControlFlowGraph::BasicBlock& block : graph.blocks) {
+    // The IR ends blocks where the graph does not, at the instructions run
+    // through Cpu::execute() that end them, and at their largest size.
+    uint16_t address = block.start;
+    while (address < block.end) {
+      const CompiledBlock& compiled = get(memory, address);
+      if (compiled.branches) {
+        break;
+      }
+      address = compiled.end;
+    }
+  }
+}
+
+void OptimizingEngine::invalidate(uint64_t written_lines) {
+  for (unsigned int line = 0; written_lines; ++line, written_lines >>= 1) {
+    if (!(written_lines & 1)) {
+      continue;
+    }
+    for (uint16_t start : blocks_by_line_[line]) {
+      blocks_[start].reset();
+    }
+    blocks_by_line_[line].clear();
+  }
+}
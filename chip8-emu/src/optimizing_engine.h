@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "src/block_ir.h"
+#include "src/execution_engine.h"
+
+// Translates straight runs of instructions into blocks of the intermediate
+// representation, optimizes each as a whole, and runs their operations
+// through pointers to their handlers, as ThreadedEngine does instructions.
+//
+// The optimizations only hold for a block run to its end, so when fewer
+// instructions are left to run than a block holds, its instructions are run
+// one at a time as translated, and the next block starts where they stop.
+// An idempotent block looping onto itself runs once for every time it fits
+// in the instructions left.
+//
+// Most flags ALU operations and DRW set are overwritten before anything reads
+// them, so VF is only computed when read, from the operands the operation
+// that set it kept, and in any case before run() returns.
+class OptimizingEngine : public ExecutionEngine {
+ public:
+  EngineKind kind() const override { return EngineKind::OPTIMIZING; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+
+  void set_block_cache(BlockCache* cache) override { cache_ = cache; }
+
+  // Translates the blocks starting where those of |graph| do, and those
+  // they run on into, unless they already are.
+  void prepare(Cpu* cpu, const ControlFlowGraph& graph) override;
+
+  // Whether the block starting at |address| of |memory| is in the block
+  // cache, so that it can be run without translating it.
+  bool cached(const uint8_t* memory, uint16_t address) const;
+
+  // The flag of the last operation to set VF, kept as what it is computed
+  // from until VF is read.
+  struct LazyFlag {
+    // The operation, or NOP once VF holds its flag.
+    IrOpcode opcode = IrOpcode::NOP;
+    // The operands of an ALU operation, or the position of a sprite.
+    uint8_t left = 0;
+    uint8_t right = 0;
+    // The sprite of a DRW.
+    uint8_t rows = 0;
+    uint16_t index = 0;
+  };
+
+  // What operations run on.
+  struct Context {
+    Cpu* cpu;
+    Cpu::Registers& registers;
+    const uint8_t* memory;
+    FrameBuffer* frame_buffer;
+    LazyFlag flag;
+  };
+
+  // Sets VF to the flag of |c|, if it is not there yet.
+  static void materialize(Context& c);
+
+  // Runs the block at the program counter of |c|, which must be below
+  // Cpu::kMaxMemory, or as much of it as |budget| instructions allow.
+  // Returns the number of instructions executed, or 0 if one fails. Memory
+  // the block writes is left to the caller to invalidate().
+  unsigned int run_block(Context& c, unsigned int budget);
+
+  // Drops the blocks translated from the cache lines set in |written_lines|.
+  void invalidate(uint64_t written_lines);
+
+  // Executes |op|. Returns false if it fails.
+  using Handler = bool (*)(Context& c, const IrOp& op);
+
+  struct Op {
+    Handler handler;
+    IrOp ir;
+  };
+
+  struct CompiledBlock {
+    explicit CompiledBlock(const Block& block);
+
+    std::vector<Op> ops;
+    std::vector<Op> instructions;
+    uint16_t end;
+    bool branches;
+    bool writes_memory;
+    bool skips_jump;
+    bool idempotent;
+  };
+
+ private:
+  const CompiledBlock& get(const uint8_t* memory, uint16_t address);
+
+  BlockCache* cache_ = nullptr;
+  std::array<std::unique_ptr<CompiledBlock>, Cpu::kMaxMemory + 1> blocks_;
+  // The start of the blocks translated from each cache line.
+  std::array<std::vector<uint16_t>, Cpu::kCacheLines> blocks_by_line_;
+};
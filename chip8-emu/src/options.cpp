@@ -0,0 +1,189 @@
+#include "src/options.h"
+
+#include <cstdlib>
+
+#include "src/logging.h"
+
+namespace {
+
+bool parse_number(const std::string& text, uint32_t* value) {
+  char* end;
+  unsigned long parsed = std::strtoul(text.c_str(), &end, 0);
+  if (text.empty() || *end != '\0') {
+    logging::log(logging::Level::ERROR, "Invalid number " + text);
+    return false;
+  }
+  *value = parsed;
+  return true;
+}
+
+bool parse_speed(const std::string& text, double* speed) {
+  if (text == "max") {
+    *speed = 0;
+    return true;
+  }
+  char* end;
+  double parsed = std::strtod(text.c_str(), &end);
+  if (text.empty() || *end != '\0' || !(parsed > 0)) {
+    logging::log(logging::Level::ERROR, "Invalid speed " + text);
+    return false;
+  }
+  *speed = parsed;
+  return true;
+}
+
+bool parse_port(const std::string& text, unsigned short* port) {
+  uint32_t parsed;
+  if (!parse_number(text, &parsed) || parsed == 0 || parsed > 0xffff) {
+    logging::log(logging::Level::ERROR, "Invalid port " + text);
+    return false;
+  }
+  *port = parsed;
+  return true;
+}
+
+}  // namespace
+
+bool parse_options(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      if (!options->rom.empty()) {
+        logging::log(logging::Level::ERROR, "Unexpected argument " + arg);
+        return false;
+      }
+      options->rom = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      logging::log(logging::Level::ERROR, "Missing value for " + arg);
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--record") {
+      options->record_path = value;
+    } else if (arg == "--replay") {
+      options->replay_path = value;
+    } else if (arg == "--seed") {
+      uint32_t seed;
+      if (!parse_number(value, &seed)) {
+        return false;
+      }
+      options->seed = seed;
+    } else if (arg == "--from") {
+      if (!parse_number(value, &options->from_frame)) {
+        return false;
+      }
+    } else if (arg == "--speed") {
+      if (!parse_speed(value, &options->speed)) {
+        return false;
+      }
+    } else if (arg == "--run-ahead") {
+      if (!parse_number(value, &options->run_ahead)) {
+        return false;
+      }
+    } else if (arg == "--netplay-port") {
+      if (!parse_port(value, &options->netplay_port)) {
+        return false;
+      }
+    } else if (arg == "--netplay-peer") {
+      size_t colon = value.rfind(':');
+      if (colon == std::string::npos ||
+          !parse_port(value.substr(colon + 1),
+                      &options->netplay_peer_port)) {
+        logging::log(logging::Level::ERROR,
+                     "Expected HOST:PORT for --netplay-peer");
+        return false;
+      }
+      options->netplay_host = value.substr(0, colon);
+    } else if (arg == "--profile") {
+      options->profile_path = value;
+    } else if (arg == "--profile-interval") {
+      if (!parse_number(value, &options->profile_interval) ||
+          options->profile_interval == 0) {
+        logging::log(logging::Level::ERROR, "Invalid profile interval");
+        return false;
+      }
+    } else if (arg == "--trace") {
+      options->trace_path = value;
+    } else if (arg == "--latency") {
+      options->latency_path = value;
+    } else if (arg == "--engine") {
+      if (!parse_engine_kind(value, &options->engine)) {
+        return false;
+      }
+    } else if (arg == "--tier-thresholds") {
+      EngineOptions& engine_options = options->engine_options;
+      size_t comma = value.find(',');
+      if (comma == std::string::npos ||
+          !parse_number(value.substr(0, comma),
+                        &engine_options.threaded_threshold) ||
+          !parse_number(value.substr(comma + 1),
+                        &engine_options.optimized_threshold) ||
+          engine_options.threaded_threshold >
+              engine_options.optimized_threshold) {
+        logging::log(logging::Level::ERROR,
+                     "Expected THREADED,OPTIMIZED run counts, in increasing "
+                     "order, for --tier-thresholds");
+        return false;
+      }
+    } else if (arg == "--aot") {
+      options->engine_options.aot_path = value;
+    } else if (arg == "--validate") {
+      Validation validation;
+      if (!parse_validation(value, &validation)) {
+        return false;
+      }
+      options->validation = validation;
+    } else if (arg == "--cfg") {
+      options->cfg_path = value;
+    } else if (arg == "--block-cache") {
+      options->block_cache_path = value;
+    } else if (arg == "--verify") {
+      Lockstep::Granularity granularity;
+      if (!parse_granularity(value, &granularity)) {
+        return false;
+      }
+      options->verify = granularity;
+    } else if (arg == "--metrics-port") {
+      if (!parse_port(value, &options->metrics_port)) {
+        return false;
+      }
+    } else if (arg == "--inputs") {
+      options->inputs_path = value;
+    } else if (arg == "--json") {
+      options->json_path = value;
+    } else if (arg == "--frames") {
+      if (!parse_number(value, &options->frames)) {
+        return false;
+      }
+    } else if (arg == "--clock") {
+      if (value != "system" && value != "virtual") {
+        logging::log(logging::Level::ERROR,
+                     "Expected system or virtual for --clock");
+        return false;
+      }
+      options->virtual_clock = value == "virtual";
+    } else {
+      logging::log(logging::Level::ERROR, "Unknown option " + arg);
+      return false;
+    }
+  }
+  if ((options->netplay_port != 0) != !options->netplay_host.empty()) {
+    logging::log(logging::Level::ERROR,
+                 "Netplay needs both --netplay-port and --netplay-peer");
+    return false;
+  }
+  if (options->netplay_port != 0 && !options->seed) {
+    logging::log(logging::Level::ERROR,
+                 "Netplay needs both players to pass the same --seed");
+    return false;
+  }
+  if (options->netplay_port != 0 && options->virtual_clock) {
+    logging::log(logging::Level::ERROR,
+                 "Netplay waits for the peer in real time, not on --clock "
+                 "virtual");
+    return false;
+  }
+  return true;
+}
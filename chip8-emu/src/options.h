@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "src/control_flow.h"
+#include "src/execution_engine.h"
+#include "src/lockstep.h"
+
+// Command line options, shared by the emulator and the headless runner.
+struct Options {
+  // The ROM to run. Required by the headless runner.
+  std::string rom;
+
+  // Seeds the random number generator instead of using the current time.
+  std::optional<uint32_t> seed;
+
+  // Records the input of the game played into this movie file. The emulator
+  // takes a directory instead, recording every game played into
+  // <rom name>.c8mv there, as the ROM benchmark reads them.
+  std::string record_path;
+
+  // Replays this movie file, checking every frame against it.
+  std::string replay_path;
+
+  // The frame to start replaying from.
+  uint32_t from_frame = 0;
+
+  // The emulation speed as a multiple of 60 frames per second, or 0 for as
+  // fast as possible. Holding the turbo key always runs as fast as possible.
+  double speed = 1;
+
+  // The number of frames to run ahead of the presented one to hide input
+  // latency, or 0 to disable run-ahead.
+  uint32_t run_ahead = 0;
+
+  // Plays a two player netplay session from this local UDP port with the
+  // peer at |netplay_host|:|netplay_peer_port|, if set.
+  unsigned short netplay_port = 0;
+  std::string netplay_host;
+  unsigned short netplay_peer_port = 0;
+
+  // Profiles every game played, writing a report to this path and collapsed
+  // stacks next to it.
+  std::string profile_path;
+
+  // Profiles one in this many instructions on average.
+  uint32_t profile_interval = 1000;
+
+  // Records a timeline of the phases of every frame to this path, as Chrome
+  // trace event JSON.
+  std::string trace_path;
+
+  // Saves the input latency measured to this path on exit, see
+  // InputLatency::save().
+  std::string latency_path;
+
+  // Executes instructions with this engine.
+  EngineKind engine = EngineKind::INTERPRETER;
+
+  // Tunes the engine.
+  EngineOptions engine_options;
+
+  // Checks each ROM once loaded and has the engine translate its code ahead
+  // of time, if set. See validate_rom().
+  std::optional<Validation> validation;
+
+  // Writes the control flow graph of the ROM to this path, in DOT if it
+  // ends with ".dot" and as text otherwise, if set. Only used by batch runs.
+  std::string cfg_path;
+
+  // Keeps the blocks engines translate in files in this directory, to be
+  // reused by later runs of the same ROM, if set. See BlockCache.
+  std::string block_cache_path;
+
+  // Runs the engine in lockstep with the reference interpreter, comparing
+  // them this often, if set. Only used by batch runs.
+  std::optional<Lockstep::Granularity> verify;
+
+  // Serves metrics for Prometheus on this localhost port, if set.
+  unsigned short metrics_port = 0;
+
+  // Directory of movies named after the ROMs they play, used as input by the
+  // ROM benchmark.
+  std::string inputs_path;
+
+  // Writes benchmark results as JSON to this path.
+  std::string json_path;
+
+  // The number of frames the headless runner runs when not replaying, and
+  // the ROM benchmark runs each ROM for.
+  uint32_t frames = 600;
+
+  // Runs on a virtual clock that advances one frame at a time instead of the
+  // system clock, so that timings and the seed are the same on every run.
+  // Only used by batch runs, outside netplay.
+  bool virtual_clock = false;
+};
+
+// Parses the command line into |options|. Returns false, after logging why,
+// if it is not valid.
+bool parse_options(int argc, char* argv[], Options* options);
@@ -0,0 +1,145 @@
+#include "src/perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "src/logging.h"
+
+namespace {
+
+#if defined(__linux__)
+
+int open_counter(PerfCounters::Event event) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  switch (event) {
+    case PerfCounters::Event::INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfCounters::Event::CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfCounters::Event::BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfCounters::Event::L1D_READ_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+  }
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+#endif
+
+}  // namespace
+
+PerfCounters::PerfCounters() {
+  fds_.fill(-1);
+#if defined(__linux__)
+  int error = 0;
+  for (size_t i = 0; i < kEvents; ++i) {
+    fds_[i] = open_counter(static_cast<Event>(i));
+    if (fds_[i] < 0) {
+      error = errno;
+    }
+  }
+  if (!available()) {
+    logging::log(logging::Level::WARN,
+                 std::string("Hardware performance counters are unavailable: ") +
+                     std::strerror(error));
+  }
+#else
+  logging::log(logging::Level::WARN,
+               "Hardware performance counters are only supported on Linux");
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::available() const {
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::start() {
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+PerfCounters::Counts PerfCounters::stop() {
+  Counts counts;
+#if defined(__linux__)
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (size_t i = 0; i < kEvents; ++i) {
+    // The count, then the time enabled and the time actually counting.
+    uint64_t values[3];
+    if (fds_[i] < 0 || read(fds_[i], values, sizeof(values)) !=
+                           static_cast<ssize_t>(sizeof(values))) {
+      continue;
+    }
+    if (values[1] == values[2]) {
+      counts[i] = values[0];
+    } else if (values[2] > 0) {
+      counts[i] = static_cast<uint64_t>(static_cast<double>(values[0]) *
+                                        values[1] / values[2]);
+    }
+  }
+#endif
+  return counts;
+}
+
+const char* PerfCounters::name(Event event) {
+  switch (event) {
+    case Event::INSTRUCTIONS:
+      return "instructions";
+    case Event::CYCLES:
+      return "cycles";
+    case Event::BRANCH_MISSES:
+      return "branch_misses";
+    case Event::L1D_READ_MISSES:
+      return "l1d_read_misses";
+  }
+  return "unknown";
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Counts host CPU events over a span of code, using Linux perf_event_open.
+//
+// Counters are opened one by one, so those the host supports keep working
+// when others are missing. Where none can be opened, e.g. in containers,
+// on virtual machines without a PMU or on other systems, every count is
+// empty and a single warning is logged.
+class PerfCounters {
+ public:
+  enum class Event {
+    INSTRUCTIONS,
+    CYCLES,
+    BRANCH_MISSES,
+    L1D_READ_MISSES,
+  };
+
+  static constexpr size_t kEvents = 4;
+
+  // The counts of each Event, empty for those unavailable.
+  using Counts = std::array<std::optional<uint64_t>, kEvents>;
+
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Returns true if at least one counter could be opened.
+  bool available() const;
+
+  // Resets and starts the counters.
+  void start();
+
+  // Stops the counters and returns the counts since start(), scaled up when
+  // the kernel had to multiplex them.
+  Counts stop();
+
+  static const char* name(Event event);
+
+  static std::optional<uint64_t> get(const Counts& counts, Event event) {
+    return counts[static_cast<size_t>(event)];
+  }
+
+ private:
+  // The file descriptor of each Event, or -1.
+  std::array<int, kEvents> fds_;
+};
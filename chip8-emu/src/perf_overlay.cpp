@@ -0,0 +1,158 @@
+#include "src/perf_overlay.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "src/constants.h"
+#include "src/fast_forward.h"
+
+namespace {
+
+constexpr unsigned int kCharacterSize = 16;
+constexpr float kPadding = 6;
+constexpr size_t kLines = 4;
+
+// Bars are kBarWidth wide, and a bar kGraphHeight high stands for
+// kGraphRange seconds. The target frame time is marked with a line.
+constexpr float kBarWidth = 2;
+constexpr float kGraphWidth = LiveStats::kHistory * kBarWidth;
+constexpr float kGraphHeight = 48;
+constexpr double kTargetFrameTime = 1 / FastForward::kFrameRate;
+constexpr double kGraphRange = 2 * kTargetFrameTime;
+
+// Frames taking longer than this are drawn as hitches.
+constexpr double kHitchFrameTime = 1.5 * kTargetFrameTime;
+
+const sf::Color kBackground(0, 0, 0, 192);
+const sf::Color kHitch = sf::Color::Red;
+const sf::Color kTargetLine(255, 255, 255, 96);
+
+// Where each part of the overlay starts in the vertex array. The graph has
+// a fixed number of vertices, so that it can be updated in place.
+constexpr size_t kBackgroundVertex = 0;
+constexpr size_t kTargetLineVertex = 4;
+constexpr size_t kBarsVertex = 8;
+constexpr size_t kTextVertex = kBarsVertex + LiveStats::kHistory * 4;
+
+float milliseconds(double seconds) {
+  return seconds * 1000;
+}
+
+}  // namespace
+
+PerfOverlay::PerfOverlay(const sf::Font& font)
+    : texture_(font.getTexture(kCharacterSize)),
+      line_spacing_(font.getLineSpacing(kCharacterSize)),
+      white_(1, 1, 0, 0),
+      vertices_(sf::Quads, kTextVertex) {
+  for (char c = kFirstGlyph; c <= kLastGlyph; ++c) {
+    const sf::Glyph& glyph = font.getGlyph(c, kCharacterSize, false);
+    glyphs_[c - kFirstGlyph] = {glyph.advance, glyph.bounds,
+                                sf::FloatRect(glyph.textureRect)};
+  }
+  set_quad(kTargetLineVertex,
+           sf::FloatRect(kPadding,
+                         kPadding + kGraphHeight -
+                             kGraphHeight * kTargetFrameTime / kGraphRange,
+                         kGraphWidth, 1),
+           white_, kTargetLine);
+  for (size_t i = 0; i < LiveStats::kHistory; ++i) {
+    set_quad(kBarsVertex + i * 4, sf::FloatRect(), white_, kForegroundColor);
+  }
+  update_text(LiveStats(), 1);
+}
+
+void PerfOverlay::set_quad(size_t vertex, sf::FloatRect rect,
+                           sf::FloatRect texture_rect, sf::Color color) {
+  float right = rect.left + rect.width;
+  float bottom = rect.top + rect.height;
+  float texture_right = texture_rect.left + texture_rect.width;
+  float texture_bottom = texture_rect.top + texture_rect.height;
+  vertices_[vertex] = sf::Vertex(sf::Vector2f(rect.left, rect.top), color,
+                                 sf::Vector2f(texture_rect.left,
+                                              texture_rect.top));
+  vertices_[vertex + 1] = sf::Vertex(
+      sf::Vector2f(right, rect.top), color,
+      sf::Vector2f(texture_right, texture_rect.top));
+  vertices_[vertex + 2] = sf::Vertex(
+      sf::Vector2f(right, bottom), color,
+      sf::Vector2f(texture_right, texture_bottom));
+  vertices_[vertex + 3] = sf::Vertex(
+      sf::Vector2f(rect.left, bottom), color,
+      sf::Vector2f(texture_rect.left, texture_bottom));
+}
+
+float PerfOverlay::add_text(const char* text, float y) {
+  float x = kPadding;
+  for (; *text; ++text) {
+    char c = *text;
+    if (c < kFirstGlyph || c > kLastGlyph) {
+      c = '?';
+    }
+    const Glyph& glyph = glyphs_[c - kFirstGlyph];
+    if (glyph.bounds.width > 0) {
+      size_t vertex = vertices_.getVertexCount();
+      vertices_.resize(vertex + 4);
+      set_quad(vertex,
+               sf::FloatRect(x + glyph.bounds.left, y + glyph.bounds.top,
+                             glyph.bounds.width, glyph.bounds.height),
+               glyph.texture_rect, kForegroundColor);
+    }
+    x += glyph.advance;
+  }
+  return x - kPadding;
+}
+
+void PerfOverlay::update_text(const LiveStats& stats, double speed) {
+  char lines[kLines][64];
+  std::snprintf(lines[0], sizeof(lines[0]), "FPS %.1f  IPS %.0f  speed %.1fx",
+                stats.frames_per_second(), stats.instructions_per_second(),
+                speed);
+  std::snprintf(lines[1], sizeof(lines[1]),
+                "frame min %.1f avg %.1f p99 %.1f ms",
+                milliseconds(stats.min_frame_time()),
+                milliseconds(stats.average_frame_time()),
+                milliseconds(stats.p99_frame_time()));
+  if (stats.timer_drift()) {
+    std::snprintf(lines[2], sizeof(lines[2]), "timer drift %+.1f ms",
+                  milliseconds(*stats.timer_drift()));
+  } else {
+    std::snprintf(lines[2], sizeof(lines[2]), "timer drift n/a");
+  }
+  std::snprintf(lines[3], sizeof(lines[3]),
+                "emu %.2f render %.2f display %.2f ms",
+                milliseconds(stats.emulation_time()),
+                milliseconds(stats.render_time()),
+                milliseconds(stats.display_time()));
+
+  vertices_.resize(kTextVertex);
+  float width = kGraphWidth;
+  float y = 2 * kPadding + kGraphHeight;
+  for (const char* line : lines) {
+    y += line_spacing_;
+    width = std::max(width, add_text(line, y));
+  }
+  set_quad(kBackgroundVertex,
+           sf::FloatRect(0, 0, width + 2 * kPadding, y + kPadding), white_,
+           kBackground);
+}
+
+void PerfOverlay::update_graph(const LiveStats& stats) {
+  // The newest frame is on the right.
+  size_t first = LiveStats::kHistory - stats.frame_times();
+  for (size_t i = 0; i < stats.frame_times(); ++i) {
+    double frame_time = stats.frame_time(i);
+    float height =
+        kGraphHeight * std::min(1.0, frame_time / kGraphRange);
+    set_quad(kBarsVertex + (first + i) * 4,
+             sf::FloatRect(kPadding + (first + i) * kBarWidth,
+                           kPadding + kGraphHeight - height, kBarWidth,
+                           height),
+             white_,
+             frame_time > kHitchFrameTime ? kHitch : kForegroundColor);
+  }
+}
+
+void PerfOverlay::draw(sf::RenderTarget* target) const {
+  target->draw(vertices_, &texture_);
+}
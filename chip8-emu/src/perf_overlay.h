@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+
+#include <SFML/Graphics.hpp>
+
+#include "src/live_stats.h"
+
+// Draws LiveStats over the game: a graph of the recent frame times, above a
+// few lines of figures.
+//
+// So as not to slow down what it measures, the whole overlay is a single
+// vertex array drawn in one call. The glyphs are looked up once, when the
+// overlay is created, and the text is only laid out again when the figures
+// are refreshed. The graph and background are textured with the white
+// square every font page reserves for underlines.
+class PerfOverlay {
+ public:
+  // |font| must outlive this instance.
+  explicit PerfOverlay(const sf::Font& font);
+
+  // Lays out the figures of |stats| again, along with the emulation |speed|
+  // as a multiple of the normal one. Only needed when they were refreshed.
+  void update_text(const LiveStats& stats, double speed);
+
+  // Moves the bars of the frame time graph to the times of |stats|.
+  void update_graph(const LiveStats& stats);
+
+  // Draws the overlay onto |target|, in the top left corner.
+  void draw(sf::RenderTarget* target) const;
+
+ private:
+  static constexpr char kFirstGlyph = ' ';
+  static constexpr char kLastGlyph = '~';
+
+  struct Glyph {
+    float advance;
+    sf::FloatRect bounds;
+    sf::FloatRect texture_rect;
+  };
+
+  // Sets the four vertices of the quad starting at |vertex|.
+  void set_quad(size_t vertex, sf::FloatRect rect, sf::FloatRect texture_rect,
+                sf::Color color);
+
+  // Appends the quads of |text| with its baseline at |y|. Returns the width
+  // of the text.
+  float add_text(const char* text, float y);
+
+  const sf::Texture& texture_;
+  std::array<Glyph, kLastGlyph - kFirstGlyph + 1> glyphs_;
+  float line_spacing_;
+  sf::FloatRect white_;
+  sf::VertexArray vertices_;
+};
@@ -0,0 +1,178 @@
+#include "src/predecoded_engine.h"
+
+bool PredecodedEngine::run(Cpu* cpu, unsigned int instructions) {
+  return counts_instructions(cpu) ? run<true>(cpu, instructions)
+                                  : run<false>(cpu, instructions);
+}
+
+template <bool kCounting>
+bool PredecodedEngine::run(Cpu* cpu, unsigned int instructions) {
+  Cpu::Registers& r = registers(cpu);
+  const uint8_t* memory = this->memory(cpu);
+  uint8_t* v = r.v;
+  cache_.invalidate(take_written_lines(cpu));
+
+  for (unsigned int i = 0; i < instructions; ++i) {
+    // Nothing runs until the key arrives, which cannot happen meanwhile.
+    if (r.waiting_for_key_press) {
+      return true;
+    }
+    // The last byte of memory holds no complete instruction.
+    if (r.pc >= Cpu::kMaxMemory) {
+      if (!cpu->step()) {
+        return false;
+      }
+      continue;
+    }
+
+    const DecodedInstruction& instruction = cache_.get(memory, r.pc);
+    if (instruction.superinstruction != Superinstruction::NONE &&
+        instructions - i >=
+            superinstruction_length(instruction.superinstruction)) {
+      uint16_t start = r.pc;
+      unsigned int executed = run_superinstruction(
+          instruction.superinstruction, instruction.word,
+          instruction.next_words, instructions - i, cpu, r);
+      if (executed == 0) {
+        return false;
+      }
+      if (kCounting) {
+        count_instructions(
+            cpu, start, superinstruction_length(instruction.superinstruction),
+            executed);
+      }
+      i += executed - 1;
+      continue;
+    }
+    if (kCounting) {
+      count_instructions(cpu, r.pc, 1, 1);
+    }
+    switch (instruction.opcode_class) {
+      case OpcodeClass::SYS:
+        break;
+      case OpcodeClass::JP:
+        r.pc = instruction.nnn;
+        continue;
+      case OpcodeClass::CALL:
+        // Overflows fail through the reference, which logs why.
+        if (r.sp >= Cpu::kStackSize) {
+          return cpu->execute(instruction.word);
+        }
+        r.stack[r.sp++] = r.pc;
+        r.pc = instruction.nnn;
+        continue;
+      case OpcodeClass::RET:
+        if (r.sp == 0) {
+          return cpu->execute(instruction.word);
+        }
+        r.pc = r.stack[--r.sp];
+        break;
+      case OpcodeClass::SE_BYTE:
+        if (v[instruction.x] == instruction.kk) {
+          r.pc += 2;
+        }
+        break;
+      case OpcodeClass::SNE_BYTE:
+        if (v[instruction.x] != instruction.kk) {
+          r.pc += 2;
+        }
+        break;
+      case OpcodeClass::SE_REG:
+        if (v[instruction.x] == v[instruction.y]) {
+          r.pc += 2;
+        }
+        break;
+      case OpcodeClass::SNE_REG:
+        if (v[instruction.x] != v[instruction.y]) {
+          r.pc += 2;
+        }
+        break;
+      case OpcodeClass::LD_BYTE:
+        v[instruction.x] = instruction.kk;
+        break;
+      case OpcodeClass::ADD_BYTE:
+        v[instruction.x] += instruction.kk;
+        break;
+      case OpcodeClass::LD_REG:
+        v[instruction.x] = v[instruction.y];
+        break;
+      case OpcodeClass::OR:
+        v[instruction.x] |= v[instruction.y];
+        break;
+      case OpcodeClass::AND:
+        v[instruction.x] &= v[instruction.y];
+        break;
+      case OpcodeClass::XOR:
+        v[instruction.x] ^= v[instruction.y];
+        break;
+      case OpcodeClass::ADD_REG: {
+        unsigned int sum = v[instruction.x] + v[instruction.y];
+        v[instruction.x] = sum;
+        v[0xf] = sum > 0xff;
+        break;
+      }
+      case OpcodeClass::SUB: {
+        uint8_t right = v[instruction.y];
+        bool no_borrow = v[instruction.x] > right;
+        v[instruction.x] -= right;
+        v[0xf] = no_borrow;
+        break;
+      }
+      case OpcodeClass::SHR: {
+        bool last_bit = v[instruction.x] & 1;
+        v[instruction.x] >>= 1;
+        v[0xf] = last_bit;
+        break;
+      }
+      case OpcodeClass::SUBN: {
+        uint8_t right = v[instruction.y];
+        bool no_borrow = right > v[instruction.x];
+        v[instruction.x] = right - v[instruction.x];
+        v[0xf] = no_borrow;
+        break;
+      }
+      case OpcodeClass::SHL: {
+        bool first_bit = (v[instruction.x] >> 7) & 1;
+        v[instruction.x] <<= 1;
+        v[0xf] = first_bit;
+        break;
+      }
+      case OpcodeClass::LD_I:
+        r.index = instruction.nnn;
+        break;
+      case OpcodeClass::JP_V0:
+        r.pc = instruction.nnn + v[0];
+        continue;
+      case OpcodeClass::LD_VX_DT:
+        v[instruction.x] = r.delay;
+        break;
+      case OpcodeClass::LD_DT_VX:
+        r.delay = v[instruction.x];
+        break;
+      case OpcodeClass::LD_ST_VX:
+        r.sound = v[instruction.x];
+        break;
+      case OpcodeClass::ADD_I_VX:
+        r.index += v[instruction.x];
+        break;
+      case OpcodeClass::LD_F_VX:
+        r.index += v[instruction.x] * 5;
+        break;
+      default:
+        if (!cpu->execute(instruction.word)) {
+          return false;
+        }
+        if (instruction.writes_memory()) {
+          cache_.invalidate(take_written_lines(cpu));
+        }
+        break;
+    }
+    r.pc += 2;
+  }
+  return true;
+}
+
+void PredecodedEngine::prepare(Cpu* cpu, const ControlFlowGraph& graph) {
+  cache_.invalidate(take_written_lines(cpu));
+  cache_.prepare(memory(cpu), graph);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "src/decode_cache.h"
+#include "src/execution_engine.h"
+
+// Decodes every instruction once, then dispatches on its opcode with a
+// switch, handling the common ones itself and the rest, e.g. drawing and
+// keys, through Cpu::execute(). Superinstructions are run as one when there
+// are enough instructions left to run.
+class PredecodedEngine : public ExecutionEngine {
+ public:
+  EngineKind kind() const override { return EngineKind::PREDECODED; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+
+  void prepare(Cpu* cpu, const ControlFlowGraph& graph) override;
+
+ private:
+  // Counts the instructions run only if kCounting, which is chosen once per
+  // call so that not counting costs nothing.
+  template <bool kCounting>
+  bool run(Cpu* cpu, unsigned int instructions);
+
+  DecodeCache<DecodedInstruction> cache_;
+};
@@ -0,0 +1,220 @@
+#include "src/profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "src/logging.h"
+#include "src/util.h"
+
+namespace {
+
+// The most instructions listed for a single block in the report.
+constexpr size_t kMaxListedInstructions = 64;
+
+uint16_t instruction_at(const Cpu& cpu, uint16_t address) {
+  return (cpu.peek(address & Cpu::kMaxMemory) << 8) |
+         cpu.peek((address + 1) & Cpu::kMaxMemory);
+}
+
+bool is_skip(uint16_t instruction) {
+  switch (opcode_class(instruction)) {
+    case OpcodeClass::SE_BYTE:
+    case OpcodeClass::SNE_BYTE:
+    case OpcodeClass::SE_REG:
+    case OpcodeClass::SNE_REG:
+    case OpcodeClass::SKP:
+    case OpcodeClass::SKNP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Marks every address that a jump or call in the program goes to. Scans the
+// whole program, so data that looks like jumps adds a few spurious targets,
+// which only split blocks. Some ROMs run code at odd addresses, so those are
+// scanned too if |odd| is set.
+std::vector<bool> branch_targets(const Cpu& cpu, bool odd) {
+  std::vector<bool> targets(Cpu::kMaxMemory + 1);
+  for (uint16_t address = Cpu::kMinAddressableMemory;
+       address < Cpu::kMaxMemory; address += odd ? 1 : 2) {
+    uint16_t instruction = instruction_at(cpu, address);
+    OpcodeClass opcode_class = ::opcode_class(instruction);
+    if (opcode_class == OpcodeClass::JP || opcode_class == OpcodeClass::CALL) {
+      targets[instruction & 0xfff] = true;
+    }
+  }
+  return targets;
+}
+
+// Returns true if a basic block starts at |address|, as it follows a branch
+// or is a branch target.
+bool starts_block(const Cpu& cpu, const std::vector<bool>& targets,
+                  uint16_t address) {
+  if (address <= Cpu::kMinAddressableMemory || targets[address]) {
+    return true;
+  }
+  if (is_branch(instruction_at(cpu, address - 2))) {
+    return true;
+  }
+  return address >= Cpu::kMinAddressableMemory + 4 &&
+         is_skip(instruction_at(cpu, address - 4));
+}
+
+uint16_t block_start(const Cpu& cpu, const std::vector<bool>& targets,
+                     uint16_t address) {
+  while (!starts_block(cpu, targets, address)) {
+    address -= 2;
+  }
+  return address;
+}
+
+std::string percent(uint64_t part, uint64_t total) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1)
+      << (total ? 100.0 * part / total : 0) << "%";
+  return out.str();
+}
+
+}  // namespace
+
+Profiler::Profiler(uint32_t interval)
+    : interval_(std::max(interval, 1u)) {
+  countdown_ = next_interval();
+}
+
+void Profiler::sample(const Cpu& cpu, uint16_t instruction) {
+  uint16_t pc = cpu.pc();
+  ++samples_;
+  ++pc_samples_[pc];
+  odd_samples_ |= pc & 1;
+  ++class_samples_[static_cast<size_t>(opcode_class(instruction))];
+
+  const Cpu::Registers& registers = cpu.registers();
+  Stack stack;
+  for (uint8_t i = 0; i < registers.sp; ++i) {
+    // The stack holds the addresses of the calls, which hold the entry
+    // points of the subroutines.
+    stack.frames[i] = instruction_at(cpu, registers.stack[i]) & 0xfff;
+  }
+  stack.frames[registers.sp] = pc;
+  stack.depth = registers.sp + 1;
+  ++stacks_[stack];
+}
+
+void Profiler::reset() {
+  samples_ = 0;
+  pc_samples_.fill(0);
+  class_samples_.fill(0);
+  stacks_.clear();
+  odd_samples_ = false;
+}
+
+std::map<uint16_t, uint64_t> Profiler::block_samples(const Cpu& cpu) const {
+  std::vector<bool> targets = branch_targets(cpu, odd_samples_);
+  std::map<uint16_t, uint64_t> blocks;
+  for (size_t address = 0; address < pc_samples_.size(); ++address) {
+    if (pc_samples_[address] > 0) {
+      blocks[block_start(cpu, targets, address)] += pc_samples_[address];
+    }
+  }
+  return blocks;
+}
+
+void Profiler::write_collapsed(const Cpu& cpu, std::ostream& out) const {
+  std::vector<bool> targets = branch_targets(cpu, odd_samples_);
+  std::map<std::string, uint64_t> collapsed;
+  for (const auto& [stack, samples] : stacks_) {
+    std::string frames = "main";
+    for (size_t i = 0; i + 1 < stack.depth; ++i) {
+      frames += ";sub_" + tohex(stack.frames[i], 3).substr(2);
+    }
+    uint16_t pc = stack.frames[stack.depth - 1];
+    frames += ";block_" + tohex(block_start(cpu, targets, pc), 3).substr(2);
+    collapsed[frames] += samples;
+  }
+  for (const auto& [frames, samples] : collapsed) {
+    out << frames << " " << samples << "\n";
+  }
+}
+
+void Profiler::write_report(const Cpu& cpu, std::ostream& out) const {
+  out << samples_ << " samples, one every " << interval_
+      << " instructions on average\n\n";
+
+  out << "Opcode classes:\n";
+  std::vector<std::pair<uint64_t, size_t>> classes;
+  for (size_t i = 0; i < class_samples_.size(); ++i) {
+    if (class_samples_[i] > 0) {
+      classes.push_back({class_samples_[i], i});
+    }
+  }
+  std::sort(classes.rbegin(), classes.rend());
+  for (const auto& [samples, index] : classes) {
+    out << "  " << opcode_pattern(static_cast<OpcodeClass>(index))
+        << std::setw(12) << samples << std::setw(8)
+        << percent(samples, samples_) << "\n";
+  }
+
+  out << "\nHottest blocks:\n";
+  std::vector<bool> targets = branch_targets(cpu, odd_samples_);
+  std::vector<std::pair<uint64_t, uint16_t>> blocks;
+  for (const auto& [start, samples] : block_samples(cpu)) {
+    blocks.push_back({samples, start});
+  }
+  std::sort(blocks.rbegin(), blocks.rend());
+  if (blocks.size() > kReportedBlocks) {
+    blocks.resize(kReportedBlocks);
+  }
+  for (const auto& [samples, start] : blocks) {
+    out << "\n" << tohex(start, 3) << ": " << samples << " samples ("
+        << percent(samples, samples_) << ")\n";
+    uint16_t address = start;
+    for (size_t i = 0; i < kMaxListedInstructions && address < Cpu::kMaxMemory;
+         ++i, address += 2) {
+      if (i > 0 && starts_block(cpu, targets, address)) {
+        break;
+      }
+      uint16_t instruction = instruction_at(cpu, address);
+      out << "  " << tohex(address, 3) << std::setw(10)
+          << pc_samples_[address] << "  " << tohex(instruction).substr(2)
+          << "  " << disassemble(instruction) << "\n";
+    }
+  }
+}
+
+bool Profiler::save(const Cpu& cpu, const std::string& path) const {
+  std::ofstream report(path);
+  std::ofstream collapsed(path + ".folded");
+  if (!report || !collapsed) {
+    logging::log(logging::Level::ERROR, "Could not write profile to " + path);
+    return false;
+  }
+  write_report(cpu, report);
+  write_collapsed(cpu, collapsed);
+  logging::log(logging::Level::INFO, "Profile written to " + path);
+  return true;
+}
+
+bool Profiler::Stack::operator==(const Stack& other) const {
+  return depth == other.depth &&
+         std::equal(frames.begin(), frames.begin() + depth,
+                    other.frames.begin());
+}
+
+size_t Profiler::StackHash::operator()(const Stack& stack) const {
+  return fnv1a(stack.frames.data(), stack.depth * sizeof(stack.frames[0]));
+}
+
+uint32_t Profiler::next_interval() {
+  if (interval_ == 1) {
+    return 1;
+  }
+  jitter_ ^= jitter_ << 13;
+  jitter_ ^= jitter_ >> 17;
+  jitter_ ^= jitter_ << 5;
+  return 1 + jitter_ % (2 * interval_ - 1);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "src/cpu.h"
+#include "src/disassembler.h"
+
+// Samples the instructions a Cpu executes, to find the hot loops of a ROM.
+//
+// Every sample counts the address and opcode class of the instruction about
+// to run, along with the subroutines on the call stack. Basic blocks are
+// found afterwards in the machine's memory, so that sampling stays cheap.
+class Profiler {
+ public:
+  // The number of hottest blocks listed by write_report().
+  static constexpr size_t kReportedBlocks = 20;
+
+  // Samples one in every |interval| instructions on average. Intervals
+  // above 1 are jittered so that loops whose length divides the interval
+  // are not always sampled at the same address.
+  explicit Profiler(uint32_t interval = 1);
+
+  // Returns true if the next instruction is to be sampled. Called by the Cpu
+  // before every instruction.
+  bool tick() {
+    if (--countdown_ != 0) {
+      return false;
+    }
+    countdown_ = next_interval();
+    return true;
+  }
+
+  // Records |instruction|, about to be executed by |cpu|.
+  void sample(const Cpu& cpu, uint16_t instruction);
+
+  void reset();
+
+  uint32_t interval() const { return interval_; }
+
+  uint64_t samples() const { return samples_; }
+
+  uint64_t samples_at(uint16_t address) const { return pc_samples_[address]; }
+
+  uint64_t samples_of(OpcodeClass opcode_class) const {
+    return class_samples_[static_cast<size_t>(opcode_class)];
+  }
+
+  // Returns the samples in each basic block of |cpu|'s program, keyed by the
+  // address of the block's first instruction.
+  std::map<uint16_t, uint64_t> block_samples(const Cpu& cpu) const;
+
+  // Writes the samples as collapsed stacks, one "main;sub_2A4;block_2B0 17"
+  // line per distinct stack, as read by flamegraph.pl, speedscope and
+  // pprof's folded importers.
+  void write_collapsed(const Cpu& cpu, std::ostream& out) const;
+
+  // Writes the opcode class histogram and the hottest blocks, disassembled
+  // with samples per address.
+  void write_report(const Cpu& cpu, std::ostream& out) const;
+
+  // Writes the report to |path| and the collapsed stacks to |path| with
+  // ".folded" appended. Returns true if successful.
+  bool save(const Cpu& cpu, const std::string& path) const;
+
+ private:
+  uint32_t next_interval();
+
+  const uint32_t interval_;
+  uint32_t countdown_ = 1;
+  // State of the xorshift generator jittering the interval. Separate from
+  // the machine's own Random so that profiling does not change emulation.
+  uint32_t jitter_ = 2463534242u;
+
+  uint64_t samples_ = 0;
+  std::array<uint64_t, Cpu::kMaxMemory + 1> pc_samples_ = {};
+  std::array<uint64_t, kOpcodeClasses> class_samples_ = {};
+  // Whether any instruction was sampled at an odd address.
+  bool odd_samples_ = false;
+  // A call stack: the entry points of the subroutines being run, outermost
+  // first, followed by the sampled address. Fixed in size, so that sampling
+  // allocates only for stacks not seen before.
+  struct Stack {
+    std::array<uint16_t, Cpu::kStackSize + 1> frames;
+    uint8_t depth;
+
+    bool operator==(const Stack& other) const;
+  };
+
+  struct StackHash {
+    size_t operator()(const Stack& stack) const;
+  };
+
+  // Samples per call stack.
+  std::unordered_map<Stack, uint64_t, StackHash> stacks_;
+};
@@ -1,14 +1,12 @@
 #include "random.h"
 
-#include <cstdlib>
-#include <ctime>
+Random::Random() : Random(*SystemClock::get()) {}
 
-Random::Random() : Random(std::time(nullptr)) {}
+Random::Random(const Clock& clock) : Random(clock.wall_time()) {}
 
-Random::Random(unsigned int seed) {
-  std::srand(seed);
-}
+Random::Random(uint32_t seed) : seed_(seed), state_(seed) {}
 
 int Random::rand() {
-  return std::rand();
+  state_ = state_ * 1103515245 + 12345;
+  return (state_ >> 16) & 0x7fff;
 }
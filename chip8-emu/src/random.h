@@ -1,11 +1,31 @@
 #pragma once
 
-// Returns random numbers using std::rand(). Provided to allow injecting tests.
+#include <cstdint>
+
+#include "src/clock.h"
+
+// Returns pseudo-random numbers from a per-instance linear congruential
+// generator, so that the sequence only depends on the seed. Provided to allow
+// injecting tests.
 class Random {
  public:
+  // Seeds from the wall time of the system clock.
   Random();
-  explicit Random(unsigned int seed);
+  // Seeds from the wall time of |clock|.
+  explicit Random(const Clock& clock);
+  explicit Random(uint32_t seed);
   virtual ~Random() = default;
 
+  // Returns a number in [0, 0x7fff].
   virtual int rand();
+
+  uint32_t seed() const { return seed_; }
+
+  // The generator state, to be saved and restored along with the machine.
+  uint32_t state() const { return state_; }
+  void set_state(uint32_t state) { state_ = state; }
+
+ private:
+  uint32_t seed_;
+  uint32_t state_;
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "src/rewind_buffer.h"
+
+#include <cstring>
+#include <utility>
+
+RewindBuffer::RewindBuffer(size_t max_bytes, size_t keyframe_interval)
+    : max_bytes_(max_bytes),
+      keyframe_interval_(keyframe_interval),
+      current_(std::make_unique<Cpu::State>()),
+      scratch_(std::make_unique<Cpu::State>()) {}
+
+RewindBuffer::~RewindBuffer() = default;
+
+size_t RewindBuffer::Entry::bytes() const {
+  return sizeof(Entry) + lines.size() * sizeof(Line) +
+         columns.size() * sizeof(Column) +
+         (keyframe ? sizeof(Cpu::State) : 0);
+}
+
+void RewindBuffer::push(Cpu* cpu) {
+  cpu->save_state(scratch_.get());
+  cpu->clear_dirty_lines();
+  if (!has_current_) {
+    std::swap(current_, scratch_);
+    has_current_ = true;
+    return;
+  }
+
+  Entry entry;
+  entry.registers = current_->registers;
+  entry.random_state = current_->random_state;
+  if (++frames_since_keyframe_ >= keyframe_interval_) {
+    frames_since_keyframe_ = 0;
+    entry.keyframe = std::make_unique<Cpu::State>(*current_);
+  } else {
+    uint64_t dirty = scratch_->dirty_lines;
+    for (uint8_t line = 0; line < Cpu::kCacheLines; ++line) {
+      if (!(dirty & (1ull << line))) {
+        continue;
+      }
+      const uint8_t* before = current_->memory + line * Cpu::kCacheLineSize;
+      const uint8_t* after = scratch_->memory + line * Cpu::kCacheLineSize;
+      if (std::memcmp(before, after, Cpu::kCacheLineSize) == 0) {
+        continue;
+      }
+      Line saved;
+      saved.index = line;
+      std::memcpy(saved.bytes, before, Cpu::kCacheLineSize);
+      entry.lines.push_back(saved);
+    }
+    for (uint8_t x = 0; x < FrameBuffer::kScreenWidth; ++x) {
+      uint32_t bits = current_->frame_buffer.column(x) ^
+                      scratch_->frame_buffer.column(x);
+      if (bits) {
+        entry.columns.push_back({x, bits});
+      }
+    }
+  }
+
+  bytes_ += entry.bytes();
+  entries_.push_back(std::move(entry));
+  std::swap(current_, scratch_);
+  current_->dirty_lines = 0;
+
+  while (bytes_ > max_bytes_ && !entries_.empty()) {
+    bytes_ -= entries_.front().bytes();
+    entries_.pop_front();
+  }
+}
+
+bool RewindBuffer::pop(Cpu* cpu) {
+  if (entries_.empty()) {
+    return false;
+  }
+  Entry& entry = entries_.back();
+  if (entry.keyframe) {
+    std::swap(current_, entry.keyframe);
+  } else {
+    for (const Line& line : entry.lines) {
+      std::memcpy(current_->memory + line.index * Cpu::kCacheLineSize,
+                  line.bytes, Cpu::kCacheLineSize);
+    }
+    for (const Column& column : entry.columns) {
+      current_->frame_buffer.xor_column(column.x, column.bits);
+    }
+    current_->registers = entry.registers;
+    current_->random_state = entry.random_state;
+  }
+  current_->dirty_lines = 0;
+  if (frames_since_keyframe_ > 0) {
+    --frames_since_keyframe_;
+  }
+  bytes_ -= entry.bytes();
+  entries_.pop_back();
+
+  cpu->load_state(*current_);
+  return true;
+}
+
+void RewindBuffer::clear() {
+  entries_.clear();
+  bytes_ = 0;
+  frames_since_keyframe_ = 0;
+  has_current_ = false;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "src/cpu.h"
+
+// Keeps a history of machine states, one per frame, so the emulation can be
+// run backwards.
+//
+// Each entry stores what is needed to go from a frame back to the one before
+// it: the previous registers and random number generator state, the previous
+// contents of the cache lines the frame wrote to (as reported by
+// Cpu::dirty_lines()) and the XOR of both framebuffers. Every |keyframe_interval| entries a complete state is stored
+// instead. The oldest entries are discarded once |max_bytes| is exceeded.
+class RewindBuffer {
+ public:
+  static constexpr size_t kDefaultMaxBytes = 4 * 1024 * 1024;
+  static constexpr size_t kDefaultKeyframeInterval = 120;
+
+  explicit RewindBuffer(size_t max_bytes = kDefaultMaxBytes,
+                        size_t keyframe_interval = kDefaultKeyframeInterval);
+  ~RewindBuffer();
+
+  // Records the current state of |cpu| and clears its dirty lines. The first
+  // call only establishes the starting point.
+  void push(Cpu* cpu);
+
+  // Moves |cpu| one frame back in time. Returns false if there is no more
+  // history to rewind to, in which case |cpu| is left untouched.
+  bool pop(Cpu* cpu);
+
+  // Forgets all history.
+  void clear();
+
+  // Returns the number of frames that can be rewound.
+  size_t size() const { return entries_.size(); }
+
+  // Returns the approximate memory used by the history, in bytes.
+  size_t bytes() const { return bytes_; }
+
+ private:
+  struct Line {
+    uint8_t index;
+    uint8_t bytes[Cpu::kCacheLineSize];
+  };
+
+  struct Column {
+    uint8_t x;
+    uint32_t bits;
+  };
+
+  struct Entry {
+    Cpu::Registers registers;
+    uint32_t random_state;
+    std::vector<Line> lines;
+    std::vector<Column> columns;
+    // Set instead of |lines| and |columns| on keyframes.
+    std::unique_ptr<Cpu::State> keyframe;
+
+    size_t bytes() const;
+  };
+
+  const size_t max_bytes_;
+  const size_t keyframe_interval_;
+
+  std::deque<Entry> entries_;
+  size_t bytes_ = 0;
+  size_t frames_since_keyframe_ = 0;
+
+  // The state at the most recent frame in the history.
+  bool has_current_ = false;
+  std::unique_ptr<Cpu::State> current_;
+  std::unique_ptr<Cpu::State> scratch_;
+};
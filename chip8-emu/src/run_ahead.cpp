@@ -0,0 +1,31 @@
+#include "src/run_ahead.h"
+
+RunAhead::RunAhead(Cpu* cpu, unsigned int frames, Clock* clock)
+    : cpu_(cpu),
+      clock_(clock),
+      frames_(frames),
+      saved_(std::make_unique<Cpu::State>()) {}
+
+RunAhead::~RunAhead() = default;
+
+bool RunAhead::run(FrameBuffer* future) {
+  auto start = clock_->now();
+  cpu_->save_state(saved_.get());
+  auto saved = clock_->now();
+
+  bool result = true;
+  for (unsigned int i = 0; i < frames_ && result; ++i) {
+    result = cpu_->run_frame();
+  }
+  if (result) {
+    *future = *cpu_->frame_buffer();
+  }
+
+  auto ran = clock_->now();
+  cpu_->load_state(*saved_);
+  auto end = clock_->now();
+
+  last_cost_ = end - start;
+  last_state_cost_ = (saved - start) + (end - ran);
+  return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+
+#include "src/clock.h"
+#include "src/cpu.h"
+#include "src/frame_buffer.h"
+
+// Hides the frames of input lag games have by presenting a frame from the
+// future: saves the machine state, runs a few frames ahead with the input
+// currently held, keeps the resulting screen and restores the state.
+class RunAhead {
+ public:
+  // |cpu| and |clock|, which times run(), must outlive this instance.
+  RunAhead(Cpu* cpu, unsigned int frames,
+           Clock* clock = SystemClock::get());
+  ~RunAhead();
+
+  // Runs ahead and copies the screen that will be shown |frames| frames from
+  // now into |future|. The machine is left as it was. Returns false if the
+  // machine fails while running ahead, in which case |future| is untouched.
+  bool run(FrameBuffer* future);
+
+  unsigned int frames() const { return frames_; }
+
+  // The time the last run() took, in seconds, and the share of it spent
+  // saving and restoring the state.
+  double last_cost() const { return last_cost_; }
+  double last_state_cost() const { return last_state_cost_; }
+
+ private:
+  Cpu* cpu_;
+  Clock* clock_;
+  const unsigned int frames_;
+  std::unique_ptr<Cpu::State> saved_;
+
+  double last_cost_ = 0;
+  double last_state_cost_ = 0;
+};
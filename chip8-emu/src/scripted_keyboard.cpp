@@ -0,0 +1,18 @@
+#include "src/scripted_keyboard.h"
+
+bool ScriptedKeyboard::is_key_pressed(uint8_t key) const {
+  if (key > 0xf) {
+    return false;
+  }
+  return keys_ & (1 << key);
+}
+
+void ScriptedKeyboard::set_keys(uint16_t keys) {
+  uint16_t pressed = keys & ~keys_;
+  keys_ = keys;
+  for (uint8_t key = 0; key <= 0xf; ++key) {
+    if (pressed & (1 << key)) {
+      dispatch_key_pressed(key);
+    }
+  }
+}
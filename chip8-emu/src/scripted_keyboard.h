@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+#include "src/keyboard.h"
+
+// A keyboard whose state is set explicitly, one bitmask per frame, bit n
+// being key n. Used to latch host input once per frame and to replay
+// recorded input deterministically.
+class ScriptedKeyboard : public Keyboard {
+ public:
+  ScriptedKeyboard() = default;
+  ~ScriptedKeyboard() override = default;
+
+  bool is_key_pressed(uint8_t key) const override;
+
+  // Replaces the pressed keys with |keys|, notifying observers of every key
+  // that was not pressed before.
+  void set_keys(uint16_t keys);
+
+  // Replaces the pressed keys with |keys| without notifying observers, e.g.
+  // when restoring a save state.
+  void reset(uint16_t keys) { keys_ = keys; }
+
+  uint16_t keys() const { return keys_; }
+
+ private:
+  uint16_t keys_ = 0;
+};
@@ -43,4 +43,23 @@ void SfKeyboardAdapter::on_key_pressed(sf::Keyboard::Key key) {
       break;
     }
   }
+}
+
+uint16_t SfKeyboardAdapter::pressed_keys() const {
+  uint16_t pressed = 0;
+  for (int i = 0; i < keys.size(); ++i) {
+    if (sf::Keyboard::isKeyPressed(keys[i])) {
+      pressed |= 1 << i;
+    }
+  }
+  return pressed;
+}
+
+uint16_t SfKeyboardAdapter::key_mask(sf::Keyboard::Key key) {
+  for (int i = 0; i < keys.size(); ++i) {
+    if (keys[i] == key) {
+      return 1 << i;
+    }
+  }
+  return 0;
 }
\ No newline at end of file
@@ -9,4 +9,10 @@ class SfKeyboardAdapter : public Keyboard {
   bool is_key_pressed(uint8_t key) const override;
 
   void on_key_pressed(sf::Keyboard::Key key);
+
+  // Returns a bitmask of the CHIP-8 keys currently held, bit n being key n.
+  uint16_t pressed_keys() const;
+
+  // Returns the bitmask for the CHIP-8 key mapped to |key|, or 0 if unmapped.
+  static uint16_t key_mask(sf::Keyboard::Key key);
 };
\ No newline at end of file
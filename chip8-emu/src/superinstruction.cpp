@@ -0,0 +1,62 @@
+#include "src/superinstruction.h"
+
+#include "src/disassembler.h"
+
+namespace {
+
+bool is_skip_byte(OpcodeClass opcode_class) {
+  return opcode_class == OpcodeClass::SE_BYTE ||
+         opcode_class == OpcodeClass::SNE_BYTE;
+}
+
+}  // namespace
+
+Superinstruction match_superinstruction(const uint8_t* memory,
+                                        uint16_t address) {
+  // The opcode classes of up to three instructions from |address|.
+  OpcodeClass opcode_classes[3] = {OpcodeClass::UNKNOWN, OpcodeClass::UNKNOWN,
+                                   OpcodeClass::UNKNOWN};
+  for (unsigned int i = 0; i < 3; ++i) {
+    unsigned int instruction_address = address + i * 2;
+    if (instruction_address >= Cpu::kMaxMemory) {
+      break;
+    }
+    opcode_classes[i] = opcode_class(static_cast<uint16_t>(
+        memory[instruction_address] << 8 | memory[instruction_address + 1]));
+  }
+
+  switch (opcode_classes[0]) {
+    case OpcodeClass::SE_BYTE:
+    case OpcodeClass::SNE_BYTE:
+      if (opcode_classes[1] == OpcodeClass::JP) {
+        return Superinstruction::SKIP_JP;
+      }
+      break;
+    case OpcodeClass::LD_I:
+      if (opcode_classes[1] == OpcodeClass::DRW) {
+        return Superinstruction::LD_I_DRW;
+      }
+      break;
+    case OpcodeClass::LD_BYTE:
+      if (opcode_classes[1] == OpcodeClass::LD_DT_VX) {
+        return Superinstruction::LD_BYTE_LD_DT;
+      }
+      break;
+    case OpcodeClass::LD_VX_DT:
+      if (is_skip_byte(opcode_classes[1])) {
+        return opcode_classes[2] == OpcodeClass::JP
+                   ? Superinstruction::LD_VX_DT_SKIP_JP
+                   : Superinstruction::LD_VX_DT_SKIP;
+      }
+      break;
+    case OpcodeClass::ADD_BYTE:
+      if (is_skip_byte(opcode_classes[1]) &&
+          opcode_classes[2] == OpcodeClass::JP) {
+        return Superinstruction::ADD_BYTE_SKIP_JP;
+      }
+      break;
+    default:
+      break;
+  }
+  return Superinstruction::NONE;
+}
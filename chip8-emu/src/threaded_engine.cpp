@@ -0,0 +1,313 @@
+#include "src/threaded_engine.h"
+
+namespace {
+
+using Instruction = ThreadedEngine::Instruction;
+
+// Executes anything without a handler of its own through the reference.
+bool execute(Cpu* cpu, Cpu::Registers& r, const Instruction& instruction) {
+  if (!cpu->execute(instruction.decoded.word)) {
+    return false;
+  }
+  r.pc += 2;
+  return true;
+}
+
+bool sys(Cpu*, Cpu::Registers& r, const Instruction&) {
+  r.pc += 2;
+  return true;
+}
+
+bool jp(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc = instruction.decoded.nnn;
+  return true;
+}
+
+bool call(Cpu* cpu, Cpu::Registers& r, const Instruction& instruction) {
+  if (r.sp >= Cpu::kStackSize) {
+    return execute(cpu, r, instruction);
+  }
+  r.stack[r.sp++] = r.pc;
+  r.pc = instruction.decoded.nnn;
+  return true;
+}
+
+bool ret(Cpu* cpu, Cpu::Registers& r, const Instruction& instruction) {
+  if (r.sp == 0) {
+    return execute(cpu, r, instruction);
+  }
+  r.pc = r.stack[--r.sp] + 2;
+  return true;
+}
+
+bool se_byte(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc += r.v[instruction.decoded.x] == instruction.decoded.kk ? 4 : 2;
+  return true;
+}
+
+bool sne_byte(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc += r.v[instruction.decoded.x] != instruction.decoded.kk ? 4 : 2;
+  return true;
+}
+
+bool se_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc += r.v[instruction.decoded.x] == r.v[instruction.decoded.y] ? 4 : 2;
+  return true;
+}
+
+bool sne_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc += r.v[instruction.decoded.x] != r.v[instruction.decoded.y] ? 4 : 2;
+  return true;
+}
+
+bool ld_byte(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] = instruction.decoded.kk;
+  r.pc += 2;
+  return true;
+}
+
+bool add_byte(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] += instruction.decoded.kk;
+  r.pc += 2;
+  return true;
+}
+
+bool ld_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] = r.v[instruction.decoded.y];
+  r.pc += 2;
+  return true;
+}
+
+bool or_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] |= r.v[instruction.decoded.y];
+  r.pc += 2;
+  return true;
+}
+
+bool and_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] &= r.v[instruction.decoded.y];
+  r.pc += 2;
+  return true;
+}
+
+bool xor_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] ^= r.v[instruction.decoded.y];
+  r.pc += 2;
+  return true;
+}
+
+bool add_reg(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  unsigned int sum = r.v[instruction.decoded.x] + r.v[instruction.decoded.y];
+  r.v[instruction.decoded.x] = sum;
+  r.v[0xf] = sum > 0xff;
+  r.pc += 2;
+  return true;
+}
+
+bool sub(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  uint8_t right = r.v[instruction.decoded.y];
+  bool no_borrow = r.v[instruction.decoded.x] > right;
+  r.v[instruction.decoded.x] -= right;
+  r.v[0xf] = no_borrow;
+  r.pc += 2;
+  return true;
+}
+
+bool shr(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  bool last_bit = r.v[instruction.decoded.x] & 1;
+  r.v[instruction.decoded.x] >>= 1;
+  r.v[0xf] = last_bit;
+  r.pc += 2;
+  return true;
+}
+
+bool subn(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  uint8_t right = r.v[instruction.decoded.y];
+  bool no_borrow = right > r.v[instruction.decoded.x];
+  r.v[instruction.decoded.x] = right - r.v[instruction.decoded.x];
+  r.v[0xf] = no_borrow;
+  r.pc += 2;
+  return true;
+}
+
+bool shl(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  bool first_bit = (r.v[instruction.decoded.x] >> 7) & 1;
+  r.v[instruction.decoded.x] <<= 1;
+  r.v[0xf] = first_bit;
+  r.pc += 2;
+  return true;
+}
+
+bool ld_i(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.index = instruction.decoded.nnn;
+  r.pc += 2;
+  return true;
+}
+
+bool jp_v0(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.pc = instruction.decoded.nnn + r.v[0];
+  return true;
+}
+
+bool ld_vx_dt(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.v[instruction.decoded.x] = r.delay;
+  r.pc += 2;
+  return true;
+}
+
+bool ld_dt_vx(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.delay = r.v[instruction.decoded.x];
+  r.pc += 2;
+  return true;
+}
+
+bool ld_st_vx(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.sound = r.v[instruction.decoded.x];
+  r.pc += 2;
+  return true;
+}
+
+bool add_i_vx(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.index += r.v[instruction.decoded.x];
+  r.pc += 2;
+  return true;
+}
+
+bool ld_f_vx(Cpu*, Cpu::Registers& r, const Instruction& instruction) {
+  r.index += r.v[instruction.decoded.x] * 5;
+  r.pc += 2;
+  return true;
+}
+
+ThreadedEngine::Handler handler_of(OpcodeClass opcode_class) {
+  switch (opcode_class) {
+    case OpcodeClass::SYS:
+      return sys;
+    case OpcodeClass::JP:
+      return jp;
+    case OpcodeClass::CALL:
+      return call;
+    case OpcodeClass::RET:
+      return ret;
+    case OpcodeClass::SE_BYTE:
+      return se_byte;
+    case OpcodeClass::SNE_BYTE:
+      return sne_byte;
+    case OpcodeClass::SE_REG:
+      return se_reg;
+    case OpcodeClass::SNE_REG:
+      return sne_reg;
+    case OpcodeClass::LD_BYTE:
+      return ld_byte;
+    case OpcodeClass::ADD_BYTE:
+      return add_byte;
+    case OpcodeClass::LD_REG:
+      return ld_reg;
+    case OpcodeClass::OR:
+      return or_reg;
+    case OpcodeClass::AND:
+      return and_reg;
+    case OpcodeClass::XOR:
+      return xor_reg;
+    case OpcodeClass::ADD_REG:
+      return add_reg;
+    case OpcodeClass::SUB:
+      return sub;
+    case OpcodeClass::SHR:
+      return shr;
+    case OpcodeClass::SUBN:
+      return subn;
+    case OpcodeClass::SHL:
+      return shl;
+    case OpcodeClass::LD_I:
+      return ld_i;
+    case OpcodeClass::JP_V0:
+      return jp_v0;
+    case OpcodeClass::LD_VX_DT:
+      return ld_vx_dt;
+    case OpcodeClass::LD_DT_VX:
+      return ld_dt_vx;
+    case OpcodeClass::LD_ST_VX:
+      return ld_st_vx;
+    case OpcodeClass::ADD_I_VX:
+      return add_i_vx;
+    case OpcodeClass::LD_F_VX:
+      return ld_f_vx;
+    default:
+      return execute;
+  }
+}
+
+}  // namespace
+
+ThreadedEngine::Instruction ThreadedEngine::Instruction::decode(
+    uint16_t word) {
+  DecodedInstruction decoded = DecodedInstruction::decode(word);
+  return {handler_of(decoded.opcode_class), decoded};
+}
+
+ThreadedEngine::Instruction ThreadedEngine::Instruction::decode(
+    const uint8_t* memory, uint16_t address) {
+  DecodedInstruction decoded = DecodedInstruction::decode(memory, address);
+  return {handler_of(decoded.opcode_class), decoded};
+}
+
+bool ThreadedEngine::run(Cpu* cpu, unsigned int instructions) {
+  return counts_instructions(cpu) ? run<true>(cpu, instructions)
+                                  : run<false>(cpu, instructions);
+}
+
+template <bool kCounting>
+bool ThreadedEngine::run(Cpu* cpu, unsigned int instructions) {
+  Cpu::Registers& r = registers(cpu);
+  const uint8_t* memory = this->memory(cpu);
+  cache_.invalidate(take_written_lines(cpu));
+
+  for (unsigned int i = 0; i < instructions; ++i) {
+    // Nothing runs until the key arrives, which cannot happen meanwhile.
+    if (r.waiting_for_key_press) {
+      return true;
+    }
+    // The last byte of memory holds no complete instruction.
+    if (r.pc >= Cpu::kMaxMemory) {
+      if (!cpu->step()) {
+        return false;
+      }
+      continue;
+    }
+    const Instruction& instruction = cache_.get(memory, r.pc);
+    const DecodedInstruction& decoded = instruction.decoded;
+    if (decoded.superinstruction != Superinstruction::NONE &&
+        instructions - i >= superinstruction_length(decoded.superinstruction)) {
+      uint16_t start = r.pc;
+      unsigned int executed =
+          run_superinstruction(decoded.superinstruction, decoded.word,
+                               decoded.next_words, instructions - i, cpu, r);
+      if (executed == 0) {
+        return false;
+      }
+      if (kCounting) {
+        count_instructions(cpu, start,
+                           superinstruction_length(decoded.superinstruction),
+                           executed);
+      }
+      i += executed - 1;
+      continue;
+    }
+    if (kCounting) {
+      count_instructions(cpu, r.pc, 1, 1);
+    }
+    if (!instruction.handler(cpu, r, instruction)) {
+      return false;
+    }
+    if (instruction.decoded.writes_memory()) {
+      cache_.invalidate(take_written_lines(cpu));
+    }
+  }
+  return true;
+}
+
+void ThreadedEngine::prepare(Cpu* cpu, const ControlFlowGraph& graph) {
+  cache_.invalidate(take_written_lines(cpu));
+  cache_.prepare(memory(cpu), graph);
+}
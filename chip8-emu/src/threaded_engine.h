@@ -0,0 +1,41 @@
+#pragma once
+
+#include "src/decode_cache.h"
+#include "src/execution_engine.h"
+
+// Decodes every instruction once into a pointer to the function that
+// executes it, so that dispatching is a single indirect call. Portable C++
+// has no computed goto, hence call threading rather than direct threading.
+// Superinstructions are run as one when there are enough instructions left
+// to run.
+class ThreadedEngine : public ExecutionEngine {
+ public:
+  EngineKind kind() const override { return EngineKind::THREADED; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+
+  void prepare(Cpu* cpu, const ControlFlowGraph& graph) override;
+
+  struct Instruction;
+
+  // Executes |instruction| and moves the program counter past it. Returns
+  // false if the instruction fails.
+  using Handler = bool (*)(Cpu* cpu, Cpu::Registers& registers,
+                           const Instruction& instruction);
+
+  struct Instruction {
+    Handler handler;
+    DecodedInstruction decoded;
+
+    static Instruction decode(uint16_t word);
+    static Instruction decode(const uint8_t* memory, uint16_t address);
+  };
+
+ private:
+  // Counts the instructions run only if kCounting, which is chosen once per
+  // call so that not counting costs nothing.
+  template <bool kCounting>
+  bool run(Cpu* cpu, unsigned int instructions);
+
+  DecodeCache<Instruction> cache_;
+};
@@ -0,0 +1,164 @@
+#include "src/tiered_engine.h"
+
+#include <algorithm>
+
+#include "src/block_ir.h"
+
+const char* tier_name(Tier tier) {
+  switch (tier) {
+    case Tier::INTERPRETER:
+      return "interpreter";
+    case Tier::THREADED:
+      return "threaded";
+    case Tier::OPTIMIZED:
+      return "optimized";
+  }
+  return "unknown";
+}
+
+TieredEngine::TieredEngine(const EngineOptions& options) : options_(options) {}
+
+bool TieredEngine::run(Cpu* cpu, unsigned int instructions) {
+  OptimizingEngine::Context c = {cpu, registers(cpu), memory(cpu),
+                                 frame_buffer(cpu), {}};
+  Cpu::Registers& r = c.registers;
+
+  bool result = true;
+  unsigned int i = 0;
+  // Nothing runs until the key arrives, which cannot happen meanwhile.
+  while (i < instructions && !r.waiting_for_key_press) {
+    invalidate(take_written_lines(cpu));
+    // The last byte of memory holds no complete instruction.
+    if (r.pc >= Cpu::kMaxMemory) {
+      OptimizingEngine::materialize(c);
+      if (!cpu->step()) {
+        result = false;
+        break;
+      }
+      ++i;
+      continue;
+    }
+
+    uint16_t start = r.pc;
+    Profile& profile = profiles_[start];
+    // Blocks translated by earlier processes start in the optimized tier.
+    if (profile.tier == Tier::INTERPRETER && profile.runs == 0 &&
+        optimized_.cached(c.memory, start)) {
+      promote(c.memory, start, Tier::OPTIMIZED);
+    }
+    Tier tier = profile.tier;
+    unsigned int executed;
+    if (tier == Tier::OPTIMIZED) {
+      executed = optimized_.run_block(c, instructions - i);
+    } else {
+      // The lower tiers expect VF to hold the flag.
+      OptimizingEngine::materialize(c);
+      executed = tier == Tier::INTERPRETER
+                     ? interpret(cpu, instructions - i)
+                     : run_threaded(cpu, instructions - i);
+    }
+    if (executed == 0) {
+      result = false;
+      break;
+    }
+    i += executed;
+    counters_.instructions[static_cast<size_t>(tier)] += executed;
+    ++counters_.blocks[static_cast<size_t>(tier)];
+    if (tier != Tier::OPTIMIZED) {
+      count_run(c.memory, start);
+    }
+  }
+  OptimizingEngine::materialize(c);
+  return result;
+}
+
+unsigned int TieredEngine::interpret(Cpu* cpu, unsigned int budget) {
+  const Cpu::Registers& r = registers(cpu);
+  const uint8_t* memory = this->memory(cpu);
+  unsigned int executed = 0;
+  while (executed < budget && executed < Block::kMaxBlockSize &&
+         r.pc < Cpu::kMaxMemory) {
+    uint16_t word =
+        static_cast<uint16_t>(memory[r.pc] << 8 | memory[r.pc + 1]);
+    if (!cpu->step()) {
+      return 0;
+    }
+    ++executed;
+    if (ends_block(word)) {
+      break;
+    }
+  }
+  return executed;
+}
+
+unsigned int TieredEngine::run_threaded(Cpu* cpu, unsigned int budget) {
+  Cpu::Registers& r = registers(cpu);
+  const uint8_t* memory = this->memory(cpu);
+  unsigned int executed = 0;
+  while (executed < budget && executed < Block::kMaxBlockSize &&
+         r.pc < Cpu::kMaxMemory) {
+    const ThreadedEngine::Instruction& instruction =
+        threaded_.get(memory, r.pc);
+    count_instructions(cpu, r.pc, 1, 1);
+    if (!instruction.handler(cpu, r, instruction)) {
+      return 0;
+    }
+    ++executed;
+    if (ends_block(instruction.decoded.word)) {
+      break;
+    }
+  }
+  return executed;
+}
+
+void TieredEngine::count_run(const uint8_t* memory, uint16_t start) {
+  Profile& profile = profiles_[start];
+  ++profile.runs;
+  if (profile.tier == Tier::INTERPRETER &&
+      profile.runs >= options_.threaded_threshold) {
+    promote(memory, start, Tier::THREADED);
+  } else if (profile.tier == Tier::THREADED &&
+             profile.runs >= options_.optimized_threshold) {
+    promote(memory, start, Tier::OPTIMIZED);
+  }
+}
+
+void TieredEngine::promote(const uint8_t* memory, uint16_t start, Tier tier) {
+  Profile& profile = profiles_[start];
+  if (profile.tier == Tier::INTERPRETER) {
+    // The optimized tier may run the jump after a final skip too, so the
+    // block is as translated.
+    uint64_t lines = translate_block(memory, start).lines;
+    for (unsigned int line = 0; line < Cpu::kCacheLines; ++line) {
+      std::vector<uint16_t>& starts = promoted_by_line_[line];
+      // A block demoted for another line may still be listed.
+      if (((lines >> line) & 1) &&
+          std::find(starts.begin(), starts.end(), start) == starts.end()) {
+        starts.push_back(start);
+      }
+    }
+  }
+  profile.tier = tier;
+  ++counters_.promotions[static_cast<size_t>(tier)];
+}
+
+void TieredEngine::invalidate(uint64_t written_lines) {
+  if (!written_lines) {
+    return;
+  }
+  threaded_.invalidate(written_lines);
+  optimized_.invalidate(written_lines);
+  for (unsigned int line = 0; written_lines; ++line, written_lines >>= 1) {
+    if (!(written_lines & 1)) {
+      continue;
+    }
+    for (uint16_t start : promoted_by_line_[line]) {
+      Profile& profile = profiles_[start];
+      if (profile.tier != Tier::INTERPRETER) {
+        ++counters_.demotions;
+      }
+      profile = {};
+    }
+    promoted_by_line_[line].clear();
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "src/decode_cache.h"
+#include "src/execution_engine.h"
+#include "src/optimizing_engine.h"
+#include "src/threaded_engine.h"
+
+// The ways TieredEngine runs a block, from the cheapest to start with to the
+// fastest once started.
+enum class Tier : uint8_t {
+  INTERPRETER,
+  THREADED,
+  OPTIMIZED,
+};
+
+constexpr size_t kTiers = 3;
+
+// Returns the name of |tier|, e.g. "threaded".
+const char* tier_name(Tier tier);
+
+// Runs blocks in the reference interpreter at first, counting how often each
+// runs, so that decoding and translating are only spent on the few loops
+// that most time goes to rather than on initialization and menus. Blocks
+// that ran EngineOptions::threaded_threshold times are promoted to the
+// threaded tier, which decodes their instructions once, and those that ran
+// EngineOptions::optimized_threshold times to the optimized tier, which runs
+// them as OptimizingEngine does. Writing the memory of a block demotes it
+// back to the interpreter, counting its runs from zero.
+//
+// Blocks end where the IR ends them, but start wherever execution goes, so
+// a block cut short by the end of a run() makes the rest start another.
+// Superinstructions, which may run past the end of a block, are not used.
+//
+// With a block cache, blocks earlier processes translated skip the lower
+// tiers.
+class TieredEngine : public ExecutionEngine {
+ public:
+  // Counted since construction.
+  struct Counters {
+    // The instructions and blocks run in each tier.
+    std::array<uint64_t, kTiers> instructions = {};
+    std::array<uint64_t, kTiers> blocks = {};
+    // The blocks promoted to each tier.
+    std::array<uint64_t, kTiers> promotions = {};
+    // The blocks demoted to the interpreter.
+    uint64_t demotions = 0;
+  };
+
+  explicit TieredEngine(const EngineOptions& options = {});
+
+  EngineKind kind() const override { return EngineKind::TIERED; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override;
+
+  // Blocks found in |cache| start in the optimized tier.
+  void set_block_cache(BlockCache* cache) override {
+    optimized_.set_block_cache(cache);
+  }
+
+  // Only to be read from the thread running the engine.
+  const Counters& counters() const { return counters_; }
+
+  // The tier the block starting at |address| runs in.
+  Tier tier(uint16_t address) const { return profiles_[address].tier; }
+
+ private:
+  struct Profile {
+    uint32_t runs = 0;
+    Tier tier = Tier::INTERPRETER;
+  };
+
+  // Run the block at the program counter, or as much of it as |budget|
+  // instructions allow, in their tier. Return the number of instructions
+  // executed, or 0 if one fails.
+  unsigned int interpret(Cpu* cpu, unsigned int budget);
+  unsigned int run_threaded(Cpu* cpu, unsigned int budget);
+
+  // Counts a run of the block starting at |start|, promoting it if it ran
+  // often enough.
+  void count_run(const uint8_t* memory, uint16_t start);
+
+  // Moves the block starting at |start| up to |tier|.
+  void promote(const uint8_t* memory, uint16_t start, Tier tier);
+
+  void invalidate(uint64_t written_lines);
+
+  const EngineOptions options_;
+  std::array<Profile, Cpu::kMaxMemory + 1> profiles_;
+  // The start of the promoted blocks in each cache line.
+  std::array<std::vector<uint16_t>, Cpu::kCacheLines> promoted_by_line_;
+  DecodeCache<ThreadedEngine::Instruction> threaded_;
+  OptimizingEngine optimized_;
+  Counters counters_;
+};
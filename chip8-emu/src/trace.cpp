@@ -0,0 +1,159 @@
+#include "src/trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "src/logging.h"
+
+namespace trace {
+
+namespace {
+
+// The spans kept per thread, about 15 minutes of frame phases at 60 frames
+// per second. Later spans are dropped rather than allocating while tracing.
+constexpr size_t kCapacity = 1 << 18;
+
+struct Event {
+  const char* name;
+  uint64_t start;
+  uint64_t end;
+};
+
+// Written only by its thread. The size is published with release semantics
+// so that stop() sees complete events.
+struct ThreadBuffer {
+  explicit ThreadBuffer(uint32_t id)
+      : id(id), events(std::make_unique<Event[]>(kCapacity)) {}
+
+  const uint32_t id;
+  std::unique_ptr<Event[]> events;
+  std::atomic<size_t> size{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+// Every thread's buffer, kept until exit so that stop() can read the
+// buffers of threads that have finished.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+thread_local ThreadBuffer* thread_buffer = nullptr;
+
+uint64_t origin = 0;
+
+// Registers the calling thread, the only time recording takes a lock.
+ThreadBuffer* register_thread() {
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  buffers.push_back(std::make_unique<ThreadBuffer>(buffers.size() + 1));
+  return buffers.back().get();
+}
+
+std::string escape(const char* text) {
+  std::string escaped;
+  for (; *text; ++text) {
+    if (*text == '"' || *text == '\\') {
+      escaped += '\\';
+    }
+    escaped += *text;
+  }
+  return escaped;
+}
+
+// Writes |nanoseconds| since the origin in microseconds, as traces expect.
+void write_time(std::ostream& out, uint64_t nanoseconds) {
+  out << nanoseconds / 1000 << "." << std::setw(3) << std::setfill('0')
+      << nanoseconds % 1000 << std::setfill(' ');
+}
+
+}  // namespace
+
+namespace internal {
+
+std::atomic<bool> enabled{false};
+std::atomic<const Clock*> clock{SystemClock::get()};
+
+uint64_t now() {
+  return std::llround(clock.load(std::memory_order_relaxed)->now() * 1e9);
+}
+
+void record(const char* name, uint64_t start, uint64_t end) {
+  if (!thread_buffer) {
+    thread_buffer = register_thread();
+  }
+  size_t size = thread_buffer->size.load(std::memory_order_relaxed);
+  if (size == kCapacity) {
+    thread_buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  thread_buffer->events[size] = {name, start, end};
+  thread_buffer->size.store(size + 1, std::memory_order_release);
+}
+
+}  // namespace internal
+
+void start(const Clock* clock) {
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (auto& buffer : buffers) {
+      buffer->size.store(0, std::memory_order_relaxed);
+      buffer->dropped.store(0, std::memory_order_relaxed);
+    }
+  }
+  internal::clock.store(clock, std::memory_order_relaxed);
+  origin = internal::now();
+  internal::enabled.store(true, std::memory_order_release);
+}
+
+bool stop(const std::string& path) {
+  internal::enabled.store(false, std::memory_order_release);
+
+  std::ofstream out(path);
+  if (!out) {
+    logging::log(logging::Level::ERROR, "Could not write trace to " + path);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+  uint64_t dropped = 0;
+  for (const auto& buffer : buffers) {
+    size_t size = buffer->size.load(std::memory_order_acquire);
+    for (size_t i = 0; i < size; ++i) {
+      const Event& event = buffer->events[i];
+      // Spans started before start() are clipped to it.
+      uint64_t start = std::max(event.start, origin);
+      out << (first ? "" : ",") << "\n{\"name\": \"" << escape(event.name)
+          << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->id
+          << ", \"ts\": ";
+      write_time(out, start - origin);
+      out << ", \"dur\": ";
+      write_time(out, event.end - start);
+      out << "}";
+      first = false;
+    }
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  }
+  out << "\n]}\n";
+  if (dropped > 0) {
+    logging::log(logging::Level::WARN,
+                 "Trace buffers were full, " + std::to_string(dropped) +
+                     " spans were dropped");
+  }
+  logging::log(logging::Level::INFO, "Trace written to " + path);
+  return true;
+}
+
+uint64_t dropped() {
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  uint64_t dropped = 0;
+  for (const auto& buffer : buffers) {
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  }
+  return dropped;
+}
+
+}  // namespace trace
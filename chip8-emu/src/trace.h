@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "src/clock.h"
+
+// Records spans of time, e.g. the phases of a frame, to be viewed as a
+// timeline in chrome://tracing or Perfetto.
+//
+// Every thread records into a buffer of its own, without locks. Tracing is
+// off until start() is called, and while it is off a Span costs little more
+// than a test of a flag.
+namespace trace {
+
+namespace internal {
+
+extern std::atomic<bool> enabled;
+extern std::atomic<const Clock*> clock;
+
+// Returns the current time of the clock in nanoseconds.
+uint64_t now();
+
+// Appends a span to the calling thread's buffer.
+void record(const char* name, uint64_t start, uint64_t end);
+
+}  // namespace internal
+
+inline bool enabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Discards the spans recorded so far and starts recording, timed by
+// |clock|, which must outlive tracing. Must not be called while other
+// threads are recording.
+void start(const Clock* clock = SystemClock::get());
+
+// Stops recording and writes the spans recorded as Chrome trace event JSON
+// to |path|. Returns true if successful.
+bool stop(const std::string& path);
+
+// The number of spans lost since start() because a thread's buffer was full.
+uint64_t dropped();
+
+// Records the time from its construction to its destruction as a span named
+// |name|, which must outlive tracing, e.g. a string literal.
+class Span {
+ public:
+  explicit Span(const char* name) {
+    if (enabled()) {
+      name_ = name;
+      start_ = internal::now();
+    }
+  }
+
+  ~Span() {
+    if (name_) {
+      internal::record(name_, start_, internal::now());
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+ private:
+  const char* name_ = nullptr;
+  uint64_t start_ = 0;
+};
+
+}  // namespace trace
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 template <typename I>
@@ -10,4 +12,10 @@ std::string tohex(I w, size_t hex_len = 4) {
     rc[i] = digits[(w >> j) & 0x0f];
   }
   return "0x" + rc;
-}
\ No newline at end of file
+}
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+
+// Returns the 64 bit FNV-1a hash of the |size| bytes at |data|. Pass a
+// previous result as |hash| to hash several buffers as one.
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = kFnvOffsetBasis);
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "src/aot_compiler.h"
+#include "src/aot_engine.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+class AotTest : public ::testing::Test {
+ protected:
+  AotTest()
+      : random_(7),
+        cpu_(&random_, &keyboard_),
+        reference_random_(7),
+        reference_(&reference_random_, &keyboard_),
+        directory_(testing::TempDir() + "aot_test") {
+    cpu_.set_engine(&engine_);
+  }
+
+  ~AotTest() override { std::filesystem::remove_all(directory_); }
+
+  void load_program(const std::vector<uint16_t>& program) {
+    for (size_t i = 0; i < program.size(); ++i) {
+      for (Cpu* cpu : {&cpu_, &reference_}) {
+        cpu->set_memory(Cpu::kMinAddressableMemory + i * 2, program[i] >> 8);
+        cpu->set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                        program[i] & 0xff);
+      }
+    }
+  }
+
+  std::vector<uint8_t> memory() const {
+    std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+    for (unsigned int address = 0; address <= Cpu::kMaxMemory; ++address) {
+      memory[address] = cpu_.peek(address);
+    }
+    return memory;
+  }
+
+  // Compiles the program loaded and loads it into the engine. Returns false
+  // if there is no compiler to do so.
+  bool compile() {
+    if (std::system("c++ --version > /dev/null 2>&1") != 0) {
+      return false;
+    }
+    std::filesystem::create_directories(directory_);
+    std::string output_path = aot_module_path(directory_, cpu_.rom_hash());
+    std::string source_path = output_path + ".cpp";
+    std::vector<uint8_t> memory = this->memory();
+    {
+      std::ofstream source(source_path);
+      source << emit_module(
+          memory.data(), cpu_.rom_hash(),
+          find_blocks(memory.data(), Cpu::kMinAddressableMemory));
+    }
+    EXPECT_TRUE(compile_module(source_path, output_path));
+    EXPECT_TRUE(engine_.load(output_path, cpu_.rom_hash()));
+    return true;
+  }
+
+  uint64_t hash(const Cpu& cpu) const {
+    Cpu::State state;
+    cpu.save_state(&state);
+    return state.hash();
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  Random reference_random_;
+  Cpu reference_;
+  AotEngine engine_;
+  std::string directory_;
+};
+
+}  // namespace
+
+TEST(FindBlocksTest, FollowsJumpsCallsAndSkips) {
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  const std::vector<uint16_t> program = {
+      0x2208,  // 0x200: CALL 0x208
+      0x3001,  // 0x202: SE V0, 1
+      0x120c,  // 0x204: JP 0x20c
+      0xb300,  // 0x206: JP V0, 0x300
+      0x6001,  // 0x208: LD V0, 1
+      0x00ee,  // 0x20a: RET
+      0x120c,  // 0x20c: JP 0x20c
+      0x6002,  // 0x20e: LD V0, 2, unreachable
+  };
+  for (size_t i = 0; i < program.size(); ++i) {
+    memory[0x200 + i * 2] = program[i] >> 8;
+    memory[0x201 + i * 2] = program[i] & 0xff;
+  }
+
+  std::vector<uint16_t> starts;
+  for (const Block& block : find_blocks(memory.data(), 0x200)) {
+    starts.push_back(block.start);
+  }
+  EXPECT_EQ(starts, (std::vector<uint16_t>{0x200, 0x202, 0x206, 0x208,
+                                           0x20c}));
+}
+
+TEST(EmitModuleTest, EmitsAFunctionPerBlock) {
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  // 0x200: LD V0, 1; 0x202: JP 0x200
+  memory[0x200] = 0x60;
+  memory[0x201] = 0x01;
+  memory[0x202] = 0x12;
+  memory[0x203] = 0x00;
+  std::string source =
+      emit_module(memory.data(), 0x1234, find_blocks(memory.data(), 0x200));
+  EXPECT_NE(source.find("uint32_t block_0200(Chip8AotMachine* m, uint32_t "
+                        "budget)"),
+            std::string::npos);
+  EXPECT_NE(source.find("// 0x200: LD V0, 0x01"), std::string::npos);
+  EXPECT_NE(source.find("0x0000000000001234ull"), std::string::npos);
+  EXPECT_EQ(source.find("block_0202"), std::string::npos);
+}
+
+TEST_F(AotTest, InterpretsWithoutAModule) {
+  load_program({0x7001, 0x1200});
+  ASSERT_TRUE(cpu_.run(10));
+  EXPECT_EQ(cpu_.v(0), 5);
+  EXPECT_FALSE(engine_.compiled(0x200));
+}
+
+TEST_F(AotTest, MatchesTheInterpreter) {
+  const std::vector<uint16_t> program = {
+      0x6a02,  // 0x200: LD VA, 2
+      0x2210,  // 0x202: CALL 0x210
+      0x7101,  // 0x204: ADD V1, 1
+      0x4110,  // 0x206: SNE V1, 0x10
+      0xa300,  // 0x208: LD I, 0x300
+      0xf155,  // 0x20a: LD [I], V1
+      0x1202,  // 0x20c: JP 0x202
+      0x0000,
+      0x8014,  // 0x210: ADD V0, V1
+      0x8ae5,  // 0x212: SUB VA, VE
+      0xd015,  // 0x214: DRW V0, V1, 5
+      0x00ee,  // 0x216: RET
+  };
+  load_program(program);
+  if (!compile()) {
+    GTEST_SKIP() << "No compiler";
+  }
+  for (int frame = 0; frame < 50; ++frame) {
+    ASSERT_TRUE(cpu_.run(11));
+    for (int i = 0; i < 11; ++i) {
+      ASSERT_TRUE(reference_.step());
+    }
+    ASSERT_EQ(hash(cpu_), hash(reference_)) << frame;
+  }
+  EXPECT_TRUE(engine_.compiled(0x202));
+}
+
+TEST_F(AotTest, FallsBackForModifiedCode) {
+  load_program({
+      0x7001,  // 0x200: ADD V0, 1
+      0x1200,  // 0x202: JP 0x200
+  });
+  if (!compile()) {
+    GTEST_SKIP() << "No compiler";
+  }
+  ASSERT_TRUE(cpu_.run(4));
+  EXPECT_TRUE(engine_.compiled(0x200));
+  // ADD V0, 2
+  cpu_.set_memory(0x201, 0x02);
+  ASSERT_TRUE(cpu_.run(4));
+  EXPECT_FALSE(engine_.compiled(0x200));
+  EXPECT_EQ(cpu_.v(0), 6);
+}
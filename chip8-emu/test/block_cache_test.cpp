@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <vector>
+
+#include "src/binary_io.h"
+#include "src/block_cache.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+#include "src/tiered_engine.h"
+
+namespace {
+
+constexpr uint64_t kRomHash = 0x1234;
+
+class BlockCacheTest : public ::testing::Test {
+ protected:
+  BlockCacheTest()
+      : memory_(Cpu::kMaxMemory + 1),
+        directory_(testing::TempDir() + "block_cache_test") {
+    // 0x200: LD V0, 1; ADD V0, 2; JP 0x200
+    const std::vector<uint8_t> program = {0x60, 0x01, 0x70, 0x02, 0x12, 0x00};
+    std::copy(program.begin(), program.end(),
+              memory_.begin() + Cpu::kMinAddressableMemory);
+  }
+
+  ~BlockCacheTest() override { std::filesystem::remove_all(directory_); }
+
+  // Saves the block at 0x200 to the cache of kRomHash.
+  void save() {
+    BlockCache cache;
+    EXPECT_FALSE(cache.open(directory_, kRomHash, 0));
+    cache.add(memory_.data(), translate_block(memory_.data(), 0x200));
+    ASSERT_TRUE(cache.save());
+  }
+
+  std::vector<uint8_t> memory_;
+  std::string directory_;
+};
+
+}  // namespace
+
+TEST_F(BlockCacheTest, ReloadsSavedBlocks) {
+  save();
+  Block expected = translate_block(memory_.data(), 0x200);
+
+  BlockCache cache;
+  ASSERT_TRUE(cache.open(directory_, kRomHash, 0));
+  EXPECT_FALSE(cache.contains(memory_.data(), 0x202));
+  ASSERT_TRUE(cache.contains(memory_.data(), 0x200));
+  std::optional<Block> block = cache.find(memory_.data(), 0x200);
+  ASSERT_TRUE(block);
+  EXPECT_EQ(block->start, expected.start);
+  EXPECT_EQ(block->lines, expected.lines);
+  EXPECT_EQ(block->branches, expected.branches);
+  EXPECT_EQ(block->idempotent, expected.idempotent);
+  ASSERT_EQ(block->ops.size(), expected.ops.size());
+  for (size_t i = 0; i < expected.ops.size(); ++i) {
+    EXPECT_EQ(to_string(block->ops[i]), to_string(expected.ops[i])) << i;
+  }
+  ASSERT_EQ(block->size(), expected.size());
+}
+
+TEST_F(BlockCacheTest, IgnoresBlocksWhoseMemoryChanged) {
+  save();
+  memory_[0x203] = 0x03;
+
+  BlockCache cache;
+  ASSERT_TRUE(cache.open(directory_, kRomHash, 0));
+  EXPECT_FALSE(cache.contains(memory_.data(), 0x200));
+  EXPECT_FALSE(cache.find(memory_.data(), 0x200));
+}
+
+TEST_F(BlockCacheTest, IgnoresStaleAndCorruptFiles) {
+  save();
+  BlockCache cache;
+  EXPECT_FALSE(cache.open(directory_, kRomHash, 1));
+  EXPECT_FALSE(cache.contains(memory_.data(), 0x200));
+
+  std::vector<uint8_t> contents;
+  ASSERT_TRUE(cache.open(directory_, kRomHash, 0));
+  ASSERT_TRUE(read_file(cache.path(), &contents));
+  contents.back() ^= 1;
+  {
+    BinaryWriter writer;
+    writer.bytes(contents.data(), contents.size());
+    ASSERT_TRUE(writer.save(cache.path()));
+  }
+  EXPECT_FALSE(cache.open(directory_, kRomHash, 0));
+  EXPECT_FALSE(cache.contains(memory_.data(), 0x200));
+}
+
+TEST_F(BlockCacheTest, StartsCachedBlocksOptimized) {
+  save();
+  BlockCache cache;
+  ASSERT_TRUE(cache.open(directory_, kRomHash, 0));
+
+  Random random(1);
+  ScriptedKeyboard keyboard;
+  Cpu cpu(&random, &keyboard);
+  for (uint16_t address = 0x200; address < 0x206; ++address) {
+    cpu.set_memory(address, memory_[address]);
+  }
+  TieredEngine engine;
+  engine.set_block_cache(&cache);
+  cpu.set_engine(&engine);
+  ASSERT_TRUE(cpu.run(6));
+  EXPECT_EQ(engine.tier(0x200), Tier::OPTIMIZED);
+  EXPECT_EQ(engine.counters().instructions[static_cast<size_t>(
+                Tier::INTERPRETER)],
+            0u);
+  EXPECT_EQ(cpu.v(0), 3);
+}
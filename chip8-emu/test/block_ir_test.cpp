@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "src/block_ir.h"
+
+namespace {
+
+class BlockIrTest : public ::testing::Test {
+ protected:
+  BlockIrTest() { memory_.fill(0); }
+
+  // Stores |program| at 0x200 and returns its block, optimized, one
+  // operation per line.
+  std::string optimize(const std::vector<uint16_t>& program) {
+    uint16_t address = Cpu::kMinAddressableMemory;
+    for (uint16_t word : program) {
+      memory_[address++] = word >> 8;
+      memory_[address++] = word & 0xff;
+    }
+    block_ = translate_block(memory_.data(), Cpu::kMinAddressableMemory);
+    std::string text;
+    for (const IrOp& op : block_.ops) {
+      text += to_string(op) + "\n";
+    }
+    return text;
+  }
+
+  std::array<uint8_t, Cpu::kMaxMemory + 1> memory_;
+  Block block_;
+};
+
+}  // namespace
+
+TEST_F(BlockIrTest, EndsAtBranches) {
+  optimize({0x6001, 0x7102, 0x1200, 0x6003});
+  EXPECT_EQ(block_.size(), 3u);
+  EXPECT_TRUE(block_.branches);
+  EXPECT_EQ(block_.instructions.back().opcode, IrOpcode::JP);
+
+  optimize({0x6001, 0xf055, 0x6003});
+  EXPECT_EQ(block_.size(), 2u);
+  EXPECT_FALSE(block_.branches);
+  EXPECT_TRUE(block_.writes_memory);
+  EXPECT_EQ(block_.end(), 0x204);
+
+  optimize({0x6001, 0xe19e, 0x6003});
+  EXPECT_EQ(block_.size(), 2u);
+  EXPECT_TRUE(block_.branches);
+}
+
+TEST_F(BlockIrTest, EndsAfterMaxBlockSize) {
+  optimize(std::vector<uint16_t>(Block::kMaxBlockSize + 4, 0x8124));
+  EXPECT_EQ(block_.size(), Block::kMaxBlockSize);
+  EXPECT_FALSE(block_.branches);
+  // 0x200 to 0x23f.
+  EXPECT_EQ(block_.lines, 1ull << 8);
+}
+
+TEST_F(BlockIrTest, EliminatesDeadFlags) {
+  EXPECT_EQ(optimize({
+                0x8124,  // ADD V1, V2
+                0x8135,  // SUB V1, V3
+                0xd125,  // DRW V1, V2, 5
+                0x00ee,  // RET
+            }),
+            "ADD V1, V2\n"
+            "SUB V1, V3\n"
+            "DRW V1, V2, 0x5 [VF]\n"
+            "RET\n");
+  EXPECT_EQ(optimize({0xd125, 0xd345, 0x00ee}),
+            "DRW V1, V2, 0x5\n"
+            "DRW V3, V4, 0x5 [VF]\n"
+            "RET\n");
+  // The flag is read before being overwritten.
+  EXPECT_EQ(optimize({0x8124, 0x81f4, 0x00ee}),
+            "ADD V1, V2 [VF]\n"
+            "ADD V1, VF [VF]\n"
+            "RET\n");
+}
+
+TEST_F(BlockIrTest, EliminatesDeadWrites) {
+  EXPECT_EQ(optimize({
+                0x6105,  // LD V1, 5
+                0x8120,  // LD V1, V2
+                0xa300,  // LD I, 0x300
+                0xa310,  // LD I, 0x310
+                0x00ee,  // RET
+            }),
+            "LD V1, V2\n"
+            "LD I, 0x310\n"
+            "RET\n");
+  // The key is stored after the block.
+  EXPECT_EQ(optimize({0x6700, 0xf70a}), "LD V7, 0x00\nLD V7, K\n");
+}
+
+TEST_F(BlockIrTest, PropagatesConstants) {
+  EXPECT_EQ(optimize({
+                0x6005,  // LD V0, 5
+                0x7003,  // ADD V0, 3
+                0x8104,  // ADD V1, V0
+                0x6208,  // LD V2, 8
+                0x8200,  // LD V2, V0
+                0xa300,  // LD I, 0x300
+                0xf01e,  // ADD I, V0
+                0x00ee,  // RET
+            }),
+            "LD V0, 0x08\n"
+            "ADD V1, 0x08 [VF]\n"
+            "LD V2, 0x08\n"
+            "LD I, 0x308\n"
+            "RET\n");
+}
+
+TEST_F(BlockIrTest, FoldsFlags) {
+  EXPECT_EQ(optimize({
+                0x60f0,  // LD V0, 0xf0
+                0x6120,  // LD V1, 0x20
+                0x8014,  // ADD V0, V1
+                0x00ee,  // RET
+            }),
+            "LD V1, 0x20\n"
+            "LD V0, 0x10\n"
+            "LD VF, 0x01\n"
+            "RET\n");
+}
+
+TEST_F(BlockIrTest, ResolvesSkipsOnConstants) {
+  EXPECT_EQ(optimize({0x6003, 0x3003}), "LD V0, 0x03\nJP 0x206\n");
+  EXPECT_EQ(optimize({0x6003, 0x4003}), "LD V0, 0x03\nJP 0x204\n");
+  EXPECT_EQ(optimize({0x6004, 0xb300}), "LD V0, 0x04\nJP 0x304\n");
+}
+
+TEST_F(BlockIrTest, PropagatesTheDelayTimer) {
+  EXPECT_EQ(optimize({0x600a, 0xf015, 0xf107, 0x00ee}),
+            "LD V0, 0x0A\n"
+            "LD DT, 0x0A\n"
+            "LD V1, 0x0A\n"
+            "RET\n");
+}
+
+TEST_F(BlockIrTest, FusesSkipsOverJumps) {
+  EXPECT_EQ(optimize({0x3005, 0x1300, 0x6001}), "JP 0x300 IF V0 != 0x05\n");
+  EXPECT_EQ(block_.size(), 2u);
+  EXPECT_TRUE(block_.skips_jump);
+  EXPECT_EQ(optimize({0x9120, 0x1300}), "JP 0x300 IF V1 == V2\n");
+
+  // A jump to where the skip goes is no jump at all.
+  optimize({0x3005, 0x1204});
+  EXPECT_EQ(block_.size(), 1u);
+  EXPECT_FALSE(block_.skips_jump);
+}
+
+TEST_F(BlockIrTest, FindsIdempotentLoops) {
+  // Waiting for the delay timer.
+  EXPECT_EQ(optimize({0xf007, 0x3000, 0x1200}),
+            "LD V0, DT\n"
+            "JP 0x200 IF V0 != 0x00\n");
+  EXPECT_TRUE(block_.idempotent);
+  optimize({0x1200});
+  EXPECT_TRUE(block_.idempotent);
+
+  // Counting.
+  optimize({0x7101, 0x3100, 0x1200});
+  EXPECT_FALSE(block_.idempotent);
+  // Drawing.
+  optimize({0xa300, 0xd125, 0x1200});
+  EXPECT_FALSE(block_.idempotent);
+  // Jumping elsewhere.
+  optimize({0xf007, 0x3000, 0x1300});
+  EXPECT_FALSE(block_.idempotent);
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include "src/clock.h"
+#include "src/random.h"
+
+TEST(ClockTest, VirtualTimeOnlyPassesWhenTold) {
+  VirtualClock clock(10);
+  EXPECT_EQ(clock.now(), 10);
+  clock.advance(0.5);
+  EXPECT_EQ(clock.now(), 10.5);
+  clock.sleep(2);
+  EXPECT_EQ(clock.now(), 12.5);
+  // Time never goes backwards.
+  clock.advance(-1);
+  clock.sleep(-1);
+  EXPECT_EQ(clock.now(), 12.5);
+}
+
+TEST(ClockTest, VirtualWallTimeFollowsTheClock) {
+  VirtualClock clock(0, 1000);
+  EXPECT_EQ(clock.wall_time(), 1000);
+  clock.advance(61.5);
+  EXPECT_EQ(clock.wall_time(), 1061);
+}
+
+TEST(ClockTest, SystemTimeIsMonotonic) {
+  SystemClock* clock = SystemClock::get();
+  double start = clock->now();
+  clock->sleep(0.001);
+  EXPECT_GE(clock->now() - start, 0.001);
+  EXPECT_GT(clock->wall_time(), 0);
+}
+
+TEST(ClockTest, SeedsRandomFromTheWallTime) {
+  VirtualClock clock(0, 1234);
+  Random one(clock);
+  Random two(clock);
+  EXPECT_EQ(one.seed(), 1234);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(one.rand(), two.rand());
+  }
+}
@@ -0,0 +1,291 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "src/block_cache.h"
+#include "src/control_flow.h"
+#include "src/optimizing_engine.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+class ControlFlowTest : public ::testing::Test {
+ protected:
+  ControlFlowTest() : memory_(Cpu::kMaxMemory + 1) {}
+
+  // Loads |program| at 0x200 and builds its graph.
+  void build(const std::vector<uint16_t>& program) {
+    for (size_t i = 0; i < program.size(); ++i) {
+      memory_[0x200 + i * 2] = program[i] >> 8;
+      memory_[0x201 + i * 2] = program[i] & 0xff;
+    }
+    graph_ = build_control_flow_graph(memory_.data(), 0x200,
+                                      0x200 + program.size() * 2);
+  }
+
+  std::vector<uint16_t> starts() const {
+    std::vector<uint16_t> starts;
+    for (const ControlFlowGraph::BasicBlock& block : graph_.blocks) {
+      starts.push_back(block.start);
+    }
+    return starts;
+  }
+
+  std::vector<uint8_t> memory_;
+  ControlFlowGraph graph_;
+};
+
+const std::vector<uint16_t> kProgram = {
+    0x2210,  // 0x200: CALL 0x210
+    0x3001,  // 0x202: SE V0, 1
+    0x1200,  // 0x204: JP 0x200
+    0x120e,  // 0x206: JP 0x20e
+    0xffff,  // 0x208: data
+    0x0102,  // 0x20a: data
+    0x0304,  // 0x20c: data
+    0x120e,  // 0x20e: JP 0x20e
+    0x6001,  // 0x210: LD V0, 1
+    0x00ee,  // 0x212: RET
+    0xabcd,  // 0x214: data
+};
+
+class ValidateRomTest : public ::testing::Test {
+ protected:
+  ValidateRomTest()
+      : random_(7),
+        cpu_(&random_, &keyboard_),
+        path_(testing::TempDir() + "validate_rom_test.ch8") {}
+
+  ~ValidateRomTest() override { std::filesystem::remove(path_); }
+
+  // Writes |program| to a ROM file and loads it.
+  void load(const std::vector<uint16_t>& program) {
+    {
+      std::ofstream file(path_, std::ios::binary);
+      for (uint16_t instruction : program) {
+        file.put(static_cast<char>(instruction >> 8));
+        file.put(static_cast<char>(instruction & 0xff));
+      }
+    }
+    ASSERT_TRUE(cpu_.load(path_));
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  std::string path_;
+};
+
+}  // namespace
+
+TEST_F(ControlFlowTest, FollowsJumpsCallsAndSkips) {
+  build(kProgram);
+  EXPECT_EQ(starts(), (std::vector<uint16_t>{0x200, 0x202, 0x204, 0x206,
+                                             0x20e, 0x210}));
+
+  const ControlFlowGraph::BasicBlock* call = graph_.block_at(0x200);
+  ASSERT_NE(call, nullptr);
+  EXPECT_EQ(call->end, 0x202);
+  EXPECT_EQ(call->successors, (std::vector<uint16_t>{0x202}));
+  EXPECT_EQ(call->callee, 0x210);
+  EXPECT_EQ(graph_.block_at(0x202)->successors,
+            (std::vector<uint16_t>{0x204, 0x206}));
+  EXPECT_EQ(graph_.block_at(0x204)->successors,
+            (std::vector<uint16_t>{0x200}));
+  const ControlFlowGraph::BasicBlock* routine = graph_.block_at(0x210);
+  EXPECT_EQ(routine->end, 0x214);
+  EXPECT_TRUE(routine->returns);
+  EXPECT_TRUE(routine->successors.empty());
+  EXPECT_EQ(graph_.block_at(0x208), nullptr);
+  EXPECT_TRUE(graph_.invalid_instructions.empty());
+}
+
+TEST_F(ControlFlowTest, MapsCodeAndData) {
+  build(kProgram);
+  EXPECT_TRUE(graph_.code[0x200]);
+  EXPECT_TRUE(graph_.code[0x213]);
+  EXPECT_FALSE(graph_.code[0x208]);
+  using Range = std::pair<uint16_t, uint16_t>;
+  EXPECT_EQ(graph_.data_ranges(),
+            (std::vector<Range>{{0x208, 0x20e}, {0x214, 0x216}}));
+}
+
+TEST_F(ControlFlowTest, BuildsTheCallGraph) {
+  build({
+      0x2206,  // 0x200: CALL 0x206
+      0x220c,  // 0x202: CALL 0x20c
+      0x1204,  // 0x204: JP 0x204
+      0x220c,  // 0x206: CALL 0x20c
+      0x220c,  // 0x208: CALL 0x20c
+      0x00ee,  // 0x20a: RET
+      0x00ee,  // 0x20c: RET
+  });
+  ASSERT_EQ(graph_.routines.size(), 3u);
+  EXPECT_EQ(graph_.routines[0].entry, 0x200);
+  EXPECT_EQ(graph_.routines[0].callees,
+            (std::vector<uint16_t>{0x206, 0x20c}));
+  EXPECT_EQ(graph_.routines[1].entry, 0x206);
+  EXPECT_EQ(graph_.routines[1].callees, (std::vector<uint16_t>{0x20c}));
+  EXPECT_EQ(graph_.routines[2].entry, 0x20c);
+  EXPECT_TRUE(graph_.routines[2].callees.empty());
+}
+
+TEST_F(ControlFlowTest, SplitsBlocksAtJumpsIntoThem) {
+  build({
+      0x6001,  // 0x200: LD V0, 1
+      0x7001,  // 0x202: ADD V0, 1
+      0x7101,  // 0x204: ADD V1, 1
+      0x1202,  // 0x206: JP 0x202
+  });
+  EXPECT_EQ(starts(), (std::vector<uint16_t>{0x200, 0x202}));
+  EXPECT_EQ(graph_.block_at(0x200)->end, 0x202);
+  EXPECT_EQ(graph_.block_at(0x200)->successors,
+            (std::vector<uint16_t>{0x202}));
+  EXPECT_EQ(graph_.block_at(0x202)->end, 0x208);
+}
+
+TEST_F(ControlFlowTest, FollowsJumpTables) {
+  build({
+      0x6002,  // 0x200: LD V0, 2
+      0xb206,  // 0x202: JP V0, 0x206
+      0x0000,  // 0x204: data
+      0x120c,  // 0x206: JP 0x20c
+      0x120e,  // 0x208: JP 0x20e
+      0x1210,  // 0x20a: JP 0x210
+      0x120c,  // 0x20c: JP 0x20c
+      0x120e,  // 0x20e: JP 0x20e
+      0x1210,  // 0x210: JP 0x210
+  });
+  const ControlFlowGraph::BasicBlock* jump = graph_.block_at(0x200);
+  ASSERT_NE(jump, nullptr);
+  EXPECT_TRUE(jump->computed_jump);
+  // The table runs on into the jumps it goes to.
+  EXPECT_EQ(jump->successors, (std::vector<uint16_t>{0x206, 0x208, 0x20a,
+                                                     0x20c, 0x20e, 0x210}));
+  EXPECT_FALSE(graph_.code[0x204]);
+  EXPECT_TRUE(graph_.code[0x20a]);
+}
+
+TEST_F(ControlFlowTest, TakesComputedJumpsWithoutATableToTheirBase) {
+  build({
+      0xb204,  // 0x200: JP V0, 0x204
+      0x0000,  // 0x202: data
+      0x00e0,  // 0x204: CLS
+      0x1206,  // 0x206: JP 0x206
+  });
+  EXPECT_EQ(graph_.block_at(0x200)->successors,
+            (std::vector<uint16_t>{0x204}));
+}
+
+TEST_F(ControlFlowTest, ReportsInvalidInstructions) {
+  build({
+      0x3000,  // 0x200: SE V0, 0
+      0x1206,  // 0x202: JP 0x206
+      0xffff,  // 0x204: invalid
+      0x1206,  // 0x206: JP 0x206
+  });
+  EXPECT_EQ(graph_.invalid_instructions, (std::vector<uint16_t>{0x204}));
+  EXPECT_TRUE(graph_.block_at(0x204)->invalid);
+  EXPECT_TRUE(graph_.block_at(0x204)->successors.empty());
+}
+
+TEST_F(ControlFlowTest, StopsAtTheEndOfMemory) {
+  build(std::vector<uint16_t>((Cpu::kMaxMemory + 1 - 0x200) / 2, 0x6000));
+  ASSERT_EQ(starts(), (std::vector<uint16_t>{0x200}));
+  EXPECT_EQ(graph_.blocks[0].end, Cpu::kMaxMemory + 1);
+  EXPECT_TRUE(graph_.blocks[0].successors.empty());
+  EXPECT_TRUE(graph_.data_ranges().empty());
+}
+
+TEST_F(ControlFlowTest, ExportsTextAndDot) {
+  build(kProgram);
+  std::string text = to_text(graph_, memory_.data());
+  EXPECT_NE(text.find("0x200-0x202 -> 0x202 (calls 0x210)\n"
+                      "  0x200  2210  CALL 0x210\n"),
+            std::string::npos)
+      << text;
+  EXPECT_NE(text.find("Data:\n  0x208-0x20E\n  0x214-0x216\n"),
+            std::string::npos)
+      << text;
+  EXPECT_NE(text.find("Routines:\n  0x200 calls 0x210\n  0x210\n"),
+            std::string::npos)
+      << text;
+
+  std::string dot = to_dot(graph_, memory_.data());
+  EXPECT_EQ(dot.rfind("digraph chip8 {\n", 0), 0u);
+  EXPECT_NE(dot.find("block_202 -> block_206;"), std::string::npos) << dot;
+  EXPECT_NE(dot.find("block_200 -> block_210 [style=dashed];"),
+            std::string::npos)
+      << dot;
+  EXPECT_NE(dot.find("0x210: LD V0, 0x01\\l0x212: RET\\l"), std::string::npos)
+      << dot;
+}
+
+TEST(ValidationTest, ParsesNames) {
+  Validation validation;
+  ASSERT_TRUE(parse_validation("warn", &validation));
+  EXPECT_EQ(validation, Validation::WARN);
+  ASSERT_TRUE(parse_validation("strict", &validation));
+  EXPECT_EQ(validation, Validation::STRICT);
+  EXPECT_FALSE(parse_validation("lenient", &validation));
+}
+
+TEST_F(ValidateRomTest, TranslatesTheCodeFound) {
+  OptimizingEngine engine;
+  cpu_.set_engine(&engine);
+  load(kProgram);
+  ASSERT_TRUE(validate_rom(&cpu_, &engine, Validation::STRICT));
+  for (uint16_t start : {0x200, 0x202, 0x204, 0x206, 0x20e, 0x210}) {
+    EXPECT_TRUE(engine.cached(nullptr, start)) << start;
+  }
+  EXPECT_FALSE(engine.cached(nullptr, 0x208));
+  ASSERT_TRUE(cpu_.run(2));
+  EXPECT_EQ(cpu_.v(0), 1);
+}
+
+TEST_F(ValidateRomTest, AddsTheCodeFoundToTheBlockCache) {
+  OptimizingEngine engine;
+  cpu_.set_engine(&engine);
+  load(kProgram);
+  BlockCache cache;
+  cache.open(testing::TempDir(), cpu_.rom_hash(), 0);
+  engine.set_block_cache(&cache);
+  ASSERT_TRUE(validate_rom(&cpu_, &engine, Validation::WARN));
+  std::vector<uint8_t> memory(Cpu::kMaxMemory + 1);
+  for (unsigned int address = 0; address <= Cpu::kMaxMemory; ++address) {
+    memory[address] = cpu_.peek(address);
+  }
+  EXPECT_TRUE(cache.contains(memory.data(), 0x202));
+  EXPECT_TRUE(cache.contains(memory.data(), 0x210));
+}
+
+TEST_F(ValidateRomTest, RefusesInvalidInstructionsIfStrict) {
+  load({
+      0x3000,  // 0x200: SE V0, 0
+      0x1206,  // 0x202: JP 0x206
+      0xffff,  // 0x204: invalid
+      0x1206,  // 0x206: JP 0x206
+  });
+  EXPECT_TRUE(validate_rom(&cpu_, nullptr, Validation::WARN));
+  EXPECT_FALSE(validate_rom(&cpu_, nullptr, Validation::STRICT));
+}
+
+TEST_F(ValidateRomTest, RefusesRomsTooLargeIfStrict) {
+  // JP 0x200, then CLS up to one instruction past the end of memory.
+  std::vector<uint16_t> program(
+      (Cpu::kMaxMemory + 1 - Cpu::kMinAddressableMemory) / 2 + 1, 0x00e0);
+  program[0] = 0x1200;
+  load(program);
+  EXPECT_EQ(cpu_.rom_size(), Cpu::kMaxMemory + 1 - Cpu::kMinAddressableMemory);
+  EXPECT_TRUE(cpu_.rom_truncated());
+  EXPECT_TRUE(validate_rom(&cpu_, nullptr, Validation::WARN));
+  EXPECT_FALSE(validate_rom(&cpu_, nullptr, Validation::STRICT));
+
+  program.pop_back();
+  load(program);
+  EXPECT_FALSE(cpu_.rom_truncated());
+  EXPECT_TRUE(validate_rom(&cpu_, nullptr, Validation::STRICT));
+}
@@ -727,6 +727,26 @@ TEST_F(CpuTest, LoadRegisters) {
   EXPECT_EQ(0x126, cpu_->index());
 }
 
+TEST_F(CpuTest, MemoryThroughIndexWrapsAround) {
+  // Set V0 to 1 and V1 to 2.
+  ASSERT_TRUE(cpu_->execute(0x6001));
+  ASSERT_TRUE(cpu_->execute(0x6102));
+
+  // Set I to 0xfff and store V0 through V1.
+  ASSERT_TRUE(cpu_->execute(0xafff));
+  ASSERT_TRUE(cpu_->execute(0xf155));
+  EXPECT_EQ(1, cpu_->peek(0xfff));
+  EXPECT_EQ(2, cpu_->peek(0x000));
+
+  // Clear V0 and V1, then load them back.
+  ASSERT_TRUE(cpu_->execute(0x6000));
+  ASSERT_TRUE(cpu_->execute(0x6100));
+  ASSERT_TRUE(cpu_->execute(0xafff));
+  ASSERT_TRUE(cpu_->execute(0xf165));
+  EXPECT_EQ(1, cpu_->v(0));
+  EXPECT_EQ(2, cpu_->v(1));
+}
+
 TEST_F(CpuTest, StepTest) {
   // Set V0 to 1.
   cpu_->set_memory(0x200, 0x60);
@@ -784,3 +804,46 @@ TEST_F(CpuTest, StepCallTest) {
   ASSERT_TRUE(cpu_->step());
   EXPECT_EQ(0x200, cpu_->pc());
 }
+
+TEST_F(CpuTest, DirtyLines) {
+  cpu_->clear_dirty_lines();
+  EXPECT_EQ(0, cpu_->dirty_lines());
+
+  cpu_->set_memory(0x240, 0x12);
+  EXPECT_EQ(1ull << (0x240 / Cpu::kCacheLineSize), cpu_->dirty_lines());
+  cpu_->clear_dirty_lines();
+
+  // Fx33 writes three bytes, which here straddle two lines.
+  ASSERT_TRUE(cpu_->execute(0xa2bf));
+  ASSERT_TRUE(cpu_->execute(0xf033));
+  EXPECT_EQ(0b11ull << (0x2bf / Cpu::kCacheLineSize), cpu_->dirty_lines());
+  cpu_->clear_dirty_lines();
+
+  // Fx55.
+  ASSERT_TRUE(cpu_->execute(0xafff));
+  ASSERT_TRUE(cpu_->execute(0xf055));
+  EXPECT_EQ(1ull << 63, cpu_->dirty_lines());
+  cpu_->clear_dirty_lines();
+
+  // Reads do not dirty memory.
+  ASSERT_TRUE(cpu_->execute(0xa300));
+  ASSERT_TRUE(cpu_->execute(0xff65));
+  EXPECT_EQ(0, cpu_->dirty_lines());
+}
+
+TEST_F(CpuTest, SaveAndLoadState) {
+  ASSERT_TRUE(cpu_->execute(0x6a42));
+  ASSERT_TRUE(cpu_->execute(0xa123));
+  cpu_->set_memory(0x300, 0xab);
+  Cpu::State state;
+  cpu_->save_state(&state);
+
+  ASSERT_TRUE(cpu_->execute(0x6a00));
+  ASSERT_TRUE(cpu_->execute(0xa000));
+  cpu_->set_memory(0x300, 0);
+
+  cpu_->load_state(state);
+  EXPECT_EQ(0x42, cpu_->v(0xa));
+  EXPECT_EQ(0x123, cpu_->index());
+  EXPECT_EQ(0xab, cpu_->peek(0x300));
+}
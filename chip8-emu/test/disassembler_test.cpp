@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include "src/disassembler.h"
+
+TEST(DisassemblerTest, ClassifiesEveryPattern) {
+  EXPECT_EQ(OpcodeClass::CLS, opcode_class(0x00e0));
+  EXPECT_EQ(OpcodeClass::RET, opcode_class(0x00ee));
+  EXPECT_EQ(OpcodeClass::SYS, opcode_class(0x0123));
+  EXPECT_EQ(OpcodeClass::SE_REG, opcode_class(0x5120));
+  EXPECT_EQ(OpcodeClass::UNKNOWN, opcode_class(0x5121));
+  EXPECT_EQ(OpcodeClass::SHL, opcode_class(0x812e));
+  EXPECT_EQ(OpcodeClass::UNKNOWN, opcode_class(0x8128));
+  EXPECT_EQ(OpcodeClass::SKNP, opcode_class(0xe3a1));
+  EXPECT_EQ(OpcodeClass::LD_VX_MEM, opcode_class(0xf265));
+  EXPECT_EQ(OpcodeClass::UNKNOWN, opcode_class(0xf2ff));
+}
+
+TEST(DisassemblerTest, NamesPatterns) {
+  EXPECT_STREQ("8xy4", opcode_pattern(OpcodeClass::ADD_REG));
+  EXPECT_STREQ("Fx0A", opcode_pattern(OpcodeClass::LD_VX_K));
+  EXPECT_STREQ("????", opcode_pattern(OpcodeClass::UNKNOWN));
+}
+
+TEST(DisassemblerTest, Disassembles) {
+  EXPECT_EQ("CLS", disassemble(0x00e0));
+  EXPECT_EQ("JP 0x2A4", disassemble(0x12a4));
+  EXPECT_EQ("SE VA, 0x05", disassemble(0x3a05));
+  EXPECT_EQ("ADD V1, VF", disassemble(0x81f4));
+  EXPECT_EQ("DRW V0, V1, 0x5", disassemble(0xd015));
+  EXPECT_EQ("LD V3, [I]", disassemble(0xf365));
+  EXPECT_EQ("DW 0xFFFF", disassemble(0xffff));
+}
+
+TEST(DisassemblerTest, FindsBranches) {
+  EXPECT_TRUE(is_branch(0x1200));
+  EXPECT_TRUE(is_branch(0x2200));
+  EXPECT_TRUE(is_branch(0x00ee));
+  EXPECT_TRUE(is_branch(0x4105));
+  EXPECT_TRUE(is_branch(0xe19e));
+  EXPECT_FALSE(is_branch(0x6105));
+  EXPECT_FALSE(is_branch(0xd015));
+}
@@ -0,0 +1,379 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <memory>
+#include <random>
+
+#include "src/control_flow.h"
+#include "src/disassembler.h"
+#include "src/execution_engine.h"
+#include "src/optimizing_engine.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+class Machine {
+ public:
+  explicit Machine(EngineKind kind)
+      : random_(7), cpu_(&random_, &keyboard_), engine_(make_engine(kind)) {
+    cpu_.set_engine(engine_.get());
+  }
+
+  Cpu* cpu() { return &cpu_; }
+  ExecutionEngine* engine() { return engine_.get(); }
+  ScriptedKeyboard* keyboard() { return &keyboard_; }
+
+  uint64_t hash() const {
+    Cpu::State state;
+    cpu_.save_state(&state);
+    return state.hash();
+  }
+
+  void load_program(const std::vector<uint16_t>& program) {
+    for (size_t i = 0; i < program.size(); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, program[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      program[i] & 0xff);
+    }
+  }
+
+ private:
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  std::unique_ptr<ExecutionEngine> engine_;
+};
+
+// Returns random instructions that jump within the program and mostly access
+// memory right after it, so that some of them modify it.
+std::vector<uint16_t> random_program(uint32_t seed, size_t size) {
+  std::mt19937 generator(seed);
+  std::vector<uint16_t> program;
+  while (program.size() < size) {
+    uint16_t word = generator();
+    switch (opcode_class(word)) {
+      case OpcodeClass::UNKNOWN:
+        continue;
+      case OpcodeClass::LD_I:
+        word = 0xa300 | (word & 0xff);
+        break;
+      case OpcodeClass::JP:
+      case OpcodeClass::CALL:
+      case OpcodeClass::JP_V0:
+        word = (word & 0xf000) + Cpu::kMinAddressableMemory +
+               (word % size) * 2;
+        break;
+      default:
+        break;
+    }
+    program.push_back(word);
+  }
+  return program;
+}
+
+class ExecutionEngineTest : public ::testing::TestWithParam<EngineKind> {
+ protected:
+  // Runs each ROM in the working directory for a few seconds of play, with
+  // the engine and the interpreter, having the engine prepare its code
+  // first if |validate|, and comparing the instructions each counted if
+  // |count|.
+  void run_bundled_roms(bool validate, bool count) {
+    std::filesystem::path directory = "roms";
+    if (!std::filesystem::is_directory(directory)) {
+      GTEST_SKIP() << "No ROMs in the working directory";
+    }
+    auto reference_counts = std::make_unique<Cpu::InstructionCounts>();
+    auto counts = std::make_unique<Cpu::InstructionCounts>();
+    for (const auto& file : std::filesystem::directory_iterator(directory)) {
+      Machine reference(EngineKind::INTERPRETER);
+      Machine machine(GetParam());
+      if (count) {
+        reference_counts->fill(0);
+        counts->fill(0);
+        reference.cpu()->set_instruction_counts(reference_counts.get());
+        machine.cpu()->set_instruction_counts(counts.get());
+      }
+      ASSERT_TRUE(reference.cpu()->load(file.path().u8string()));
+      ASSERT_TRUE(machine.cpu()->load(file.path().u8string()));
+      if (validate) {
+        ASSERT_TRUE(validate_rom(machine.cpu(), machine.engine(),
+                                 Validation::WARN));
+      }
+      for (uint32_t frame = 0; frame < 300; ++frame) {
+        uint16_t keys = (frame / 8) % 3 == 0 ? 1 << (frame / 24 % 16) : 0;
+        reference.keyboard()->set_keys(keys);
+        machine.keyboard()->set_keys(keys);
+        bool result = reference.cpu()->run_frame();
+        ASSERT_EQ(machine.cpu()->run_frame(), result) << file.path();
+        ASSERT_EQ(machine.hash(), reference.hash())
+            << file.path() << ", frame " << frame;
+        if (!result) {
+          break;
+        }
+      }
+      for (size_t word = 0; count && word < counts->size(); ++word) {
+        ASSERT_EQ((*counts)[word], (*reference_counts)[word])
+            << file.path() << ", " << disassemble(word);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+TEST(EngineKindTest, ParsesNames) {
+  for (EngineKind kind : {EngineKind::INTERPRETER, EngineKind::PREDECODED,
+                          EngineKind::THREADED, EngineKind::OPTIMIZING,
+                          EngineKind::TIERED, EngineKind::AOT}) {
+    EngineKind parsed;
+    ASSERT_TRUE(parse_engine_kind(engine_name(kind), &parsed));
+    EXPECT_EQ(parsed, kind);
+    EXPECT_EQ(make_engine(kind)->kind(), kind);
+  }
+  EngineKind parsed;
+  EXPECT_FALSE(parse_engine_kind("jit", &parsed));
+}
+
+TEST(LoadStateTest, KeepsBlocksOfUnchangedMemory) {
+  Random random(7);
+  ScriptedKeyboard keyboard;
+  Cpu cpu(&random, &keyboard);
+  OptimizingEngine engine;
+  cpu.set_engine(&engine);
+  // 0x200: ADD V0, 1; JP 0x200, and 0x240: ADD V1, 1; JP 0x240
+  for (uint16_t address : {0x200, 0x240}) {
+    cpu.set_memory(address, 0x70 | (address >> 6 & 1));
+    cpu.set_memory(address + 1, 0x01);
+    cpu.set_memory(address + 2, 0x12);
+    cpu.set_memory(address + 3, address & 0xff);
+  }
+  Cpu::State state;
+  cpu.save_state(&state);
+  ASSERT_TRUE(cpu.run(4));
+  ASSERT_TRUE(engine.cached(nullptr, 0x200));
+
+  cpu.set_engine(&engine);
+  state.registers.pc = 0x240;
+  cpu.load_state(state);
+  ASSERT_TRUE(cpu.run(2));
+  EXPECT_TRUE(engine.cached(nullptr, 0x200));
+  EXPECT_EQ(cpu.v(1), 1);
+
+  // Only the line that differs is dropped: 0x240: ADD V1, 2.
+  state.memory[0x241] = 0x02;
+  cpu.load_state(state);
+  ASSERT_TRUE(cpu.run(2));
+  EXPECT_TRUE(engine.cached(nullptr, 0x200));
+  EXPECT_EQ(cpu.v(1), 2);
+}
+
+TEST_P(ExecutionEngineTest, MatchesTheInterpreterOnRandomPrograms) {
+  for (uint32_t seed = 1; seed <= 50; ++seed) {
+    std::vector<uint16_t> program = random_program(seed, 256);
+    Machine reference(EngineKind::INTERPRETER);
+    Machine machine(GetParam());
+    reference.load_program(program);
+    machine.load_program(program);
+
+    for (int i = 0; i < 2000; ++i) {
+      if (i % 100 == 0) {
+        reference.keyboard()->set_keys(i * 0x9e37);
+        machine.keyboard()->set_keys(i * 0x9e37);
+      }
+      bool result = reference.cpu()->run(1);
+      ASSERT_EQ(machine.cpu()->run(1), result)
+          << "seed " << seed << ", instruction " << i;
+      ASSERT_EQ(machine.hash(), reference.hash())
+          << "seed " << seed << ", instruction " << i << ", pc "
+          << reference.cpu()->pc();
+      if (!result) {
+        break;
+      }
+      if (i % Cpu::kInstructionsPerFrame == 0) {
+        reference.cpu()->update_timers();
+        machine.cpu()->update_timers();
+      }
+    }
+  }
+}
+
+TEST_P(ExecutionEngineTest, MatchesTheInterpreterOnRandomProgramsInChunks) {
+  for (uint32_t seed = 1; seed <= 50; ++seed) {
+    std::vector<uint16_t> program = random_program(seed, 256);
+    Machine reference(EngineKind::INTERPRETER);
+    Machine machine(GetParam());
+    reference.load_program(program);
+    machine.load_program(program);
+
+    // Chunks of every size up to past the longest block.
+    for (unsigned int chunk = 0; chunk < 200; ++chunk) {
+      unsigned int instructions = 1 + chunk * 7 % 40;
+      reference.keyboard()->set_keys(chunk * 0x9e37);
+      machine.keyboard()->set_keys(chunk * 0x9e37);
+      bool result = reference.cpu()->run(instructions);
+      ASSERT_EQ(machine.cpu()->run(instructions), result)
+          << "seed " << seed << ", chunk " << chunk;
+      ASSERT_EQ(machine.hash(), reference.hash())
+          << "seed " << seed << ", chunk " << chunk << ", pc "
+          << reference.cpu()->pc();
+      if (!result) {
+        break;
+      }
+      reference.cpu()->update_timers();
+      machine.cpu()->update_timers();
+    }
+  }
+}
+
+TEST_P(ExecutionEngineTest, SeesSelfModifyingCode) {
+  Machine machine(GetParam());
+  machine.load_program({
+      0x6012,  // 0x200: LD V0, 0x12
+      0x610e,  // 0x202: LD V1, 0x0e
+      0x6205,  // 0x204: LD V2, 5
+      0x630c,  // 0x206: LD V3, 0x0c
+      0xa20a,  // 0x208: LD I, 0x20a
+      0x1212,  // 0x20a: JP 0x212, then JP 0x20e once overwritten.
+      0x6201,  // 0x20c: LD V2, 1
+      0x1210,  // 0x20e: JP 0x210
+      0x1210,  // 0x210: JP 0x210
+      0xf155,  // 0x212: LD [I], V1
+      0x120a,  // 0x214: JP 0x20a
+  });
+  // Decodes everything, then overwrites 0x20a with JP 0x20e.
+  ASSERT_TRUE(machine.cpu()->run(20));
+  EXPECT_EQ(machine.cpu()->pc(), 0x210);
+  EXPECT_EQ(machine.cpu()->v(2), 5);
+}
+
+TEST_P(ExecutionEngineTest, MatchesTheInterpreterOnSuperinstructions) {
+  const std::vector<uint16_t> program = {
+      0x6005,  // 0x200: LD V0, 5
+      0xf015,  // 0x202: LD DT, V0
+      0xf107,  // 0x204: LD V1, DT
+      0x3100,  // 0x206: SE V1, 0
+      0x1204,  // 0x208: JP 0x204
+      0x6200,  // 0x20a: LD V2, 0
+      0x7201,  // 0x20c: ADD V2, 1
+      0x320a,  // 0x20e: SE V2, 10
+      0x120c,  // 0x210: JP 0x20c
+      0xa300,  // 0x212: LD I, 0x300
+      0xd125,  // 0x214: DRW V1, V2, 5
+      0xf307,  // 0x216: LD V3, DT
+      0x4300,  // 0x218: SNE V3, 0
+      0x6401,  // 0x21a: LD V4, 1
+      0x4205,  // 0x21c: SNE V2, 5
+      0x1200,  // 0x21e: JP 0x200
+      0x7401,  // 0x220: ADD V4, 1
+      0x1200,  // 0x222: JP 0x200
+  };
+  Machine reference(EngineKind::INTERPRETER);
+  Machine machine(GetParam());
+  reference.load_program(program);
+  machine.load_program(program);
+
+  // Runs in chunks of every size, so that superinstructions are cut short
+  // at every point.
+  unsigned int frame_instructions = 0;
+  for (unsigned int chunk = 0; chunk < 2000; ++chunk) {
+    unsigned int instructions = 1 + chunk % 7;
+    ASSERT_TRUE(reference.cpu()->run(instructions));
+    ASSERT_TRUE(machine.cpu()->run(instructions));
+    ASSERT_EQ(machine.hash(), reference.hash())
+        << "chunk " << chunk << ", pc " << reference.cpu()->pc();
+    frame_instructions += instructions;
+    if (frame_instructions >= Cpu::kInstructionsPerFrame) {
+      frame_instructions = 0;
+      reference.cpu()->update_timers();
+      machine.cpu()->update_timers();
+    }
+  }
+}
+
+TEST_P(ExecutionEngineTest, SeesSelfModifiedSuperinstructions) {
+  std::vector<uint16_t> program(0x24, 0x0000);
+  program[0x00] = 0x6012;  // 0x200: LD V0, 0x12
+  program[0x01] = 0x6142;  // 0x202: LD V1, 0x42
+  program[0x02] = 0xa240;  // 0x204: LD I, 0x240
+  program[0x03] = 0x123e;  // 0x206: JP 0x23e
+  // The jump is at the start of the next cache line.
+  program[0x1f] = 0x3000;  // 0x23e: SE V0, 0
+  program[0x20] = 0x1244;  // 0x240: JP 0x244, then JP 0x242 once overwritten.
+  program[0x21] = 0x1242;  // 0x242: JP 0x242
+  program[0x22] = 0xf155;  // 0x244: LD [I], V1
+  program[0x23] = 0x123e;  // 0x246: JP 0x23e
+  Machine machine(GetParam());
+  machine.load_program(program);
+  // Runs SE and JP as one, overwrites the jump, then runs them again.
+  ASSERT_TRUE(machine.cpu()->run(30));
+  EXPECT_EQ(machine.cpu()->pc(), 0x242);
+}
+
+TEST_P(ExecutionEngineTest, ReadsFlagsSetInEarlierBlocks) {
+  Machine machine(GetParam());
+  machine.load_program({
+      0xa220,  // 0x200: LD I, 0x220
+      0x7380,  // 0x202: ADD V3, 0x80
+      0xd015,  // 0x204: DRW V0, V1, 5
+      0x1208,  // 0x206: JP 0x208
+      0xd015,  // 0x208: DRW V0, V1, 5, erasing it.
+      0x120c,  // 0x20a: JP 0x20c
+      0x82f0,  // 0x20c: LD V2, VF
+      0x8334,  // 0x20e: ADD V3, V3, carrying.
+      0x1212,  // 0x210: JP 0x212
+      0x4f01,  // 0x212: SNE VF, 1
+      0x7401,  // 0x214: ADD V4, 1
+      0x1216,  // 0x216: JP 0x216
+      0, 0, 0, 0,
+      0xffff, 0xffff, 0xff00,  // 0x220: The sprite.
+  });
+  // Stops with the carry yet to be read.
+  ASSERT_TRUE(machine.cpu()->run(9));
+  EXPECT_EQ(machine.cpu()->pc(), 0x212);
+  EXPECT_EQ(machine.cpu()->v(2), 1);
+  EXPECT_EQ(machine.cpu()->v(3), 0);
+  EXPECT_EQ(machine.cpu()->v(0xf), 1);
+  ASSERT_TRUE(machine.cpu()->run(3));
+  EXPECT_EQ(machine.cpu()->v(4), 1);
+}
+
+TEST_P(ExecutionEngineTest, StopsAtFailures) {
+  Machine machine(GetParam());
+  machine.load_program({0x6001, 0x00ee});
+  EXPECT_FALSE(machine.cpu()->run(10));
+  EXPECT_EQ(machine.cpu()->pc(), 0x202);
+  EXPECT_EQ(machine.cpu()->v(0), 1);
+}
+
+TEST_P(ExecutionEngineTest, WaitsForKeys) {
+  Machine machine(GetParam());
+  machine.load_program({0xf30a, 0x7301, 0x1202});
+  ASSERT_TRUE(machine.cpu()->run(10));
+  EXPECT_TRUE(machine.cpu()->waiting_for_key_press());
+  machine.keyboard()->set_keys(1 << 4);
+  ASSERT_TRUE(machine.cpu()->run(1));
+  EXPECT_EQ(machine.cpu()->v(3), 5);
+}
+
+TEST_P(ExecutionEngineTest, MatchesTheInterpreterOnBundledRoms) {
+  run_bundled_roms(false, false);
+}
+
+TEST_P(ExecutionEngineTest, MatchesTheInterpreterOnValidatedRoms) {
+  run_bundled_roms(true, false);
+}
+
+TEST_P(ExecutionEngineTest, CountsTheInstructionsItRuns) {
+  run_bundled_roms(false, true);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, ExecutionEngineTest,
+                         ::testing::Values(EngineKind::PREDECODED,
+                                           EngineKind::THREADED,
+                                           EngineKind::OPTIMIZING,
+                                           EngineKind::TIERED,
+                                           EngineKind::AOT),
+                         [](const auto& info) {
+                           return std::string(engine_name(info.param));
+                         });
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include "src/fast_forward.h"
+
+TEST(FastForwardTest, BoundedSpeedFollowsWallTime) {
+  // 4x is 240 frames per second, 15 frames every 62.5 ms.
+  FastForward fast_forward(4);
+  fast_forward.start(0);
+  EXPECT_EQ(0, fast_forward.frames_to_run(0));
+
+  // Nothing has been measured yet, so frames are emulated one at a time.
+  EXPECT_EQ(1, fast_forward.frames_to_run(0.0625));
+  fast_forward.on_frames_run(1, 0.001);
+
+  // Then in batches of up to 16 ms.
+  EXPECT_EQ(14, fast_forward.frames_to_run(0.0625));
+  fast_forward.on_frames_run(14, 0.014);
+  EXPECT_EQ(0, fast_forward.frames_to_run(0.0625));
+  EXPECT_EQ(15, fast_forward.frames_to_run(0.125));
+  EXPECT_EQ(16, fast_forward.frames_to_run(0.25));
+}
+
+TEST(FastForwardTest, DropsBacklog) {
+  FastForward fast_forward(2);
+  fast_forward.start(0);
+  fast_forward.on_frames_run(1, 0.001);
+  EXPECT_EQ(1, fast_forward.frames_to_run(5));
+  fast_forward.on_frames_run(1, 0.001);
+  EXPECT_EQ(0, fast_forward.frames_to_run(5));
+  EXPECT_EQ(15, fast_forward.frames_to_run(5.125));
+}
+
+TEST(FastForwardTest, UnboundedRunsInBatches) {
+  FastForward fast_forward(FastForward::kUnbounded);
+  fast_forward.start(0);
+  EXPECT_EQ(1, fast_forward.frames_to_run(0));
+  fast_forward.on_frames_run(1, 0.0001);
+  EXPECT_EQ(166, fast_forward.frames_to_run(0));
+}
+
+TEST(FastForwardTest, SkipAdaptsToPresentCost) {
+  FastForward fast_forward(FastForward::kUnbounded);
+  fast_forward.start(0);
+  EXPECT_EQ(1, fast_forward.skip());
+
+  // Presenting costs 8 frames worth of emulation: only every 32nd frame can
+  // be presented to keep presenting under 20% of the time.
+  fast_forward.on_frames_run(10, 0.010);
+  fast_forward.on_presented(0.010, 0.008);
+  EXPECT_EQ(32, fast_forward.skip());
+
+  double now = 0.018;
+  fast_forward.on_frames_run(31, 0.031);
+  now += 0.031;
+  EXPECT_FALSE(fast_forward.should_present(now));
+  fast_forward.on_frames_run(1, 0.001);
+  now += 0.001;
+  EXPECT_TRUE(fast_forward.should_present(now));
+}
+
+TEST(FastForwardTest, PresentsAtMostSixtyTimesPerSecond) {
+  FastForward fast_forward(FastForward::kUnbounded);
+  fast_forward.start(0);
+  fast_forward.on_frames_run(1, 0.000001);
+  EXPECT_FALSE(fast_forward.should_present(0.001));
+  EXPECT_TRUE(fast_forward.should_present(1.0 / 60));
+}
+
+TEST(FastForwardTest, EffectiveSpeed) {
+  FastForward fast_forward(FastForward::kUnbounded);
+  fast_forward.start(0);
+  for (int i = 1; i <= 60; ++i) {
+    fast_forward.on_frames_run(5, 0.001);
+    fast_forward.on_presented(i / 60.0, 0.001);
+  }
+  EXPECT_DOUBLE_EQ(5, fast_forward.effective_speed());
+}
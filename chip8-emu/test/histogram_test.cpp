@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+#include "src/histogram.h"
+
+TEST(HistogramTest, CountsSmallValuesExactly) {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 100; ++value) {
+    histogram.record(value);
+  }
+  EXPECT_EQ(histogram.count(), 100);
+  EXPECT_EQ(histogram.min(), 1);
+  EXPECT_EQ(histogram.max(), 100);
+  EXPECT_DOUBLE_EQ(histogram.mean(), 50.5);
+  EXPECT_EQ(histogram.percentile(50), 50);
+  EXPECT_EQ(histogram.percentile(99), 99);
+  EXPECT_EQ(histogram.percentile(100), 100);
+}
+
+TEST(HistogramTest, KeepsRelativePrecision) {
+  for (uint64_t value : {300ull, 16667ull, 1000000ull, 123456789ull}) {
+    Histogram histogram;
+    histogram.record(value);
+    histogram.record(value * 2);
+    uint64_t reported = histogram.percentile(50);
+    EXPECT_GE(reported, value);
+    EXPECT_LE(reported - value, value / Histogram::kSubBuckets) << value;
+  }
+}
+
+TEST(HistogramTest, ClampsLargeValues) {
+  Histogram histogram;
+  histogram.record(~0ull);
+  EXPECT_EQ(histogram.max(), Histogram::kMaxValue);
+  EXPECT_EQ(histogram.percentile(100), Histogram::kMaxValue);
+}
+
+TEST(HistogramTest, WritesHdrPercentiles) {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.record(value * 1000);
+  }
+  std::ostringstream out;
+  histogram.write_percentiles(out, 1000);
+  std::string text = out.str();
+
+  EXPECT_EQ(text.rfind("       Value     Percentile TotalCount "
+                       "1/(1-Percentile)\n\n",
+                       0),
+            0);
+  EXPECT_NE(text.find(" 0.500000000000 "), std::string::npos);
+  // The last line is the maximum, at 100%.
+  EXPECT_NE(text.find(" 1.000000000000       1000\n#[Mean"),
+            std::string::npos);
+  EXPECT_NE(text.find("#[Max     =     1000.000, Total count    =         "
+                      "1000]"),
+            std::string::npos);
+}
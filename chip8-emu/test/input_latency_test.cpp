@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include "src/input_latency.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+class InputLatencyTest : public ::testing::Test {
+ protected:
+  InputLatencyTest() : random_(1), cpu_(&random_, &keyboard_) {}
+
+  // Runs one instruction with the keys held, as a frame would.
+  void run(uint16_t instruction, uint16_t keys) {
+    keyboard_.set_keys(keys);
+    cpu_.execute(instruction);
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  InputLatency latency_;
+};
+
+uint64_t only_value(const Histogram& histogram) {
+  EXPECT_EQ(histogram.count(), 1);
+  return histogram.max();
+}
+
+}  // namespace
+
+TEST_F(InputLatencyTest, MeasuresEachStage) {
+  FrameBuffer before;
+  FrameBuffer after;
+  after.set_pixel(0, 0, true);
+
+  latency_.on_draw(before, 0);
+  latency_.on_display(0.001);
+  latency_.on_key_event(1 << 5, 0.010);
+
+  // SKP V0 with V0 = 5.
+  cpu_.execute(0x6005);
+  run(0xe09e, 1 << 5);
+  latency_.on_emulated(&cpu_, 0.012);
+  latency_.on_draw(before, 0.013);
+  latency_.on_display(0.017);
+  EXPECT_EQ(latency_.histogram(InputLatency::Stage::EVENT_TO_DISPLAY).count(),
+            0);
+
+  latency_.on_emulated(&cpu_, 0.028);
+  latency_.on_draw(after, 0.030);
+  latency_.on_display(0.034);
+
+  using Stage = InputLatency::Stage;
+  EXPECT_EQ(only_value(latency_.histogram(Stage::EVENT_TO_OBSERVED)), 2000);
+  EXPECT_EQ(only_value(latency_.histogram(Stage::OBSERVED_TO_CHANGE)), 18000);
+  EXPECT_EQ(only_value(latency_.histogram(Stage::CHANGE_TO_DISPLAY)), 4000);
+  EXPECT_EQ(only_value(latency_.histogram(Stage::EVENT_TO_DISPLAY)), 24000);
+  EXPECT_EQ(latency_.histogram(Stage::FRAME_TIME).count(), 2);
+}
+
+TEST_F(InputLatencyTest, IgnoresKeysSeenBeforeTheEvent) {
+  cpu_.execute(0x6005);
+  run(0xe09e, 1 << 5);
+  latency_.on_emulated(&cpu_, 0.005);
+
+  latency_.on_key_event(1 << 5, 0.010);
+  latency_.on_emulated(&cpu_, 0.012);
+  FrameBuffer changed;
+  changed.set_pixel(1, 1, true);
+  latency_.on_draw(changed, 0.013);
+  latency_.on_display(0.017);
+  EXPECT_EQ(latency_.histogram(InputLatency::Stage::EVENT_TO_DISPLAY).count(),
+            0);
+}
+
+TEST_F(InputLatencyTest, ObservesKeyWaits) {
+  latency_.on_key_event(1 << 3, 0);
+  // LD V2, K.
+  cpu_.execute(0xf20a);
+  keyboard_.set_keys(1 << 3);
+  EXPECT_EQ(cpu_.observed_keys(), 1 << 3);
+  latency_.on_emulated(&cpu_, 0.004);
+  EXPECT_EQ(cpu_.observed_keys(), 0);
+
+  FrameBuffer changed;
+  changed.set_pixel(2, 2, true);
+  latency_.on_draw(changed, 0.008);
+  latency_.on_display(0.010);
+  EXPECT_EQ(only_value(latency_.histogram(
+                InputLatency::Stage::EVENT_TO_OBSERVED)),
+            4000);
+}
+
+TEST_F(InputLatencyTest, DropsPressesAfterTimeout) {
+  latency_.on_key_event(1, 0);
+  latency_.on_display(0.5);
+  latency_.on_key_event(1, 0.6);
+  latency_.on_display(InputLatency::kTimeout + 0.1);
+  EXPECT_EQ(latency_.timeouts(), 1);
+
+  // The key can be measured again.
+  latency_.on_key_event(1, 2);
+  run(0xe0a1, 1);
+  latency_.on_emulated(&cpu_, 2.001);
+  FrameBuffer changed;
+  changed.set_pixel(3, 3, true);
+  latency_.on_draw(changed, 2.002);
+  latency_.on_display(2.003);
+  EXPECT_EQ(only_value(latency_.histogram(
+                InputLatency::Stage::EVENT_TO_DISPLAY)),
+            3000);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "src/cpu.h"
+#include "src/fast_forward.h"
+#include "src/live_stats.h"
+
+TEST(LiveStatsTest, RefreshesTwiceASecond) {
+  LiveStats stats(0);
+  for (int frame = 1; frame < 30; ++frame) {
+    EXPECT_FALSE(stats.end_frame(frame / 60.0, frame));
+  }
+  EXPECT_TRUE(stats.end_frame(0.5, 30));
+  EXPECT_NEAR(stats.frames_per_second(), 60, 1e-9);
+  EXPECT_NEAR(stats.instructions_per_second(),
+              60 * Cpu::kInstructionsPerFrame, 1e-9);
+}
+
+TEST(LiveStatsTest, SummarizesFrameTimes) {
+  LiveStats stats(0);
+  double now = 0;
+  for (int frame = 0; frame < 200; ++frame) {
+    // One frame in sixty hitches.
+    now += frame % 60 == 50 ? 0.05 : 0.01;
+    stats.end_frame(now, frame);
+  }
+  ASSERT_EQ(stats.frame_times(), LiveStats::kHistory);
+  EXPECT_NEAR(stats.frame_time(LiveStats::kHistory - 1), 0.01, 1e-9);
+  EXPECT_NEAR(stats.frame_time(LiveStats::kHistory - 30), 0.05, 1e-9);
+
+  stats.end_frame(now + 0.01, 200);
+  EXPECT_NEAR(stats.min_frame_time(), 0.01, 1e-9);
+  EXPECT_NEAR(stats.p99_frame_time(), 0.05, 1e-9);
+  EXPECT_NEAR(stats.average_frame_time(), (118 * 0.01 + 2 * 0.05) / 120,
+              1e-9);
+}
+
+TEST(LiveStatsTest, SplitsTimeBetweenParts) {
+  LiveStats stats(0);
+  for (int frame = 1; frame <= 30; ++frame) {
+    stats.add_emulation(0.001, 1);
+    stats.add_render(0.002);
+    stats.add_display(0.010);
+    stats.end_frame(frame / 60.0, frame);
+  }
+  EXPECT_DOUBLE_EQ(stats.emulation_time(), 0.001);
+  EXPECT_DOUBLE_EQ(stats.render_time(), 0.002);
+  EXPECT_DOUBLE_EQ(stats.display_time(), 0.010);
+}
+
+TEST(LiveStatsTest, MeasuresTimerDrift) {
+  LiveStats stats(0);
+  for (int frame = 1; frame <= 30; ++frame) {
+    stats.end_frame(frame / 60.0, frame);
+  }
+  EXPECT_FALSE(stats.timer_drift());
+
+  // At 2x, 60 timer ticks in 0.6 seconds are 0.1 seconds behind.
+  stats.restart_drift(0.5, 2);
+  stats.add_emulation(0, 60);
+  stats.end_frame(1.1, 90);
+  ASSERT_TRUE(stats.timer_drift());
+  EXPECT_NEAR(*stats.timer_drift(), -0.1, 1e-9);
+
+  stats.restart_drift(1.1, FastForward::kUnbounded);
+  stats.add_emulation(0, 1000);
+  stats.end_frame(1.6, 1090);
+  EXPECT_FALSE(stats.timer_drift());
+}
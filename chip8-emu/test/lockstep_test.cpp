@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "src/execution_engine.h"
+#include "src/lockstep.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+// Adds and draws in a loop, storing the sum every eighth pass.
+constexpr uint16_t kProgram[] = {
+    0x6001,  // 0x200: LD V0, 1
+    0x61ff,  // 0x202: LD V1, 0xff
+    0x8014,  // 0x204: ADD V0, V1
+    0xa000,  // 0x206: LD I, 0x000
+    0xd005,  // 0x208: DRW V0, V0, 5
+    0x7201,  // 0x20a: ADD V2, 1
+    0x3208,  // 0x20c: SE V2, 8
+    0x1204,  // 0x20e: JP 0x204
+    0x6200,  // 0x210: LD V2, 0
+    0xa300,  // 0x212: LD I, 0x300
+    0xf055,  // 0x214: LD [I], V0
+    0x1204,  // 0x216: JP 0x204
+};
+
+// Steps every instruction like the reference, then breaks the result of
+// |opcode| whenever it runs with V2 equal to |v2|.
+class BrokenEngine : public ExecutionEngine {
+ public:
+  enum class Breaks { REGISTER, MEMORY, RANDOM };
+
+  BrokenEngine(uint16_t opcode, uint8_t v2, Breaks breaks)
+      : opcode_(opcode), v2_(v2), breaks_(breaks) {}
+
+  EngineKind kind() const override { return EngineKind::INTERPRETER; }
+
+  bool run(Cpu* cpu, unsigned int instructions) override {
+    for (unsigned int i = 0; i < instructions; ++i) {
+      bool matches =
+          (cpu->peek(cpu->pc()) << 8 | cpu->peek(cpu->pc() + 1)) == opcode_ &&
+          cpu->v(2) == v2_;
+      if (!cpu->step()) {
+        return false;
+      }
+      if (matches) {
+        if (breaks_ == Breaks::REGISTER) {
+          registers(cpu).v[1] ^= 1;
+        } else if (breaks_ == Breaks::MEMORY) {
+          cpu->set_memory(0x301, cpu->peek(0x301) + 1);
+        } else {
+          // Draws a number that nothing uses.
+          uint8_t v3 = cpu->v(3);
+          cpu->execute(0xc3ff);  // RND V3, 0xff
+          registers(cpu).v[3] = v3;
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+  const uint16_t opcode_;
+  const uint8_t v2_;
+  const Breaks breaks_;
+};
+
+class Machine {
+ public:
+  explicit Machine(ScriptedKeyboard* keyboard)
+      : random_(3), cpu_(&random_, keyboard) {
+    for (size_t i = 0; i < std::size(kProgram); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, kProgram[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      kProgram[i] & 0xff);
+    }
+  }
+
+  Cpu* cpu() { return &cpu_; }
+
+ private:
+  Random random_;
+  Cpu cpu_;
+};
+
+class LockstepTest : public ::testing::TestWithParam<Lockstep::Granularity> {
+ protected:
+  LockstepTest() : reference_(&keyboard_), machine_(&keyboard_) {}
+
+  ScriptedKeyboard keyboard_;
+  Machine reference_;
+  Machine machine_;
+};
+
+bool contains(const std::vector<std::string>& differences,
+              const std::string& difference) {
+  return std::find(differences.begin(), differences.end(), difference) !=
+         differences.end();
+}
+
+}  // namespace
+
+TEST(LockstepGranularityTest, ParsesNames) {
+  for (Lockstep::Granularity granularity :
+       {Lockstep::Granularity::INSTRUCTION, Lockstep::Granularity::BLOCK,
+        Lockstep::Granularity::FRAME}) {
+    Lockstep::Granularity parsed;
+    ASSERT_TRUE(parse_granularity(granularity_name(granularity), &parsed));
+    EXPECT_EQ(parsed, granularity);
+  }
+  Lockstep::Granularity parsed;
+  EXPECT_FALSE(parse_granularity("cycle", &parsed));
+}
+
+TEST_P(LockstepTest, PassesMatchingEngines) {
+  std::unique_ptr<ExecutionEngine> engine = make_engine(EngineKind::THREADED);
+  machine_.cpu()->set_engine(engine.get());
+  Lockstep lockstep(reference_.cpu(), machine_.cpu(), GetParam());
+  for (int frame = 0; frame < 100; ++frame) {
+    ASSERT_TRUE(lockstep.run_frame()) << lockstep.report();
+  }
+  EXPECT_FALSE(lockstep.divergence());
+  EXPECT_EQ(lockstep.report(), "");
+  EXPECT_EQ(machine_.cpu()->frames_run(), 100);
+}
+
+TEST_P(LockstepTest, FindsTheFirstWrongInstruction) {
+  BrokenEngine engine(0x8014, 2, BrokenEngine::Breaks::REGISTER);
+  machine_.cpu()->set_engine(&engine);
+  Lockstep lockstep(reference_.cpu(), machine_.cpu(), GetParam());
+  ASSERT_TRUE(lockstep.run_frame());
+  ASSERT_FALSE(lockstep.run_frame());
+  ASSERT_TRUE(lockstep.divergence());
+
+  const Lockstep::Divergence& divergence = *lockstep.divergence();
+  // The third ADD V0, V1 is the 15th instruction.
+  EXPECT_EQ(divergence.frame, 1);
+  EXPECT_EQ(divergence.instruction, 4);
+  EXPECT_EQ(divergence.pc, 0x204);
+  EXPECT_EQ(divergence.opcode, 0x8014);
+  EXPECT_TRUE(divergence.reproduced);
+  EXPECT_EQ(divergence.differences,
+            std::vector<std::string>{"V1: 0xFF (reference) != 0xFE (engine)"});
+  EXPECT_NE(lockstep.report().find("0x204: 0x8014 ADD V0, V1"),
+            std::string::npos)
+      << lockstep.report();
+
+  // Stays stopped.
+  EXPECT_FALSE(lockstep.run_frame());
+}
+
+TEST_P(LockstepTest, FindsMemoryDifferences) {
+  BrokenEngine engine(0xf055, 0, BrokenEngine::Breaks::MEMORY);
+  machine_.cpu()->set_engine(&engine);
+  Lockstep lockstep(reference_.cpu(), machine_.cpu(), GetParam());
+  int frames = 0;
+  while (lockstep.run_frame()) {
+    ASSERT_LT(++frames, 100);
+  }
+  ASSERT_TRUE(lockstep.divergence());
+  EXPECT_EQ(lockstep.divergence()->opcode, 0xf055);
+  EXPECT_TRUE(contains(lockstep.divergence()->differences,
+                       "memory[0x301]: 0x00 (reference) != 0x01 (engine)"))
+      << lockstep.report();
+}
+
+TEST_P(LockstepTest, FindsExtraRandomNumbers) {
+  BrokenEngine engine(0x8014, 2, BrokenEngine::Breaks::RANDOM);
+  machine_.cpu()->set_engine(&engine);
+  Lockstep lockstep(reference_.cpu(), machine_.cpu(), GetParam());
+  ASSERT_TRUE(lockstep.run_frame());
+  ASSERT_FALSE(lockstep.run_frame());
+  ASSERT_TRUE(lockstep.divergence());
+
+  const Lockstep::Divergence& divergence = *lockstep.divergence();
+  EXPECT_EQ(divergence.frame, 1);
+  EXPECT_EQ(divergence.instruction, 4);
+  EXPECT_EQ(divergence.opcode, 0x8014);
+  ASSERT_EQ(divergence.differences.size(), 1);
+  EXPECT_EQ(divergence.differences[0].rfind("random state: ", 0), 0)
+      << lockstep.report();
+}
+
+INSTANTIATE_TEST_SUITE_P(Granularities, LockstepTest,
+                         ::testing::Values(Lockstep::Granularity::INSTRUCTION,
+                                           Lockstep::Granularity::BLOCK,
+                                           Lockstep::Granularity::FRAME),
+                         [](const auto& info) {
+                           return std::string(granularity_name(info.param));
+                         });
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+#include <SFML/Network.hpp>
+
+#include "src/metrics.h"
+#include "src/metrics_server.h"
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+#include "src/tiered_engine.h"
+
+namespace {
+
+class MetricsTest : public ::testing::Test {
+ protected:
+  MetricsTest() : random_(1), cpu_(&random_, &keyboard_) {
+    // LD V0, 0x01; ADD V0, 0x01; JP 0x202.
+    const uint8_t program[] = {0x60, 0x01, 0x70, 0x01, 0x12, 0x02};
+    for (size_t i = 0; i < sizeof(program); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i, program[i]);
+    }
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  Metrics metrics_;
+};
+
+std::string fetch(unsigned short port, const std::string& request) {
+  sf::TcpSocket socket;
+  if (socket.connect(sf::IpAddress::LocalHost, port, sf::seconds(1)) !=
+      sf::Socket::Done) {
+    return "";
+  }
+  socket.send(request.data(), request.size());
+  std::string response;
+  char buffer[1024];
+  size_t received;
+  while (socket.receive(buffer, sizeof(buffer), received) ==
+         sf::Socket::Done) {
+    response.append(buffer, received);
+  }
+  return response;
+}
+
+}  // namespace
+
+TEST_F(MetricsTest, CountsInstructionsByOpcode) {
+  metrics_.attach(&cpu_);
+  ASSERT_TRUE(cpu_.run_frame());
+  // Nothing is published until kPublishInterval has passed.
+  metrics_.update(0.5);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::INSTRUCTIONS), 0);
+
+  metrics_.update(Metrics::kPublishInterval);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::FRAMES), 1);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::INSTRUCTIONS),
+            Cpu::kInstructionsPerFrame);
+  EXPECT_EQ(metrics_.opcode_count(OpcodeClass::LD_BYTE), 1);
+  EXPECT_EQ(metrics_.opcode_count(OpcodeClass::ADD_BYTE), 5);
+  EXPECT_EQ(metrics_.opcode_count(OpcodeClass::JP), 4);
+
+  // Detaching publishes what is left, and stops counting.
+  ASSERT_TRUE(cpu_.run_frame());
+  metrics_.detach();
+  ASSERT_TRUE(cpu_.run_frame());
+  EXPECT_EQ(metrics_.get(Metrics::Counter::FRAMES), 2);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::INSTRUCTIONS),
+            2 * Cpu::kInstructionsPerFrame);
+}
+
+TEST_F(MetricsTest, CountsInstructionsByTier) {
+  TieredEngine engine;
+  cpu_.set_engine(&engine);
+  metrics_.attach(&cpu_, &engine);
+  ASSERT_TRUE(cpu_.run_frame());
+  metrics_.update(Metrics::kPublishInterval);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::INSTRUCTIONS),
+            Cpu::kInstructionsPerFrame);
+  EXPECT_EQ(metrics_.tier_instructions(Tier::INTERPRETER),
+            Cpu::kInstructionsPerFrame);
+  // Opcodes are not counted, which would step every instruction instead.
+  EXPECT_EQ(metrics_.opcode_count(OpcodeClass::ADD_BYTE), 0);
+
+  std::ostringstream out;
+  metrics_.write(out);
+  EXPECT_NE(out.str().find(
+                "chip8_tier_instructions_total{tier=\"interpreter\"} 10\n"),
+            std::string::npos);
+  EXPECT_NE(out.str().find("chip8_tier_demotions_total 0\n"),
+            std::string::npos);
+  metrics_.detach();
+  cpu_.set_engine(nullptr);
+}
+
+TEST_F(MetricsTest, CountsDroppedFrames) {
+  metrics_.on_presented(0);
+  metrics_.on_presented(1 / 60.0);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::DROPPED_FRAMES), 0);
+  // Three refreshes later, two were missed.
+  metrics_.on_presented(4 / 60.0);
+  EXPECT_EQ(metrics_.get(Metrics::Counter::DROPPED_FRAMES), 2);
+}
+
+TEST_F(MetricsTest, PublishesP99FrameTime) {
+  EXPECT_LT(metrics_.p99_frame_time(), 0);
+  double now = 0;
+  for (int frame = 0; frame < 700; ++frame) {
+    now += frame % 50 == 0 ? 0.05 : 0.016;
+    metrics_.on_presented(now);
+  }
+  EXPECT_NEAR(metrics_.p99_frame_time(), 0.05, 0.05 / Histogram::kSubBuckets);
+}
+
+TEST_F(MetricsTest, WritesPrometheusText) {
+  metrics_.add(Metrics::Counter::KEY_EVENTS, 3);
+  metrics_.add(Metrics::Counter::LOAD_ERRORS);
+  std::ostringstream out;
+  metrics_.write(out);
+  std::string text = out.str();
+
+  EXPECT_NE(text.find("# TYPE chip8_key_events_total counter\n"
+                      "chip8_key_events_total 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("chip8_load_errors_total 1\n"), std::string::npos);
+  EXPECT_NE(text.find("chip8_opcode_instructions_total{opcode=\"8xy4\"} 0\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("chip8_opcode_instructions_total{opcode=\"unknown\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("chip8_frame_time_p99_seconds NaN\n"),
+            std::string::npos);
+}
+
+TEST_F(MetricsTest, ServesOverHttp) {
+  MetricsServer server(&metrics_);
+  ASSERT_TRUE(server.start(0));
+  metrics_.add(Metrics::Counter::KEY_EVENTS, 7);
+
+  std::string response =
+      fetch(server.port(), "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(response.rfind("HTTP/1.0 200 OK\r\n", 0), 0) << response;
+  EXPECT_NE(response.find("\r\n\r\n# HELP chip8_frames_total"),
+            std::string::npos);
+  EXPECT_NE(response.find("chip8_key_events_total 7\n"), std::string::npos);
+
+  response = fetch(server.port(), "GET / HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(response.rfind("HTTP/1.0 404 Not Found\r\n", 0), 0) << response;
+
+  server.stop();
+  EXPECT_EQ(fetch(server.port(), "GET /metrics HTTP/1.1\r\n\r\n"), "");
+}
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "src/binary_io.h"
+#include "src/cpu.h"
+#include "src/movie.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+// Draws a digit at a random column and a row that moves down while key 0 is
+// held.
+constexpr uint16_t kProgram[] = {
+    0xc0ff,  // 0x200: RND V0, 0xff
+    0xe19e,  // 0x202: SKP V1
+    0x1208,  // 0x204: JP 0x208
+    0x7201,  // 0x206: ADD V2, 1
+    0xa000,  // 0x208: LD I, 0x000
+    0xd025,  // 0x20a: DRW V0, V2, 5
+    0x1200,  // 0x20c: JP 0x200
+};
+
+class KeyObserver : public Keyboard::KeyboardObserver {
+ public:
+  void on_key_pressed(uint8_t key) override { pressed.push_back(key); }
+
+  std::vector<uint8_t> pressed;
+};
+
+}  // namespace
+
+class MovieTest : public testing::Test {
+ protected:
+  MovieTest() : random_(1234), cpu_(&random_, &keyboard_) {
+    for (size_t i = 0; i < std::size(kProgram); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, kProgram[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      kProgram[i] & 0xff);
+    }
+  }
+
+  // Records |frames| frames holding key 0 every third frame.
+  void record(Movie* movie, uint32_t frames) {
+    MovieRecorder recorder(movie, &cpu_, &keyboard_, random_.seed());
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      ASSERT_TRUE(recorder.run_frame(frame % 3 == 0 ? 0x1 : 0x0));
+    }
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+};
+
+TEST(ScriptedKeyboardTest, DispatchesNewlyPressedKeys) {
+  ScriptedKeyboard keyboard;
+  KeyObserver observer;
+  keyboard.add_observer(&observer);
+
+  keyboard.set_keys(0b101);
+  EXPECT_TRUE(keyboard.is_key_pressed(0));
+  EXPECT_FALSE(keyboard.is_key_pressed(1));
+  EXPECT_TRUE(keyboard.is_key_pressed(2));
+  EXPECT_EQ((std::vector<uint8_t>{0, 2}), observer.pressed);
+
+  observer.pressed.clear();
+  keyboard.set_keys(0b110);
+  EXPECT_EQ((std::vector<uint8_t>{1}), observer.pressed);
+
+  observer.pressed.clear();
+  keyboard.reset(0);
+  keyboard.set_keys(0b100);
+  EXPECT_EQ((std::vector<uint8_t>{2}), observer.pressed);
+
+  keyboard.remove_observer(&observer);
+}
+
+TEST_F(MovieTest, RecordsFramesAndKeyframes) {
+  Movie movie;
+  movie.keyframe_interval = 10;
+  record(&movie, 25);
+  EXPECT_EQ(1234, movie.seed);
+  ASSERT_EQ(25, movie.frames.size());
+  EXPECT_EQ(0x1, movie.frames[0].keys);
+  EXPECT_EQ(0x0, movie.frames[1].keys);
+  EXPECT_EQ(cpu_.frame_buffer()->hash(), movie.frames[24].frame_buffer_hash);
+  ASSERT_EQ(3, movie.keyframes.size());
+  EXPECT_EQ(0, movie.keyframes[0].frame);
+  EXPECT_EQ(10, movie.keyframes[1].frame);
+  EXPECT_EQ(20, movie.keyframes[2].frame);
+}
+
+TEST_F(MovieTest, ReplayMatches) {
+  Movie movie;
+  movie.keyframe_interval = 10;
+  record(&movie, 25);
+
+  MoviePlayer player(&movie, &cpu_, &keyboard_);
+  ASSERT_TRUE(player.seek(0));
+  for (uint32_t frame = 0; frame < 25; ++frame) {
+    ASSERT_EQ(MoviePlayer::Status::OK, player.run_frame()) << frame;
+  }
+  EXPECT_EQ(MoviePlayer::Status::END, player.run_frame());
+}
+
+TEST_F(MovieTest, SeekToAnyFrame) {
+  Movie movie;
+  movie.keyframe_interval = 10;
+  record(&movie, 25);
+
+  MoviePlayer player(&movie, &cpu_, &keyboard_);
+  for (uint32_t start : {24, 3, 10, 17}) {
+    ASSERT_TRUE(player.seek(start));
+    EXPECT_EQ(start, player.frame());
+    for (uint32_t frame = start; frame < 25; ++frame) {
+      ASSERT_EQ(MoviePlayer::Status::OK, player.run_frame()) << frame;
+    }
+  }
+  EXPECT_FALSE(player.seek(26));
+}
+
+TEST_F(MovieTest, DetectsDesync) {
+  Movie movie;
+  record(&movie, 5);
+  movie.frames[3].frame_buffer_hash ^= 1;
+
+  MoviePlayer player(&movie, &cpu_, &keyboard_);
+  ASSERT_TRUE(player.seek(0));
+  EXPECT_EQ(MoviePlayer::Status::OK, player.run_frame());
+  EXPECT_EQ(MoviePlayer::Status::OK, player.run_frame());
+  EXPECT_EQ(MoviePlayer::Status::OK, player.run_frame());
+  EXPECT_EQ(MoviePlayer::Status::DESYNC, player.run_frame());
+}
+
+TEST_F(MovieTest, DropFrame) {
+  Movie movie;
+  movie.keyframe_interval = 2;
+  MovieRecorder recorder(&movie, &cpu_, &keyboard_, random_.seed());
+  Cpu::State state;
+  ASSERT_TRUE(recorder.run_frame(0x1));
+  ASSERT_TRUE(recorder.run_frame(0x0));
+  cpu_.save_state(&state);
+  ASSERT_TRUE(recorder.run_frame(0x1));
+
+  cpu_.load_state(state);
+  recorder.drop_frame();
+  EXPECT_EQ(2, movie.frames.size());
+  EXPECT_EQ(0x0, keyboard_.keys());
+  ASSERT_TRUE(recorder.run_frame(0x0));
+  ASSERT_TRUE(recorder.run_frame(0x1));
+  EXPECT_EQ(2, movie.keyframes.size());
+
+  MoviePlayer player(&movie, &cpu_, &keyboard_);
+  ASSERT_TRUE(player.seek(0));
+  for (uint32_t frame = 0; frame < 4; ++frame) {
+    ASSERT_EQ(MoviePlayer::Status::OK, player.run_frame()) << frame;
+  }
+}
+
+TEST_F(MovieTest, SaveAndLoad) {
+  Movie movie;
+  movie.keyframe_interval = 10;
+  record(&movie, 25);
+
+  std::string path = testing::TempDir() + "movie_test.c8mv";
+  ASSERT_TRUE(save_movie(movie, path));
+  Movie loaded;
+  ASSERT_TRUE(load_movie(path, &loaded));
+  std::remove(path.c_str());
+
+  EXPECT_EQ(movie.seed, loaded.seed);
+  EXPECT_EQ(movie.keyframe_interval, loaded.keyframe_interval);
+  ASSERT_EQ(movie.frames.size(), loaded.frames.size());
+  ASSERT_EQ(movie.keyframes.size(), loaded.keyframes.size());
+
+  MoviePlayer player(&loaded, &cpu_, &keyboard_);
+  ASSERT_TRUE(player.seek(12));
+  for (uint32_t frame = 12; frame < 25; ++frame) {
+    ASSERT_EQ(MoviePlayer::Status::OK, player.run_frame()) << frame;
+  }
+}
+
+TEST_F(MovieTest, LoadRejectsCorruptFiles) {
+  Movie movie;
+  record(&movie, 5);
+  std::string path = testing::TempDir() + "movie_test_corrupt.c8mv";
+  ASSERT_TRUE(save_movie(movie, path));
+  std::vector<uint8_t> contents;
+  ASSERT_TRUE(read_file(path, &contents));
+  contents.resize(contents.size() / 2);
+  {
+    BinaryWriter writer;
+    writer.bytes(contents.data(), contents.size());
+    ASSERT_TRUE(writer.save(path));
+  }
+  Movie loaded;
+  EXPECT_FALSE(load_movie(path, &loaded));
+  std::remove(path.c_str());
+}
@@ -0,0 +1,287 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+
+#include <SFML/Network/UdpSocket.hpp>
+#include <SFML/System/Sleep.hpp>
+
+#include "src/binary_io.h"
+#include "src/cpu.h"
+#include "src/netplay.h"
+#include "src/scripted_keyboard.h"
+
+namespace {
+
+// Draws a sprite at a random column, on a row chosen by the keys held.
+constexpr uint16_t kProgram[] = {
+    0x00e0,  // 0x200: CLS
+    0xc03f,  // 0x202: RND V0, 0x3f
+    0x6100,  // 0x204: LD V1, 0
+    0xe29e,  // 0x206: SKP V2
+    0x710a,  // 0x208: ADD V1, 10
+    0xe39e,  // 0x20a: SKP V3
+    0x7105,  // 0x20c: ADD V1, 5
+    0xa000,  // 0x20e: LD I, 0x000
+    0xd015,  // 0x210: DRW V0, V1, 5
+    0x1200,  // 0x212: JP 0x200
+};
+
+class Machine {
+ public:
+  Machine() : random_(7), cpu_(&random_, &keyboard_) {
+    for (size_t i = 0; i < std::size(kProgram); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, kProgram[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      kProgram[i] & 0xff);
+    }
+    // Player one holds key 2 and player two key 3.
+    cpu_.execute(0x6202);
+    cpu_.execute(0x6303);
+  }
+
+  Cpu* cpu() { return &cpu_; }
+  ScriptedKeyboard* keyboard() { return &keyboard_; }
+  uint32_t seed() const { return random_.seed(); }
+
+  uint64_t hash() {
+    Cpu::State state;
+    cpu_.save_state(&state);
+    return state.hash();
+  }
+
+ private:
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+};
+
+// Delivers packets to the other end of the pair |latency| calls to receive()
+// after they were sent, dropping every |drop_every|-th one.
+class LoopbackTransport : public NetplayTransport {
+ public:
+  LoopbackTransport(size_t latency, size_t drop_every)
+      : latency_(latency), drop_every_(drop_every) {}
+
+  void connect(LoopbackTransport* peer) { peer_ = peer; }
+
+  void send(const std::vector<uint8_t>& packet) override {
+    if (drop_every_ && ++sent_ % drop_every_ == 0) {
+      return;
+    }
+    peer_->queue_.push_back({peer_->polls_ + latency_, packet});
+  }
+
+  bool receive(std::vector<uint8_t>* packet) override {
+    ++polls_;
+    if (queue_.empty() || queue_.front().first > polls_) {
+      return false;
+    }
+    *packet = std::move(queue_.front().second);
+    queue_.pop_front();
+    return true;
+  }
+
+ private:
+  const size_t latency_;
+  const size_t drop_every_;
+  LoopbackTransport* peer_ = nullptr;
+  std::deque<std::pair<size_t, std::vector<uint8_t>>> queue_;
+  size_t polls_ = 0;
+  size_t sent_ = 0;
+};
+
+uint16_t player_keys(int player, uint32_t frame) {
+  return (frame / 4 + player) % 3 == 0 ? 1 << (player + 2) : 0;
+}
+
+// Returns a UDP port that was free a moment ago, or 0.
+unsigned short free_port() {
+  sf::UdpSocket socket;
+  if (socket.bind(sf::Socket::AnyPort) != sf::Socket::Done) {
+    return 0;
+  }
+  return socket.getLocalPort();
+}
+
+}  // namespace
+
+class NetplayTest : public testing::Test {
+ protected:
+  // Runs both players for |frames| frames, then lets them settle.
+  void run(NetplaySession* one, NetplaySession* two, uint32_t frames) {
+    for (int i = 0; i < 10000 && (one->frame() < frames ||
+                                  two->frame() < frames ||
+                                  one->confirmed() < frames ||
+                                  two->confirmed() < frames);
+         ++i) {
+      for (auto [player, session] : {std::pair{0, one}, std::pair{1, two}}) {
+        NetplaySession::Status status =
+            session->frame() < frames
+                ? session->advance(player_keys(player, session->frame()))
+                : session->update();
+        ASSERT_NE(NetplaySession::Status::ERROR, status);
+        ASSERT_NE(NetplaySession::Status::DESYNC, status);
+        EXPECT_LE(session->last_rollback(), NetplaySession::kMaxRollback);
+        max_rollback_ = std::max(max_rollback_, session->last_rollback());
+      }
+    }
+    ASSERT_EQ(frames, one->frame());
+    ASSERT_EQ(frames, two->frame());
+    ASSERT_EQ(frames, one->confirmed());
+    ASSERT_EQ(frames, two->confirmed());
+  }
+
+  // Runs |frames| frames without netplay, with both players' keys.
+  uint64_t reference_hash(uint32_t frames) {
+    Machine machine;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      machine.keyboard()->set_keys(player_keys(0, frame) |
+                                   player_keys(1, frame));
+      EXPECT_TRUE(machine.cpu()->run_frame());
+    }
+    return machine.hash();
+  }
+
+  uint32_t max_rollback_ = 0;
+};
+
+TEST_F(NetplayTest, WithoutLatencyMatchesLocalPlay) {
+  Machine machine_one, machine_two;
+  LoopbackTransport transport_one(0, 0), transport_two(0, 0);
+  transport_one.connect(&transport_two);
+  transport_two.connect(&transport_one);
+  NetplaySession one(machine_one.cpu(), machine_one.keyboard(),
+                     &transport_one, machine_one.seed());
+  NetplaySession two(machine_two.cpu(), machine_two.keyboard(),
+                     &transport_two, machine_two.seed());
+
+  run(&one, &two, 100);
+  EXPECT_EQ(reference_hash(100), machine_one.hash());
+  EXPECT_EQ(reference_hash(100), machine_two.hash());
+}
+
+TEST_F(NetplayTest, RollsBackLateInput) {
+  Machine machine_one, machine_two;
+  LoopbackTransport transport_one(5, 0), transport_two(3, 7);
+  transport_one.connect(&transport_two);
+  transport_two.connect(&transport_one);
+  NetplaySession one(machine_one.cpu(), machine_one.keyboard(),
+                     &transport_one, machine_one.seed());
+  NetplaySession two(machine_two.cpu(), machine_two.keyboard(),
+                     &transport_two, machine_two.seed());
+
+  run(&one, &two, 300);
+  EXPECT_GT(max_rollback_, 1);
+  EXPECT_EQ(reference_hash(300), machine_one.hash());
+  EXPECT_EQ(reference_hash(300), machine_two.hash());
+}
+
+TEST_F(NetplayTest, WaitsForTheRemotePlayer) {
+  Machine machine;
+  LoopbackTransport transport(0, 0), nobody(0, 0);
+  transport.connect(&nobody);
+  NetplaySession session(machine.cpu(), machine.keyboard(), &transport,
+                         machine.seed());
+  for (uint32_t i = 0; i < NetplaySession::kMaxRollback; ++i) {
+    EXPECT_EQ(NetplaySession::Status::ADVANCED, session.advance(0));
+  }
+  EXPECT_EQ(NetplaySession::Status::WAITING, session.advance(0));
+  EXPECT_EQ(NetplaySession::kMaxRollback, session.frame());
+}
+
+TEST_F(NetplayTest, DetectsDesync) {
+  Machine machine_one, machine_two;
+  LoopbackTransport transport_one(1, 0), transport_two(1, 0);
+  transport_one.connect(&transport_two);
+  transport_two.connect(&transport_one);
+  NetplaySession one(machine_one.cpu(), machine_one.keyboard(),
+                     &transport_one, machine_one.seed());
+  NetplaySession two(machine_two.cpu(), machine_two.keyboard(),
+                     &transport_two, machine_two.seed());
+
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(NetplaySession::Status::ADVANCED, one.advance(0));
+    ASSERT_EQ(NetplaySession::Status::ADVANCED, two.advance(0));
+  }
+  machine_two.cpu()->set_memory(0xf00, 0x42);
+  bool desync = false;
+  for (int i = 0; i < 20 && !desync; ++i) {
+    desync = one.advance(0) == NetplaySession::Status::DESYNC ||
+             two.advance(0) == NetplaySession::Status::DESYNC;
+  }
+  EXPECT_TRUE(desync);
+}
+
+TEST_F(NetplayTest, DropsInputAheadOfTheWindow) {
+  Machine machine;
+  LoopbackTransport transport(0, 0), peer(0, 0);
+  transport.connect(&peer);
+  peer.connect(&transport);
+  NetplaySession session(machine.cpu(), machine.keyboard(), &transport,
+                         machine.seed());
+  // Hashes the state before frame 0.
+  ASSERT_EQ(NetplaySession::Status::ADVANCED, session.advance(0));
+  ASSERT_EQ(NetplaySession::Status::ADVANCED, session.advance(0));
+
+  // The keys of frames 40 and 41, then the hash of a frame yet to come,
+  // which read from the second keys on would be a wrong hash of frame 0.
+  BinaryWriter writer;
+  writer.u32(0x504e3843);
+  writer.u32(machine.seed());
+  writer.u64(machine.cpu()->rom_hash());
+  writer.u32(40);
+  writer.u8(2);
+  writer.u16(0);
+  writer.u16(0);
+  writer.u32(0x10000);
+  writer.u64(0);
+  peer.send(writer.buffer());
+  EXPECT_EQ(NetplaySession::Status::ADVANCED, session.update());
+  EXPECT_EQ(0u, session.confirmed());
+}
+
+TEST_F(NetplayTest, RejectsDifferentSeed) {
+  Machine machine_one, machine_two;
+  LoopbackTransport transport_one(0, 0), transport_two(0, 0);
+  transport_one.connect(&transport_two);
+  transport_two.connect(&transport_one);
+  NetplaySession one(machine_one.cpu(), machine_one.keyboard(),
+                     &transport_one, 1);
+  NetplaySession two(machine_two.cpu(), machine_two.keyboard(),
+                     &transport_two, 2);
+  ASSERT_EQ(NetplaySession::Status::ADVANCED, one.advance(0));
+  EXPECT_EQ(NetplaySession::Status::ERROR, two.advance(0));
+}
+
+TEST_F(NetplayTest, OverUdp) {
+  unsigned short port_one = free_port();
+  unsigned short port_two = free_port();
+  ASSERT_NE(0, port_one);
+  ASSERT_NE(0, port_two);
+  UdpTransport transport_one, transport_two;
+  ASSERT_TRUE(
+      transport_one.open(port_one, sf::IpAddress::LocalHost, port_two));
+  ASSERT_TRUE(
+      transport_two.open(port_two, sf::IpAddress::LocalHost, port_one));
+
+  Machine machine_one, machine_two;
+  NetplaySession one(machine_one.cpu(), machine_one.keyboard(),
+                     &transport_one, machine_one.seed());
+  NetplaySession two(machine_two.cpu(), machine_two.keyboard(),
+                     &transport_two, machine_two.seed());
+  for (int i = 0; i < 2000 && (one.confirmed() < 60 || two.confirmed() < 60);
+       ++i) {
+    for (auto [player, session] :
+         {std::pair{0, &one}, std::pair{1, &two}}) {
+      NetplaySession::Status status =
+          session->frame() < 60
+              ? session->advance(player_keys(player, session->frame()))
+              : session->update();
+      ASSERT_NE(NetplaySession::Status::ERROR, status);
+      ASSERT_NE(NetplaySession::Status::DESYNC, status);
+    }
+    sf::sleep(sf::microseconds(200));
+  }
+  EXPECT_EQ(reference_hash(60), machine_one.hash());
+  EXPECT_EQ(reference_hash(60), machine_two.hash());
+}
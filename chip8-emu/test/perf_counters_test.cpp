@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "src/perf_counters.h"
+
+TEST(PerfCountersTest, CountsOrDegrades) {
+  PerfCounters counters;
+  counters.start();
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 100000; ++i) {
+    sum = sum + i;
+  }
+  PerfCounters::Counts counts = counters.stop();
+
+  if (!counters.available()) {
+    for (const auto& count : counts) {
+      EXPECT_FALSE(count.has_value());
+    }
+    GTEST_SKIP() << "No hardware performance counters on this host";
+  }
+  std::optional<uint64_t> instructions =
+      PerfCounters::get(counts, PerfCounters::Event::INSTRUCTIONS);
+  if (instructions) {
+    EXPECT_GT(*instructions, 100000);
+  }
+}
+
+TEST(PerfCountersTest, RestartsFromZero) {
+  PerfCounters counters;
+  if (!counters.available()) {
+    GTEST_SKIP() << "No hardware performance counters on this host";
+  }
+  counters.start();
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 1000000; ++i) {
+    sum = sum + i;
+  }
+  PerfCounters::Counts long_run = counters.stop();
+  counters.start();
+  PerfCounters::Counts short_run = counters.stop();
+  for (size_t i = 0; i < PerfCounters::kEvents; ++i) {
+    if (long_run[i] && short_run[i]) {
+      EXPECT_LT(*short_run[i], *long_run[i])
+          << PerfCounters::name(static_cast<PerfCounters::Event>(i));
+    }
+  }
+}
+
+TEST(PerfCountersTest, NamesEvents) {
+  EXPECT_STREQ("cycles", PerfCounters::name(PerfCounters::Event::CYCLES));
+  EXPECT_STREQ("l1d_read_misses",
+               PerfCounters::name(PerfCounters::Event::L1D_READ_MISSES));
+}
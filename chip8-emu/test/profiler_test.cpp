@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "src/cpu.h"
+#include "src/profiler.h"
+
+namespace {
+
+// Counts V0 up in a subroutine, forever.
+constexpr uint16_t kProgram[] = {
+    0x6000,  // 0x200: LD V0, 0
+    0x2206,  // 0x202: CALL 0x206
+    0x1202,  // 0x204: JP 0x202
+    0x7001,  // 0x206: ADD V0, 1
+    0x7100,  // 0x208: ADD V1, 0
+    0x00ee,  // 0x20a: RET
+};
+
+class ProfilerTest : public testing::Test {
+ protected:
+  ProfilerTest() : random_(1), cpu_(&random_, &keyboard_) {
+    for (size_t i = 0; i < std::size(kProgram); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, kProgram[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      kProgram[i] & 0xff);
+    }
+  }
+
+  // Runs the first instruction, then |loops| times around the loop.
+  void run(Profiler* profiler, int loops) {
+    cpu_.set_profiler(profiler);
+    for (int i = 0; i < 1 + loops * 5; ++i) {
+      ASSERT_TRUE(cpu_.step());
+    }
+    cpu_.set_profiler(nullptr);
+  }
+
+  Random random_;
+  Keyboard keyboard_;
+  Cpu cpu_;
+};
+
+}  // namespace
+
+TEST_F(ProfilerTest, CountsEveryInstruction) {
+  Profiler profiler;
+  run(&profiler, 100);
+
+  EXPECT_EQ(501, profiler.samples());
+  EXPECT_EQ(1, profiler.samples_at(0x200));
+  EXPECT_EQ(100, profiler.samples_at(0x206));
+  EXPECT_EQ(0, profiler.samples_at(0x20c));
+  EXPECT_EQ(200, profiler.samples_of(OpcodeClass::ADD_BYTE));
+  EXPECT_EQ(100, profiler.samples_of(OpcodeClass::RET));
+
+  std::map<uint16_t, uint64_t> blocks = profiler.block_samples(cpu_);
+  EXPECT_EQ((std::map<uint16_t, uint64_t>{
+                {0x200, 1}, {0x204, 100}, {0x206, 300}, {0x202, 100}}),
+            blocks);
+}
+
+TEST_F(ProfilerTest, SamplesEveryIntervalOnAverage) {
+  Profiler profiler(10);
+  run(&profiler, 2000);
+
+  EXPECT_NEAR(1000, profiler.samples(), 100);
+  // Jitter keeps the 5 instruction loop from aliasing with the interval.
+  for (uint16_t address = 0x202; address <= 0x20a; address += 2) {
+    EXPECT_NEAR(200, profiler.samples_at(address), 60) << address;
+  }
+}
+
+TEST_F(ProfilerTest, WritesCollapsedStacks) {
+  Profiler profiler;
+  run(&profiler, 10);
+
+  std::ostringstream out;
+  profiler.write_collapsed(cpu_, out);
+  EXPECT_EQ(
+      "main;block_200 1\n"
+      "main;block_202 10\n"
+      "main;block_204 10\n"
+      "main;sub_206;block_206 30\n",
+      out.str());
+}
+
+TEST_F(ProfilerTest, ReportsHotBlocksWithDisassembly) {
+  Profiler profiler;
+  run(&profiler, 10);
+
+  std::ostringstream out;
+  profiler.write_report(cpu_, out);
+  std::string report = out.str();
+  EXPECT_NE(std::string::npos, report.find("51 samples")) << report;
+  EXPECT_NE(std::string::npos, report.find("7xkk          20   39.2%"))
+      << report;
+  EXPECT_NE(std::string::npos, report.find("0x206: 30 samples (58.8%)"))
+      << report;
+  EXPECT_NE(std::string::npos,
+            report.find("  0x208        10  7100  ADD V1, 0x00\n"))
+      << report;
+}
+
+TEST_F(ProfilerTest, Resets) {
+  Profiler profiler;
+  run(&profiler, 10);
+  profiler.reset();
+  EXPECT_EQ(0, profiler.samples());
+  EXPECT_EQ(0, profiler.samples_at(0x206));
+  EXPECT_EQ(0, profiler.samples_of(OpcodeClass::RET));
+  EXPECT_TRUE(profiler.block_samples(cpu_).empty());
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include "src/cpu.h"
+#include "src/rewind_buffer.h"
+
+class RewindBufferTest : public testing::Test {
+ protected:
+  RewindBufferTest() : random_(0), cpu_(&random_, &keyboard_) {}
+
+  // Runs a small program that touches registers, memory and the screen.
+  void run_frame(uint8_t frame) {
+    ASSERT_TRUE(cpu_.execute(0x6000 | frame));         // LD V0, frame
+    ASSERT_TRUE(cpu_.execute(0xa300 | frame * 0x10));  // LD I, 0x300 + frame * 16
+    ASSERT_TRUE(cpu_.execute(0xf055));                 // LD [I], V0
+    ASSERT_TRUE(cpu_.execute(0xa000));                 // LD I, 0x000
+    ASSERT_TRUE(cpu_.execute(0xd005));                 // DRW V0, V0, 5
+  }
+
+  // Compares everything that affects emulation, registers, memory, the
+  // screen and the random number generator alike.
+  void expect_same_state(const Cpu::State& expected) {
+    Cpu::State actual;
+    cpu_.save_state(&actual);
+    EXPECT_EQ(expected.hash(), actual.hash());
+  }
+
+  Random random_;
+  Keyboard keyboard_;
+  Cpu cpu_;
+};
+
+TEST_F(RewindBufferTest, PopEmpty) {
+  RewindBuffer buffer;
+  EXPECT_FALSE(buffer.pop(&cpu_));
+  buffer.push(&cpu_);
+  EXPECT_EQ(0, buffer.size());
+  EXPECT_FALSE(buffer.pop(&cpu_));
+}
+
+TEST_F(RewindBufferTest, PushClearsDirtyLines) {
+  RewindBuffer buffer;
+  EXPECT_NE(0, cpu_.dirty_lines());
+  buffer.push(&cpu_);
+  EXPECT_EQ(0, cpu_.dirty_lines());
+}
+
+TEST_F(RewindBufferTest, RewindsEveryFrame) {
+  for (size_t keyframe_interval : {1, 3, 1000}) {
+    RewindBuffer buffer(RewindBuffer::kDefaultMaxBytes, keyframe_interval);
+    std::vector<Cpu::State> states(10);
+    buffer.push(&cpu_);
+    cpu_.save_state(&states[0]);
+    for (uint8_t frame = 1; frame < states.size(); ++frame) {
+      run_frame(frame);
+      buffer.push(&cpu_);
+      cpu_.save_state(&states[frame]);
+    }
+    EXPECT_EQ(states.size() - 1, buffer.size());
+
+    for (size_t frame = states.size() - 1; frame > 0; --frame) {
+      ASSERT_TRUE(buffer.pop(&cpu_));
+      expect_same_state(states[frame - 1]);
+    }
+    EXPECT_FALSE(buffer.pop(&cpu_));
+  }
+}
+
+TEST_F(RewindBufferTest, ResumesAfterRewinding) {
+  RewindBuffer buffer;
+  buffer.push(&cpu_);
+  run_frame(1);
+  buffer.push(&cpu_);
+  Cpu::State after_first;
+  cpu_.save_state(&after_first);
+  run_frame(2);
+  buffer.push(&cpu_);
+
+  ASSERT_TRUE(buffer.pop(&cpu_));
+  run_frame(3);
+  buffer.push(&cpu_);
+  ASSERT_TRUE(buffer.pop(&cpu_));
+  expect_same_state(after_first);
+}
+
+TEST_F(RewindBufferTest, RewindsRandomNumbers) {
+  RewindBuffer buffer(RewindBuffer::kDefaultMaxBytes, 1000);
+  buffer.push(&cpu_);
+  Cpu::State before;
+  cpu_.save_state(&before);
+  ASSERT_TRUE(cpu_.execute(0xc0ff));  // RND V0, 0xff
+  buffer.push(&cpu_);
+
+  ASSERT_TRUE(buffer.pop(&cpu_));
+  expect_same_state(before);
+  EXPECT_EQ(before.random_state, random_.state());
+}
+
+TEST_F(RewindBufferTest, DeltasAreSmallerThanKeyframes) {
+  RewindBuffer buffer(RewindBuffer::kDefaultMaxBytes, 1000);
+  buffer.push(&cpu_);
+  run_frame(1);
+  buffer.push(&cpu_);
+  EXPECT_LT(buffer.bytes(), sizeof(Cpu::State) / 4);
+}
+
+TEST_F(RewindBufferTest, DropsOldestFramesWhenFull) {
+  RewindBuffer buffer(/*max_bytes=*/2 * sizeof(Cpu::State),
+                      /*keyframe_interval=*/1);
+  buffer.push(&cpu_);
+  for (uint8_t frame = 1; frame < 10; ++frame) {
+    run_frame(frame);
+    buffer.push(&cpu_);
+  }
+  EXPECT_LE(buffer.bytes(), 2 * sizeof(Cpu::State));
+  EXPECT_EQ(1, buffer.size());
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "src/cpu.h"
+#include "src/run_ahead.h"
+
+namespace {
+
+// Draws a digit at a random position every frame and clears the screen every
+// other frame.
+constexpr uint16_t kProgram[] = {
+    0xc03f,  // 0x200: RND V0, 0x3f
+    0xc11f,  // 0x202: RND V1, 0x1f
+    0xa000,  // 0x204: LD I, 0x000
+    0xd015,  // 0x206: DRW V0, V1, 5
+    0x7201,  // 0x208: ADD V2, 1
+    0x3203,  // 0x20a: SE V2, 3
+    0x1200,  // 0x20c: JP 0x200
+    0x00e0,  // 0x20e: CLS
+    0x6200,  // 0x210: LD V2, 0
+    0x1200,  // 0x212: JP 0x200
+};
+
+class Machine {
+ public:
+  Machine() : random_(42), cpu_(&random_, &keyboard_) {
+    for (size_t i = 0; i < std::size(kProgram); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, kProgram[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      kProgram[i] & 0xff);
+    }
+  }
+
+  Cpu* cpu() { return &cpu_; }
+
+ private:
+  Random random_;
+  Keyboard keyboard_;
+  Cpu cpu_;
+};
+
+}  // namespace
+
+TEST(RunAheadTest, PresentsTheFutureAndRestoresThePresent) {
+  constexpr unsigned int kFrames = 3;
+  Machine machine;
+  Machine reference;
+  RunAhead run_ahead(machine.cpu(), kFrames);
+
+  for (unsigned int i = 0; i < kFrames; ++i) {
+    ASSERT_TRUE(reference.cpu()->run_frame());
+  }
+  for (int frame = 0; frame < 20; ++frame) {
+    ASSERT_TRUE(machine.cpu()->run_frame());
+    ASSERT_TRUE(reference.cpu()->run_frame());
+
+    uint64_t present = machine.cpu()->frame_buffer()->hash();
+    uint16_t pc = machine.cpu()->pc();
+    FrameBuffer future;
+    ASSERT_TRUE(run_ahead.run(&future));
+    EXPECT_EQ(reference.cpu()->frame_buffer()->hash(), future.hash());
+
+    EXPECT_EQ(present, machine.cpu()->frame_buffer()->hash());
+    EXPECT_EQ(pc, machine.cpu()->pc());
+  }
+  EXPECT_GT(run_ahead.last_cost(), 0);
+  EXPECT_LE(run_ahead.last_state_cost(), run_ahead.last_cost());
+}
+
+TEST(RunAheadTest, FailureLeavesFutureUntouched) {
+  Machine machine;
+  // An invalid instruction at the start of the program.
+  machine.cpu()->set_memory(Cpu::kMinAddressableMemory, 0x90);
+  machine.cpu()->set_memory(Cpu::kMinAddressableMemory + 1, 0x01);
+  RunAhead run_ahead(machine.cpu(), 2);
+
+  FrameBuffer future;
+  future.set_pixel(1, 1, true);
+  EXPECT_FALSE(run_ahead.run(&future));
+  EXPECT_TRUE(future.get_pixel(1, 1));
+  EXPECT_EQ(Cpu::kMinAddressableMemory, machine.cpu()->pc());
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <vector>
+
+#include "src/superinstruction.h"
+
+namespace {
+
+class SuperinstructionTest : public ::testing::Test {
+ protected:
+  SuperinstructionTest() { memory_.fill(0); }
+
+  void store(uint16_t address, const std::vector<uint16_t>& words) {
+    for (uint16_t word : words) {
+      memory_[address++] = word >> 8;
+      memory_[address++] = word & 0xff;
+    }
+  }
+
+  Superinstruction match(uint16_t address) const {
+    return match_superinstruction(memory_.data(), address);
+  }
+
+  std::array<uint8_t, Cpu::kMaxMemory + 1> memory_;
+};
+
+}  // namespace
+
+TEST_F(SuperinstructionTest, MatchesIdioms) {
+  store(0x200, {0x3001, 0x1200});
+  EXPECT_EQ(match(0x200), Superinstruction::SKIP_JP);
+  store(0x200, {0x4001, 0x1200});
+  EXPECT_EQ(match(0x200), Superinstruction::SKIP_JP);
+  store(0x200, {0xa300, 0xd015});
+  EXPECT_EQ(match(0x200), Superinstruction::LD_I_DRW);
+  store(0x200, {0x6010, 0xf115});
+  EXPECT_EQ(match(0x200), Superinstruction::LD_BYTE_LD_DT);
+  store(0x200, {0xf007, 0x3000, 0x6000});
+  EXPECT_EQ(match(0x200), Superinstruction::LD_VX_DT_SKIP);
+  store(0x200, {0xf007, 0x4000, 0x1200});
+  EXPECT_EQ(match(0x200), Superinstruction::LD_VX_DT_SKIP_JP);
+  store(0x200, {0x7001, 0x3010, 0x1200});
+  EXPECT_EQ(match(0x200), Superinstruction::ADD_BYTE_SKIP_JP);
+}
+
+TEST_F(SuperinstructionTest, IgnoresOtherSequences) {
+  store(0x200, {0x5010, 0x1200});
+  EXPECT_EQ(match(0x200), Superinstruction::NONE);
+  store(0x200, {0xa300, 0x6000});
+  EXPECT_EQ(match(0x200), Superinstruction::NONE);
+  store(0x200, {0x7001, 0x3010, 0x6000});
+  EXPECT_EQ(match(0x200), Superinstruction::NONE);
+  // The middle of the superinstruction is an instruction of its own.
+  store(0x200, {0xf007, 0x3000, 0x1200});
+  EXPECT_EQ(match(0x202), Superinstruction::SKIP_JP);
+}
+
+TEST_F(SuperinstructionTest, StopsAtTheEndOfMemory) {
+  // The jump would start at the last byte, which is no instruction.
+  store(Cpu::kMaxMemory - 3, {0x3001});
+  memory_[Cpu::kMaxMemory] = 0x12;
+  EXPECT_EQ(match(Cpu::kMaxMemory - 3), Superinstruction::NONE);
+
+  store(Cpu::kMaxMemory - 4, {0x3001, 0x1200});
+  EXPECT_EQ(match(Cpu::kMaxMemory - 4), Superinstruction::SKIP_JP);
+}
+
+TEST(SuperinstructionLengthTest, CountsInstructions) {
+  EXPECT_EQ(superinstruction_length(Superinstruction::NONE), 1u);
+  EXPECT_EQ(superinstruction_length(Superinstruction::LD_I_DRW), 2u);
+  EXPECT_EQ(superinstruction_length(Superinstruction::LD_VX_DT_SKIP_JP), 3u);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "src/random.h"
+#include "src/scripted_keyboard.h"
+#include "src/tiered_engine.h"
+
+namespace {
+
+class TieredEngineTest : public ::testing::Test {
+ protected:
+  TieredEngineTest() : random_(1), cpu_(&random_, &keyboard_) {}
+
+  // Loads |program| at 0x200 and runs it with an engine promoting blocks
+  // after |threaded_threshold| and |optimized_threshold| runs.
+  void start(const std::vector<uint16_t>& program,
+             uint32_t threaded_threshold, uint32_t optimized_threshold) {
+    for (size_t i = 0; i < program.size(); ++i) {
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2, program[i] >> 8);
+      cpu_.set_memory(Cpu::kMinAddressableMemory + i * 2 + 1,
+                      program[i] & 0xff);
+    }
+    EngineOptions options;
+    options.threaded_threshold = threaded_threshold;
+    options.optimized_threshold = optimized_threshold;
+    engine_ = std::make_unique<TieredEngine>(options);
+    cpu_.set_engine(engine_.get());
+  }
+
+  Random random_;
+  ScriptedKeyboard keyboard_;
+  Cpu cpu_;
+  std::unique_ptr<TieredEngine> engine_;
+};
+
+}  // namespace
+
+TEST_F(TieredEngineTest, PromotesHotBlocks) {
+  start({0x7001, 0x1200}, 2, 4);
+  ASSERT_TRUE(cpu_.run(4));
+  EXPECT_EQ(engine_->tier(0x200), Tier::THREADED);
+  ASSERT_TRUE(cpu_.run(4));
+  EXPECT_EQ(engine_->tier(0x200), Tier::OPTIMIZED);
+  ASSERT_TRUE(cpu_.run(4));
+  EXPECT_EQ(cpu_.v(0), 6);
+
+  const TieredEngine::Counters& counters = engine_->counters();
+  for (size_t tier = 0; tier < kTiers; ++tier) {
+    EXPECT_EQ(counters.instructions[tier], 4u) << tier;
+    EXPECT_EQ(counters.blocks[tier], 2u) << tier;
+  }
+  EXPECT_EQ(counters.promotions[static_cast<size_t>(Tier::THREADED)], 1u);
+  EXPECT_EQ(counters.promotions[static_cast<size_t>(Tier::OPTIMIZED)], 1u);
+  EXPECT_EQ(counters.demotions, 0u);
+}
+
+TEST_F(TieredEngineTest, DemotesBlocksWhoseMemoryIsWritten) {
+  start(
+      {
+          0x7001,  // 0x200: ADD V0, 1
+          0x3005,  // 0x202: SE V0, 5
+          0x1200,  // 0x204: JP 0x200
+          0xa220,  // 0x206: LD I, 0x220
+          0xf055,  // 0x208: LD [I], V0
+          0x120a,  // 0x20a: JP 0x20a
+      },
+      1, 2);
+  ASSERT_TRUE(cpu_.run(20));
+  EXPECT_EQ(cpu_.pc(), 0x20a);
+  EXPECT_EQ(cpu_.peek(0x220), 5);
+  // 0x200 and 0x204 were optimized, and 0x206 decoded.
+  EXPECT_EQ(engine_->counters().demotions, 3u);
+  EXPECT_EQ(engine_->tier(0x200), Tier::INTERPRETER);
+  EXPECT_EQ(engine_->tier(0x206), Tier::INTERPRETER);
+  EXPECT_EQ(engine_->tier(0x20a), Tier::OPTIMIZED);
+}
+
+TEST_F(TieredEngineTest, KeepsTiersAcrossLoadState) {
+  start(
+      {
+          0x7001,  // 0x200: ADD V0, 1
+          0xa280,  // 0x202: LD I, 0x280
+          0xf055,  // 0x204: LD [I], V0
+          0x1200,  // 0x206: JP 0x200
+      },
+      2, 4);
+  // As when running ahead: each frame is run, rolled back and run again,
+  // writing memory of another line each time.
+  Cpu::State state;
+  for (int frame = 0; frame < 3; ++frame) {
+    cpu_.save_state(&state);
+    ASSERT_TRUE(cpu_.run(8));
+    cpu_.load_state(state);
+    ASSERT_TRUE(cpu_.run(8));
+  }
+  EXPECT_EQ(engine_->tier(0x200), Tier::OPTIMIZED);
+  EXPECT_EQ(engine_->tier(0x206), Tier::OPTIMIZED);
+  EXPECT_EQ(engine_->counters().demotions, 0u);
+  EXPECT_EQ(cpu_.v(0), 6);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/trace.h"
+
+namespace {
+
+struct TracedSpan {
+  std::string name;
+  int tid;
+  double ts;
+  double dur;
+};
+
+std::vector<TracedSpan> read_trace(const std::string& path) {
+  std::ifstream file(path);
+  std::stringstream text;
+  text << file.rdbuf();
+  std::string json = text.str();
+
+  std::vector<TracedSpan> spans;
+  std::regex event(
+      "\\{\"name\": \"([^\"]*)\", \"ph\": \"X\", \"pid\": 1, \"tid\": (\\d+), "
+      "\"ts\": ([0-9.]+), \"dur\": ([0-9.]+)\\}");
+  for (std::sregex_iterator it(json.begin(), json.end(), event), end;
+       it != end; ++it) {
+    spans.push_back({(*it)[1], std::stoi((*it)[2]), std::stod((*it)[3]),
+                     std::stod((*it)[4])});
+  }
+  return spans;
+}
+
+const TracedSpan* find(const std::vector<TracedSpan>& spans,
+                       const std::string& name) {
+  for (const TracedSpan& span : spans) {
+    if (span.name == name) {
+      return &span;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(TraceTest, RecordsNothingWhenDisabled) {
+  std::string path = testing::TempDir() + "trace_disabled.json";
+  { trace::Span span("before"); }
+  trace::start();
+  { trace::Span span("during"); }
+  ASSERT_TRUE(trace::stop(path));
+  { trace::Span span("after"); }
+
+  std::vector<TracedSpan> spans = read_trace(path);
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_EQ(spans[0].name, "during");
+}
+
+TEST(TraceTest, NestsSpans) {
+  std::string path = testing::TempDir() + "trace_nested.json";
+  VirtualClock clock;
+  trace::start(&clock);
+  {
+    trace::Span outer("frame");
+    clock.advance(0.0005);
+    {
+      trace::Span inner("instructions");
+      clock.advance(0.001);
+    }
+    clock.advance(0.0002);
+    trace::Span inner("update_timers");
+  }
+  ASSERT_TRUE(trace::stop(path));
+
+  std::vector<TracedSpan> spans = read_trace(path);
+  ASSERT_EQ(spans.size(), 3);
+  const TracedSpan* frame = find(spans, "frame");
+  const TracedSpan* instructions = find(spans, "instructions");
+  const TracedSpan* timers = find(spans, "update_timers");
+  ASSERT_TRUE(frame && instructions && timers);
+  EXPECT_DOUBLE_EQ(frame->ts, 0);
+  EXPECT_DOUBLE_EQ(frame->dur, 1700);
+  EXPECT_DOUBLE_EQ(instructions->ts, 500);
+  EXPECT_DOUBLE_EQ(instructions->dur, 1000);
+  EXPECT_DOUBLE_EQ(timers->ts, 1700);
+  EXPECT_DOUBLE_EQ(timers->dur, 0);
+  EXPECT_EQ(trace::dropped(), 0);
+}
+
+TEST(TraceTest, SeparatesThreads) {
+  std::string path = testing::TempDir() + "trace_threads.json";
+  trace::start();
+  { trace::Span span("main"); }
+  std::thread worker([] { trace::Span span("worker"); });
+  worker.join();
+  ASSERT_TRUE(trace::stop(path));
+
+  std::vector<TracedSpan> spans = read_trace(path);
+  const TracedSpan* main = find(spans, "main");
+  const TracedSpan* worker_span = find(spans, "worker");
+  ASSERT_TRUE(main && worker_span);
+  EXPECT_NE(main->tid, worker_span->tid);
+}
+
+TEST(TraceTest, ReportsUnwritablePath) {
+  trace::start();
+  EXPECT_FALSE(trace::stop(testing::TempDir() + "missing/trace.json"));
+  EXPECT_FALSE(trace::enabled());
+}